@@ -63,6 +63,14 @@
 //      Buffer for data from the other side. Its size always should
 //      be more or equal to the @size_bytes.
 //      {NULL} then rx data is not processed (even if @size_bytes is 0).
+// @segment_size_bytes {0 || divisor of @size_bytes}
+//      If not 0, then the xfer data is a batch of the consumer data
+//      units (say, protocol packages) of this size each, laid out
+//      back to back. The whole batch is still exchanged within a
+//      single xfer (single handshake with the other side), but the
+//      transport layer may transfer every unit as a separate
+//      hardware transfer.
+//      {0} the xfer data is a single unit.
 // @xfers_count {readonly for consumer}
 //      Set **only** by SYMSPI. When the xfer is accepted from consumer
 //      the counter is 0, and increases with every finished HW xfer.
@@ -158,6 +166,8 @@ struct full_duplex_xfer {
         void __kernel *data_tx;
         void __kernel *data_rx_buf;
 
+        size_t segment_size_bytes;
+
         int xfers_counter;
 
         int id;
@@ -0,0 +1,594 @@
+/*
+ * This file defines the full duplex loopback driver: the pair of
+ * software full duplex devices connected to each other in memory
+ * at configurable line rate.
+ *
+ * Copyright (c) 2026 The iccom-utils contributors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// SPDX-License-Identifier: GPL-2.0
+
+// The loopback link mimics the SymSPI behaviour as it is seen by the
+// full duplex interface consumer:
+// * the xfer starts when any side requests it, both sides exchange
+//   their current xfers data within it,
+// * upon the xfer end the done callbacks of both sides are called,
+//   any of them may request the next xfer to start immediately,
+// * if the sides xfers sizes differ, the fail callbacks of both
+//   sides are called and the next xfer is started right away (like
+//   the SymSPI error recovery ends with).
+//
+// All xfers are run one by one by the single xfer work, which also
+// sleeps for the xfer duration defined by the line rate, and calls
+// the consumer callbacks (so they are called in sleepable context).
+
+#include <linux/slab.h>
+#include <linux/module.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include <linux/delay.h>
+
+#include "full_duplex_interface.h"
+#include "full_duplex_loopback.h"
+
+/* --------------------- BUILD CONFIGURATION ----------------------------*/
+
+// The max size of the xfer data in bytes
+#ifndef FD_LOOPBACK_XFER_SIZE_MAX_BYTES
+#define FD_LOOPBACK_XFER_SIZE_MAX_BYTES 4096
+#endif
+
+// The default line rate in bits per second (see line_rate_bps param)
+#define FD_LOOPBACK_DEFAULT_LINE_RATE_BPS 10000000
+// The default per xfer overhead in usec (see xfer_overhead_us param),
+// accounts the flags handshake of real transport
+#define FD_LOOPBACK_DEFAULT_XFER_OVERHEAD_US 20
+
+// The xfer durations up to this value are slept via usleep_range(...),
+// longer ones via msleep(...)
+#define FD_LOOPBACK_USLEEP_MAX_US 20000
+
+#define FD_LOOPBACK_INITIAL_XFER_ID 1
+
+#define FD_LOOPBACK_LOG_PREFIX "FD loopback: "
+
+/* --------------------- UTILITIES SECTION ----------------------------- */
+
+#define fd_loopback_err(fmt, ...)					\
+	pr_err(FD_LOOPBACK_LOG_PREFIX"%s: "fmt"\n", __func__, ##__VA_ARGS__)
+#define fd_loopback_info(fmt, ...)					\
+	pr_info(FD_LOOPBACK_LOG_PREFIX"%s: "fmt"\n", __func__, ##__VA_ARGS__)
+
+/* --------------------- PARAM SECTION ----------------------------- */
+
+// NOTE: both params can be changed at runtime via
+//      /sys/module/full_duplex_loopback/parameters/
+static unsigned int line_rate_bps = FD_LOOPBACK_DEFAULT_LINE_RATE_BPS;
+module_param(line_rate_bps, uint, 0644);
+MODULE_PARM_DESC(line_rate_bps, "The simulated line rate (bits per second)"
+		 ", 0 means no line delay.");
+
+static unsigned int xfer_overhead_us = FD_LOOPBACK_DEFAULT_XFER_OVERHEAD_US;
+module_param(xfer_overhead_us, uint, 0644);
+MODULE_PARM_DESC(xfer_overhead_us, "The simulated per xfer overhead"
+		 " (usec) added to the line time.");
+
+/* --------------------- DATA STRUCTS SECTION ---------------------------*/
+
+struct fd_loopback_dev;
+
+// Describes the single side of the loopback link, this is the device
+// given to the full duplex consumer.
+//
+// @link the link the side belongs to
+// @running true between init and close
+// @halted true if the consumer halted the side by returning the
+//      error pointer from a callback
+// @xfer_requested true when this side requested the xfer
+// @xfer the current xfer, its data points to the side buffers
+// @tx_buf {FD_LOOPBACK_XFER_SIZE_MAX_BYTES} the current xfer TX
+//      data copy
+// @rx_buf {FD_LOOPBACK_XFER_SIZE_MAX_BYTES} the RX data buffer
+// @next_xfer_id the id to be assigned to the next new xfer
+struct fd_loopback_side {
+	struct fd_loopback_dev *link;
+
+	bool running;
+	bool halted;
+	bool xfer_requested;
+
+	struct full_duplex_xfer xfer;
+	void *tx_buf;
+	void *rx_buf;
+
+	int next_xfer_id;
+};
+
+// Describes the loopback link.
+//
+// @side the link sides
+// @lock protects the sides data
+// @wq the workqueue to run the xfers in
+// @xfer_work runs the requested xfers
+// @xfers_done the number of successful xfers
+// @xfers_failed the number of xfers failed due to the sides xfer
+//      sizes mismatch
+struct fd_loopback_dev {
+	struct fd_loopback_side side[FD_LOOPBACK_SIDES_COUNT];
+
+	spinlock_t lock;
+	struct workqueue_struct *wq;
+	struct work_struct xfer_work;
+
+	unsigned long long xfers_done;
+	unsigned long long xfers_failed;
+};
+
+/* ------------------------ GLOBAL VARIABLES ----------------------------*/
+
+static struct fd_loopback_dev fd_loopback_global_dev;
+
+/* ------------------------- MAIN SECTION -------------------------------*/
+
+// Helper. Makes the consumer @xfer the current one of the @side
+// (TX data is copied).
+//
+// LOCKING: link lock is to be held by caller
+//
+// RETURNS:
+//      >0: the new xfer id
+//      <0: negated error code
+static int __fd_loopback_side_accept(struct fd_loopback_side *side
+				     , struct full_duplex_xfer *xfer)
+{
+	if (xfer->size_bytes == 0
+			|| xfer->size_bytes > FD_LOOPBACK_XFER_SIZE_MAX_BYTES) {
+		fd_loopback_err("xfer size %zu is out of (0; %d] bytes"
+				, xfer->size_bytes
+				, FD_LOOPBACK_XFER_SIZE_MAX_BYTES);
+		return -EINVAL;
+	}
+
+	if (!IS_ERR_OR_NULL(xfer->data_tx)) {
+		memcpy(side->tx_buf, xfer->data_tx, xfer->size_bytes);
+	} else {
+		memset(side->tx_buf, 0, xfer->size_bytes);
+	}
+
+	side->xfer = *xfer;
+	side->xfer.data_tx = side->tx_buf;
+	side->xfer.data_rx_buf = side->rx_buf;
+	side->xfer.xfers_counter = 0;
+	side->xfer.id = side->next_xfer_id;
+
+	side->next_xfer_id = (side->next_xfer_id < INT_MAX)
+			     ? side->next_xfer_id + 1
+			     : FD_LOOPBACK_INITIAL_XFER_ID;
+
+	xfer->id = side->xfer.id;
+	return side->xfer.id;
+}
+
+// Helper. Sleeps for the duration of the xfer of @size_bytes on the
+// line.
+//
+// CONTEXT: sleepable
+static void __fd_loopback_line_delay(const size_t size_bytes)
+{
+	const unsigned int rate = READ_ONCE(line_rate_bps);
+	u64 delay_us = READ_ONCE(xfer_overhead_us);
+
+	if (rate) {
+		delay_us += div_u64((u64)size_bytes * 8 * USEC_PER_SEC, rate);
+	}
+	if (delay_us == 0) {
+		return;
+	}
+	if (delay_us <= FD_LOOPBACK_USLEEP_MAX_US) {
+		usleep_range((unsigned long)delay_us
+			     , (unsigned long)(delay_us + delay_us / 8 + 1));
+		return;
+	}
+	msleep((unsigned int)DIV_ROUND_UP(delay_us, USEC_PER_MSEC));
+}
+
+// Helper. Reports the xfer result to the @side consumer and applies
+// the next xfer provided by the consumer.
+//
+// @side {valid ptr} the side to report to
+// @done {valid ptr} the finished xfer copy
+// @ok true if the xfer was successful
+//
+// CONTEXT: sleepable
+static void __fd_loopback_xfer_report(struct fd_loopback_side *side
+				      , struct full_duplex_xfer *done
+				      , const bool ok)
+{
+	struct full_duplex_xfer *next_xfer = NULL;
+	bool start_immediately = false;
+
+	if (ok) {
+		done->xfers_counter++;
+		if (!IS_ERR_OR_NULL(done->done_callback)) {
+			next_xfer = done->done_callback(done
+					, side->next_xfer_id
+					, &start_immediately
+					, done->consumer_data);
+		}
+	} else {
+		if (!IS_ERR_OR_NULL(done->fail_callback)) {
+			next_xfer = done->fail_callback(done
+					, side->next_xfer_id
+					, FD_LOOPBACK_ERROR_XFER_SIZE_MISMATCH
+					, done->consumer_data);
+		}
+		// the recovery ends with the new xfer
+		start_immediately = true;
+	}
+
+	unsigned long flags;
+	spin_lock_irqsave(&side->link->lock, flags);
+	if (IS_ERR(next_xfer)) {
+		fd_loopback_info("side %d halted by consumer request"
+				 , (int)(side - side->link->side));
+		side->halted = true;
+	} else if (next_xfer) {
+		if (__fd_loopback_side_accept(side, next_xfer) < 0) {
+			side->halted = true;
+		}
+	} else if (ok && side->xfer.id == done->id) {
+		side->xfer.xfers_counter = done->xfers_counter;
+	}
+	if (start_immediately) {
+		side->xfer_requested = true;
+	}
+	spin_unlock_irqrestore(&side->link->lock, flags);
+}
+
+// Helper. Runs the next xfer if requested by any side.
+//
+// CONTEXT: sleepable
+//
+// RETURNS:
+//      true: if xfer was run
+//      false: if there was no xfer requested (or the link is down)
+static bool __fd_loopback_xfer(struct fd_loopback_dev *lb)
+{
+	struct fd_loopback_side *a = &lb->side[0];
+	struct fd_loopback_side *b = &lb->side[1];
+	struct full_duplex_xfer done[FD_LOOPBACK_SIDES_COUNT];
+	unsigned long flags;
+
+	spin_lock_irqsave(&lb->lock, flags);
+	if (!a->running || !b->running || a->halted || b->halted
+			|| (!a->xfer_requested && !b->xfer_requested)) {
+		spin_unlock_irqrestore(&lb->lock, flags);
+		return false;
+	}
+	a->xfer_requested = false;
+	b->xfer_requested = false;
+
+	const bool ok = (a->xfer.size_bytes == b->xfer.size_bytes);
+	if (ok) {
+		memcpy(a->rx_buf, b->tx_buf, a->xfer.size_bytes);
+		memcpy(b->rx_buf, a->tx_buf, b->xfer.size_bytes);
+		lb->xfers_done++;
+	} else {
+		lb->xfers_failed++;
+	}
+	done[0] = a->xfer;
+	done[1] = b->xfer;
+	spin_unlock_irqrestore(&lb->lock, flags);
+
+	__fd_loopback_line_delay(max(done[0].size_bytes
+				     , done[1].size_bytes));
+
+	// NOTE: RX buffers are written only by this work, so they stay
+	//      intact till the callbacks are done
+	__fd_loopback_xfer_report(a, &done[0], ok);
+	__fd_loopback_xfer_report(b, &done[1], ok);
+	return true;
+}
+
+// Runs the requested xfers till there are any.
+static void __fd_loopback_xfer_work(struct work_struct *work)
+{
+	struct fd_loopback_dev *lb = container_of(work, struct fd_loopback_dev
+						  , xfer_work);
+
+	while (__fd_loopback_xfer(lb)) {
+		cond_resched();
+	}
+}
+
+/* --------------------- FULL DUPLEX IFACE SECTION ----------------------*/
+
+// API: see symspi_data_xchange(...).
+//
+// NOTE: the xfer size change is allowed at any time, the sides
+//      sizes mismatch fails the xfer on both sides.
+//
+// CONTEXT: any
+__maybe_unused
+static int fd_loopback_data_xchange(void __kernel *device
+				    , struct __kernel full_duplex_xfer *xfer
+				    , bool force_size_change)
+{
+	struct fd_loopback_side *side = (struct fd_loopback_side *)device;
+	unsigned long flags;
+	int res = 0;
+
+	if (IS_ERR_OR_NULL(side)) {
+		return -FULL_DUPLEX_ERROR_NO_DEVICE_PROVIDED;
+	}
+
+	spin_lock_irqsave(&side->link->lock, flags);
+	if (!side->running || side->halted) {
+		spin_unlock_irqrestore(&side->link->lock, flags);
+		return -FULL_DUPLEX_ERROR_NOT_READY;
+	}
+	if (xfer) {
+		res = __fd_loopback_side_accept(side, xfer);
+	}
+	if (res >= 0) {
+		side->xfer_requested = true;
+	}
+	spin_unlock_irqrestore(&side->link->lock, flags);
+
+	if (res >= 0) {
+		queue_work(side->link->wq, &side->link->xfer_work);
+	}
+	return res;
+}
+
+// API: see symspi_default_data_update(...).
+//
+// CONTEXT: any
+__maybe_unused
+static int fd_loopback_default_data_update(void __kernel *device
+					   , struct full_duplex_xfer *xfer
+					   , bool force_size_change)
+{
+	struct fd_loopback_side *side = (struct fd_loopback_side *)device;
+	unsigned long flags;
+	int res = 0;
+
+	if (IS_ERR_OR_NULL(side)) {
+		return -FULL_DUPLEX_ERROR_NO_DEVICE_PROVIDED;
+	}
+
+	spin_lock_irqsave(&side->link->lock, flags);
+	if (!side->running || side->halted) {
+		res = -FULL_DUPLEX_ERROR_NOT_READY;
+	} else if (xfer) {
+		res = __fd_loopback_side_accept(side, xfer);
+	}
+	spin_unlock_irqrestore(&side->link->lock, flags);
+
+	return res;
+}
+
+// API: see symspi_is_running(...).
+__maybe_unused
+static bool fd_loopback_is_running(void __kernel *device)
+{
+	struct fd_loopback_side *side = (struct fd_loopback_side *)device;
+
+	return !IS_ERR_OR_NULL(side) && READ_ONCE(side->running);
+}
+
+// API: see symspi_init(...).
+//
+// CONTEXT: sleepable
+__maybe_unused
+static int fd_loopback_init(void __kernel *device
+			    , struct full_duplex_xfer *default_xfer)
+{
+	struct fd_loopback_side *side = (struct fd_loopback_side *)device;
+	unsigned long flags;
+
+	if (IS_ERR_OR_NULL(side)) {
+		return -FULL_DUPLEX_ERROR_NO_DEVICE_PROVIDED;
+	}
+	if (IS_ERR_OR_NULL(default_xfer)) {
+		fd_loopback_err("no default xfer provided");
+		return -EINVAL;
+	}
+
+	spin_lock_irqsave(&side->link->lock, flags);
+	if (side->running) {
+		spin_unlock_irqrestore(&side->link->lock, flags);
+		fd_loopback_err("side is already running");
+		return -EALREADY;
+	}
+	side->halted = false;
+	side->xfer_requested = false;
+	side->next_xfer_id = FD_LOOPBACK_INITIAL_XFER_ID;
+	int res = __fd_loopback_side_accept(side, default_xfer);
+	if (res >= 0) {
+		side->running = true;
+		res = 0;
+	}
+	spin_unlock_irqrestore(&side->link->lock, flags);
+
+	return res;
+}
+
+// API: see symspi_close(...).
+//
+// Returns when no more callbacks of the side consumer can be
+// invoked.
+//
+// CONTEXT: sleepable, not from the side callbacks
+__maybe_unused
+static int fd_loopback_close(void __kernel *device)
+{
+	struct fd_loopback_side *side = (struct fd_loopback_side *)device;
+	unsigned long flags;
+
+	if (IS_ERR_OR_NULL(side)) {
+		return -FULL_DUPLEX_ERROR_NO_DEVICE_PROVIDED;
+	}
+
+	spin_lock_irqsave(&side->link->lock, flags);
+	side->running = false;
+	side->xfer_requested = false;
+	spin_unlock_irqrestore(&side->link->lock, flags);
+
+	flush_work(&side->link->xfer_work);
+	return 0;
+}
+
+// API: see symspi_reset(...).
+//
+// CONTEXT: sleepable, not from the side callbacks
+__maybe_unused
+static int fd_loopback_reset(void __kernel *device
+			     , struct full_duplex_xfer *default_xfer)
+{
+	const int res = fd_loopback_close(device);
+
+	if (res < 0) {
+		return res;
+	}
+	return fd_loopback_init(device, default_xfer);
+}
+
+static const struct full_duplex_sym_iface fd_loopback_full_duplex_iface = {
+	.data_xchange = &fd_loopback_data_xchange
+	, .default_data_update = &fd_loopback_default_data_update
+	, .is_running = &fd_loopback_is_running
+	, .init = &fd_loopback_init
+	, .reset = &fd_loopback_reset
+	, .close = &fd_loopback_close
+};
+
+/* --------------------- KERNEL SPACE API -------------------------------*/
+
+// API
+//
+// Returns ptr to the full duplex device interface object.
+//
+// RETURNS:
+//      valid ptr to struct full_duplex_sym_iface with all
+//      fields filled
+__maybe_unused
+const struct full_duplex_sym_iface *full_duplex_loopback_iface(void)
+{
+	return &fd_loopback_full_duplex_iface;
+}
+
+// API
+//
+// Returns the full duplex device of the given loopback link side.
+// The devices of different sides are connected to each other.
+//
+// @side [0; FD_LOOPBACK_SIDES_COUNT - 1] the link side
+//
+// RETURNS:
+//      the device: on success
+//      the device with error ptr in .dev field: on failure
+__maybe_unused
+struct full_duplex_device full_duplex_loopback_get_device(
+		const unsigned int side)
+{
+	struct full_duplex_device dev = {
+		.dev = ERR_PTR(-ENODEV)
+		, .iface = NULL
+	};
+
+	if (side >= FD_LOOPBACK_SIDES_COUNT) {
+		fd_loopback_err("no side %u", side);
+		return dev;
+	}
+
+	dev.dev = (void *)&fd_loopback_global_dev.side[side];
+	dev.iface = &fd_loopback_full_duplex_iface;
+	return dev;
+}
+
+/* --------------------- MODULE HOUSEKEEPING SECTION ------------------- */
+
+EXPORT_SYMBOL(full_duplex_loopback_iface);
+EXPORT_SYMBOL(full_duplex_loopback_get_device);
+
+static void __fd_loopback_dev_free(struct fd_loopback_dev *lb)
+{
+	if (!IS_ERR_OR_NULL(lb->wq)) {
+		destroy_workqueue(lb->wq);
+		lb->wq = NULL;
+	}
+	for (int i = 0; i < FD_LOOPBACK_SIDES_COUNT; i++) {
+		kfree(lb->side[i].tx_buf);
+		kfree(lb->side[i].rx_buf);
+		lb->side[i].tx_buf = NULL;
+		lb->side[i].rx_buf = NULL;
+	}
+}
+
+static int __init fd_loopback_module_init(void)
+{
+	struct fd_loopback_dev *lb = &fd_loopback_global_dev;
+
+	memset(lb, 0, sizeof(*lb));
+	spin_lock_init(&lb->lock);
+	INIT_WORK(&lb->xfer_work, &__fd_loopback_xfer_work);
+
+	for (int i = 0; i < FD_LOOPBACK_SIDES_COUNT; i++) {
+		struct fd_loopback_side *side = &lb->side[i];
+
+		side->link = lb;
+		side->next_xfer_id = FD_LOOPBACK_INITIAL_XFER_ID;
+		side->tx_buf = kmalloc(FD_LOOPBACK_XFER_SIZE_MAX_BYTES
+				       , GFP_KERNEL);
+		side->rx_buf = kmalloc(FD_LOOPBACK_XFER_SIZE_MAX_BYTES
+				       , GFP_KERNEL);
+		if (!side->tx_buf || !side->rx_buf) {
+			fd_loopback_err("no memory for xfer buffers");
+			goto failed;
+		}
+	}
+
+	lb->wq = alloc_workqueue("fd_loopback", WQ_HIGHPRI | WQ_UNBOUND, 1);
+	if (IS_ERR_OR_NULL(lb->wq)) {
+		fd_loopback_err("could not create workqueue");
+		lb->wq = NULL;
+		goto failed;
+	}
+
+	fd_loopback_info("module loaded, line rate %u bps, xfer overhead"
+			 " %u us", line_rate_bps, xfer_overhead_us);
+	return 0;
+
+failed:
+	__fd_loopback_dev_free(lb);
+	return -ENOMEM;
+}
+
+static void __exit fd_loopback_module_exit(void)
+{
+	struct fd_loopback_dev *lb = &fd_loopback_global_dev;
+
+	fd_loopback_info("module unloaded, xfers done: %llu, failed: %llu"
+			 , lb->xfers_done, lb->xfers_failed);
+	__fd_loopback_dev_free(lb);
+}
+
+module_init(fd_loopback_module_init);
+module_exit(fd_loopback_module_exit);
+
+MODULE_DESCRIPTION("Full duplex loopback transport module.");
+MODULE_AUTHOR("The iccom-utils contributors");
+MODULE_LICENSE("GPL v2");
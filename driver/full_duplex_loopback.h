@@ -0,0 +1,46 @@
+/*
+ * This file declares kernel API to the full duplex loopback driver.
+ *
+ * The driver provides the pair of software full duplex devices
+ * (see full_duplex_interface.h) connected to each other in memory,
+ * so the full duplex consumers (like ICCom) can be run and loaded
+ * without any transport hardware.
+ *
+ * Copyright (c) 2026 The iccom-utils contributors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// SPDX-License-Identifier: GPL-2.0
+
+#ifndef FULL_DUPLEX_LOOPBACK_HEADER
+
+#include "full_duplex_interface.h"
+
+// The number of devices (link sides) provided by the driver.
+#define FD_LOOPBACK_SIDES_COUNT 2
+
+// The error code reported to the fail callbacks of both sides when
+// their xfers sizes differ (like SymSPI reports the sync loss).
+#define FD_LOOPBACK_ERROR_XFER_SIZE_MISMATCH EPIPE
+
+/* -------------------- API DECLARATIONS SECTION ------------------------*/
+/* ---------- for documentation, see full_duplex_loopback.c file --------*/
+
+struct full_duplex_device full_duplex_loopback_get_device(
+		const unsigned int side);
+const struct full_duplex_sym_iface *full_duplex_loopback_iface(void);
+
+#define FULL_DUPLEX_LOOPBACK_HEADER
+
+#endif //FULL_DUPLEX_LOOPBACK_HEADER
@@ -47,11 +47,22 @@
 #include <linux/module.h>
 #include <linux/proc_fs.h>
 #include <linux/hrtimer.h>
+#include <linux/llist.h>
+#include <linux/percpu.h>
 #include <linux/uaccess.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/version.h>
+#include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/idr.h>
 
 #include "full_duplex_interface.h"
 #include "iccom.h"
 
+#define CREATE_TRACE_POINTS
+#include "iccom_trace.h"
+
 /* --------------------- BUILD CONFIGURATION ----------------------------*/
 
 // package layout info, see @iccom_package description
@@ -107,12 +118,16 @@
 // Selects the workqueue to use to run consumer delivery operations
 // to not to block the underlying transport layer.
 //
-// Three options are available now:
+// Four options are available now:
 // * "ICCOM_WQ_SYSTEM": see system_wq in workqueue.h.
 // * "ICCOM_WQ_SYSTEM_HIGHPRI": see system_highpri_wq in
 //   workqueue.h.
 // * "ICCOM_WQ_PRIVATE": use privately constructed single threaded
 //   workqueue.
+// * "ICCOM_WQ_RT_KTHREAD": use the private kthread worker running
+//   with SCHED_FIFO policy (see ICCOM_RT_KTHREAD_PRIORITY), its
+//   priority and CPU affinity can be set via the module parameters
+//   and at runtime via the /proc/iccom/worker file. The default one.
 //
 // NOTE: the selection of the workqueue depends on the
 //      generic considerations on ICCom functioning
@@ -122,18 +137,23 @@
 //      then "ICCOM_WQ_SYSTEM" workqeue is a nice option to select.
 //      On the other hand if no delays are allowed in handling ICCom
 //      communication (say, to communicate to hardware watchdog)
-//      then "ICCOM_WQ_SYSTEM_HIGHPRI" or "ICCOM_WQ_PRIVATE" is
-//      surely more preferrable.
+//      then "ICCOM_WQ_RT_KTHREAD", "ICCOM_WQ_SYSTEM_HIGHPRI" or
+//      "ICCOM_WQ_PRIVATE" is surely more preferrable.
+//
+// NOTE: the worker priority and CPU affinity controls (worker_priority
+//      and worker_cpus module parameters, /proc/iccom/worker file)
+//      exist in "ICCOM_WQ_RT_KTHREAD" mode only.
 //
 // Can be set via kernel config, see:
 // 		BOSCH_ICCOM_WORKQUEUE_MODE configuration parameter
 #ifndef ICCOM_WORKQUEUE_MODE
-#define ICCOM_WORKQUEUE_MODE ICCOM_WQ_PRIVATE
+#define ICCOM_WORKQUEUE_MODE ICCOM_WQ_RT_KTHREAD
 #endif
 
 #define ICCOM_WQ_SYSTEM 0
 #define ICCOM_WQ_SYSTEM_HIGHPRI 1
 #define ICCOM_WQ_PRIVATE 2
+#define ICCOM_WQ_RT_KTHREAD 3
 
 // Comparator
 #define ICCOM_WORKQUEUE_MODE_MATCH(x)		\
@@ -143,7 +163,253 @@
 #ifndef ICCOM_WORKQUEUE_MODE
 #error ICCOM_WORKQUEUE_MODE must be defined to \
 		one of [ICCOM_WQ_SYSTEM, ICCOM_WQ_SYSTEM_HIGHPRI, \
-		ICCOM_WQ_PRIVATE].
+		ICCOM_WQ_PRIVATE, ICCOM_WQ_RT_KTHREAD].
+#endif
+
+// The default SCHED_FIFO priority of the ICCom kthread worker
+// (ICCOM_WQ_RT_KTHREAD mode only), [1; MAX_RT_PRIO - 1].
+// Is by default just below the SymSPI worker one, so the transport
+// layer is not delayed by the consumer delivery.
+// Can be overridden by the worker_priority module parameter.
+#ifndef ICCOM_RT_KTHREAD_PRIORITY
+#define ICCOM_RT_KTHREAD_PRIORITY (MAX_RT_PRIO / 2 - 1)
+#endif
+
+// The ICCom works are kthread works in ICCOM_WQ_RT_KTHREAD mode
+// and regular works otherwise.
+#if ICCOM_WORKQUEUE_MODE_MATCH(RT_KTHREAD)
+#define iccom_work_struct kthread_work
+#define ICCOM_INIT_WORK(work, func) kthread_init_work(work, func)
+#else
+#define iccom_work_struct work_struct
+#define ICCOM_INIT_WORK(work, func) INIT_WORK(work, func)
+#endif
+
+// The number of TX priority levels the TX scheduler works with.
+// The consumer message priority [0; ICCOM_TX_PRIORITY_MAX] (see
+// iccom_post_message) is mapped linearly onto the level in
+// [0; ICCOM_TX_PRIORITY_LEVELS_COUNT - 1], the higher level is
+// the more urgent one.
+//
+// Surely: > 0
+#ifndef ICCOM_TX_PRIORITY_LEVELS_COUNT
+#define ICCOM_TX_PRIORITY_LEVELS_COUNT 4
+#endif
+// The maximal consumer message priority value, all values above
+// are treated as this one.
+#define ICCOM_TX_PRIORITY_MAX 100
+
+// Selects the policy used to pick the TX priority level to take
+// the data from, when the next TX package is being built.
+//
+// Two options are available now:
+// * "ICCOM_TX_SCHED_STRICT": the package is always filled up from
+//   the highest non-empty priority level first, the lower levels
+//   only get the room which is left. Say, watchdog heartbeat
+//   messages will never wait behind the bulk transfer, however
+//   the bulk transfer might starve as long as there is a
+//   continuous higher priority traffic.
+// * "ICCOM_TX_SCHED_WEIGHTED": the priority levels are served in
+//   the deficit round robin manner (from higher to lower ones),
+//   every level gets the share of TX bandwidth proportional to its
+//   weight (see ICCOM_TX_SCHED_LEVEL_WEIGHTS). The unused share of
+//   idle levels is given to the busy ones. No level is starved.
+//
+// Can be set via kernel config.
+#ifndef ICCOM_TX_SCHEDULING
+#define ICCOM_TX_SCHEDULING ICCOM_TX_SCHED_STRICT
+#endif
+
+#define ICCOM_TX_SCHED_STRICT 0
+#define ICCOM_TX_SCHED_WEIGHTED 1
+
+// Comparator
+#define ICCOM_TX_SCHEDULING_MATCH(x)		\
+	ICCOM_TX_SCHEDULING == ICCOM_TX_SCHED_##x
+
+#if ICCOM_TX_SCHEDULING_MATCH(WEIGHTED)
+// The weights of the TX priority levels (from lowest to highest),
+// used only by ICCOM_TX_SCHED_WEIGHTED policy.
+// Surely: every weight > 0, number of weights equals to
+//      ICCOM_TX_PRIORITY_LEVELS_COUNT
+#ifndef ICCOM_TX_SCHED_LEVEL_WEIGHTS
+#define ICCOM_TX_SCHED_LEVEL_WEIGHTS { 1, 2, 4, 8 }
+#endif
+// The number of package bytes the level gets per weight unit
+// in every round of the deficit round robin.
+#ifndef ICCOM_TX_SCHED_QUANTUM_BYTES
+#define ICCOM_TX_SCHED_QUANTUM_BYTES 64
+#endif
+#endif
+
+// The number of package bytes the channel gets per weight unit every
+// time its turn comes in the deficit round robin among the active
+// channels of the same TX priority level.
+#ifndef ICCOM_TX_CHANNEL_QUANTUM_BYTES
+#define ICCOM_TX_CHANNEL_QUANTUM_BYTES 32
+#endif
+// The TX channel weight the channel has until another is set via
+// procfs, and the maximal allowed weight.
+#define ICCOM_TX_CHANNEL_DEFAULT_WEIGHT 1
+#define ICCOM_TX_CHANNEL_MAX_WEIGHT 1024
+// The maximal time interval (in msec) of the guaranteed minimal rate
+// the channel can accumulate as a burst while it has nothing to send.
+#ifndef ICCOM_TX_MIN_RATE_BURST_MSEC
+#define ICCOM_TX_MIN_RATE_BURST_MSEC 100
+#endif
+
+// The default limit (in bytes) of the consumer data pending in the
+// TX queue (posted but not yet written into the TX packages). When
+// the limit is reached the new messages are rejected with -EAGAIN
+// until the queue drains (see iccom_wait_tx_space(...)). The limit
+// can be changed at runtime via tx_queue_max_bytes module parameter.
+//
+// NOTE: the single message bigger than the limit is still accepted
+//      into the empty queue, so it is never rejected forever.
+#ifndef ICCOM_TX_QUEUE_MAX_BYTES
+#define ICCOM_TX_QUEUE_MAX_BYTES (1024 * 1024)
+#endif
+
+// Link negotiation: both sides start with the legacy protocol
+// (ICCOM_DATA_XFER_SIZE_BYTES packages, every data xfer is followed
+// by the ack xfer) and offer their link capabilities to each other
+// via ICCOM_TECHNICAL_CHANNEL_ID records. At the frame where both
+// offers were delivered and acked both sides switch to the common
+// subset of capabilities. Legacy side never answers the offer, so
+// the legacy protocol remains then.
+//
+// NOTE: if link negotiation is enabled, then the
+//      ICCOM_TECHNICAL_CHANNEL_ID channel is reserved for ICCom and
+//      is not available for consumer messages.
+
+// The maximal data package size (in bytes) our side supports. If it
+// is bigger than ICCOM_DATA_XFER_SIZE_BYTES, then the link switches
+// to the min of the offered sizes.
+//
+// NOTE: should not exceed the transport layer maximal xfer size
+//      (see SYMSPI_XFER_SIZE_MAX_BYTES).
+#ifndef ICCOM_DATA_XFER_MAX_SIZE_BYTES
+#define ICCOM_DATA_XFER_MAX_SIZE_BYTES ICCOM_DATA_XFER_SIZE_BYTES
+#endif
+#if ICCOM_DATA_XFER_MAX_SIZE_BYTES > 0xFFFF
+#error ICCOM_DATA_XFER_MAX_SIZE_BYTES must fit into 16 bit \
+	package size offer
+#endif
+// If set to 1, then our side supports the piggyback acks: the
+// separate ack xfer is dropped, and every data package carries the
+// ack of the last package received from the other side. So every
+// frame consists of single data xfer.
+#ifndef ICCOM_ACK_PIGGYBACK
+#define ICCOM_ACK_PIGGYBACK 0
+#endif
+// The maximal number of sent and not acked packages in piggyback acks
+// mode (the sliding window size). The packages received out of order
+// within the window are kept until the missing ones are resent, and
+// the acks are cumulative with the selective ack bit mask of the
+// packages received after the first missing one. So only the lost
+// packages are resent. The link uses the min of the offered window
+// sizes.
+#ifndef ICCOM_PB_WINDOW_PACKAGES
+#define ICCOM_PB_WINDOW_PACKAGES 8
+#endif
+#if ICCOM_PB_WINDOW_PACKAGES < 2 || ICCOM_PB_WINDOW_PACKAGES > 9
+#error ICCOM_PB_WINDOW_PACKAGES must be in [2; 9] to fit into \
+	selective ack bit mask
+#endif
+// The maximal number of data packages our side puts into a single
+// xfer in piggyback acks mode (batch), so the transport layer
+// handshake cost is shared by all of them. The link uses the min of
+// the offered batch sizes (but not more than the window). With the
+// batch of N packages every frame xfers N packages slots, the slots
+// we have nothing to send in are filled with
+// ICCOM_PACKAGE_EMPTY_PAYLOAD_VALUE.
+//
+// NOTE: the N * ICCOM_DATA_XFER_MAX_SIZE_BYTES must not exceed the
+//      transport layer maximal xfer size (see
+//      ICCOM_TRANSPORT_XFER_MAX_SIZE_BYTES), the negotiated batch is
+//      additionally clamped to it at runtime.
+#ifndef ICCOM_PB_BATCH_PACKAGES
+#define ICCOM_PB_BATCH_PACKAGES 1
+#endif
+#if ICCOM_PB_BATCH_PACKAGES < 1 \
+	|| ICCOM_PB_BATCH_PACKAGES > ICCOM_PB_WINDOW_PACKAGES
+#error ICCOM_PB_BATCH_PACKAGES must be in [1; ICCOM_PB_WINDOW_PACKAGES]
+#endif
+#define ICCOM_LINK_NEGOTIATION						\
+	((ICCOM_DATA_XFER_MAX_SIZE_BYTES > ICCOM_DATA_XFER_SIZE_BYTES)	\
+	 || ICCOM_ACK_PIGGYBACK)
+// The maximal xfer size (in bytes) of the transport layer (see
+// SYMSPI_XFER_SIZE_MAX_BYTES), the negotiated package size times the
+// negotiated batch never exceeds it.
+#ifndef ICCOM_TRANSPORT_XFER_MAX_SIZE_BYTES
+#define ICCOM_TRANSPORT_XFER_MAX_SIZE_BYTES 4096
+#endif
+#if ICCOM_DATA_XFER_MAX_SIZE_BYTES > ICCOM_TRANSPORT_XFER_MAX_SIZE_BYTES
+#error ICCOM_DATA_XFER_MAX_SIZE_BYTES must not exceed \
+	ICCOM_TRANSPORT_XFER_MAX_SIZE_BYTES
+#endif
+#if ICCOM_PB_BATCH_PACKAGES * ICCOM_DATA_XFER_MAX_SIZE_BYTES \
+	> ICCOM_TRANSPORT_XFER_MAX_SIZE_BYTES
+#error ICCOM_PB_BATCH_PACKAGES * ICCOM_DATA_XFER_MAX_SIZE_BYTES must \
+	not exceed ICCOM_TRANSPORT_XFER_MAX_SIZE_BYTES
+#endif
+// The number of failed frames in a row after which we request the
+// other side to drop the negotiated link, so both sides fall back to
+// the legacy protocol (and negotiate again) within the same frame.
+// In legacy frames the request goes within our ack xfer (see
+// ICCOM_PACKAGE_ACK_FALLBACK_VALUE), in piggyback acks mode within
+// our ack record (see ICCOM_TECH_REC_ACK_FALLBACK).
+#ifndef ICCOM_LINK_FALLBACK_FAILED_FRAMES
+#define ICCOM_LINK_FALLBACK_FAILED_FRAMES 16
+#endif
+// The number of frames our fallback request waits for the other side
+// answer in piggyback acks mode, after which we fall back anyway.
+#ifndef ICCOM_LINK_FALLBACK_REQUEST_FRAMES
+#define ICCOM_LINK_FALLBACK_REQUEST_FRAMES 4
+#endif
+// The number of legacy frames we don't offer the link for after the
+// link fallback, the hold off is doubled with every next fallback (up
+// to 2^ICCOM_LINK_HOLDOFF_MAX_SHIFT times), and is reset when the
+// negotiated link works for ICCOM_LINK_STABLE_FRAMES frames. Also
+// every fallback halves the package size we offer (down to
+// ICCOM_DATA_XFER_SIZE_BYTES), so the link doesn't flap between the
+// package size the line can't carry and the legacy protocol.
+#ifndef ICCOM_LINK_RENEGOTIATION_HOLDOFF_FRAMES
+#define ICCOM_LINK_RENEGOTIATION_HOLDOFF_FRAMES 64
+#endif
+#define ICCOM_LINK_HOLDOFF_MAX_SHIFT 6
+#ifndef ICCOM_LINK_STABLE_FRAMES
+#define ICCOM_LINK_STABLE_FRAMES 4096
+#endif
+// The number of our link offers delivered to the other side
+// without the other side offer in response, after which we consider
+// the other side as a legacy one and stop offering (until the other
+// side offer comes).
+#ifndef ICCOM_LINK_MAX_UNANSWERED_OFFERS
+#define ICCOM_LINK_MAX_UNANSWERED_OFFERS 64
+#endif
+// If set to 1, then the received packages are parsed in pipelined
+// manner: the transport layer return point only verifies the package
+// (CRC, packets layout and technical records), acks it and queues its
+// payload, while the consumer packets are parsed into the messages
+// storage by the dedicated work (see __iccom_rx_parse_routine) when
+// the next xfer is already going. So the parsing time doesn't add to
+// the inter-frame latency.
+//
+// NOTE: the broken packages are still never acked, and if the queued
+//      payload can not be parsed later (no memory), then the messages
+//      storage is rolled back to the state before the payload as
+//      usual and the payload is parsed again by the next run of the
+//      work (before any later received payload).
+#ifndef ICCOM_RX_PIPELINED
+#define ICCOM_RX_PIPELINED 0
+#endif
+// The number of buckets of the latency histograms (see struct
+// iccom_latency_hist). The bucket i counts the latencies within
+// [2^i; 2^(i+1)) usec, the first bucket also counts the lower ones,
+// the last one also counts the higher ones.
+#ifndef ICCOM_LATENCY_HIST_BUCKETS
+#define ICCOM_LATENCY_HIST_BUCKETS 20
 #endif
 
 
@@ -215,8 +481,6 @@
 //
 //      * Add "do {.....} while (0)" for all function-like macro
 //
-//      * make statistics robust
-//
 //      * verify the reason of crash if uncomment the following line
 //        (around 2910 line):
 //           __iccom_msg_storage_printout(&iccom->p->rx_messages);
@@ -247,14 +511,6 @@
 //        MSG2: part 1 ptr + size; part 2 ptr + size, part 3 ptr + size;...
 //
 //
-//      * TO THINK ABOUT BANDWIDTH QUOTES/LOAD BALANCING, to make consumers
-//        to have bandwidth preallocated and thus guaranteed to avoid the
-//        situations when single consumer consumes whole bandwidth of the
-//        whole device.
-//
-//      * BANDWIDTH ALLOCATION CAN BE MADE BY PRIORITIZATION of incoming
-//        packets (the more bytes is sent, the less priority gets)
-//
 //      * if callback thread is blocked for more than gitven threshold,
 //        then it is reasonable to launch the second worker thread by
 //        timeout to 1) avoid excessive threads creation 2) still be able
@@ -273,15 +529,89 @@
 // to the other side ICCom.
 #define ICCOM_TECHNICAL_CHANNEL_ID 0
 
+// The technical channel packet payload consists of records:
+//      [1 byte type][1 byte value length][value]
+// unknown records are skipped.
+#define ICCOM_TECH_REC_HEADER_SIZE_BYTES 2
+// The package size offer record, the value is the maximal data
+// package size the sender supports (2 bytes, big endian).
+#define ICCOM_TECH_REC_PKG_SIZE_OFFER 0x01
+#define ICCOM_TECH_REC_PKG_SIZE_OFFER_SIZE_BYTES 2
+// The features offer record, the value is the ICCOM_LINK_FEATURE_*
+// bit mask of features the sender supports (1 byte).
+#define ICCOM_TECH_REC_FEATURES_OFFER 0x02
+#define ICCOM_TECH_REC_FEATURES_OFFER_SIZE_BYTES 1
+// The piggyback ack record, the value is the ID of the last package
+// the sender received in order (1 byte) followed by the selective ack
+// bit mask (1 byte): bit i is set if the package with ID (ack + 2 + i)
+// is received. The record always comes in the dedicated first packet
+// of the package, so it can be updated in place on package resend.
+#define ICCOM_TECH_REC_ACK 0x03
+#define ICCOM_TECH_REC_ACK_SIZE_BYTES 2
+#define ICCOM_TECH_ACK_PACKET_SIZE_BYTES				\
+	(ICCOM_PACKET_HEADER_SIZE_BYTES + ICCOM_TECH_REC_HEADER_SIZE_BYTES \
+	 + ICCOM_TECH_REC_ACK_SIZE_BYTES)
+// The rebuilt package record, the value is the ID of the package
+// this package was rebuilt from on the link fallback (1 byte). The
+// record always comes in the dedicated first packet of the package,
+// it allows the other side to drop the data it already received
+// within the original package.
+#define ICCOM_TECH_REC_REBUILT_OF 0x04
+#define ICCOM_TECH_REC_REBUILT_OF_SIZE_BYTES 1
+// The window offer record, the value is the maximal number of
+// packages in flight the sender supports in piggyback acks mode
+// (1 byte, see ICCOM_PB_WINDOW_PACKAGES).
+#define ICCOM_TECH_REC_WINDOW_OFFER 0x05
+#define ICCOM_TECH_REC_WINDOW_OFFER_SIZE_BYTES 1
+// The batch offer record, the value is the maximal number of
+// packages per xfer the sender supports in piggyback acks mode
+// (1 byte, see ICCOM_PB_BATCH_PACKAGES).
+#define ICCOM_TECH_REC_BATCH_OFFER 0x06
+#define ICCOM_TECH_REC_BATCH_OFFER_SIZE_BYTES 1
+// The piggyback ack record which also requests the link fallback (or
+// agrees to the other side request), the value is the same as of
+// ICCOM_TECH_REC_ACK. Replaces the ICCOM_TECH_REC_ACK record in place
+// (see __iccom_package_set_ack).
+#define ICCOM_TECH_REC_ACK_FALLBACK 0x07
+// The number of last received package IDs the legacy protocol treats
+// as resent: the other side might still resend the packages in flight
+// while its piggyback acks mode falls back.
+#define ICCOM_RX_RESENT_IDS_COUNT					\
+	(ICCOM_ACK_PIGGYBACK ? ICCOM_PB_WINDOW_PACKAGES : 1)
+
+// The link features
+#define ICCOM_LINK_FEATURE_ACK_PIGGYBACK 0x01
+#define ICCOM_LINK_OUR_FEATURES						\
+	(ICCOM_ACK_PIGGYBACK ? ICCOM_LINK_FEATURE_ACK_PIGGYBACK : 0)
+
+// The link negotiation states
+#define ICCOM_LINK_NEGOTIATING 0
+#define ICCOM_LINK_SWITCHED 1
+#define ICCOM_LINK_OFFERS_STOPPED 2
+
 // should be > 0
 #define ICCOM_INITIAL_PACKAGE_ID 1
 
 // the root directory in proc file system, which contains
-// ICCom information for user space
+// ICCom information for user space, the first ICCom instance uses it
+// as is, the next ones get their instance number appended (like
+// "iccom1")
 #define ICCOM_PROC_ROOT_NAME "iccom"
+#define ICCOM_PROC_ROOT_NAME_MAX_LEN 16
 // the name of the character device to readout ICCom statistics
 #define ICCOM_STATISTICS_FILE_NAME "statistics"
 #define ICCOM_PROC_R_PERMISSIONS 0444
+// the file in ICCom proc directory, which allows to read and set the
+// TX scheduling parameters of the channels
+#define ICCOM_TX_CHANNELS_FILE_NAME "tx_channels"
+// the file in ICCom proc directory, which provides the per-channel and
+// per-priority level statistics
+#define ICCOM_CHANNELS_STATISTICS_FILE_NAME "channels_statistics"
+// the file in ICCom proc directory, which allows to read and set the
+// scheduling priority and the CPU affinity of the kthread worker
+// (ICCOM_WQ_RT_KTHREAD mode only)
+#define ICCOM_WORKER_FILE_NAME "worker"
+#define ICCOM_PROC_RW_PERMISSIONS 0600
 
 #if ICCOM_DATA_XFER_SIZE_BYTES > ICCOM_ACK_XFER_SIZE_BYTES
 #define ICCOM_BUFFER_SIZE ICCOM_DATA_XFER_SIZE_BYTES
@@ -313,6 +643,10 @@
 /* ---------------------- ACK PACKAGE CONFIGURATION ---------------------*/
 #define ICCOM_PACKAGE_ACK_VALUE 0xD0
 #define ICCOM_PACKAGE_NACK_VALUE 0xE1
+// The ACK/NACK values which also request the link fallback, sent only
+// on the negotiated link (see ICCOM_LINK_FALLBACK_FAILED_FRAMES).
+#define ICCOM_PACKAGE_ACK_FALLBACK_VALUE 0xD2
+#define ICCOM_PACKAGE_NACK_FALLBACK_VALUE 0xE3
 
 /* ---------------------- ADDITIONAL VALUES -----------------------------*/
 
@@ -431,6 +765,15 @@
 		error_action;						\
 	}
 
+// The statistics counters updates (see struct iccom_dev_statistics),
+// @iccom_p is the pointer to the ICCom device private data.
+#define ICCOM_STATS_ADD(iccom_p, field, val)				\
+	this_cpu_add((iccom_p)->statistics->field, (val))
+#define ICCOM_STATS_INC(iccom_p, field)					\
+	this_cpu_inc((iccom_p)->statistics->field)
+#define ICCOM_STATS_DEC(iccom_p, field)					\
+	this_cpu_dec((iccom_p)->statistics->field)
+
 #define ICCOM_MSG_STORAGE_CHECK_STORAGE(msg, error_action)		\
 	if (IS_ERR_OR_NULL(storage)) {					\
 		iccom_err("%s: bad msg storage ptr; "msg"\n", __func__);\
@@ -456,9 +799,40 @@ static ssize_t __iccom_statistics_read(struct file *file
 		, char __user *ubuf
 		, size_t count
 		, loff_t *_unused_ppos);
+static ssize_t __iccom_tx_channels_read(struct file *file
+		, char __user *ubuf
+		, size_t count
+		, loff_t *ppos);
+static ssize_t __iccom_tx_channels_write(struct file *file
+		, const char __user *ubuf
+		, size_t count
+		, loff_t *ppos);
+static ssize_t __iccom_channels_statistics_read(struct file *file
+		, char __user *ubuf
+		, size_t count
+		, loff_t *ppos);
+#if ICCOM_WORKQUEUE_MODE_MATCH(RT_KTHREAD)
+static ssize_t __iccom_worker_read(struct file *file
+		, char __user *ubuf
+		, size_t count
+		, loff_t *ppos);
+static ssize_t __iccom_worker_write(struct file *file
+		, const char __user *ubuf
+		, size_t count
+		, loff_t *ppos);
+#endif
 
 /* --------------------------- MAIN STRUCTURES --------------------------*/
 
+// The log2 histogram of latencies.
+//
+// @count the number of latencies within the bucket, the bucket i
+//      counts the latencies within [2^i; 2^(i+1)) usec (see
+//      ICCOM_LATENCY_HIST_BUCKETS).
+struct iccom_latency_hist {
+	unsigned long long count[ICCOM_LATENCY_HIST_BUCKETS];
+};
+
 // TODO: probably not needed
 // (probably needed only for xfer)
 //
@@ -501,10 +875,16 @@ static ssize_t __iccom_statistics_read(struct file *file
 //      received again, thus as long we have no packets IDs in
 //      protocol right now, we need to revert all applied changes
 //      from failed package to maintain data integrity.
+// @finalized_ns the time the message was finalized at, to measure
+//      the RX to delivery latency.
+// @data_headroom the number of bytes reserved in front of @data
+//      within its allocated buffer (the buffer starts at
+//      @data - @data_headroom).
 struct iccom_message {
 	struct list_head list_anchor;
 
 	char *data;
+	size_t data_headroom;
 	size_t length;
 	unsigned int channel;
 	unsigned int id;
@@ -512,6 +892,125 @@ struct iccom_message {
 	bool finalized;
 
 	size_t uncommitted_length;
+	s64 finalized_ns;
+};
+
+// Describes the outgoing consumer message which waits in the TX
+// channel queue to be written into the TX packages.
+//
+// @list_anchor the binding to the TX channel messages queue (or to
+//      @tx_unresolved while it waits for its channel record), and
+//      after the message is completely written into the TX package,
+//      the binding to the package done messages list (see
+//      @done_messages of struct iccom_package)
+// @submit_anchor the binding to the TX submission queue, used until
+//      the message is put into the TX channel messages queue (see
+//      @tx_submitted)
+// @data the copy of the consumer message data, owned by the struct
+// @length the total size of the message data in bytes
+// @offset the number of message bytes which were already written
+//      into the TX packages, so the rest of the message starts
+//      at @data + @offset.
+// @channel the id of the destination channel
+// @priority the consumer message priority
+// @level the TX priority level of the message (see
+//      __iccom_tx_priority_level), the message is sent and accounted
+//      at this level.
+// @posted_ns the time the message was posted at, to measure the post
+//      to ack latency.
+struct iccom_tx_message {
+	struct list_head list_anchor;
+	struct llist_node submit_anchor;
+
+	char *data;
+	size_t length;
+	size_t offset;
+	unsigned int channel;
+	unsigned int priority;
+	int level;
+	s64 posted_ns;
+};
+
+// Describes the TX statistics of the single channel or the single TX
+// priority level.
+//
+// @anchor the binding to the list of the channels TX statistics
+//      records (not used for the priority level records)
+// @channel the channel id (not used for the priority level records)
+// @messages_sent the number of the messages the other side confirmed
+//      completely.
+// @bytes_sent the number of the consumer bytes of @messages_sent.
+// @messages_pending the number of the posted messages which are not
+//      confirmed by the other side yet (the TX queue depth).
+// @post_to_ack the histogram of the latencies from the message post
+//      to the other side confirmation of its last part.
+struct iccom_tx_stats {
+	struct list_head anchor;
+	unsigned int channel;
+
+	unsigned long long messages_sent;
+	unsigned long long bytes_sent;
+	unsigned long messages_pending;
+	struct iccom_latency_hist post_to_ack;
+};
+
+// Describes the received package payload which waits to be parsed in
+// pipelined RX mode (see ICCOM_RX_PIPELINED).
+//
+// @anchor the binding to the RX parsing queue
+// @size the size of the payload in bytes
+// @payload the copy of the package payload
+struct iccom_rx_payload {
+	struct llist_node anchor;
+	size_t size;
+	char payload[];
+};
+
+// Describes the TX scheduling state of the single channel.
+//
+// @all_anchor the binding to the list of all TX channel records
+// @sched_anchor the bindings to the active channels lists of the TX
+//      priority levels (index is the level), the channel is in the
+//      level list only while it has pending messages of the level
+//      which may be sent now (else the anchor points to itself).
+// @channel the channel id
+// @messages the FIFO queues of the channel pending outgoing messages
+//      (struct iccom_tx_message) of every TX priority level (index
+//      is the level), so the more urgent messages of the channel
+//      overtake the less urgent ones.
+// @sending the message of the channel which is partially written
+//      into the TX packages, NULL if none. The other side appends
+//      the packets of the channel to its last unfinished message, so
+//      while @sending is set the channel is active only at the
+//      @sending level (see __iccom_tx_channel_hold).
+// @weight {>0} the channel weight in the deficit round robin among
+//      the active channels of the same priority level: the channel
+//      gets the share of the level bandwidth proportional to its
+//      weight. Configured via procfs.
+// @deficit the channel deficits (in package bytes) in the deficit
+//      round robin of every TX priority level.
+// @min_rate_bps the guaranteed minimal TX rate of the channel in
+//      consumer bytes (inclusive packet headers) per second, the
+//      channel which is behind its guaranteed rate is served before
+//      any other data, regardless of its priority level. 0 means no
+//      guarantee. Configured via procfs.
+// @rate_tokens the token bucket of the guaranteed minimal rate in
+//      bytes * NSEC_PER_SEC units (see __iccom_tx_channel_refill).
+// @rate_last_refill_ns the time of the last @rate_tokens refill.
+struct iccom_tx_channel {
+	struct list_head all_anchor;
+	struct list_head sched_anchor[ICCOM_TX_PRIORITY_LEVELS_COUNT];
+
+	unsigned int channel;
+	struct list_head messages[ICCOM_TX_PRIORITY_LEVELS_COUNT];
+	struct iccom_tx_message *sending;
+
+	int weight;
+	int deficit[ICCOM_TX_PRIORITY_LEVELS_COUNT];
+
+	unsigned int min_rate_bps;
+	s64 rate_tokens;
+	s64 rate_last_refill_ns;
 };
 
 // Describes the single data package. The data package is a data,
@@ -524,6 +1023,22 @@ struct iccom_message {
 //      total number of bytes in the package
 // @owns_data if true, then the data pointed by xfer_data is owned
 //      by the package and must be freed upon package destruction.
+// @carries_link_offer if true, then the package contains our link
+//      offer records (see ICCOM_LINK_NEGOTIATION).
+// @carries_data if true, then the package contains consumer data.
+// @sent if true, then the package was sent at least once, so the
+//      other side might have received it already.
+// @rebuilt_of the ID of the package this package was rebuilt from
+//      on link fallback, -1 if the package is not rebuilt.
+// @sacked piggyback acks mode only: if true, then the other side
+//      confirmed the package with selective ack.
+// @sent_frame piggyback acks mode only: the number of the frame the
+//      package was sent last time within.
+// @done_messages the TX messages (struct iccom_tx_message, without
+//      data) whose last part is written into the package, they are
+//      accounted in the statistics when the package is confirmed by
+//      the other side (see __iccom_queue_package_acked).
+// @consumer_packets the number of the consumer packets in the package.
 //
 // NOTE: for now we will use the following package configuration:
 //      SALT documentation, 20 November 2018, 1.4.2 Transmission
@@ -542,6 +1057,31 @@ struct iccom_package {
 	size_t size;
 
 	bool owns_data;
+	bool carries_link_offer;
+	bool carries_data;
+	bool sent;
+	int rebuilt_of;
+	bool sacked;
+	unsigned long sent_frame;
+
+	struct list_head done_messages;
+	unsigned int consumer_packets;
+};
+
+// Describes the link capabilities offered by the side.
+//
+// @max_pkg_size the maximal data package size the side supports,
+//      0 means no offer.
+// @features the ICCOM_LINK_FEATURE_* bit mask the side supports.
+// @window the maximal number of packages in flight the side supports
+//      in piggyback acks mode, 0 means no offer.
+// @batch the maximal number of packages per xfer the side supports
+//      in piggyback acks mode, 0 means no offer.
+struct iccom_link_offer {
+	size_t max_pkg_size;
+	unsigned int features;
+	unsigned int window;
+	unsigned int batch;
 };
 
 // Packet header descriptor.
@@ -605,6 +1145,11 @@ struct iccom_packet {
 //              transferred to the consumer;
 //          false: then message data ownership remains in ICCom,
 //              and is immediately discarded after callback invocation.
+// @messages_delivered the number of the channel messages delivered
+//      to the consumer (via callback or read).
+// @bytes_delivered the number of the bytes of @messages_delivered.
+// @rx_to_delivery the histogram of the latencies from the message
+//      finalization to its delivery to the consumer.
 struct iccom_message_storage_channel
 {
 	struct list_head channel_anchor;
@@ -616,6 +1161,10 @@ struct iccom_message_storage_channel
 
 	void *consumer_callback_data;
 	iccom_msg_ready_callback_ptr_t message_ready_callback;
+
+	unsigned long long messages_delivered;
+	unsigned long long bytes_delivered;
+	struct iccom_latency_hist rx_to_delivery;
 };
 
 // Describes the messages storage. Intended to be used to
@@ -641,6 +1190,10 @@ struct iccom_message_storage_channel
 //      @message_ready_global_callback.
 // @uncommitted_finalized_count the number of finalized messages since
 //      last commit.
+// @data_headroom the number of bytes to reserve in front of the
+//      message data within every newly allocated message data buffer.
+// @data_tailroom the number of bytes to reserve after the message
+//      data within every newly allocated message data buffer.
 struct iccom_message_storage
 {
 	struct list_head channels_list;
@@ -650,6 +1203,9 @@ struct iccom_message_storage
 	void *global_consumer_data;
 
 	int uncommitted_finalized_count;
+
+	size_t data_headroom;
+	size_t data_tailroom;
 };
 
 // Iccom device statistics
@@ -661,13 +1217,26 @@ struct iccom_message_storage
 //      get a duplicated package.
 // @packages_parsing_failed incremented every time we fail
 //      to parse the package data into correct packets.
-//
-// NOTE: statistics is not guaranteed to be percise or even
-//      selfconsistent. This data is mainly for debugging,
-//      general picture monitoring. Don't use these values
-//      for non-statistical/monitoring purposes. This is due
-//      to absence of correct sync in statistics operations
-//      which otherwise will introduce too big overhead.
+// @packages_received_out_of_order piggyback acks mode only:
+//      incremented every time we hold the package which came
+//      ahead of the missing one.
+// @packages_resent piggyback acks mode only: incremented every
+//      time we resend the package which was lost.
+// @idle_periods incremented every time the link gets idle.
+// @packets_sent the number of the consumer packets the other side
+//      confirmed.
+// @messages_sent the number of the consumer messages the other side
+//      confirmed completely.
+// @total_consumers_bytes_sent the number of the consumer bytes of
+//      @messages_sent.
+//
+// NOTE: the statistics is kept per CPU (see ICCOM_STATS_ADD), every
+//      counter is updated locally on the current CPU without locking
+//      or atomic operations, and the per CPU values are summed up on
+//      readout (see __iccom_statistics_get). So the counters are
+//      exact, while the gauges (like @packages_in_tx_queue) might be
+//      decremented on other CPU than incremented, which is fine as
+//      long as only their sum is relevant.
 struct iccom_dev_statistics {
 	unsigned long long transport_layer_xfers_done_count;
 	unsigned long long raw_bytes_xfered_via_transport_layer;
@@ -677,16 +1246,18 @@ struct iccom_dev_statistics {
 	unsigned long long packages_bad_data_received;
 	unsigned long long packages_duplicated_received;
 	unsigned long long packages_parsing_failed;
+	unsigned long long packages_received_out_of_order;
+	unsigned long long packages_resent;
+	unsigned long long idle_periods;
 	unsigned long long packets_received_ok;
 	unsigned long long messages_received_ok;
 	unsigned long packages_in_tx_queue;
+	unsigned long messages_in_tx_queue;
 	unsigned long long total_consumers_bytes_received_ok;
 	unsigned long messages_ready_in_storage;
-
-// TODO:
-//	unsigned long long packets_sent;
-//	unsigned long long messages_sent;
-//	unsigned long long total_consumers_bytes_sent;
+	unsigned long long packets_sent;
+	unsigned long long messages_sent;
+	unsigned long long total_consumers_bytes_sent;
 };
 
 // Keeps the error history record
@@ -753,12 +1324,68 @@ struct iccom_error_rec {
 //      TX queue manipulation routines:
 //          __iccom_queue_*
 //
-// @tx_queue_lock mutex to protect the TX packages queue from data
-//      races.
+//      NOTE: the consumer messages are not written into the packages
+//          directly upon posting, but are kept in the TX channels
+//          queues till the next package is built (this happens when
+//          the heading package was delivered), this allows more
+//          urgent messages to overtake the less urgent ones (at the
+//          message boundaries).
+// @tx_channels the list of all TX channel records (struct
+//      iccom_tx_channel): the ones which have pending outgoing
+//      messages or non-default scheduling parameters.
+//      Protected by @tx_queue_lock.
+// @tx_active_channels the per-priority-level lists of the channels
+//      which have pending outgoing messages of the level (struct
+//      iccom_tx_channel via @sched_anchor). Index is the priority
+//      level (the higher index the more urgent messages). The channels of the same
+//      level are served in the deficit round robin manner.
+//      Protected by @tx_queue_lock.
+// @tx_min_rate_channels_count the number of TX channel records with
+//      guaranteed minimal rate set.
+// @tx_sched_cursor the priority level which currently has the turn
+//      in the deficit round robin over priority levels.
+//      NOTE: used only when ICCOM_TX_SCHEDULING equals
+//          ICCOM_TX_SCHED_WEIGHTED
+// @tx_sched_deficit the deficit (in package bytes) of every priority
+//      level in the deficit round robin over priority levels.
+//      NOTE: used only when ICCOM_TX_SCHEDULING equals
+//          ICCOM_TX_SCHED_WEIGHTED
+// @tx_queue_lock mutex to protect the TX packages queue and TX
+//      messages queues from data races.
+// @tx_submitted the lock-free queue of the TX messages posted by the
+//      consumers, which are not put into the TX channels queues yet:
+//      any number of consumers add messages here without locking,
+//      while the messages are taken by the package builder only
+//      (under @tx_queue_lock, see __iccom_queue_take_submitted). So
+//      the consumers don't contend with the transport layer.
+// @tx_unresolved the TX messages (struct iccom_tx_message via
+//      @list_anchor) taken from @tx_submitted which are not put into
+//      their channels queues yet, as long as their TX channel record
+//      couldn't be allocated. Kept in order of posting and retried
+//      before any later submitted message.
+//      Protected by @tx_queue_lock.
+// @tx_queued_bytes the number of consumer data bytes posted but not
+//      yet written into the TX packages (or dropped), is limited by
+//      tx_queue_max_bytes module parameter.
+// @tx_space_wait the wait queue the consumers wait for the room in
+//      TX queue on (see iccom_wait_tx_space(...)), woken up every
+//      time the @tx_queued_bytes are released.
+// @tx_stats the TX statistics records of the channels (struct
+//      iccom_tx_stats), the record is created upon the first channel
+//      message and is kept until ICCom is closed.
+// @tx_level_stats the TX statistics of the TX priority levels (the
+//      level the message is sent at, see @level of struct
+//      iccom_tx_message).
 // @ack_val const by usage. Keeps the ACK value, which is to be sent to
 //      the other side when ACK.
 // @nack_val const by usage. Keeps the NACK value, which is to be sent to
 //      the other side when NACK.
+// @ack_fallback_val const by usage. Keeps the ACK value, which is to
+//      be sent to the other side when ACK and we request the link
+//      fallback.
+// @nack_fallback_val const by usage. Keeps the NACK value, which is to
+//      be sent to the other side when NACK and we request the link
+//      fallback.
 // @xfer the currently going xfer, it only points to the data but never
 //      owns it.
 // @data_xfer_stage according to the protocol, data and ack packages are
@@ -775,7 +1402,72 @@ struct iccom_error_rec {
 // @last_rx_package_id the sequence ID of the last package we have
 //      received from the other side. If we receive two packages
 //      with the same sequence ID, than we will drop all but one of the
-//      packages with the same sequence ID.
+//      packages with the same sequence ID (see also
+//      ICCOM_RX_RESENT_IDS_COUNT).
+// @last_rx_whole_package_id the sequence ID of the last package we
+//      have received from the other side which was not rebuilt on link
+//      fallback, -1 if none.
+// @data_xfer_size_bytes the current data package size, is
+//      ICCOM_DATA_XFER_SIZE_BYTES until other size is negotiated.
+// @link_features the currently used ICCOM_LINK_FEATURE_* bit mask,
+//      is 0 until other is negotiated.
+// @link_state the link negotiation state (ICCOM_LINK_*).
+// @link_offers_unanswered the number of our delivered link offers
+//      the other side didn't answer with its offer.
+// @link_failed_frames the number of failed frames in a row since
+//      the link was switched.
+// @link_fallback_requested set to true when we request the other side
+//      to drop the negotiated link (or agree to its request), our
+//      next xfers carry the request then.
+// @link_fallback_agreed piggyback acks mode only: set to true when we
+//      answer the other side fallback request, so we fall back after
+//      the frame which carries our answer.
+// @link_fallback_frames piggyback acks mode only: the number of
+//      frames our fallback request was sent within.
+// @link_fallbacks the number of link fallbacks since the link last
+//      worked for ICCOM_LINK_STABLE_FRAMES frames, defines the
+//      renegotiation hold off.
+// @link_stable_frames the number of frames done since the link was
+//      switched.
+// @link_holdoff_frames the number of legacy frames left till we offer
+//      the link again after the fallback.
+// @link_max_pkg_size the data package size we offer, is halved on
+//      every fallback of the link with bigger packages.
+// @link_fell_back set to true when the link falls back to the legacy
+//      protocol, until the sent TX packages are rebuilt (see
+//      __iccom_queue_fit_packages).
+// @rx_link_offer_uncommitted the other side link offer from the
+//      package being parsed now.
+// @last_rx_link_offer the other side link offer from the last
+//      successfully received package.
+// @frame_rx_link_offer the other side link offer received within
+//      current frame.
+// @link_window piggyback acks mode only: the maximal number of our
+//      packages in flight.
+// @link_batch piggyback acks mode only: the number of packages
+//      slots in every xfer, 1 if packages are not batched.
+// @pb_frames piggyback acks mode only: the number of frames done.
+// @tx_last_sent piggyback acks mode only: the last package of TX queue
+//      which was sent but is not acked yet, all packages before it are
+//      also sent and not acked yet; NULL if none.
+// @tx_next piggyback acks mode only: the package to be sent within
+//      the next frame; NULL if the first package is to be sent.
+// @tx_batch piggyback acks mode with batching only: the packages to
+//      be sent within the next frame, the first one is @tx_next.
+// @tx_batch_count the number of valid @tx_batch entries, 0 if only
+//      @tx_next (or the first package) is to be sent.
+// @tx_batch_buf piggyback acks mode with batching only: the next xfer
+//      TX data (the @tx_batch packages laid out back to back); NULL if
+//      batching is not supported by our side.
+// @rx_window piggyback acks mode only: the packages received out of
+//      order (ahead of the missing ones) within the window, the slot
+//      is free if its data is NULL.
+// @frame_rx_data legacy protocol only: set to true if the other side
+//      package received within current frame carries consumer data.
+// @idle set to true if the link is idle: neither side had consumer
+//      data (or link offers) to send within the last frame, so we
+//      don't initiate the next frame until the consumer posts new
+//      data or the other side starts the xfer.
 // @rx_messages the incoming messages storage. Stores completed incoming
 //      messages as well as under construction incoming messages.
 // @work_queue pointer to personal ICCom dedicated work-queue to handle
@@ -784,14 +1476,35 @@ struct iccom_error_rec {
 //      by other running/pending tasks. So to stay on a safe side we
 //      will allocate our own single-threaded workqueue for our purposes.
 //      NOTE: used only when ICCOM_WORKQUEUE_MODE equals ICCOM_WQ_PRIVATE
+// @worker the ICCom dedicated SCHED_FIFO kthread worker to handle
+//      communication jobs.
+//      NOTE: used only when ICCOM_WORKQUEUE_MODE equals
+//          ICCOM_WQ_RT_KTHREAD
+// @worker_ctl_lock serializes the changes of the @worker scheduling
+//      parameters.
+// @worker_priority the current SCHED_FIFO priority of the @worker,
+//      0 means the normal scheduling policy.
+// @worker_cpus the CPUs the @worker is currently allowed to run on.
 // @consumer_delivery_work the kworker which is responsible for
 //      notification and delivery to the consumer finished incoming
 //      messages.
+// @rx_parse_queue pipelined RX mode only: the received package
+//      payloads (struct iccom_rx_payload) which wait to be parsed, in
+//      reverse order of receiving.
+// @rx_parse_pending pipelined RX mode only: the received package
+//      payloads (struct iccom_rx_payload) taken from @rx_parse_queue
+//      which are not parsed yet, in order of receiving, the head one
+//      failed to be parsed last time (if any). Is used only by the
+//      @rx_parse_work.
+// @rx_parse_work pipelined RX mode only: the kworker which parses the
+//      queued received package payloads into the messages storage.
 // @closing true only when iccom device is going to be shutdown.
 // @statistics the integral operational information about ICCom device
-//      instance.
+//      instance, per CPU.
 // @errors tracks the errors by type, and allows the flooding error
 //      reporting protection
+// @proc_id the ICCom instance number, defines the @proc_root name,
+//      -1 if not allocated
 // @proc_root the root iccom directory in the proc file system
 //      this directory is now aiming to provide statistical
 //      information on ICCom but later might be used to set some
@@ -800,14 +1513,43 @@ struct iccom_error_rec {
 //      ICCom statistics info to user space)
 // @statistics_file the file in proc fs which provides the ICCom
 //      statistics to user space.
+// @tx_channels_ops ICCom TX channels control file operations (to read
+//      and set the TX scheduling parameters of the channels)
+// @tx_channels_file the file in proc fs which provides the TX channels
+//      scheduling control to user space.
+// @channels_statistics_ops ICCom channels statistics file operations
+//      (to read out the per-channel and per-priority level statistics
+//      to user space)
+// @channels_statistics_file the file in proc fs which provides the
+//      per-channel and per-priority level statistics to user space.
+// @worker_ops ICCom kthread worker control file operations (to read
+//      and set the worker priority and CPU affinity)
+// @worker_file the file in proc fs which provides the kthread worker
+//      control to user space.
+//      NOTE: used only in ICCOM_WQ_RT_KTHREAD mode
 struct iccom_dev_private {
 	struct iccom_dev *iccom;
 
 	struct list_head tx_data_packages_head;
+	struct list_head tx_channels;
+	struct list_head tx_active_channels[ICCOM_TX_PRIORITY_LEVELS_COUNT];
+	int tx_min_rate_channels_count;
+#if ICCOM_TX_SCHEDULING_MATCH(WEIGHTED)
+	int tx_sched_cursor;
+	int tx_sched_deficit[ICCOM_TX_PRIORITY_LEVELS_COUNT];
+#endif
 	struct mutex tx_queue_lock;
+	struct llist_head tx_submitted;
+	struct list_head tx_unresolved;
+	atomic_t tx_queued_bytes;
+	wait_queue_head_t tx_space_wait;
+	struct list_head tx_stats;
+	struct iccom_tx_stats tx_level_stats[ICCOM_TX_PRIORITY_LEVELS_COUNT];
 
 	unsigned char ack_val;
 	unsigned char nack_val;
+	unsigned char ack_fallback_val;
+	unsigned char nack_fallback_val;
 
 	// never owns the data pointed to
 	struct full_duplex_xfer xfer;
@@ -816,24 +1558,75 @@ struct iccom_dev_private {
 
 	int next_tx_package_id;
 	int last_rx_package_id;
+	int last_rx_whole_package_id;
+
+	size_t data_xfer_size_bytes;
+	unsigned int link_features;
+	int link_state;
+	int link_offers_unanswered;
+	int link_failed_frames;
+	bool link_fallback_requested;
+	bool link_fallback_agreed;
+	int link_fallback_frames;
+	int link_fallbacks;
+	unsigned int link_stable_frames;
+	int link_holdoff_frames;
+	size_t link_max_pkg_size;
+	bool link_fell_back;
+	struct iccom_link_offer rx_link_offer_uncommitted;
+	struct iccom_link_offer last_rx_link_offer;
+	struct iccom_link_offer frame_rx_link_offer;
+	unsigned int link_window;
+	unsigned int link_batch;
+	unsigned long pb_frames;
+	struct iccom_package *tx_last_sent;
+	struct iccom_package *tx_next;
+	struct iccom_package *tx_batch[ICCOM_PB_BATCH_PACKAGES];
+	unsigned int tx_batch_count;
+	uint8_t *tx_batch_buf;
+	struct iccom_package rx_window[ICCOM_PB_WINDOW_PACKAGES - 1];
+	bool frame_rx_data;
+	bool idle;
 
 	struct iccom_message_storage rx_messages;
 
 #if ICCOM_WORKQUEUE_MODE_MATCH(PRIVATE)
 	struct workqueue_struct *work_queue;
+#elif ICCOM_WORKQUEUE_MODE_MATCH(RT_KTHREAD)
+	struct kthread_worker *worker;
+	struct mutex worker_ctl_lock;
+	int worker_priority;
+	struct cpumask worker_cpus;
+#endif
+	struct iccom_work_struct consumer_delivery_work;
+#if ICCOM_RX_PIPELINED
+	struct llist_head rx_parse_queue;
+	struct llist_node *rx_parse_pending;
+	struct iccom_work_struct rx_parse_work;
 #endif
-	struct work_struct consumer_delivery_work;
 
 	bool closing;
 
-	struct iccom_dev_statistics statistics;
+	struct iccom_dev_statistics __percpu *statistics;
 
 	struct iccom_error_rec errors[ICCOM_ERROR_TYPES_COUNT];
 
+	int proc_id;
 	struct proc_dir_entry *proc_root;
 
 	struct file_operations statistics_ops;
 	struct proc_dir_entry *statistics_file;
+
+	struct file_operations tx_channels_ops;
+	struct proc_dir_entry *tx_channels_file;
+
+	struct file_operations channels_statistics_ops;
+	struct proc_dir_entry *channels_statistics_file;
+
+#if ICCOM_WORKQUEUE_MODE_MATCH(RT_KTHREAD)
+	struct file_operations worker_ops;
+	struct proc_dir_entry *worker_file;
+#endif
 };
 
 /* ------------------------ GLOBAL VARIABLES ----------------------------*/
@@ -845,6 +1638,31 @@ static const char ICCOM_ERROR_S_NOMEM[] = "no memory available";
 static const char ICCOM_ERROR_S_TRANSPORT[]
 	= "Xfer failed on transport layer. Restarting frame.";
 
+#if ICCOM_WORKQUEUE_MODE_MATCH(RT_KTHREAD)
+static int worker_priority = ICCOM_RT_KTHREAD_PRIORITY;
+module_param(worker_priority, int, S_IRUGO);
+MODULE_PARM_DESC(worker_priority, "The initial SCHED_FIFO priority of"
+		 " the kthread worker, 0 for normal policy");
+
+static char *worker_cpus = "";
+module_param(worker_cpus, charp, S_IRUGO);
+MODULE_PARM_DESC(worker_cpus, "The initial CPU list (like \"0,2-3\")"
+		 " the kthread worker runs on, empty for all CPUs");
+#endif
+
+// see ICCOM_TX_QUEUE_MAX_BYTES
+static unsigned int tx_queue_max_bytes = ICCOM_TX_QUEUE_MAX_BYTES;
+module_param(tx_queue_max_bytes, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(tx_queue_max_bytes, "The max number of consumer data"
+		 " bytes pending in the TX queue, the messages above are"
+		 " rejected with -EAGAIN");
+
+#if ICCOM_TX_SCHEDULING_MATCH(WEIGHTED)
+// The weights of the TX priority levels (index is the level).
+static const int iccom_tx_sched_level_weights[ICCOM_TX_PRIORITY_LEVELS_COUNT]
+	= ICCOM_TX_SCHED_LEVEL_WEIGHTS;
+#endif
+
 /* ------------------------ FORWARD DECLARATIONS ------------------------*/
 
 #ifdef ICCOM_DEBUG
@@ -1161,6 +1979,14 @@ static int __iccom_package_init(struct iccom_package *package
 {
 	package->size = package_size_bytes;
 	package->owns_data = true;
+	package->carries_link_offer = false;
+	package->carries_data = false;
+	package->sent = false;
+	package->rebuilt_of = -1;
+	package->sacked = false;
+	package->sent_frame = 0;
+	INIT_LIST_HEAD(&package->done_messages);
+	package->consumer_packets = 0;
 	package->data = kmalloc(package->size, GFP_KERNEL);
 	if (!package->data) {
 		iccom_err("no memory");
@@ -1174,6 +2000,33 @@ static int __iccom_package_init(struct iccom_package *package
 	return 0;
 }
 
+// Helper. Changes the package size keeping its header and payload.
+// The package is to be finalized after this call.
+//
+// @package {valid ptr to package which owns its data}
+// @package_size_bytes the new size of the package, should have room
+//      for current package payload.
+//
+// RETURNS:
+//      0 on success
+//      < 0 - the negative error code (the package remains untouched)
+static int __iccom_package_resize(struct iccom_package *package
+		, size_t package_size_bytes)
+{
+	if (package->size == package_size_bytes) {
+		return 0;
+	}
+	unsigned char *data = krealloc(package->data, package_size_bytes
+				       , GFP_KERNEL);
+	if (!data) {
+		iccom_err("no memory");
+		return -ENOMEM;
+	}
+	package->data = data;
+	package->size = package_size_bytes;
+	return 0;
+}
+
 // Helper. Frees the package data, allocated for @package structure
 // if package owns the data, and the package itself.
 //
@@ -1182,6 +2035,14 @@ static int __iccom_package_init(struct iccom_package *package
 // LOCKING: storage should be locked before this call
 static void __iccom_package_free(struct iccom_package *package)
 {
+	struct iccom_tx_message *msg;
+	struct iccom_tx_message *tmp;
+
+	list_for_each_entry_safe(msg, tmp, &package->done_messages
+				 , list_anchor) {
+		list_del(&msg->list_anchor);
+		kfree(msg);
+	}
 	if (package->owns_data) {
 		kfree(package->data);
 	}
@@ -1205,17 +2066,6 @@ static void __iccom_package_finalize(struct iccom_package *package)
 	__iccom_package_set_src(package, __iccom_package_compute_src(package));
 }
 
-// Helper. Clears the package to make it contain no payload.
-// @package {valid ptr to package}
-//
-// After this operation package is correct and empty.
-// After this call the package is ready to be sent.
-static void __iccom_package_make_empty(struct iccom_package *package)
-{
-	__iccom_package_set_payload_size(package, 0);
-	__iccom_package_finalize(package);
-}
-
 #ifdef ICCOM_DEBUG
 static void iccom_dbg_printout_package(struct iccom_package *pkg)
 {
@@ -1497,15 +2347,19 @@ invalidate_packet:
 //      and then the packet is added to the package payload room.
 // @payload_size_bytes the lengthe of @packet_payload in bytes.
 // @channel the channel to which the packet attached
+// @finalizing if false, then the packet is not marked as the last
+//      chunk of the message even if whole @packet_payload fits into
+//      the package (used when the message chunk is being moved from
+//      one package to another).
 //
 // RETURNS:
 //      the number of consumer payload bytes which were added to the
 //      package.
 //      0 means that no more pakets can be added to the package. So
 //      the package is ready to be sent.
-static size_t iccom_package_add_packet(struct iccom_package *package
+static size_t __iccom_package_add_packet_ext(struct iccom_package *package
 		, char *packet_payload, const size_t payload_size_bytes
-		, const unsigned int channel)
+		, const unsigned int channel, const bool finalizing)
 {
 	if (IS_ERR_OR_NULL(package)) {
 		return 0;
@@ -1532,7 +2386,8 @@ static size_t iccom_package_add_packet(struct iccom_package *package
 	bytes_written_to_package += iccom_packet_write_header(
 					    payload_write_size_bytes
 					    , channel
-					    , payload_write_size_bytes
+					    , finalizing
+					      && payload_write_size_bytes
 						    == payload_size_bytes
 					    , start_ptr);
 	memcpy(start_ptr + bytes_written_to_package, packet_payload
@@ -1547,6 +2402,64 @@ static size_t iccom_package_add_packet(struct iccom_package *package
 	return payload_write_size_bytes;
 }
 
+// Adds the maximum possible amount of bytes from message to the package
+// marking the packet as finalizing one if whole remaining message data
+// fits. See __iccom_package_add_packet_ext.
+static inline size_t iccom_package_add_packet(
+		struct iccom_package *package
+		, char *packet_payload, const size_t payload_size_bytes
+		, const unsigned int channel)
+{
+	return __iccom_package_add_packet_ext(package, packet_payload
+					      , payload_size_bytes, channel
+					      , true);
+}
+
+/* ------------------ LATENCY HISTOGRAMS --------------------------------*/
+
+// Helper. Adds the latency to the histogram.
+//
+// @hist {valid ptr}
+// @latency_ns the latency in nsec
+static void __iccom_latency_hist_add(struct iccom_latency_hist *hist
+				     , const s64 latency_ns)
+{
+	const u64 usec = latency_ns > 0
+			 ? div_u64((u64)latency_ns, NSEC_PER_USEC) : 0;
+	int bucket = usec ? fls64(usec) - 1 : 0;
+
+	if (bucket >= ICCOM_LATENCY_HIST_BUCKETS) {
+		bucket = ICCOM_LATENCY_HIST_BUCKETS - 1;
+	}
+	hist->count[bucket]++;
+}
+
+// Helper. Prints the histogram buckets counters (space separated, the
+// line is ended) into the buffer.
+//
+// @hist {valid ptr}
+// @buf {valid ptr} the buffer to print to
+// @size the buffer size in bytes
+//
+// RETURNS:
+//      the number of bytes printed (like snprintf, so might be
+//      greater than @size if the output was truncated)
+static size_t __iccom_latency_hist_print(
+		const struct iccom_latency_hist *hist
+		, char *buf, const size_t size)
+{
+	size_t len = 0;
+
+	for (int i = 0; i < ICCOM_LATENCY_HIST_BUCKETS && len < size; i++) {
+		len += (size_t)snprintf(buf + len, size - len, " %llu"
+					, hist->count[i]);
+	}
+	if (len < size) {
+		len += (size_t)snprintf(buf + len, size - len, "\n");
+	}
+	return len;
+}
+
 /* ------------------ MESSAGES MANIPULATION -----------------------------*/
 
 // Helper. Initializes new message struct.
@@ -1572,7 +2485,7 @@ static void __iccom_message_free(struct iccom_message *msg)
 	}
 	list_del(&(msg->list_anchor));
 	if (!IS_ERR_OR_NULL(msg->data)) {
-		kfree(msg->data);
+		kfree(msg->data - msg->data_headroom);
 	}
 	kfree(msg);
 }
@@ -1717,6 +2630,10 @@ __iccom_msg_storage_add_channel(struct iccom_message_storage *storage
 			= ICCOM_PACKET_INVALID_MESSAGE_ID;
 	channel_rec->consumer_callback_data = NULL;
 	channel_rec->message_ready_callback = NULL;
+	channel_rec->messages_delivered = 0;
+	channel_rec->bytes_delivered = 0;
+	memset(&channel_rec->rx_to_delivery, 0
+	       , sizeof(channel_rec->rx_to_delivery));
 
 	return channel_rec;
 }
@@ -1759,6 +2676,21 @@ static void __iccom_msg_storage_free_channel(
 	return;
 }
 
+// Helper. Accounts the ready message delivery to the consumer in the
+// channel statistics.
+//
+// LOCKING: storage should be locked before calling this function
+static void __iccom_msg_storage_account_delivery(
+		struct iccom_message_storage_channel *channel_rec
+		, struct iccom_message *msg)
+{
+	channel_rec->messages_delivered++;
+	channel_rec->bytes_delivered += msg->length;
+	__iccom_latency_hist_add(&channel_rec->rx_to_delivery
+				 , ktime_to_ns(ktime_get())
+				   - msg->finalized_ns);
+}
+
 // Notifies the channel consumer about all ready messages
 // in the channel (in FIFO sequence). Notified messages are
 // discarded from the channel if consumer callback
@@ -1820,8 +2752,12 @@ static int __iccom_msg_storage_pass_channel_to_consumer(
 		if (!__iccom_message_is_ready(msg)) {
 			continue;
 		}
+		__iccom_msg_storage_account_delivery(channel_rec, msg);
 		mutex_unlock(&storage->lock);
 
+		trace_iccom_message_delivered(channel_rec->channel, msg->id
+					      , msg->length);
+
 		count++;
 		bool ownership_to_consumer = msg_ready_callback(
 						 channel_rec->channel
@@ -2277,6 +3213,7 @@ struct iccom_message *iccom_msg_storage_pop_first_ready_message(
 	list_for_each_entry(msg, &channel_rec->messages
 			    , list_anchor) {
 		if (__iccom_message_is_ready(msg)) {
+			__iccom_msg_storage_account_delivery(channel_rec, msg);
 			list_del(&(msg->list_anchor));
 			goto finalize;
 		}
@@ -2562,11 +3499,14 @@ int iccom_msg_storage_append_data_to_message(
 
 	// TODO: avoid reallocation (allocate maximum available message
 	// size only once).
-	void *new_store = kmalloc(msg->length + new_data_length, GFP_KERNEL);
-	if (!new_store) {
+	const size_t headroom = storage->data_headroom;
+	char *new_buf = kmalloc(headroom + msg->length + new_data_length
+				+ storage->data_tailroom, GFP_KERNEL);
+	if (!new_buf) {
 		iccom_err("Could not allocate memory for new message data.");
 		return -ENOMEM;
 	}
+	char *new_store = new_buf + headroom;
 
 	if (!IS_ERR_OR_NULL(msg->data) && msg->length > 0) {
 		memcpy(new_store, msg->data, msg->length);
@@ -2576,15 +3516,18 @@ int iccom_msg_storage_append_data_to_message(
 	// caution: the order of lines matters here: we update the pointer
 	// first to keep the data selfconsistent, cause new data block
 	// contains the old one, thus the data still will be selfconsistent
-	char *old_data = msg->data;
+	char *old_buf = IS_ERR_OR_NULL(msg->data)
+			? NULL : msg->data - msg->data_headroom;
 	msg->data = new_store;
+	msg->data_headroom = headroom;
 	mutex_lock(&storage->lock);
 	msg->length += new_data_length;
 	msg->uncommitted_length = new_data_length;
 	mutex_unlock(&storage->lock);
-	kfree(old_data);
+	kfree(old_buf);
 
 	if (final) {
+		msg->finalized_ns = ktime_to_ns(ktime_get());
 		msg->finalized = true;
 		__sync_add_and_fetch(&storage->uncommitted_finalized_count, 1);
 	}
@@ -2796,6 +3739,8 @@ static int iccom_msg_storage_init(
 	storage->uncommitted_finalized_count = 0;
 	storage->message_ready_global_callback = NULL;
 	storage->global_consumer_data = NULL;
+	storage->data_headroom = 0;
+	storage->data_tailroom = 0;
 	return 0;
 }
 
@@ -2983,6 +3928,92 @@ static bool __iccom_error_report(struct iccom_dev *iccom
 	return true;
 }
 
+#if ICCOM_WORKQUEUE_MODE_MATCH(RT_KTHREAD)
+// Helper.
+// Switches the @task to the SCHED_FIFO policy with the @priority, or
+// to the normal policy if the @priority is 0.
+//
+// NOTE: since Linux 5.9 the modules can not pick the RT priority
+//      directly, so there the @priority is mapped to the closest
+//      level the kernel provides: [MAX_RT_PRIO / 2; MAX_RT_PRIO - 1]
+//      to sched_set_fifo() and [1; MAX_RT_PRIO / 2 - 1] to
+//      sched_set_fifo_low(), so the relative order of the workers
+//      is kept.
+//
+// RETURNS:
+//      >= 0: the priority actually applied, on success
+//      < 0: negated error code, on failure
+static int __iccom_worker_set_policy(struct task_struct *task
+		, const int priority)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 9, 0)
+	if (priority == 0) {
+		sched_set_normal(task, 0);
+		return 0;
+	}
+	if (priority >= MAX_RT_PRIO / 2) {
+		sched_set_fifo(task);
+		return MAX_RT_PRIO / 2;
+	}
+	sched_set_fifo_low(task);
+	return 1;
+#else
+	const struct sched_param param = {
+		.sched_priority = priority
+	};
+
+	int res = sched_setscheduler(task
+			, priority ? SCHED_FIFO : SCHED_NORMAL, &param);
+	return res < 0 ? res : priority;
+#endif
+}
+
+// Helper.
+// Applies the scheduling policy and the CPU affinity to the ICCom
+// kthread worker and keeps the applied values on success, the
+// worker is left as it was on failure.
+//
+// @iccom the ICCom device with the running kthread worker
+// @priority the SCHED_FIFO priority, [1; MAX_RT_PRIO - 1],
+//      or 0 to run the worker with normal policy.
+// @cpus the CPUs the worker is allowed to run on, should contain
+//      at least one online CPU.
+//
+// RETURNS:
+//      0: on success
+//      < 0: negated error code, on failure
+//
+// LOCKING: @iccom->p->worker_ctl_lock should be held by caller.
+static int __iccom_worker_apply(const struct iccom_dev *const iccom
+		, const int priority, const struct cpumask *const cpus)
+{
+	if (priority < 0 || priority >= MAX_RT_PRIO) {
+		return -EINVAL;
+	}
+
+	struct task_struct *task = iccom->p->worker->task;
+
+	// the affinity goes first: it is the one which can be rolled
+	// back, so the failed call leaves the worker as it was
+	int res = set_cpus_allowed_ptr(task, cpus);
+	if (res < 0) {
+		return res;
+	}
+
+	res = __iccom_worker_set_policy(task, priority);
+	if (res < 0) {
+		set_cpus_allowed_ptr(task, &iccom->p->worker_cpus);
+		return res;
+	}
+	iccom->p->worker_priority = res;
+	if (&iccom->p->worker_cpus != cpus) {
+		cpumask_copy(&iccom->p->worker_cpus, cpus);
+	}
+
+	return 0;
+}
+#endif
+
 // Helper.
 // Inits the workqueue which is to be used by ICCom
 // in its current configuration. If we use system-provided
@@ -3016,6 +4047,49 @@ static inline int __iccom_init_workqueue(
 	iccom_err("%s: the private work queue init failed."
 				, __func__);
 	return -EAGAIN;
+#elif ICCOM_WORKQUEUE_MODE_MATCH(RT_KTHREAD)
+	iccom_info(ICCOM_LOG_INFO_KEY_LEVEL, "using RT kthread worker");
+	iccom->p->worker = kthread_create_worker(0, "iccom");
+
+	if (IS_ERR(iccom->p->worker)) {
+		iccom_err("%s: the kthread worker init failed: %ld."
+			  , __func__, PTR_ERR(iccom->p->worker));
+		iccom->p->worker = NULL;
+		return -EAGAIN;
+	}
+
+	mutex_init(&iccom->p->worker_ctl_lock);
+	iccom->p->worker_priority = 0;
+	cpumask_copy(&iccom->p->worker_cpus, cpu_possible_mask);
+
+	cpumask_var_t cpus;
+	if (!alloc_cpumask_var(&cpus, GFP_KERNEL)) {
+		iccom_warning("%s: no memory for the worker CPU list, using"
+			      " normal policy on all CPUs", __func__);
+		return 0;
+	}
+	cpumask_copy(cpus, cpu_possible_mask);
+	if (worker_cpus && worker_cpus[0] != '\0'
+			&& cpulist_parse(worker_cpus, cpus) < 0) {
+		iccom_warning("%s: could not parse the worker CPU list"
+			      " \"%s\", using all CPUs"
+			      , __func__, worker_cpus);
+		cpumask_copy(cpus, cpu_possible_mask);
+	}
+
+	// the failed apply leaves the worker as it was created: normal
+	// policy on all CPUs
+	mutex_lock(&iccom->p->worker_ctl_lock);
+	int res = __iccom_worker_apply(iccom, worker_priority, cpus);
+	if (res < 0) {
+		iccom_warning("%s: could not apply priority %d and CPUs"
+			      " \"%s\" to kthread worker: %d, using"
+			      " normal policy on all CPUs", __func__
+			      , worker_priority, worker_cpus, res);
+	}
+	mutex_unlock(&iccom->p->worker_ctl_lock);
+	free_cpumask_var(cpus);
+	return 0;
 #endif
 }
 
@@ -3029,6 +4103,9 @@ static inline void __iccom_close_workqueue(
 #if ICCOM_WORKQUEUE_MODE_MATCH(PRIVATE)
 	destroy_workqueue(iccom->p->work_queue);
 	iccom->p->work_queue = NULL;
+#elif ICCOM_WORKQUEUE_MODE_MATCH(RT_KTHREAD)
+	kthread_destroy_worker(iccom->p->worker);
+	iccom->p->worker = NULL;
 #else
 	(void)iccom;
 #endif
@@ -3039,7 +4116,7 @@ static inline void __iccom_close_workqueue(
 // Schedules SymSPI work to the target queue.
 static inline void __iccom_schedule_work(
 		const struct iccom_dev *const iccom
-		, struct work_struct *work)
+		, struct iccom_work_struct *work)
 {
 #if ICCOM_WORKQUEUE_MODE_MATCH(SYSTEM)
 	(void)iccom;
@@ -3049,6 +4126,8 @@ static inline void __iccom_schedule_work(
 	queue_work(system_highpri_wq, work);
 #elif ICCOM_WORKQUEUE_MODE_MATCH(PRIVATE)
 	queue_work(iccom->p->work_queue, work);
+#elif ICCOM_WORKQUEUE_MODE_MATCH(RT_KTHREAD)
+	kthread_queue_work(iccom->p->worker, work);
 #else
 #error no known SymSPI work queue mode defined
 #endif
@@ -3059,9 +4138,13 @@ static inline void __iccom_schedule_work(
 // need some custom queue operations on cancelling.
 static inline void __iccom_cancel_work_sync(
 		const struct iccom_dev *const iccom
-		, struct work_struct *work)
+		, struct iccom_work_struct *work)
 {
+#if ICCOM_WORKQUEUE_MODE_MATCH(RT_KTHREAD)
+	kthread_cancel_work_sync(work);
+#else
 	cancel_work_sync(work);
+#endif
 }
 
 // Helper. Provides next outgoing package id.
@@ -3113,7 +4196,7 @@ static int __iccom_enqueue_new_tx_data_package(struct iccom_dev *iccom)
 	}
 
 	int res = __iccom_package_init(new_package
-				       , ICCOM_DATA_XFER_SIZE_BYTES);
+				       , iccom->p->data_xfer_size_bytes);
 	if (res < 0) {
 		iccom_err("no memory for new package");
 		kfree(new_package);
@@ -3126,7 +4209,7 @@ static int __iccom_enqueue_new_tx_data_package(struct iccom_dev *iccom)
 	list_add_tail(&new_package->list_anchor
 		      , &iccom->p->tx_data_packages_head);
 
-	iccom->p->statistics.packages_in_tx_queue++;
+	ICCOM_STATS_INC(iccom->p, packages_in_tx_queue);
 
 	return 0;
 }
@@ -3156,24 +4239,6 @@ static bool __iccom_have_multiple_packages(struct iccom_dev *iccom)
 	return count == 2;
 }
 
-// Helper. Enqueues new finalized and empty package to tx packages
-// queue (to the end of queue). The former last package (if one)
-// is finalized.
-//
-// RETURNS:
-//      0: on success
-//      <0: negative error code on error
-static int __iccom_enqueue_empty_tx_data_package(struct iccom_dev *iccom)
-{
-	int res = __iccom_enqueue_new_tx_data_package(iccom);
-	if (res != 0) {
-		return res;
-	}
-	struct iccom_package *pkg = __iccom_get_last_tx_package(iccom);
-	__iccom_package_make_empty(pkg);
-	return 0;
-}
-
 // Helper. Returns true if the package checksum is correct.
 static inline bool __iccom_verify_package_crc(
 	struct iccom_package *package)
@@ -3217,8 +4282,54 @@ static int __iccom_verify_package_data(struct iccom_package *package)
 	return (int)payload_size;
 }
 
+// Helper. Piggyback acks mode with batching. Fills up the
+// full_duplex_xfer data structure to make a full-duplex data xfer
+// of @link_batch packages slots: the @tx_batch packages (or the
+// @first_pkg only if batch was not selected) followed by the empty
+// slots.
+//
+// @first_pkg {valid ptr} the package to be sent in the first slot if
+//      @tx_batch is empty
+static void __iccom_fillup_batch_xfer(struct iccom_dev *iccom
+				      , struct full_duplex_xfer *xfer
+				      , struct iccom_package *first_pkg)
+{
+	struct iccom_dev_private *p = iccom->p;
+	const size_t slot_size = p->data_xfer_size_bytes;
+
+	if (p->tx_batch_count == 0) {
+		p->tx_batch[0] = first_pkg;
+		p->tx_batch_count = 1;
+	}
+
+	for (int i = 0; i < p->link_batch; i++) {
+		uint8_t *slot = p->tx_batch_buf + i * slot_size;
+
+		if (i >= p->tx_batch_count) {
+			memset(slot, ICCOM_PACKAGE_EMPTY_PAYLOAD_VALUE
+			       , slot_size);
+			continue;
+		}
+		p->tx_batch[i]->sent = true;
+		memcpy(slot, p->tx_batch[i]->data, slot_size);
+		trace_iccom_package_tx(__iccom_package_get_id(p->tx_batch[i])
+				       , slot_size, i);
+	}
+	p->tx_batch_count = 0;
+
+	xfer->size_bytes = p->link_batch * slot_size;
+	xfer->data_tx = p->tx_batch_buf;
+	xfer->data_rx_buf = NULL;
+	xfer->segment_size_bytes = slot_size;
+	xfer->consumer_data = (void*)iccom;
+	xfer->done_callback = &__iccom_xfer_done_callback;
+	xfer->fail_callback = &__iccom_xfer_failed_callback;
+}
+
 // Helper. Fills up the full_duplex_xfer data structure to make a
-// full-duplex data xfer for the first pending data package in TX queue.
+// full-duplex data xfer for the first pending data package in TX queue
+// (or for the package selected to be sent in piggyback acks mode, see
+// @tx_next).
 //
 // NOTE: surely the first package in TX queue should be finalized before
 //      this call
@@ -3237,7 +4348,14 @@ static void __iccom_fillup_next_data_xfer(struct iccom_dev *iccom
 	}
 #endif
 
-	struct iccom_package *src_pkg = __iccom_get_first_tx_package(iccom);
+	struct iccom_package *src_pkg = iccom->p->tx_next
+					? iccom->p->tx_next
+					: __iccom_get_first_tx_package(iccom);
+
+	if (iccom->p->link_batch > 1) {
+		__iccom_fillup_batch_xfer(iccom, xfer, src_pkg);
+		return;
+	}
 
 #ifdef ICCOM_DEBUG
 	if (IS_ERR_OR_NULL(src_pkg)) {
@@ -3249,24 +4367,38 @@ static void __iccom_fillup_next_data_xfer(struct iccom_dev *iccom
 		return;
 	}
 #endif
+	src_pkg->sent = true;
+	trace_iccom_package_tx(__iccom_package_get_id(src_pkg)
+			       , src_pkg->size, 0);
 	xfer->size_bytes = src_pkg->size;
 	xfer->data_tx = src_pkg->data;
 	xfer->data_rx_buf = NULL;
+	xfer->segment_size_bytes = 0;
 	xfer->consumer_data = (void*)iccom;
 	xfer->done_callback = &__iccom_xfer_done_callback;
 	xfer->fail_callback = &__iccom_xfer_failed_callback;
 }
 
 // Helper. Fills up the full_duplex_xfer data structure to make a
-// full-duplex ack/nack xfer.
+// full-duplex ack/nack xfer. The ack/nack also carries our link
+// fallback request, if we have one.
 static inline void __iccom_fillup_ack_xfer(
 		struct iccom_dev *iccom
 		, struct full_duplex_xfer *xfer
 		, bool ack)
 {
+	struct iccom_dev_private *p = iccom->p;
+
+	trace_iccom_ack(true, ack);
 	xfer->size_bytes = ICCOM_ACK_XFER_SIZE_BYTES;
-	xfer->data_tx = ack ? &iccom->p->ack_val : &iccom->p->nack_val;
+	if (p->link_fallback_requested) {
+		xfer->data_tx = ack ? &p->ack_fallback_val
+				    : &p->nack_fallback_val;
+	} else {
+		xfer->data_tx = ack ? &p->ack_val : &p->nack_val;
+	}
 	xfer->data_rx_buf = NULL;
+	xfer->segment_size_bytes = 0;
 	xfer->consumer_data = (void*)iccom;
 	xfer->done_callback = &__iccom_xfer_done_callback;
 	xfer->fail_callback = &__iccom_xfer_failed_callback;
@@ -3277,764 +4409,3911 @@ static inline void __iccom_fillup_ack_xfer(
 static inline bool __iccom_verify_ack(struct iccom_package *package)
 {
 	return (package->size == ICCOM_ACK_XFER_SIZE_BYTES)
-		&& (package->data[0] == ICCOM_PACKAGE_ACK_VALUE);
+		&& (package->data[0] == ICCOM_PACKAGE_ACK_VALUE
+		    || package->data[0] == ICCOM_PACKAGE_ACK_FALLBACK_VALUE);
 }
 
-// Helper. Moves TX package queue one step forward.
-// If there are multiple data packages, simply discards the heading
-// package. If there is only one package (which is supposed to be
-// just sent), then empties it, updates its ID and finalizes it so
-// it is ready for next xfer.
-//
-// To be called when the first in TX queue package xfer was
-// proven to be done successfully (its ACK was received).
+// Helper. Returns true if the ack/nack package carries the link
+// fallback request.
+static inline bool __iccom_ack_requests_fallback(
+		const struct iccom_package *package)
+{
+	return (package->size == ICCOM_ACK_XFER_SIZE_BYTES)
+		&& (package->data[0] == ICCOM_PACKAGE_ACK_FALLBACK_VALUE
+		    || package->data[0]
+		       == ICCOM_PACKAGE_NACK_FALLBACK_VALUE);
+}
+
+// Helper. Maps the consumer message priority onto the TX priority
+// level.
 //
-// NOTE: thread safe
+// @priority {any} the consumer message priority, values above
+//      ICCOM_TX_PRIORITY_MAX are treated as ICCOM_TX_PRIORITY_MAX.
 //
 // RETURNS:
-//      if there is a non-empty package for xfer from our side.
-static bool __iccom_queue_step_forward(struct iccom_dev *iccom)
+//      the TX priority level [0; ICCOM_TX_PRIORITY_LEVELS_COUNT - 1]
+static inline int __iccom_tx_priority_level(unsigned int priority)
 {
-#ifdef ICCOM_DEBUG
-	ICCOM_CHECK_DEVICE("", return false);
-	ICCOM_CHECK_DEVICE_PRIVATE("", return false);
-	if (!__iccom_have_packages(iccom)) {
-		iccom_err("empty TX packages: logical error");
-		return false;
-	}
-#endif
-	bool have_data;
-	// this function is called indirectly by transport layer below,
-	// while the TX queue can be updated independently by the
-	// consumer, so need mutex here for protection
-	mutex_lock(&iccom->p->tx_queue_lock);
-
-	// if we have more than one package in the queue, this
-	// means we have some our data to send in further packages
-	if (__iccom_have_multiple_packages(iccom)) {
-		struct iccom_package *delivered_package
-			     = __iccom_get_first_tx_package(iccom);
-		__iccom_package_free(delivered_package);
-		iccom->p->statistics.packages_in_tx_queue--;
-		have_data = true;
-		goto finalize;
+	if (priority > ICCOM_TX_PRIORITY_MAX) {
+		priority = ICCOM_TX_PRIORITY_MAX;
 	}
+	return (int)((priority * ICCOM_TX_PRIORITY_LEVELS_COUNT)
+		     / (ICCOM_TX_PRIORITY_MAX + 1));
+}
 
-	// we have only one package in queue
-	struct iccom_package *delivered_package
-		= __iccom_get_first_tx_package(iccom);
-
-	// set this package empty and update with new id
-	int next_id = __iccom_get_next_package_id(iccom);
-	__iccom_package_set_id(delivered_package, next_id);
-	__iccom_package_make_empty(delivered_package);
+// Helper. Returns the pointer to an iccom_tx_message structure
+// given by its list anchor pointer.
+static inline struct iccom_tx_message *__iccom_get_tx_msg_from_list_anchor(
+		struct list_head *anchor)
+{
+	const int offset = offsetof(struct iccom_tx_message, list_anchor);
+	return (struct iccom_tx_message *)((char*)anchor - offset);
+}
 
-	have_data = false;
-finalize:
-	mutex_unlock(&iccom->p->tx_queue_lock);
-	return have_data;
+// Helper. Frees the TX message and its data and removes it from
+// the TX channel messages queue it was in.
+//
+// LOCKING: TX queue should be locked before this call
+static void __iccom_tx_message_free(struct iccom_tx_message *msg)
+{
+	list_del(&msg->list_anchor);
+	kfree(msg->data);
+	msg->data = NULL;
+	kfree(msg);
 }
 
-// Frees whole TX queue (should be called only on ICCom
-// destruction when all external calls which might modify the
-// TX queue are already disabled).
-static void __iccom_queue_free(struct iccom_dev *iccom)
+// Helper. Releases the given number of consumer data bytes from the
+// TX queue (see @tx_queued_bytes) and wakes up the consumers waiting
+// for the room in TX queue.
+//
+// CONCURRENCE: thread safe
+static inline void __iccom_tx_release_bytes(struct iccom_dev *iccom
+					    , const size_t bytes)
 {
-#ifdef ICCOM_DEBUG
-	if (!__iccom_have_packages(iccom)) {
-	    iccom_err("empty TX packages");
+	if (!bytes) {
+		return;
 	}
-#endif
-	mutex_lock(&iccom->p->tx_queue_lock);
+	atomic_sub((int)bytes, &iccom->p->tx_queued_bytes);
+	wake_up_interruptible(&iccom->p->tx_space_wait);
+}
 
-	struct iccom_package *first_package
-		    = __iccom_get_first_tx_package(iccom);
+// Helper. Checks if the TX queue has the room for @length bytes of
+// consumer data.
+//
+// CONCURRENCE: thread safe
+static inline bool __iccom_tx_has_space(struct iccom_dev *iccom
+					, const size_t length)
+{
+	const size_t queued
+		= (size_t)atomic_read(&iccom->p->tx_queued_bytes);
+	return queued == 0
+	       || queued + length <= (size_t)READ_ONCE(tx_queue_max_bytes);
+}
 
-	while (first_package) {
-	    __iccom_package_free(first_package);
-	    first_package = __iccom_get_first_tx_package(iccom);
+// Helper. Looks for the TX channel record of the given channel.
+//
+// LOCKING: TX queue should be locked before this call
+//
+// RETURNS:
+//      !NULL: the TX channel record
+//      NULL: if there is no record for the channel
+static struct iccom_tx_channel *__iccom_tx_find_channel(
+		struct iccom_dev *iccom, const unsigned int channel)
+{
+	struct iccom_tx_channel *ch;
+	list_for_each_entry(ch, &iccom->p->tx_channels, all_anchor) {
+		if (ch->channel == channel) {
+			return ch;
+		}
 	}
-
-	// freeing the TX queue access
-	mutex_unlock(&iccom->p->tx_queue_lock);
-
-	mutex_destroy(&iccom->p->tx_queue_lock);
+	return NULL;
 }
 
-// Helper. Enqueues given message into the queue. Adds as many
-// packages as needed.
+// Helper. Returns the TX channel record of the given channel, creates
+// the new one with default scheduling parameters if there is no record
+// for the channel yet.
 //
-// CONCURRENCE: thread safe
+// LOCKING: TX queue should be locked before this call
 //
 // RETURNS:
-//      < 0 : the negated error number
-//      0   : success
-static int __iccom_queue_append_message(struct iccom_dev *iccom
-			       , char *data, const size_t length
-			       , unsigned int channel
-			       , unsigned int priority)
+//      !NULL: the TX channel record
+//      NULL: if no memory
+static struct iccom_tx_channel *__iccom_tx_get_channel(
+		struct iccom_dev *iccom, const unsigned int channel)
 {
-#ifdef ICCOM_DEBUG
-	ICCOM_CHECK_DEVICE("", return -ENODEV);
-	ICCOM_CHECK_CHANNEL("", return -EBADSLT);
-	if (IS_ERR_OR_NULL(data)) {
-		iccom_err("bad data pointer");
-		return -EINVAL;
+	struct iccom_tx_channel *ch = __iccom_tx_find_channel(iccom, channel);
+	if (ch) {
+		return ch;
 	}
-	if (!length) {
-		iccom_err("bad data length");
-		return -ENODATA;
+
+	ch = kmalloc(sizeof(*ch), GFP_KERNEL);
+	if (!ch) {
+		iccom_err("no memory for new TX channel record");
+		return NULL;
 	}
-	if (!__iccom_have_packages(iccom)) {
-		iccom_err("empty TX packages: logical error");
-		return -EFAULT;
+	memset(ch, 0, sizeof(*ch));
+	for (int lvl = 0; lvl < ICCOM_TX_PRIORITY_LEVELS_COUNT; lvl++) {
+		INIT_LIST_HEAD(&ch->sched_anchor[lvl]);
+		INIT_LIST_HEAD(&ch->messages[lvl]);
 	}
-#endif
+	ch->channel = channel;
+	ch->weight = ICCOM_TX_CHANNEL_DEFAULT_WEIGHT;
 
-	int bytes_written = 0;
-	struct iccom_package *dst_package = NULL;
-	int res = 0;
+	list_add_tail(&ch->all_anchor, &iccom->p->tx_channels);
+	return ch;
+}
 
-	mutex_lock(&iccom->p->tx_queue_lock);
-	// we will assume the first package to be in active xfer
-	// (however there might be some IDLE pause between xfers)
-	// so if only one package left we will simply add a brand
-	// new one
-	if (!__iccom_have_multiple_packages(iccom)) {
-		// TODO: we can consider to update first package
-		// if its xfer have not yet began, to do this we need
-		// to create its updated memory in separate place,
-		// and then try to update the xfer data on transport
-		// layer device, and if succeeded, then we may put
-		// this data into the first package.
-		res = __iccom_enqueue_new_tx_data_package(iccom);
-		if (res < 0) {
-			iccom_err("Could not post message: err %d", res);
-			goto finalize;
+// Helper. Returns the TX statistics record of the given channel,
+// creates the new one if there is no record for the channel yet.
+//
+// LOCKING: TX queue should be locked before this call
+//
+// RETURNS:
+//      !NULL: the TX statistics record
+//      NULL: if no memory
+static struct iccom_tx_stats *__iccom_tx_get_stats(
+		struct iccom_dev *iccom, const unsigned int channel)
+{
+	struct iccom_tx_stats *stats;
+
+	list_for_each_entry(stats, &iccom->p->tx_stats, anchor) {
+		if (stats->channel == channel) {
+			return stats;
 		}
 	}
 
-	while (length > bytes_written) {
-		dst_package = __iccom_get_last_tx_package(iccom);
+	stats = kmalloc(sizeof(*stats), GFP_KERNEL);
+	if (!stats) {
+		iccom_err("no memory for new TX statistics record");
+		return NULL;
+	}
+	memset(stats, 0, sizeof(*stats));
+	stats->channel = channel;
 
-		// adding message part (or whole) to the latest package
-		int bytes_written_old = bytes_written;
-		bytes_written += iccom_package_add_packet(
-					 dst_package
-					 , data + bytes_written
-					 , length - bytes_written
-					 , channel);
+	list_add_tail(&stats->anchor, &iccom->p->tx_stats);
+	return stats;
+}
 
-		// some bytes were written to the package
-		if (bytes_written != bytes_written_old) {
-			continue;
+// Helper. Returns the highest TX priority level the channel has
+// pending messages at.
+//
+// LOCKING: TX queue should be locked before this call
+//
+// RETURNS:
+//      >= 0: the highest TX priority level with pending messages
+//      < 0: if the channel has no pending messages
+static int __iccom_tx_channel_top_level(const struct iccom_tx_channel *ch)
+{
+	for (int lvl = ICCOM_TX_PRIORITY_LEVELS_COUNT - 1; lvl >= 0; lvl--) {
+		if (!list_empty(&ch->messages[lvl])) {
+			return lvl;
 		}
+	}
+	return -1;
+}
 
-		// last package in queue already has no space
-		res = __iccom_enqueue_new_tx_data_package(iccom);
-		if (res < 0) {
-			// TODO make robust previous packages
-			//      cleanup here to remove parts of
-			//      failed message.
-			iccom_err("Could not post message: err %d"
-				  , res);
-			goto finalize;
-		}
+// Helper. Frees the TX channel record if it has neither pending
+// messages nor non-default scheduling parameters, so the records
+// of the channels which were used only once don't pile up.
+//
+// LOCKING: TX queue should be locked before this call
+static void __iccom_tx_channel_collect(struct iccom_tx_channel *ch)
+{
+	if (__iccom_tx_channel_top_level(ch) >= 0
+			|| ch->weight != ICCOM_TX_CHANNEL_DEFAULT_WEIGHT
+			|| ch->min_rate_bps != 0) {
+		return;
 	}
+	list_del(&ch->all_anchor);
+	kfree(ch);
+}
 
-	// we will always finalize package to make it always be ready
-	// for sending, however this doesn't mean that we can not add
-	// more data to the finalized but not full package later
-	__iccom_package_finalize(dst_package);
+// Helper. Puts the channel into the active channels list of the given
+// TX priority level, if it has pending messages of the level and is
+// not there yet. Nothing is done while the channel is held at the
+// level of its partially written message (see @sending).
+//
+// LOCKING: TX queue should be locked before this call
+static void __iccom_tx_channel_activate(struct iccom_dev *iccom
+					, struct iccom_tx_channel *ch
+					, const int level)
+{
+	if (list_empty(&ch->messages[level])
+	    || !list_empty(&ch->sched_anchor[level])
+	    || (ch->sending && ch->sending->level != level)) {
+		return;
+	}
 
-finalize:
-	mutex_unlock(&iccom->p->tx_queue_lock);
-	return res;
+	ch->deficit[level] = ch->weight * ICCOM_TX_CHANNEL_QUANTUM_BYTES;
+	list_add_tail(&ch->sched_anchor[level]
+		      , &iccom->p->tx_active_channels[level]);
 }
 
-// Helper. Adds new message to the storage channel. If channel does
-// not exist, creates it. Returns pointer to newly created message.
+// Helper. Removes the channel from the active channels list of the
+// given TX priority level.
 //
-// @iccom {valid iccom pointer}
-// @channel {valid channel number} the channel to add the new message
-//
-// CONCURRENCE: thread safe
-// OWNERSHIP: of the new message belongs to the storage
+// LOCKING: TX queue should be locked before this call
+static inline void __iccom_tx_channel_deactivate(
+		struct iccom_tx_channel *ch, const int level)
+{
+	list_del_init(&ch->sched_anchor[level]);
+	ch->deficit[level] = 0;
+}
+
+// Helper. Holds the channel at the level of the given message, which
+// was just partially written into the TX package: the other levels
+// of the channel are deactivated until the message is written
+// completely, so the message parts are not interleaved with other
+// messages of the channel.
 //
-// RETURNS:
-//      !NULL: valid pointer to newly created and initialized
-//          iccom_message
-//      NULL: if fails
-static struct iccom_message *__iccom_construct_message_in_storage(
-		struct iccom_dev *iccom
-		, unsigned int channel)
+// LOCKING: TX queue should be locked before this call
+static void __iccom_tx_channel_hold(struct iccom_tx_channel *ch
+				    , struct iccom_tx_message *msg)
 {
-	struct iccom_message *msg;
-	msg = kmalloc(sizeof(struct iccom_message), GFP_KERNEL);
-	if (IS_ERR_OR_NULL(msg)) {
-		iccom_err("No memory for new message");
-		return NULL;
+	if (ch->sending) {
+		return;
 	}
-	// TODO: allocate either the message maximum or expected
-	// (if known) size to avoid reallocation
-	__iccom_message_init(msg);
-	msg->channel = channel;
-
-	if (iccom_msg_storage_push_message(&iccom->p->rx_messages
-					   , msg) != 0) {
-		kfree(msg);
-		return NULL;
+	ch->sending = msg;
+	for (int lvl = 0; lvl < ICCOM_TX_PRIORITY_LEVELS_COUNT; lvl++) {
+		if (lvl != msg->level) {
+			__iccom_tx_channel_deactivate(ch, lvl);
+		}
 	}
-	return msg;
 }
 
-// Helper. Parses the next packet from the package. Starts at given
-// position and if parsing is successful adds the parsed consumer data
-// into the iccom consumer messages storage.
-//
-// @iccom {valid iccom ptr}
-// @start_from {valid ptr} the pointer to the first packet byte
-//      (first byte of packet header)
-// @max_bytes_available the maximum possible total packet size (in
-//      bytes), this is usually equal to the number of bytes left till
-//      the end of the package payload area.
-//      NOTE: any value less than minimal possible packet size
-//          immediately will lead to parsing error.
-// @consumer_bytes_count__out {NULL | valid ptr}: pointer to the
-//      output variable where to ADD number of consumer bytes
-//      parced from the packet. If not valid ptr - not used.
-// @finalized_message__out {NULL | valid ptr}: pointer to the
-//      output variable where to WRITE, if the message was just
-//      finalized. If not valid ptr - not used.
+// Helper. Releases the channel hold (see __iccom_tx_channel_hold) if
+// any and activates the channel at every level it has pending messages
+// of.
 //
-// NOTE: if parsing of a packet failed, then all rest packets from
-//      given package will be dropped, as long as the parsing
-//      will be unreliable.
+// LOCKING: TX queue should be locked before this call
+static void __iccom_tx_channel_release(struct iccom_dev *iccom
+				       , struct iccom_tx_channel *ch)
+{
+	ch->sending = NULL;
+	for (int lvl = 0; lvl < ICCOM_TX_PRIORITY_LEVELS_COUNT; lvl++) {
+		__iccom_tx_channel_activate(iccom, ch, lvl);
+	}
+}
+
+// Helper. Refills the guaranteed minimal rate token bucket of the
+// channel according to the time passed since last refill.
 //
-// CONCURRENCE: no simultaneous calls allowed, but finalized messages
-//      storage can be read by consumer freely
+// NOTE: the tokens are kept in bytes * NSEC_PER_SEC units to avoid
+//      the rounding losses on frequent refills.
 //
-// RETURNS:
-//      >0: size of data read from the start (equals to the size of the
-//          package which was read (in bytes)), this also means that
-//          parsing of the packet was successful.
-//       0: caller provided 0 bytes available, so nothing left to parse
-//      <0: negative error number if parsing failed
-static int __iccom_read_next_packet(struct iccom_dev __kernel *iccom
-	, void __kernel *start_from
-	, size_t max_bytes_available
-	, size_t *consumer_bytes_count__out
-	, bool *finalized_message__out)
+// LOCKING: TX queue should be locked before this call
+static void __iccom_tx_channel_refill(struct iccom_tx_channel *ch
+				      , const s64 now_ns)
 {
-#ifdef ICCOM_DEBUG
-	ICCOM_CHECK_DEVICE("", return -ENODEV);
-	ICCOM_CHECK_DEVICE_PRIVATE("", return -EINVAL);
-	ICCOM_CHECK_PTR(start_from, return -EINVAL);
-#endif
-	if (max_bytes_available == 0) {
-		return 0;
-	}
+	const s64 max_burst_ns
+		= (s64)ICCOM_TX_MIN_RATE_BURST_MSEC * NSEC_PER_MSEC;
+	s64 elapsed_ns = now_ns - ch->rate_last_refill_ns;
 
-	struct iccom_packet packet;
-	int res = __iccom_packet_parse_into_struct(start_from
-				    , max_bytes_available, &packet);
-	if (res < 0) {
-		iccom_err("Broken packet detected.");
-		return res;
+	ch->rate_last_refill_ns = now_ns;
+	if (elapsed_ns <= 0) {
+		return;
+	}
+	if (elapsed_ns > max_burst_ns) {
+		elapsed_ns = max_burst_ns;
 	}
 
-	// while message id is not used we always append data to the
-	// latest message within the channel
-	// TODO: adapt as protocol includes message ID
-	struct iccom_message *msg
-			= iccom_msg_storage_get_last_unfinalized_message(
-					    &iccom->p->rx_messages
-					    , packet.channel);
+	ch->rate_tokens += (s64)ch->min_rate_bps * elapsed_ns;
+	if (ch->rate_tokens > (s64)ch->min_rate_bps * max_burst_ns) {
+		ch->rate_tokens = (s64)ch->min_rate_bps * max_burst_ns;
+	}
+}
 
-	if (!msg) {
-		msg = __iccom_construct_message_in_storage(
-				iccom, packet.channel);
-		if (!msg) {
-			iccom_err("No memory for incoming message.");
-			return -ENOMEM;
+// Helper. Selects the TX priority level to take the next portion of
+// the data from according to the TX scheduling policy (see
+// ICCOM_TX_SCHEDULING).
+//
+// LOCKING: TX queue should be locked before this call
+//
+// RETURNS:
+//      >= 0: the TX priority level to take the data from
+//      < 0: if there is no pending TX messages at all
+static int __iccom_tx_sched_select_level(struct iccom_dev *iccom)
+{
+#if ICCOM_TX_SCHEDULING_MATCH(STRICT)
+	for (int lvl = ICCOM_TX_PRIORITY_LEVELS_COUNT - 1; lvl >= 0; lvl--) {
+		if (!list_empty(&iccom->p->tx_active_channels[lvl])) {
+			return lvl;
 		}
 	}
+	return -1;
+#elif ICCOM_TX_SCHEDULING_MATCH(WEIGHTED)
+	struct iccom_dev_private *p = iccom->p;
 
-	res = iccom_msg_storage_append_data_to_message(
-		    &iccom->p->rx_messages, msg->channel, msg->id
-		    , packet.payload, packet.payload_length
-		    , packet.finalizing);
+	// one full round gives the quantum to every level, so if we
+	// still didn't find the level after it, then there is no data
+	for (int i = 0; i <= ICCOM_TX_PRIORITY_LEVELS_COUNT; i++) {
+		const int lvl = p->tx_sched_cursor;
 
-	if (res < 0) {
-		return res;
-	}
-	if (!IS_ERR_OR_NULL(consumer_bytes_count__out)) {
-		*consumer_bytes_count__out = packet.payload_length;
-	}
-	if (!IS_ERR_OR_NULL(finalized_message__out)) {
-		*finalized_message__out = packet.finalizing;
-	}
+		if (list_empty(&p->tx_active_channels[lvl])) {
+			// idle levels don't accumulate the credit
+			p->tx_sched_deficit[lvl] = 0;
+		} else if (p->tx_sched_deficit[lvl] > 0) {
+			return lvl;
+		}
 
-	return iccom_packet_packet_size_bytes(packet.payload_length);
+		// the level has spent its share: passing the turn to
+		// the next (lower) level, wrapping around
+		const int next = (lvl == 0) ? ICCOM_TX_PRIORITY_LEVELS_COUNT - 1
+					    : lvl - 1;
+		p->tx_sched_cursor = next;
+		p->tx_sched_deficit[next] += iccom_tx_sched_level_weights[next]
+					     * ICCOM_TX_SCHED_QUANTUM_BYTES;
+	}
+	return -1;
+#else
+#error no known ICCom TX scheduling policy defined
+#endif
 }
 
-// Helper. Full parsing of the package and dispatching all its packets
-// to the consumer messages storage.
+// Helper. Selects the TX channel to take the next portion of the
+// data from.
 //
-// @iccom {valid iccom ptr}
-// @start_from {valid ptr} to the first byte of the package
-//      payload.
-// @payload_size {>=0} the exact size of the package payload in bytes
+// The channels which are behind their guaranteed minimal rate are
+// served first (regardless of their priority level). Then the TX
+// priority level is selected according to the TX scheduling policy
+// (see __iccom_tx_sched_select_level) and the active channels of
+// the level are served in the deficit round robin manner according
+// to their weights.
 //
-// Rolls back the applied changes from the package if parsing
-// fails at some point. So the message storage is guaranteed to
-// remain in selfconsistent state: either whole package is
-// applied or whole package is not applied.
+// @guaranteed__out {valid ptr} is set to true if the channel was
+//      selected to catch up its guaranteed minimal rate, to false
+//      else.
+// @level__out {valid ptr} is set to the TX priority level of the
+//      channel to take the message from.
 //
-// To be called directly or indirectly by transport layer.
-//
-// CONCURRENCE: no simultaneous calls allowed, protected
-//      async reading of finalized messages is OK.
+// LOCKING: TX queue should be locked before this call
 //
 // RETURNS:
-//      0: on successful parsing of the whole package
-//      -EBADMSG: if parsing failed (also due to out-of-memory conditions)
-static int __iccom_process_package_payload(
-		struct iccom_dev __kernel *iccom
-		, void __kernel *start_from
-		, size_t payload_size)
+//      !NULL: the channel to take the data from
+//      NULL: if there is no pending TX messages at all
+static struct iccom_tx_channel *__iccom_tx_sched_select_channel(
+		struct iccom_dev *iccom, bool *guaranteed__out
+		, int *level__out)
 {
-	int packets_done = 0;
-	size_t bytes_to_parse = payload_size;
-	void *start = start_from;
-	size_t consumer_bytes_parsed_total = 0;
+	struct iccom_dev_private *p = iccom->p;
+	struct iccom_tx_channel *ch;
 
-	while (bytes_to_parse > 0) {
-		int bytes_read = __iccom_read_next_packet(iccom
-					    , start, bytes_to_parse
-					    , &consumer_bytes_parsed_total
-					    , NULL);
-		if (bytes_read <= 0) {
-			iccom_msg_storage_rollback(&iccom->p->rx_messages);
-			iccom_err("Package parsing failed on %d packet"
-				  "(starting from 0). Error code: %d"
-				  , packets_done, bytes_read);
-			print_hex_dump(KERN_WARNING, ICCOM_LOG_PREFIX
-				       ": Failed package payload: ", 0, 16, 1
-				       , start_from, payload_size, true);
-			// NOTE: the no-memory case is aggregated here also
-			// 	to ask other size to resend the message
-			return -EBADMSG;
-		}
+	if (p->tx_min_rate_channels_count > 0) {
+		const s64 now_ns = ktime_to_ns(ktime_get());
 
-		start += bytes_read;
-		bytes_to_parse -= bytes_read;
-		packets_done++;
+		list_for_each_entry(ch, &p->tx_channels, all_anchor) {
+			if (ch->min_rate_bps == 0) {
+				continue;
+			}
+			__iccom_tx_channel_refill(ch, now_ns);
+			const int top = ch->sending ? ch->sending->level
+					: __iccom_tx_channel_top_level(ch);
+			if (top >= 0 && ch->rate_tokens > 0) {
+				*guaranteed__out = true;
+				*level__out = top;
+				return ch;
+			}
+		}
 	}
 
-	int finalized = iccom_msg_storage_uncommitted_finalized_count(
-				&iccom->p->rx_messages);
-	iccom_msg_storage_commit(&iccom->p->rx_messages);
+	*guaranteed__out = false;
 
-	iccom->p->statistics.packets_received_ok += packets_done;
-	iccom->p->statistics.messages_received_ok += finalized;
-	iccom->p->statistics.total_consumers_bytes_received_ok
-			+= consumer_bytes_parsed_total;
-	__sync_add_and_fetch(
-			&iccom->p->statistics.messages_ready_in_storage
-			, finalized);
+	const int lvl = __iccom_tx_sched_select_level(iccom);
+	if (lvl < 0) {
+		return NULL;
+	}
+	*level__out = lvl;
 
-	if (finalized > 0) {
-		// notify consumer if there is any new ready messages
-		__iccom_schedule_work(iccom
-				, &iccom->p->consumer_delivery_work);
+	// every pass gives the quantum to the heading channel, and
+	// weights are > 0, so some channel surely gets positive deficit
+	struct list_head *const active = &p->tx_active_channels[lvl];
+	while (true) {
+		ch = container_of(active->next, struct iccom_tx_channel
+				  , sched_anchor[lvl]);
+		if (ch->deficit[lvl] > 0) {
+			return ch;
+		}
+		ch->deficit[lvl] += ch->weight * ICCOM_TX_CHANNEL_QUANTUM_BYTES;
+		list_move_tail(&ch->sched_anchor[lvl], active);
 	}
-	return 0;
 }
 
-// Helper. Initiates the xfer of the first package in TX queue using
-// the underlying transport layer. We must have finalized data package
-// in TX queue before calling this function.
+// Helper. Charges the TX scheduler for the package room the channel
+// has just used at the given TX priority level.
 //
-// NOTE: if the underlying transport is busy, then we will not shedule
-//      xfer here, but in xfer-done callback.
+// @guaranteed if true, then the room was used to catch up the
+//      channel guaranteed minimal rate, so only the rate token bucket
+//      is charged.
 //
-// RETURNS:
-//      0 on success
-//      < 0 - the negative error code
-static int __iccom_initiate_data_xfer(struct iccom_dev *iccom)
+// LOCKING: TX queue should be locked before this call
+static inline void __iccom_tx_sched_charge(struct iccom_dev *iccom
+					   , struct iccom_tx_channel *ch
+					   , const int level
+					   , const bool guaranteed
+					   , const size_t bytes)
 {
-#ifdef ICCOM_DEBUG
-	ICCOM_CHECK_DEVICE("", return -ENODEV);
-	ICCOM_CHECK_DEVICE_PRIVATE("", return -EINVAL);
-#endif
-	if (!__iccom_have_packages(iccom)) {
-		iccom_err("No data to be sent.");
-		return -ENODATA;
+	if (guaranteed) {
+		ch->rate_tokens -= (s64)bytes * NSEC_PER_SEC;
+		return;
 	}
+	ch->deficit[level] -= (int)bytes;
+#if ICCOM_TX_SCHEDULING_MATCH(WEIGHTED)
+	iccom->p->tx_sched_deficit[level] -= (int)bytes;
+#else
+	(void)iccom;
+#endif
+}
 
-	// to guarantee selfconsistence, we will just trigger
-	// current xfer, while the xfer data is only to be updated
-	// from the xfer done callback, the xfer done callback is
-	// guaranteed to be called after data_xchange(...) invocation
-	int res = iccom->xfer_iface.data_xchange(
-			iccom->xfer_device, NULL, false);
+// Helper. Traces the TX queue depth (if the trace event is enabled).
+//
+// LOCKING: TX queue should be locked before this call
+static void __iccom_trace_tx_queue(struct iccom_dev *iccom)
+{
+	if (!trace_iccom_tx_queue_enabled()) {
+		return;
+	}
 
-	switch (res) {
-	case FULL_DUPLEX_ERROR_NOT_READY:
-		return 0;
-	case FULL_DUPLEX_ERROR_NO_DEVICE_PROVIDED:
-		iccom_err("No underlying xfer device provided");
-		return -ENODEV;
-	default: return 0;
+	unsigned long messages = 0;
+	for (int lvl = 0; lvl < ICCOM_TX_PRIORITY_LEVELS_COUNT; lvl++) {
+		messages += iccom->p->tx_level_stats[lvl].messages_pending;
 	}
+	trace_iccom_tx_queue(messages);
 }
 
-
-// Transport layer return point.
-//
-// Called from transport layer, when xfer failed. Dedicated
-// to handle supervised error recovery or halting xfer device.
+// Helper. Puts all messages posted by the consumers so far into their
+// TX channels queues of the messages priority levels (see
+// @tx_submitted), in order of posting, and activates the channels at
+// these levels (see __iccom_queue_append_message).
 //
-// See full_duplex_xfer.fail_callback description for details.
+// NOTE: the message is already accepted, so if its TX channel record
+//      can't be allocated, then the message (and all messages posted
+//      after it) waits in @tx_unresolved for the next call.
 //
-// CONCURRENCE: no simultaneous calls, also with other
-//      transport layer return points
-struct full_duplex_xfer *__iccom_xfer_failed_callback(
-		const struct full_duplex_xfer __kernel *failed_xfer
-		, const int next_xfer_id
-		, int error_code
-		, void __kernel *consumer_data)
+// LOCKING: TX queue should be locked before this call
+static void __iccom_queue_take_submitted(struct iccom_dev *iccom)
 {
-	// The xfer failed
-
-	struct iccom_dev *iccom = (struct iccom_dev *)consumer_data;
-	ICCOM_CHECK_DEVICE("External error. No device provided."
-			   , return ERR_PTR(-ENODATA));
-	// if we are closing, then we will halt bottom transport layer
-	// by returning error pointer value
-	ICCOM_CHECK_CLOSING("will not invoke", return ERR_PTR(-ENODATA));
+	struct llist_node *first = llist_del_all(&iccom->p->tx_submitted);
+	struct iccom_tx_message *msg;
+	struct iccom_tx_message *tmp;
 
-	iccom_info(ICCOM_LOG_INFO_DBG_LEVEL, "FAILED xfer:");
-	iccom_dbg_printout_xfer(failed_xfer);
-	iccom_info(ICCOM_LOG_INFO_DBG_LEVEL, "TX queue:");
-	iccom_dbg_printout_tx_queue(iccom
-				, ICCOM_DEBUG_PACKAGES_PRINT_MAX_COUNT);
+	// the submission queue is LIFO
+	first = llist_reverse_order(first);
+	llist_for_each_entry_safe(msg, tmp, first, submit_anchor) {
+		list_add_tail(&msg->list_anchor, &iccom->p->tx_unresolved);
+	}
 
-	__iccom_err_report(ICCOM_ERROR_TRANSPORT, error_code);
+	if (list_empty(&iccom->p->tx_unresolved)) {
+		return;
+	}
 
-	// we always goto ack stage with NACK package
-	// and then repeat the data xfer within the next frame.
-	__iccom_fillup_ack_xfer(iccom, &iccom->p->xfer, false);
-	iccom->p->data_xfer_stage = false;
+	list_for_each_entry_safe(msg, tmp, &iccom->p->tx_unresolved
+				 , list_anchor) {
+		const int level = msg->level;
+		struct iccom_tx_channel *ch
+			= __iccom_tx_get_channel(iccom, msg->channel);
+		if (!ch) {
+			iccom_warning("no memory for TX channel %u, will"
+				      " retry", msg->channel);
+			break;
+		}
+		struct iccom_tx_stats *stats
+			= __iccom_tx_get_stats(iccom, msg->channel);
+		list_move_tail(&msg->list_anchor, &ch->messages[level]);
+		__iccom_tx_channel_activate(iccom, ch, level);
+		ICCOM_STATS_INC(iccom->p, messages_in_tx_queue);
+		if (stats) {
+			stats->messages_pending++;
+		}
+		iccom->p->tx_level_stats[level].messages_pending++;
+	}
 
-	iccom_info(ICCOM_LOG_INFO_DBG_LEVEL, "Next xfer:");
-	iccom_dbg_printout_xfer(&iccom->p->xfer);
-	return &iccom->p->xfer;
+	__iccom_trace_tx_queue(iccom);
 }
 
-// Transport layer return point.
+// Helper. Writes our link offer records into the given empty package,
+// if we are negotiating the link now (and don't hold off the
+// renegotiation after the link fallback).
 //
-// CONCURRENCE: no simultaneous calls
+// @package {valid ptr to empty package}
 //
-// Called from transport layer, when xfer is done.
-struct full_duplex_xfer *__iccom_xfer_done_callback(
-			const struct full_duplex_xfer __kernel *done_xfer
-			, const int next_xfer_id
-			, bool __kernel *start_immediately__out
-			, void *consumer_data)
+// LOCKING: TX queue should be locked before this call
+static void __iccom_link_add_offer(struct iccom_dev *iccom
+				   , struct iccom_package *package)
 {
-	// The xfer was just finished. The done_xfer.data_rx_buf contains
-	// the received data.
+	package->carries_link_offer = false;
 
-	struct iccom_dev *iccom = (struct iccom_dev *)consumer_data;
-	ICCOM_CHECK_DEVICE("External error. No device provided."
-			   , return ERR_PTR(-ENODATA));
-	// if we are closing, then we will halt bottom transport layer
-	// by returning error pointer value
-	ICCOM_CHECK_CLOSING("will not invoke", return ERR_PTR(-ENODATA));
-
-	// convenience wrappers around done_xfer.data_tx/rx_buf
-	struct iccom_package rx_pkg = {.data = done_xfer->data_rx_buf
-				       , .size = done_xfer->size_bytes
-				       , .owns_data = false};
-	if (IS_ERR_OR_NULL(rx_pkg.data)) {
-		iccom_err("got broken RX data pointer: %px; "
-			  , rx_pkg.data);
-		return ERR_PTR(-ENODATA);
+	if (!ICCOM_LINK_NEGOTIATION
+	    || iccom->p->link_state != ICCOM_LINK_NEGOTIATING
+	    || iccom->p->link_holdoff_frames > 0) {
+		return;
 	}
 
-	iccom_info(ICCOM_LOG_INFO_DBG_LEVEL, "Done xfer:");
-	iccom_dbg_printout_xfer(done_xfer);
-	iccom_info(ICCOM_LOG_INFO_DBG_LEVEL, "TX queue:");
-	iccom_dbg_printout_tx_queue(iccom
-			, ICCOM_DEBUG_PACKAGES_PRINT_MAX_COUNT);
-
-	iccom->p->statistics.raw_bytes_xfered_via_transport_layer
-		    += done_xfer->size_bytes;
-	iccom->p->statistics.transport_layer_xfers_done_count++;
-
-	// If we are in data xfering stage, thus the data xfer has been
-	// just finished, so we need to verify it and send the ack/nack
-	// answer back. TODO: later we may indicate the CRC failure with
-	// other side drop flag timeout so we'll need no ack/nack xfers
-	// at all.
-	if (iccom->p->data_xfer_stage) {
-		iccom->p->statistics.packages_xfered++;
-
-		*start_immediately__out = true;
+	const size_t max_pkg_size = iccom->p->link_max_pkg_size;
+
+	char rec[ICCOM_TECH_REC_HEADER_SIZE_BYTES
+		 + ICCOM_TECH_REC_PKG_SIZE_OFFER_SIZE_BYTES
+		 + ICCOM_TECH_REC_HEADER_SIZE_BYTES
+		 + ICCOM_TECH_REC_FEATURES_OFFER_SIZE_BYTES
+		 + ICCOM_TECH_REC_HEADER_SIZE_BYTES
+		 + ICCOM_TECH_REC_WINDOW_OFFER_SIZE_BYTES
+		 + ICCOM_TECH_REC_HEADER_SIZE_BYTES
+		 + ICCOM_TECH_REC_BATCH_OFFER_SIZE_BYTES];
+	rec[0] = ICCOM_TECH_REC_PKG_SIZE_OFFER;
+	rec[1] = ICCOM_TECH_REC_PKG_SIZE_OFFER_SIZE_BYTES;
+	rec[2] = (char)((max_pkg_size >> 8) & 0xFF);
+	rec[3] = (char)(max_pkg_size & 0xFF);
+	rec[4] = ICCOM_TECH_REC_FEATURES_OFFER;
+	rec[5] = ICCOM_TECH_REC_FEATURES_OFFER_SIZE_BYTES;
+	rec[6] = (char)ICCOM_LINK_OUR_FEATURES;
+	rec[7] = ICCOM_TECH_REC_WINDOW_OFFER;
+	rec[8] = ICCOM_TECH_REC_WINDOW_OFFER_SIZE_BYTES;
+	rec[9] = (char)ICCOM_PB_WINDOW_PACKAGES;
+	rec[10] = ICCOM_TECH_REC_BATCH_OFFER;
+	rec[11] = ICCOM_TECH_REC_BATCH_OFFER_SIZE_BYTES;
+	rec[12] = (char)ICCOM_PB_BATCH_PACKAGES;
+
+	package->carries_link_offer
+		= iccom_package_add_packet(package, rec, sizeof(rec)
+					   , ICCOM_TECHNICAL_CHANNEL_ID)
+		  == sizeof(rec);
+}
 
-		int payload_size = __iccom_verify_package_data(&rx_pkg);
+// Helper. Writes the piggyback ack record packet into the given empty
+// package, if piggyback acks are used now. The ack value is set by
+// __iccom_package_set_ack later.
+//
+// @package {valid ptr to empty package}
+//
+// LOCKING: TX queue should be locked before this call
+static void __iccom_link_add_ack(struct iccom_dev *iccom
+				 , struct iccom_package *package)
+{
+	if (!(iccom->p->link_features & ICCOM_LINK_FEATURE_ACK_PIGGYBACK)) {
+		return;
+	}
 
-		// if package level data is not selfconsistent
-		if (payload_size < 0) {
-			__iccom_fillup_ack_xfer(iccom, &iccom->p->xfer, false);
-			iccom->p->statistics.packages_bad_data_received += 1;
-			goto finalize;
-		}
+	char rec[ICCOM_TECH_REC_HEADER_SIZE_BYTES
+		 + ICCOM_TECH_REC_ACK_SIZE_BYTES];
+	rec[0] = ICCOM_TECH_REC_ACK;
+	rec[1] = ICCOM_TECH_REC_ACK_SIZE_BYTES;
+	rec[2] = 0;
+	rec[3] = 0;
 
-		// package is selfconsistent, but we already received
-		// and processed it successfully, then we will say that
-		// this package is (already) OK
-		int rx_pkg_id = __iccom_package_get_id(&rx_pkg);
-		if (rx_pkg_id == iccom->p->last_rx_package_id) {
-			__iccom_fillup_ack_xfer(iccom, &iccom->p->xfer, true);
-			iccom->p->statistics.packages_duplicated_received += 1;
-			goto finalize;
-		}
+	iccom_package_add_packet(package, rec, sizeof(rec)
+				 , ICCOM_TECHNICAL_CHANNEL_ID);
+}
 
-		// package is selfconsistent and we have not processed it
-		// yet, so we'll try to process it
-		void *pkg_payload = __iccom_package_payload_start_addr(&rx_pkg);
-		if (__iccom_process_package_payload(iccom, pkg_payload
-					  , (size_t)payload_size) != 0) {
-			__iccom_fillup_ack_xfer(iccom, &iccom->p->xfer, false);
-			iccom->p->statistics.packages_parsing_failed += 1;
-			goto finalize;
-		}
+// Helper. Returns the pointer to the value of the technical record
+// which comes in the dedicated first packet of the package, if the
+// package has one.
+//
+// @package {valid ptr to package with verified payload size}
+// @rec_type the ICCOM_TECH_REC_* record type
+// @rec_size the record value size in bytes
+//
+// RETURNS:
+//      the record value pointer: if package has the record
+//      NULL: else
+static uint8_t *__iccom_package_first_rec_addr(
+		struct iccom_package *package
+		, const uint8_t rec_type, const size_t rec_size)
+{
+	const size_t packet_size = ICCOM_PACKET_HEADER_SIZE_BYTES
+				   + ICCOM_TECH_REC_HEADER_SIZE_BYTES
+				   + rec_size;
 
-		// package parsing was OK
-		iccom->p->statistics.packages_received_ok++;
-		iccom->p->last_rx_package_id = rx_pkg_id;
-		__iccom_fillup_ack_xfer(iccom, &iccom->p->xfer, true);
-		goto finalize;
+	if (__iccom_package_payload_size(package, NULL) < packet_size) {
+		return NULL;
 	}
 
-	// If we are in ack stage, then we have just finished the
-	// ack xfer and can goto to the next frame (using old or
-	// new data depending on the ack state of the other side).
+	struct iccom_packet packet;
+	if (__iccom_packet_parse_into_struct(
+			__iccom_package_payload_start_addr(package)
+			, packet_size, &packet) < 0) {
+		return NULL;
+	}
 
-	// If other side acked the correct receiving of our data
-	if (__iccom_verify_ack(&rx_pkg)) {
-		iccom->p->statistics.packages_sent_ok++;
-		// TODO to schedule only if at least one message finalized
-		*start_immediately__out = __iccom_queue_step_forward(iccom);
-	} else {
-		// We must resend the failed package immediately.
-		// TODO: probably we may avoid resending the empty
-		//      package if new packages arrived in TX queue.
-		*start_immediately__out = true;
+	uint8_t *rec = (uint8_t *)packet.payload;
+	if (packet.channel != ICCOM_TECHNICAL_CHANNEL_ID
+	    || packet.payload_length != ICCOM_TECH_REC_HEADER_SIZE_BYTES
+					+ rec_size
+	    || rec[0] != rec_type || rec[1] != rec_size) {
+		return NULL;
 	}
+	return rec + ICCOM_TECH_REC_HEADER_SIZE_BYTES;
+}
 
-	// preparing the next xfer with the first pending package in queue
-	__iccom_fillup_next_data_xfer(iccom, &iccom->p->xfer);
+// Helper. Returns the pointer to the piggyback ack record value
+// within the package, if the package has one.
+//
+// @package {valid ptr to package with verified payload size}
+// @fallback__out {NULL || valid ptr} is set to true if the ack record
+//      also carries the link fallback request (see
+//      ICCOM_TECH_REC_ACK_FALLBACK), to false else.
+//
+// RETURNS:
+//      the ack value pointer: if package has piggyback ack record
+//      NULL: else
+static uint8_t *__iccom_package_ack_addr(struct iccom_package *package
+					 , bool *fallback__out)
+{
+	uint8_t *ack = __iccom_package_first_rec_addr(package
+					, ICCOM_TECH_REC_ACK
+					, ICCOM_TECH_REC_ACK_SIZE_BYTES);
+	bool fallback = false;
+
+	if (!ack) {
+		ack = __iccom_package_first_rec_addr(package
+					, ICCOM_TECH_REC_ACK_FALLBACK
+					, ICCOM_TECH_REC_ACK_SIZE_BYTES);
+		fallback = ack != NULL;
+	}
+	if (fallback__out) {
+		*fallback__out = fallback;
+	}
+	return ack;
+}
 
-finalize:
-	// switching to other stage (the only point where the
-	// data_xfer_stage is being written)
-	iccom->p->data_xfer_stage = !iccom->p->data_xfer_stage;
+// Helper. Checks if the received package carries consumer data, not
+// only the technical records.
+//
+// @rx_pkg {valid ptr to package with verified payload size}
+// @payload_size the verified package payload size
+//
+// RETURNS:
+//      true: if the package has at least one consumer packet
+//      false: else
+static bool __iccom_package_carries_consumer_data(
+		struct iccom_package *rx_pkg, const size_t payload_size)
+{
+	void *start = __iccom_package_payload_start_addr(rx_pkg);
+	size_t bytes_left = payload_size;
+
+	while (bytes_left > 0) {
+		struct iccom_packet packet;
+		if (__iccom_packet_parse_into_struct(start, bytes_left
+						     , &packet) < 0) {
+			// broken packages are treated as the busy link
+			return true;
+		}
+		if (packet.channel != ICCOM_TECHNICAL_CHANNEL_ID) {
+			return true;
+		}
+		const size_t packet_size = iccom_packet_packet_size_bytes(
+						   packet.payload_length);
+		start += packet_size;
+		bytes_left -= packet_size;
+	}
+	return false;
+}
 
-#ifdef ICCOM_DEBUG
-	mutex_lock(&iccom->p->rx_messages.lock);
-	__iccom_msg_storage_printout(&iccom->p->rx_messages
-				     , ICCOM_DEBUG_MESSAGES_PRINTOUT_MAX_COUNT
-				     , ICCOM_DEBUG_CHANNEL);
-	mutex_unlock(&iccom->p->rx_messages.lock);
-#endif
-	iccom_info(ICCOM_LOG_INFO_DBG_LEVEL, "Next xfer:");
-	iccom_dbg_printout_xfer(&iccom->p->xfer);
+// Helper. Checks if the received package is a part of the package
+// we have already received before it was rebuilt by the other side
+// on link fallback (see __iccom_queue_fit_package), so its data
+// must be dropped.
+//
+// @rx_pkg {valid ptr to package with verified payload size}
+//
+// CONCURRENCE: called only from transport layer return points
+//
+// RETURNS:
+//      true: if the package data was already received
+//      false: else
+static bool __iccom_package_rx_already_received(
+		struct iccom_dev *iccom, struct iccom_package *rx_pkg)
+{
+	const uint8_t *rebuilt_of = __iccom_package_first_rec_addr(rx_pkg
+				, ICCOM_TECH_REC_REBUILT_OF
+				, ICCOM_TECH_REC_REBUILT_OF_SIZE_BYTES);
+	const int last_whole_id = iccom->p->last_rx_whole_package_id;
 
-	return &iccom->p->xfer;
+	if (!rebuilt_of || last_whole_id < 0) {
+		return false;
+	}
+	// the original package was sent not earlier than the packages
+	// in flight before it
+	return ((last_whole_id - (int)*rebuilt_of) & 0xFF)
+			< ICCOM_PB_WINDOW_PACKAGES;
 }
 
-// Stops the underlying byte xfer device and detaches it from
-// the ICCom driver.
-void __iccomm_stop_xfer_device(struct iccom_dev *iccom)
+// Helper. Updates the RX sequence state with the received package
+// which was accepted.
+//
+// @rx_pkg {valid ptr to package with verified payload size}
+//
+// CONCURRENCE: called only from transport layer return points
+static void __iccom_package_rx_accepted(struct iccom_dev *iccom
+					, struct iccom_package *rx_pkg)
 {
-	iccom->xfer_iface.close(iccom->xfer_device);
+	const int rx_pkg_id = __iccom_package_get_id(rx_pkg);
+
+	iccom->p->last_rx_package_id = rx_pkg_id;
+	if (!__iccom_package_first_rec_addr(rx_pkg, ICCOM_TECH_REC_REBUILT_OF
+				, ICCOM_TECH_REC_REBUILT_OF_SIZE_BYTES)) {
+		iccom->p->last_rx_whole_package_id = rx_pkg_id;
+	}
 }
 
+// Helper. Updates the piggyback ack record of the finalized package
+// (if it has one) and updates the package CRC.
+//
+// @package {valid ptr to finalized package}
+// @ack_id the ID of the last package we received in order
+// @sack_mask the selective ack bit mask (see ICCOM_TECH_REC_ACK)
+// @fallback if true, then the ack record also carries our link
+//      fallback request (see ICCOM_TECH_REC_ACK_FALLBACK)
+//
+// LOCKING: TX queue should be locked before this call
+static void __iccom_package_set_ack(struct iccom_package *package
+				    , int ack_id, unsigned int sack_mask
+				    , const bool fallback)
+{
+	bool has_fallback;
+	uint8_t *ack = __iccom_package_ack_addr(package, &has_fallback);
+	if (!ack || (ack[0] == (uint8_t)ack_id
+		     && ack[1] == (uint8_t)sack_mask
+		     && has_fallback == fallback)) {
+		return;
+	}
+	ack[-ICCOM_TECH_REC_HEADER_SIZE_BYTES] = fallback
+						 ? ICCOM_TECH_REC_ACK_FALLBACK
+						 : ICCOM_TECH_REC_ACK;
+	ack[0] = (uint8_t)ack_id;
+	ack[1] = (uint8_t)sack_mask;
+	__iccom_package_set_src(package
+				, __iccom_package_compute_src(package));
+}
 
-// The consumer notification procedure, is sheduled every time, when
-// any incoming message is finished and ready to be delivered to the
-// consumer. Due to latency in scheduling not only notifies about
-// initial message, but also checks for other finished messages.
+// Helper. Applies the technical channel packet records.
 //
-// @work the scheduled work which launched the notification
-static void __iccom_consumer_notification_routine(
-	struct work_struct *work)
+// @packet {valid ptr} the technical channel packet
+//
+// CONCURRENCE: called only from package parsing
+//
+// RETURNS:
+//      0: on success
+//      -EBADMSG: if the packet records are broken
+static int __iccom_tech_packet_process(struct iccom_dev *iccom
+				       , struct iccom_packet *packet)
 {
-	if (IS_ERR_OR_NULL(work)) {
-		iccom_err("no notification work provided");
-		return;
+	const uint8_t *rec = (const uint8_t *)packet->payload;
+	size_t bytes_left = packet->payload_length;
+	struct iccom_link_offer *offer = &iccom->p->rx_link_offer_uncommitted;
+
+	while (bytes_left > 0) {
+		if (bytes_left < ICCOM_TECH_REC_HEADER_SIZE_BYTES) {
+			return -EBADMSG;
+		}
+		const size_t rec_size = ICCOM_TECH_REC_HEADER_SIZE_BYTES
+					+ rec[1];
+		if (bytes_left < rec_size) {
+			return -EBADMSG;
+		}
+
+		switch (rec[0]) {
+		case ICCOM_TECH_REC_PKG_SIZE_OFFER:
+			if (rec[1] != ICCOM_TECH_REC_PKG_SIZE_OFFER_SIZE_BYTES) {
+				break;
+			}
+			offer->max_pkg_size
+				= ((size_t)rec[2] << 8) | (size_t)rec[3];
+			break;
+		case ICCOM_TECH_REC_FEATURES_OFFER:
+			if (rec[1] != ICCOM_TECH_REC_FEATURES_OFFER_SIZE_BYTES) {
+				break;
+			}
+			offer->features = rec[2];
+			break;
+		case ICCOM_TECH_REC_WINDOW_OFFER:
+			if (rec[1] != ICCOM_TECH_REC_WINDOW_OFFER_SIZE_BYTES) {
+				break;
+			}
+			offer->window = rec[2];
+			break;
+		case ICCOM_TECH_REC_BATCH_OFFER:
+			if (rec[1] != ICCOM_TECH_REC_BATCH_OFFER_SIZE_BYTES) {
+				break;
+			}
+			offer->batch = rec[2];
+			break;
+		default:
+			// the piggyback acks are handled separately (see
+			// __iccom_package_ack_addr), the unknown records
+			// are from newer protocol versions
+			break;
+		}
+
+		rec += rec_size;
+		bytes_left -= rec_size;
 	}
+	return 0;
+}
 
-	struct iccom_dev_private *iccom_p = container_of(work
-		, struct iccom_dev_private, consumer_delivery_work);
+// Helper. Allocates the new empty package of current size to replace
+// the rebuilt TX package and adds it to the given list.
+//
+// @rebuilt_of the ID of the package which was sent to the other side
+//      and is rebuilt now, or < 0 if the rebuilt package was not sent
+// @list {valid ptr} the list to add the new package to
+//
+// LOCKING: TX queue should be locked before this call
+//
+// RETURNS:
+//      the new package: on success
+//      NULL: if no memory
+static struct iccom_package *__iccom_queue_new_rebuilt_package(
+		struct iccom_dev *iccom, const int rebuilt_of
+		, struct list_head *list)
+{
+	struct iccom_package *pkg = kmalloc(sizeof(*pkg), GFP_KERNEL);
+	if (!pkg) {
+		return NULL;
+	}
+	if (__iccom_package_init(pkg, iccom->p->data_xfer_size_bytes) < 0) {
+		kfree(pkg);
+		return NULL;
+	}
+	list_add_tail(&pkg->list_anchor, list);
 
-	int passed = iccom_msg_storage_pass_ready_data_to_consumer(
-					     &iccom_p->rx_messages);
-	if (passed >= 0) {
-		__sync_add_and_fetch(
-			    &iccom_p->statistics.messages_ready_in_storage
-			    , -passed);
+	if (rebuilt_of < 0) {
+		return pkg;
 	}
+
+	char rec[ICCOM_TECH_REC_HEADER_SIZE_BYTES
+		 + ICCOM_TECH_REC_REBUILT_OF_SIZE_BYTES];
+	rec[0] = ICCOM_TECH_REC_REBUILT_OF;
+	rec[1] = ICCOM_TECH_REC_REBUILT_OF_SIZE_BYTES;
+	rec[2] = (char)rebuilt_of;
+
+	iccom_package_add_packet(pkg, rec, sizeof(rec)
+				 , ICCOM_TECHNICAL_CHANNEL_ID);
+	pkg->rebuilt_of = rebuilt_of;
+	return pkg;
 }
 
-// Verifies if the interface of full duplex transport device contains all
-// records relevant for ICCom
-static bool __iccom_verify_transport_layer_interface(
-		const struct full_duplex_sym_iface  *const iface)
+// Helper. Brings the TX package to the current data package size. If
+// the package payload doesn't fit the new size or the package is to
+// be rebuilt, then its consumer packets are moved into the new
+// packages of current size, which replace the package in the TX
+// queue.
+//
+// The sent package is rebuilt on link fallback, cause the other side
+// might have received it already. The new packages then carry the
+// original package ID (see ICCOM_TECH_REC_REBUILT_OF), so the other
+// side drops their data if it has the original one. The package
+// which is not sent yet is rebuilt on link fallback if it carries our
+// piggyback ack, cause the ack becomes outdated.
+//
+// @package {valid ptr to finalized package in TX queue}
+// @rebuild if true, then the package is rebuilt even if it fits the
+//      current size
+//
+// LOCKING: TX queue should be locked before this call
+//
+// RETURNS:
+//      0: if the package is fit in place
+//      1: if the package is replaced by the new packages
+//      < 0: negated error code (TX queue remains untouched)
+static int __iccom_queue_fit_package(struct iccom_dev *iccom
+				     , struct iccom_package *package
+				     , const bool rebuild)
 {
-	return !IS_ERR_OR_NULL(iface)
-		    && !IS_ERR_OR_NULL(iface->data_xchange)
-		    && !IS_ERR_OR_NULL(iface->is_running)
-		    && !IS_ERR_OR_NULL(iface->init)
-		    && !IS_ERR_OR_NULL(iface->reset)
-		    && !IS_ERR_OR_NULL(iface->close);
+	const size_t new_size = iccom->p->data_xfer_size_bytes;
+
+	if (!rebuild && package->size == new_size) {
+		return 0;
+	}
+
+	const size_t payload_size = __iccom_package_payload_size(package
+								 , NULL);
+	const size_t new_room = new_size
+				- ICCOM_PACKAGE_PAYLOAD_DATA_LENGTH_FIELD_SIZE_BYTES
+				- ICCOM_PACKAGE_ID_FIELD_SIZE_BYTES
+				- ICCOM_PACKAGE_CRC_FIELD_SIZE_BYTES;
+
+	if (!rebuild && payload_size <= new_room) {
+		int res = __iccom_package_resize(package, new_size);
+		if (res < 0) {
+			return res;
+		}
+		__iccom_package_finalize(package);
+		return 0;
+	}
+
+	const int rebuilt_of = (rebuild && package->sent
+				&& package->rebuilt_of < 0)
+				? __iccom_package_get_id(package)
+				: package->rebuilt_of;
+	LIST_HEAD(new_packages);
+	struct iccom_package *pkg = NULL;
+	void *start = __iccom_package_payload_start_addr(package);
+	size_t bytes_left = payload_size;
+	int count = 0;
+
+	while (bytes_left > 0) {
+		struct iccom_packet packet;
+		if (__iccom_packet_parse_into_struct(start, bytes_left
+						     , &packet) < 0) {
+			iccom_err("broken TX package: logical error");
+			goto free_new_packages;
+		}
+
+		// the technical records are outdated now
+		size_t offset = packet.channel == ICCOM_TECHNICAL_CHANNEL_ID
+				? packet.payload_length : 0;
+		while (offset < packet.payload_length) {
+			if (!pkg) {
+				pkg = __iccom_queue_new_rebuilt_package(iccom
+						, rebuilt_of, &new_packages);
+				if (!pkg) {
+					goto free_new_packages;
+				}
+				pkg->carries_data = package->carries_data;
+				count++;
+			}
+			const size_t written = __iccom_package_add_packet_ext(
+					pkg, packet.payload + offset
+					, packet.payload_length - offset
+					, packet.channel, packet.finalizing);
+			if (written == 0) {
+				pkg = NULL;
+				continue;
+			}
+			pkg->consumer_packets++;
+			offset += written;
+		}
+
+		start += iccom_packet_packet_size_bytes(packet.payload_length);
+		bytes_left -= iccom_packet_packet_size_bytes(
+						packet.payload_length);
+	}
+
+	// the package without consumer data is still to be replaced
+	if (count == 0) {
+		if (!__iccom_queue_new_rebuilt_package(iccom, rebuilt_of
+						       , &new_packages)) {
+			goto free_new_packages;
+		}
+		count++;
+	}
+
+	// the messages are done with the last part of the package data
+	pkg = list_last_entry(&new_packages, struct iccom_package
+			      , list_anchor);
+	list_splice_tail_init(&package->done_messages, &pkg->done_messages);
+
+	// the package is replaced by new ones in the same position
+	list_for_each_entry(pkg, &new_packages, list_anchor) {
+		__iccom_package_set_id(pkg, __iccom_get_next_package_id(iccom));
+		__iccom_package_finalize(pkg);
+	}
+	if (iccom->p->tx_next == package) {
+		iccom->p->tx_next = NULL;
+	}
+	if (iccom->p->tx_last_sent == package) {
+		iccom->p->tx_last_sent = NULL;
+	}
+	list_splice(&new_packages, &package->list_anchor);
+	__iccom_package_free(package);
+	ICCOM_STATS_ADD(iccom->p, packages_in_tx_queue, count - 1);
+	return 1;
+
+free_new_packages:
+	while (!list_empty(&new_packages)) {
+		__iccom_package_free(__iccom_get_package_from_list_anchor(
+						new_packages.next));
+	}
+	return -ENOMEM;
 }
 
-// Helper. Initializes the iccom packages storage (TX storage).
+// Helper. Brings all TX packages to the current data package size
+// (see __iccom_queue_fit_package), rebuilds the sent packages and the
+// packages with our piggyback ack if the link fell back. The packages which are not sent yet get new
+// sequence IDs in TX queue order then, so the IDs keep going in
+// order of sending.
+//
+// LOCKING: TX queue should be locked before this call
+//
 // RETURNS:
-//      0: all fine
-//      <0: negative error code
-static inline int __iccom_init_packages_storage(struct iccom_dev *iccom)
+//      0: on success
+//      < 0: negated error code
+static int __iccom_queue_fit_packages(struct iccom_dev *iccom)
 {
-#ifdef ICCOM_DEBUG
-	ICCOM_CHECK_DEVICE("", return -ENODEV);
-	ICCOM_CHECK_DEVICE_PRIVATE("", return -EINVAL);
-#endif
-	INIT_LIST_HEAD(&iccom->p->tx_data_packages_head);
-	mutex_init(&iccom->p->tx_queue_lock);
-	iccom->p->next_tx_package_id = ICCOM_INITIAL_PACKAGE_ID;
-	return 0;
+	struct list_head *const head = &iccom->p->tx_data_packages_head;
+	const bool rebuild_sent = iccom->p->link_fell_back;
+	struct iccom_package *pkg;
+	struct iccom_package *tmp;
+	bool replaced = false;
+	int next_id = -1;
+	int res = 0;
+
+	iccom->p->link_fell_back = false;
+
+	list_for_each_entry(pkg, head, list_anchor) {
+		if (!pkg->sent) {
+			if (next_id < 0) {
+				next_id = __iccom_package_get_id(pkg);
+			}
+			break;
+		}
+		next_id = __iccom_package_get_id(pkg) + 1;
+	}
+
+	list_for_each_entry_safe(pkg, tmp, head, list_anchor) {
+		const int pkg_res = __iccom_queue_fit_package(iccom, pkg
+				, rebuild_sent
+				  && (pkg->sent
+				      || __iccom_package_ack_addr(pkg, NULL)));
+		if (pkg_res < 0) {
+			res = pkg_res;
+		} else if (pkg_res > 0) {
+			replaced = true;
+		}
+	}
+
+	if (!replaced || next_id < 0) {
+		return res;
+	}
+
+	iccom->p->next_tx_package_id = next_id;
+	list_for_each_entry(pkg, head, list_anchor) {
+		if (pkg->sent) {
+			continue;
+		}
+		__iccom_package_set_id(pkg, __iccom_get_next_package_id(iccom));
+		__iccom_package_finalize(pkg);
+	}
+	return res;
 }
 
-// Helper. Frees all resources owned by packages storage.
-static inline void __iccom_free_packages_storage(struct iccom_dev *iccom)
+// Helper. Updates the link negotiation upon the successful frame.
+//
+// CONCURRENCE: called only from transport layer return points
+static void __iccom_link_on_frame_ok(struct iccom_dev *iccom)
 {
-#ifdef ICCOM_DEBUG
-	ICCOM_CHECK_DEVICE("", return);
-	ICCOM_CHECK_DEVICE_PRIVATE("", return);
-#endif
-	mutex_lock(&iccom->p->tx_queue_lock);
-	while (__iccom_have_packages(iccom)) {
-		__iccom_package_free(__iccom_get_first_tx_package(iccom));
+	struct iccom_dev_private *p = iccom->p;
+
+	p->link_failed_frames = 0;
+	if (p->link_holdoff_frames > 0) {
+		p->link_holdoff_frames--;
+	}
+	if (p->link_state == ICCOM_LINK_SWITCHED
+	    && ++p->link_stable_frames >= ICCOM_LINK_STABLE_FRAMES) {
+		p->link_fallbacks = 0;
 	}
-	mutex_unlock(&iccom->p->tx_queue_lock);
-	mutex_destroy(&iccom->p->tx_queue_lock);
 }
 
-// Helper. Inits the ICCom procfs.
-// RETURNS:
-//      >= 0: on success,
-//      < 0: on failure (negated error code)
-static inline int __iccom_procfs_init(struct iccom_dev *iccom)
+// Helper. Updates the link negotiation upon our package delivery
+// confirmation (ACK) in the legacy protocol. Switches the link if
+// both our and other side offers were delivered within current frame.
+//
+// NOTE: the other side makes the same decision within the same
+//      frame, so both sides switch the link simultaneously.
+//
+// CONCURRENCE: called only from transport layer return points
+static void __iccom_link_on_ack(struct iccom_dev *iccom)
 {
-	ICCOM_CHECK_DEVICE("", return -ENODEV);
-	ICCOM_CHECK_DEVICE_PRIVATE("", return -ENODEV);
+	if (!ICCOM_LINK_NEGOTIATION) {
+		return;
+	}
 
-	iccom->p->proc_root = proc_mkdir(ICCOM_PROC_ROOT_NAME, NULL);
+	struct iccom_dev_private *p = iccom->p;
+	const struct iccom_link_offer *their = &p->frame_rx_link_offer;
+	const bool offer_answered
+		= their->max_pkg_size >= ICCOM_DATA_XFER_SIZE_BYTES;
 
-	if (IS_ERR_OR_NULL(iccom->p->proc_root)) {
-		iccom_err("failed to create ICCom proc root folder"
-			  " with name: "ICCOM_PROC_ROOT_NAME);
-		return -EIO;
+	__iccom_link_on_frame_ok(iccom);
+
+	if (p->link_state == ICCOM_LINK_OFFERS_STOPPED) {
+		if (offer_answered) {
+			p->link_state = ICCOM_LINK_NEGOTIATING;
+			p->link_offers_unanswered = 0;
+		}
+		return;
 	}
-	return 0;
-}
 
-// Removes the ICcom proc root
-static void __iccom_procfs_close(struct iccom_dev *iccom)
-{
-	ICCOM_CHECK_DEVICE("", return);
-	ICCOM_CHECK_DEVICE_PRIVATE("", return);
+	if (!__iccom_get_first_tx_package(iccom)->carries_link_offer) {
+		return;
+	}
 
-	if (IS_ERR_OR_NULL(iccom->p->proc_root)) {
+	if (!offer_answered) {
+		p->link_offers_unanswered++;
+		if (p->link_offers_unanswered
+				>= ICCOM_LINK_MAX_UNANSWERED_OFFERS) {
+			iccom_info(ICCOM_LOG_INFO_OPT_LEVEL
+				   , "no link offer from other side,"
+				     " keeping legacy protocol");
+			p->link_state = ICCOM_LINK_OFFERS_STOPPED;
+		}
 		return;
 	}
 
-	proc_remove(iccom->p->proc_root);
-	iccom->p->proc_root = NULL;
+	p->data_xfer_size_bytes = min_t(size_t, their->max_pkg_size
+					, p->link_max_pkg_size);
+	p->link_features = their->features & ICCOM_LINK_OUR_FEATURES;
+	p->link_window = clamp_t(unsigned int, their->window, 2
+				 , ICCOM_PB_WINDOW_PACKAGES);
+	p->link_batch = 1;
+	if (p->link_features & ICCOM_LINK_FEATURE_ACK_PIGGYBACK) {
+		// the whole batch goes within single transport xfer
+		const unsigned int max_batch = max_t(unsigned int, 1
+				, ICCOM_TRANSPORT_XFER_MAX_SIZE_BYTES
+				  / p->data_xfer_size_bytes);
+		p->link_batch = clamp_t(unsigned int, their->batch, 1
+					, min_t(unsigned int, p->link_window
+						, min_t(unsigned int, max_batch
+							, ICCOM_PB_BATCH_PACKAGES)));
+	}
+	p->link_state = ICCOM_LINK_SWITCHED;
+	p->link_stable_frames = 0;
+	p->tx_last_sent = NULL;
+	p->tx_next = NULL;
+	p->tx_batch_count = 0;
+	iccom_info(ICCOM_LOG_INFO_OPT_LEVEL
+		   , "link switched: package size %zu bytes, features 0x%x"
+		     ", window %u, batch %u"
+		   , p->data_xfer_size_bytes, p->link_features
+		   , p->link_window, p->link_batch);
+}
+
+// Helper. Piggyback acks mode. Drops all packages received out of
+// order.
+//
+// CONCURRENCE: called only from transport layer return points
+static void __iccom_pb_rx_window_free(struct iccom_dev *iccom)
+{
+	for (int i = 0; i < ARRAY_SIZE(iccom->p->rx_window); i++) {
+		struct iccom_package *slot = &iccom->p->rx_window[i];
+		kfree(slot->data);
+		slot->data = NULL;
+		slot->size = 0;
+	}
 }
 
+// Helper. Piggyback acks mode. Computes the selective ack bit mask of
+// the packages we received out of order (see ICCOM_TECH_REC_ACK).
+//
+// CONCURRENCE: called only from transport layer return points
+static unsigned int __iccom_pb_rx_sack_mask(struct iccom_dev *iccom)
+{
+	unsigned int sack_mask = 0;
 
-// Helper. Initializes the statistics structure of ICCom.
-// NOTE: the ICCom proc rootfs should be created beforehand,
-//      if not: then we will fail to create statistics node.
+	for (int i = 0; i < ARRAY_SIZE(iccom->p->rx_window); i++) {
+		struct iccom_package *slot = &iccom->p->rx_window[i];
+		if (!slot->data) {
+			continue;
+		}
+		const unsigned int bit = (__iccom_package_get_id(slot)
+					  - iccom->p->last_rx_package_id - 2)
+					 & 0xFF;
+		if (bit < 8) {
+			sack_mask |= 1u << bit;
+		}
+	}
+	return sack_mask;
+}
+
+// Helper. Piggyback acks mode. Looks up the package received out of
+// order by its ID.
+//
+// @id the package ID to look up, or < 0 to look up a free slot
+//
+// CONCURRENCE: called only from transport layer return points
 //
 // RETURNS:
-//      >= 0: on success,
-//      < 0: on failure (negated error code)
-static inline int __iccom_statistics_init(struct iccom_dev *iccom)
+//      the slot of the package, if found
+//      NULL: else
+static struct iccom_package *__iccom_pb_rx_window_find(
+		struct iccom_dev *iccom, const int id)
+{
+	for (int i = 0; i < ARRAY_SIZE(iccom->p->rx_window); i++) {
+		struct iccom_package *slot = &iccom->p->rx_window[i];
+		if (id < 0 ? !slot->data
+			   : (slot->data
+			      && __iccom_package_get_id(slot) == id)) {
+			return slot;
+		}
+	}
+	return NULL;
+}
+
+// Helper. Drops the negotiated link and falls back to the legacy
+// protocol. The renegotiation is held off then (see
+// ICCOM_LINK_RENEGOTIATION_HOLDOFF_FRAMES).
+//
+// @reason the human readable reason of the fallback
+//
+// CONCURRENCE: called only from transport layer return points
+static void __iccom_link_fall_back(struct iccom_dev *iccom
+				   , const char *reason)
+{
+	struct iccom_dev_private *p = iccom->p;
+
+	p->link_fallbacks++;
+	p->link_holdoff_frames = ICCOM_LINK_RENEGOTIATION_HOLDOFF_FRAMES
+				 << min(p->link_fallbacks - 1
+					, ICCOM_LINK_HOLDOFF_MAX_SHIFT);
+	if (p->data_xfer_size_bytes > ICCOM_DATA_XFER_SIZE_BYTES) {
+		p->link_max_pkg_size = max_t(size_t
+					     , ICCOM_DATA_XFER_SIZE_BYTES
+					     , p->data_xfer_size_bytes / 2);
+	}
+
+	iccom_warning("%s, falling back to legacy protocol from negotiated"
+		      " link (package size %zu bytes, features 0x%x),"
+		      " renegotiating in %d frames with package size"
+		      " %zu bytes"
+		      , reason, p->data_xfer_size_bytes, p->link_features
+		      , p->link_holdoff_frames, p->link_max_pkg_size);
+	p->data_xfer_size_bytes = ICCOM_DATA_XFER_SIZE_BYTES;
+	p->link_features = 0;
+	p->link_batch = 1;
+	p->tx_batch_count = 0;
+	p->link_state = ICCOM_LINK_NEGOTIATING;
+	p->link_offers_unanswered = 0;
+	p->link_failed_frames = 0;
+	p->link_fallback_requested = false;
+	p->link_fallback_agreed = false;
+	p->link_fallback_frames = 0;
+	p->link_fell_back = true;
+	p->tx_last_sent = NULL;
+	p->tx_next = NULL;
+	__iccom_pb_rx_window_free(iccom);
+}
+
+// Helper. Updates the link negotiation upon the failed frame. Requests
+// the link fallback if too many frames in a row failed with
+// negotiated link (see ICCOM_LINK_FALLBACK_FAILED_FRAMES).
+//
+// CONCURRENCE: called only from transport layer return points
+static void __iccom_link_on_frame_failed(struct iccom_dev *iccom)
 {
-	ICCOM_CHECK_DEVICE("", return -ENODEV);
-	ICCOM_CHECK_DEVICE_PRIVATE("", return -ENODEV);
+	if (!ICCOM_LINK_NEGOTIATION) {
+		return;
+	}
 
-	// initial statistics data
-	memset(&iccom->p->statistics, 0, sizeof(iccom->p->statistics));
+	struct iccom_dev_private *p = iccom->p;
 
-	// statistics access operations
-	memset(&iccom->p->statistics_ops, 0, sizeof(iccom->p->statistics_ops));
-	iccom->p->statistics_ops.read  = &__iccom_statistics_read;
-	iccom->p->statistics_ops.owner = THIS_MODULE;
+	if (p->link_holdoff_frames > 0) {
+		p->link_holdoff_frames--;
+	}
+	if (p->link_state != ICCOM_LINK_SWITCHED
+	    || p->link_fallback_requested) {
+		return;
+	}
+	p->link_failed_frames++;
+	if (p->link_failed_frames < ICCOM_LINK_FALLBACK_FAILED_FRAMES) {
+		return;
+	}
 
-	if (IS_ERR_OR_NULL(iccom->p->proc_root)) {
-		iccom_err("failed to create statistics proc entry:"
-			  " no ICCom root proc entry");
-		iccom->p->statistics_file = NULL;
-		return -ENOENT;
+	iccom_info(ICCOM_LOG_INFO_OPT_LEVEL
+		   , "%d frames failed in a row with negotiated link,"
+		     " requesting fallback", p->link_failed_frames);
+	p->link_fallback_requested = true;
+}
+
+// Helper. Legacy frames. Falls back to the legacy protocol at the end
+// of the frame, if our or other side ack xfer carried the link
+// fallback request (see ICCOM_PACKAGE_ACK_FALLBACK_VALUE): the ack
+// xfers are short, so both sides see the request within the same
+// frame.
+//
+// @tx_fallback our ack xfer of the frame carried the request
+// @rx_fallback the other side ack xfer of the frame carried the request
+//
+// CONCURRENCE: called only from transport layer return points
+static void __iccom_link_fallback_update(struct iccom_dev *iccom
+					 , const bool tx_fallback
+					 , const bool rx_fallback)
+{
+	if (!ICCOM_LINK_NEGOTIATION
+	    || iccom->p->link_state != ICCOM_LINK_SWITCHED) {
+		return;
+	}
+	if (tx_fallback) {
+		__iccom_link_fall_back(iccom, "fallback requested");
+	} else if (rx_fallback) {
+		__iccom_link_fall_back(iccom, "other side requested fallback");
 	}
+}
 
-	iccom->p->statistics_file = proc_create_data(
-					   ICCOM_STATISTICS_FILE_NAME
-					   , ICCOM_PROC_R_PERMISSIONS
-					   , iccom->p->proc_root
-					   , &iccom->p->statistics_ops
-					   , (void*)iccom);
+// Helper. Piggyback acks mode. Updates the link fallback agreement at
+// the end of the frame (see ICCOM_TECH_REC_ACK_FALLBACK):
+// * the side which gets the other side request answers it within the
+//   next frame and falls back after it,
+// * the requesting side falls back when it gets the answer, or after
+//   ICCOM_LINK_FALLBACK_REQUEST_FRAMES frames without it (the other
+//   side might have fallen back while its answer was lost).
+// So normally both sides fall back after the same frame.
+//
+// @tx_fallback our packages of the frame carried the fallback request
+// @rx_fallback the other side package of the frame carried the
+//      fallback request
+//
+// CONCURRENCE: called only from transport layer return points
+static void __iccom_pb_link_fallback_update(struct iccom_dev *iccom
+					    , const bool tx_fallback
+					    , const bool rx_fallback)
+{
+	struct iccom_dev_private *p = iccom->p;
 
-	if (IS_ERR_OR_NULL(iccom->p->statistics_file)) {
-		iccom_err("failed to create statistics proc entry.");
-		return -EIO;
+	if (!ICCOM_LINK_NEGOTIATION || p->link_state != ICCOM_LINK_SWITCHED) {
+		return;
+	}
+
+	if (tx_fallback && (rx_fallback || p->link_fallback_agreed)) {
+		__iccom_link_fall_back(iccom, "fallback agreed");
+		return;
+	}
+	if (rx_fallback) {
+		p->link_fallback_requested = true;
+		p->link_fallback_agreed = true;
+		return;
+	}
+	if (tx_fallback && ++p->link_fallback_frames
+			   >= ICCOM_LINK_FALLBACK_REQUEST_FRAMES) {
+		__iccom_link_fall_back(iccom, "fallback request not answered");
+	}
+}
+
+// Helper. Fills up the given empty package with pending consumer
+// messages data from the TX channels queues (the newly posted
+// messages are taken first), the order is defined by TX scheduling
+// (see __iccom_tx_sched_select_channel). Finalizes
+// the package. Our piggyback ack and link offer records (if any) go
+// first.
+//
+// @package {valid ptr to empty package}
+//
+// LOCKING: TX queue should be locked before this call
+//
+// RETURNS:
+//      true: if some consumer data was written to the package
+//      false: else (the package is empty or carries technical
+//          records only)
+static bool __iccom_queue_fill_package(struct iccom_dev *iccom
+				       , struct iccom_package *package)
+{
+	bool have_data = false;
+
+	__iccom_queue_take_submitted(iccom);
+	__iccom_link_add_ack(iccom, package);
+	__iccom_link_add_offer(iccom, package);
+
+	while (true) {
+		bool guaranteed;
+		int lvl;
+		struct iccom_tx_channel *ch
+			= __iccom_tx_sched_select_channel(iccom, &guaranteed
+							  , &lvl);
+		if (!ch) {
+			break;
+		}
+
+		struct iccom_tx_message *msg
+			= __iccom_get_tx_msg_from_list_anchor(
+				    ch->messages[lvl].next);
+
+		const size_t written = iccom_package_add_packet(
+					       package
+					       , msg->data + msg->offset
+					       , msg->length - msg->offset
+					       , msg->channel);
+		// no more room in the package
+		if (written == 0) {
+			break;
+		}
+
+		have_data = true;
+		package->consumer_packets++;
+		msg->offset += written;
+		__iccom_tx_release_bytes(iccom, written);
+		__iccom_tx_sched_charge(iccom, ch, lvl, guaranteed
+				, written + ICCOM_PACKET_HEADER_SIZE_BYTES);
+
+		if (msg->offset != msg->length) {
+			__iccom_tx_channel_hold(ch, msg);
+			continue;
+		}
+
+		// the message is accounted as sent upon the package ack
+		list_del(&msg->list_anchor);
+		kfree(msg->data);
+		msg->data = NULL;
+		list_add_tail(&msg->list_anchor, &package->done_messages);
+		ICCOM_STATS_DEC(iccom->p, messages_in_tx_queue);
+
+		if (list_empty(&ch->messages[lvl])) {
+			__iccom_tx_channel_deactivate(ch, lvl);
+		}
+		if (ch->sending) {
+			__iccom_tx_channel_release(iccom, ch);
+		}
+		__iccom_tx_channel_collect(ch);
+	}
+
+	__iccom_package_finalize(package);
+	return have_data;
+}
+
+// Helper. Accounts the consumer data of the TX package in the
+// statistics when the package is confirmed by the other side: the
+// packets and the messages whose last part is in the package (see
+// @done_messages) are sent.
+//
+// @pkg {valid ptr to the package in TX queue}
+//
+// LOCKING: TX queue should be locked before this call
+static void __iccom_queue_package_acked(struct iccom_dev *iccom
+					, struct iccom_package *pkg)
+{
+	struct iccom_dev_private *p = iccom->p;
+	struct iccom_tx_message *msg;
+	struct iccom_tx_message *tmp;
+	const s64 now_ns = ktime_to_ns(ktime_get());
+
+	ICCOM_STATS_ADD(p, packets_sent, pkg->consumer_packets);
+	pkg->consumer_packets = 0;
+
+	if (list_empty(&pkg->done_messages)) {
+		return;
+	}
+
+	list_for_each_entry_safe(msg, tmp, &pkg->done_messages
+				 , list_anchor) {
+		struct iccom_tx_stats *level_stats
+				= &p->tx_level_stats[msg->level];
+		struct iccom_tx_stats *stats
+			= __iccom_tx_get_stats(iccom, msg->channel);
+
+		if (stats) {
+			stats->messages_sent++;
+			stats->bytes_sent += msg->length;
+			stats->messages_pending--;
+			__iccom_latency_hist_add(&stats->post_to_ack
+						 , now_ns - msg->posted_ns);
+		}
+		level_stats->messages_sent++;
+		level_stats->bytes_sent += msg->length;
+		level_stats->messages_pending--;
+		__iccom_latency_hist_add(&level_stats->post_to_ack
+					 , now_ns - msg->posted_ns);
+
+		ICCOM_STATS_INC(p, messages_sent);
+		ICCOM_STATS_ADD(p, total_consumers_bytes_sent, msg->length);
+
+		list_del(&msg->list_anchor);
+		kfree(msg);
+	}
+
+	__iccom_trace_tx_queue(iccom);
+}
+
+// Helper. Checks if we have something to send to the other side:
+// consumer data (within TX packages or pending TX messages) or our
+// link offer.
+//
+// LOCKING: TX queue should be locked before this call
+//
+// RETURNS:
+//      true: if there is something to send
+//      false: else (our side is idle)
+static bool __iccom_queue_have_pending(struct iccom_dev *iccom)
+{
+	struct iccom_package *pkg;
+
+	if (!llist_empty(&iccom->p->tx_submitted)
+	    || !list_empty(&iccom->p->tx_unresolved)) {
+		return true;
+	}
+
+	list_for_each_entry(pkg, &iccom->p->tx_data_packages_head
+			    , list_anchor) {
+		if (pkg->carries_data || pkg->carries_link_offer) {
+			return true;
+		}
+	}
+	for (int lvl = 0; lvl < ICCOM_TX_PRIORITY_LEVELS_COUNT; lvl++) {
+		if (!list_empty(&iccom->p->tx_active_channels[lvl])) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Helper. Checks if we have consumer messages (or their parts) which
+// are not put into the TX packages yet.
+//
+// LOCKING: TX queue should be locked before this call
+static bool __iccom_queue_have_messages(struct iccom_dev *iccom)
+{
+	__iccom_queue_take_submitted(iccom);
+
+	if (!list_empty(&iccom->p->tx_unresolved)) {
+		return true;
+	}
+	for (int lvl = 0; lvl < ICCOM_TX_PRIORITY_LEVELS_COUNT; lvl++) {
+		if (!list_empty(&iccom->p->tx_active_channels[lvl])) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Helper. Updates the link idle state upon the finished frame: the
+// link is idle if neither side has anything to send.
+//
+// @tx_pending if true, then we have something to send (see
+//      __iccom_queue_have_pending)
+// @rx_data if true, then the other side package received within the
+//      frame carries consumer data
+//
+// CONCURRENCE: called only from transport layer return points
+//
+// RETURNS:
+//      true: if the next frame should be started immediately
+//      false: if the link is idle, then the next frame is started on
+//          consumer data post or by the other side
+static bool __iccom_link_idle_update(struct iccom_dev *iccom
+				     , const bool tx_pending
+				     , const bool rx_data)
+{
+	const bool idle = !tx_pending && !rx_data;
+
+	if (idle && !iccom->p->idle) {
+		ICCOM_STATS_INC(iccom->p, idle_periods);
+		iccom_info(ICCOM_LOG_INFO_DBG_LEVEL, "link is idle");
+	}
+	iccom->p->idle = idle;
+	return !idle;
+}
+
+// Helper. Frees all pending TX messages, all TX channel records and
+// TX statistics records.
+//
+// LOCKING: TX queue should be locked before this call
+static void __iccom_queue_free_messages(struct iccom_dev *iccom)
+{
+	struct iccom_tx_channel *ch;
+	struct iccom_tx_channel *tmp;
+	struct iccom_tx_message *msg;
+	struct iccom_tx_message *msg_tmp;
+
+	llist_for_each_entry_safe(msg, msg_tmp
+			, llist_del_all(&iccom->p->tx_submitted)
+			, submit_anchor) {
+		__iccom_tx_release_bytes(iccom, msg->length);
+		kfree(msg->data);
+		kfree(msg);
+	}
+	list_for_each_entry_safe(msg, msg_tmp, &iccom->p->tx_unresolved
+				 , list_anchor) {
+		list_del(&msg->list_anchor);
+		__iccom_tx_release_bytes(iccom, msg->length);
+		kfree(msg->data);
+		kfree(msg);
+	}
+
+	list_for_each_entry_safe(ch, tmp, &iccom->p->tx_channels
+				 , all_anchor) {
+		for (int lvl = 0; lvl < ICCOM_TX_PRIORITY_LEVELS_COUNT; lvl++) {
+			while (!list_empty(&ch->messages[lvl])) {
+				msg = __iccom_get_tx_msg_from_list_anchor(
+						ch->messages[lvl].next);
+				__iccom_tx_release_bytes(iccom
+						, msg->length - msg->offset);
+				__iccom_tx_message_free(msg);
+			}
+			list_del(&ch->sched_anchor[lvl]);
+		}
+		list_del(&ch->all_anchor);
+		kfree(ch);
+	}
+	iccom->p->tx_min_rate_channels_count = 0;
+
+	struct iccom_tx_stats *stats;
+	struct iccom_tx_stats *stats_tmp;
+	list_for_each_entry_safe(stats, stats_tmp, &iccom->p->tx_stats
+				 , anchor) {
+		list_del(&stats->anchor);
+		kfree(stats);
+	}
+}
+
+// Helper. Moves TX package queue one step forward.
+// If there are multiple data packages, simply discards the heading
+// package. If there is only one package (which is supposed to be
+// just sent), then empties it, updates its ID and size, fills it up with
+// pending TX messages data (see __iccom_queue_fill_package) and
+// finalizes it so it is ready for next xfer.
+//
+// To be called when the first in TX queue package xfer was
+// proven to be done successfully (its ACK was received).
+//
+// NOTE: thread safe
+//
+// RETURNS:
+//      if there is a non-empty package for xfer from our side.
+static bool __iccom_queue_step_forward(struct iccom_dev *iccom)
+{
+#ifdef ICCOM_DEBUG
+	ICCOM_CHECK_DEVICE("", return false);
+	ICCOM_CHECK_DEVICE_PRIVATE("", return false);
+	if (!__iccom_have_packages(iccom)) {
+		iccom_err("empty TX packages: logical error");
+		return false;
+	}
+#endif
+	bool have_data;
+	// this function is called indirectly by transport layer below,
+	// while the TX queue can be updated independently by the
+	// consumer, so need mutex here for protection
+	mutex_lock(&iccom->p->tx_queue_lock);
+
+	// if we have more than one package in the queue, this
+	// means we have some our data to send in further packages
+	if (__iccom_have_multiple_packages(iccom)) {
+		struct iccom_package *delivered_package
+			     = __iccom_get_first_tx_package(iccom);
+		__iccom_queue_package_acked(iccom, delivered_package);
+		__iccom_package_free(delivered_package);
+		ICCOM_STATS_DEC(iccom->p, packages_in_tx_queue);
+		have_data = true;
+		goto finalize;
+	}
+
+	// we have only one package in queue
+	struct iccom_package *delivered_package
+		= __iccom_get_first_tx_package(iccom);
+	__iccom_queue_package_acked(iccom, delivered_package);
+
+	// set this package empty, update with new id and put
+	// the most urgent pending data into it
+	int next_id = __iccom_get_next_package_id(iccom);
+	__iccom_package_set_id(delivered_package, next_id);
+	__iccom_package_set_payload_size(delivered_package, 0);
+	delivered_package->sent = false;
+	delivered_package->rebuilt_of = -1;
+	delivered_package->sacked = false;
+	// NOTE: if resize fails, the package is to be fit later by
+	//      __iccom_queue_fit_packages
+	__iccom_package_resize(delivered_package
+			       , iccom->p->data_xfer_size_bytes);
+	have_data = __iccom_queue_fill_package(iccom, delivered_package);
+	delivered_package->carries_data = have_data;
+finalize:
+	mutex_unlock(&iccom->p->tx_queue_lock);
+	return have_data;
+}
+
+// Helper. Piggyback acks mode. Drops the sent TX packages which are
+// confirmed by the other side ack.
+//
+// @ack_id the ID of the last package the other side received in
+//      order
+//
+// LOCKING: TX queue should be locked before this call
+static void __iccom_queue_pb_apply_ack(struct iccom_dev *iccom
+				       , const int ack_id)
+{
+	struct iccom_dev_private *p = iccom->p;
+	struct iccom_package *acked = NULL;
+	struct iccom_package *pkg;
+
+	if (!p->tx_last_sent) {
+		return;
+	}
+
+	list_for_each_entry(pkg, &p->tx_data_packages_head, list_anchor) {
+		if (__iccom_package_get_id(pkg) == ack_id) {
+			acked = pkg;
+		}
+		if (pkg == p->tx_last_sent) {
+			break;
+		}
+	}
+	if (!acked) {
+		return;
+	}
+
+	if (acked == p->tx_last_sent) {
+		p->tx_last_sent = NULL;
+	}
+	while (true) {
+		pkg = __iccom_get_first_tx_package(iccom);
+		const bool last = (pkg == acked);
+		if (pkg == p->tx_next) {
+			p->tx_next = NULL;
+		}
+		__iccom_queue_package_acked(iccom, pkg);
+		__iccom_package_free(pkg);
+		ICCOM_STATS_DEC(p, packages_in_tx_queue);
+		ICCOM_STATS_INC(p, packages_sent_ok);
+		if (last) {
+			break;
+		}
+	}
+}
+
+// Helper. Piggyback acks mode. Marks the sent TX packages which are
+// confirmed by the other side selective ack.
+//
+// @ack_id the ID of the last package the other side received in
+//      order
+// @sack_mask the selective ack bit mask (see ICCOM_TECH_REC_ACK)
+//
+// LOCKING: TX queue should be locked before this call
+static void __iccom_queue_pb_apply_sack(struct iccom_dev *iccom
+					, const int ack_id
+					, const unsigned int sack_mask)
+{
+	struct iccom_dev_private *p = iccom->p;
+	struct iccom_package *pkg;
+
+	if (!p->tx_last_sent || !sack_mask) {
+		return;
+	}
+
+	list_for_each_entry(pkg, &p->tx_data_packages_head, list_anchor) {
+		const unsigned int bit = (__iccom_package_get_id(pkg)
+					  - ack_id - 2) & 0xFF;
+		if (bit < 8 && (sack_mask & (1u << bit))) {
+			pkg->sacked = true;
+			__iccom_queue_package_acked(iccom, pkg);
+		}
+		if (pkg == p->tx_last_sent) {
+			break;
+		}
+	}
+}
+
+// Helper. Piggyback acks mode. Selects the oldest package in flight
+// which is not confirmed by the other side yet.
+//
+// @lost_only if true, then only the packages which were sent before
+//      the finished frame are considered (the other side ack for
+//      them already came, so they are lost)
+// @frame the number of the finished frame
+// @in_flight__out {valid ptr || NULL} set to the number of packages
+//      in flight
+//
+// LOCKING: TX queue should be locked before this call
+//
+// RETURNS:
+//      the selected package, if found
+//      NULL: else
+static struct iccom_package *__iccom_queue_pb_oldest_unacked(
+		struct iccom_dev *iccom, const bool lost_only
+		, const unsigned long frame, unsigned int *in_flight__out)
+{
+	struct iccom_dev_private *p = iccom->p;
+	struct iccom_package *found = NULL;
+	struct iccom_package *pkg;
+	unsigned int in_flight = 0;
+
+	if (p->tx_last_sent) {
+		list_for_each_entry(pkg, &p->tx_data_packages_head
+				    , list_anchor) {
+			in_flight++;
+			if (!found && !pkg->sacked
+			    && (!lost_only || pkg->sent_frame < frame)) {
+				found = pkg;
+			}
+			if (pkg == p->tx_last_sent) {
+				break;
+			}
+		}
+	}
+	if (in_flight__out) {
+		*in_flight__out = in_flight;
+	}
+	return found;
+}
+
+// Helper. Piggyback acks mode. Applies the other side ack and selects
+// the TX package for the next frame (selective repeat).
+//
+// Up to @link_window packages are sent without waiting for acks (a
+// single one if the other side ack is unknown for now). The
+// other side ack comes with one frame delay, so the package sent
+// before the finished frame which is neither acked cumulatively nor
+// selectively is lost and is resent first (the oldest one). Otherwise
+// the next new package is sent (created and filled up if needed) if
+// the window allows, else the oldest not acked package is repeated.
+// The package ack record is updated with the ID of the last package
+// we received in order and with the packages we hold out of order.
+//
+// @ack_id the ID of the last package the other side received in
+//      order, < 0 if unknown
+// @sack_mask the selective ack bit mask (see ICCOM_TECH_REC_ACK)
+//
+// LOCKING: TX queue should be locked before this call
+//
+// RETURNS:
+//      the package to be sent within the next frame
+static struct iccom_package *__iccom_queue_pb_next(
+		struct iccom_dev *iccom, const int ack_id
+		, const unsigned int sack_mask)
+{
+	struct iccom_dev_private *p = iccom->p;
+	struct list_head *const head = &p->tx_data_packages_head;
+	const unsigned long frame = p->pb_frames++;
+	struct iccom_package *pkg;
+	unsigned int in_flight;
+
+	// the package next to the last sent one is created before the
+	// ack is applied, so the TX queue never gets empty
+	if (!p->tx_last_sent || p->tx_last_sent->list_anchor.next == head) {
+		if (__iccom_enqueue_new_tx_data_package(iccom) < 0) {
+			// the other side will repeat its ack within the
+			// next frame, so just resending for now
+			iccom_err("no memory for next package, resending");
+			p->tx_next = __iccom_get_first_tx_package(iccom);
+			goto finalize;
+		}
+		pkg = __iccom_get_last_tx_package(iccom);
+		pkg->carries_data = __iccom_queue_fill_package(iccom, pkg);
+	}
+
+	if (ack_id >= 0) {
+		__iccom_queue_pb_apply_ack(iccom, ack_id);
+		__iccom_queue_pb_apply_sack(iccom, ack_id, sack_mask);
+	}
+
+	// NOTE: without the other side ack we keep single package in
+	//      flight, cause the other side might have fallen back to
+	//      the legacy protocol which doesn't expect the packages
+	//      out of order
+	const unsigned int window = ack_id >= 0 ? p->link_window : 1;
+
+	p->tx_next = __iccom_queue_pb_oldest_unacked(iccom, ack_id >= 0
+						     , frame, &in_flight);
+	if (p->tx_next) {
+		ICCOM_STATS_INC(p, packages_resent);
+	} else if (in_flight < window) {
+		p->tx_last_sent = __iccom_get_package_from_list_anchor(
+					  p->tx_last_sent
+					  ? p->tx_last_sent->list_anchor.next
+					  : head->next);
+		p->tx_next = p->tx_last_sent;
+	} else {
+		// window is full: repeating while waiting for acks
+		p->tx_next = __iccom_queue_pb_oldest_unacked(iccom, false
+							     , frame, NULL);
+		if (!p->tx_next) {
+			p->tx_next = __iccom_get_first_tx_package(iccom);
+		}
+	}
+	p->tx_next->sent_frame = frame + 1;
+finalize:
+	__iccom_package_set_ack(p->tx_next, p->last_rx_package_id
+				, __iccom_pb_rx_sack_mask(iccom)
+				, p->link_fallback_requested);
+	return p->tx_next;
+}
+
+// Helper. Piggyback acks mode with batching. Selects the packages to
+// be sent within the next frame together with @tx_next (see
+// __iccom_queue_pb_next) into @tx_batch: the lost packages first,
+// then the new packages with consumer data while the window allows.
+// The empty packages are not batched (to keep IDs and window for the
+// data), so the batch might be not full.
+//
+// @ack_id the ID of the last package the other side received in
+//      order, < 0 if unknown (then only @tx_next is sent)
+//
+// LOCKING: TX queue should be locked before this call
+static void __iccom_queue_pb_batch(struct iccom_dev *iccom
+				   , const int ack_id)
+{
+	struct iccom_dev_private *p = iccom->p;
+	struct list_head *const head = &p->tx_data_packages_head;
+	const unsigned long frame = p->pb_frames - 1;
+	const unsigned int sack_mask = __iccom_pb_rx_sack_mask(iccom);
+
+	p->tx_batch[0] = p->tx_next;
+	p->tx_batch_count = 1;
+
+	if (ack_id < 0) {
+		return;
+	}
+
+	while (p->tx_batch_count < p->link_batch) {
+		unsigned int in_flight;
+		struct iccom_package *pkg = __iccom_queue_pb_oldest_unacked(
+						iccom, true, frame, &in_flight);
+		if (pkg) {
+			ICCOM_STATS_INC(p, packages_resent);
+		} else {
+			if (in_flight >= p->link_window) {
+				break;
+			}
+			if (p->tx_last_sent
+			    && p->tx_last_sent->list_anchor.next == head) {
+				if (!__iccom_queue_have_messages(iccom)
+				    || __iccom_enqueue_new_tx_data_package(
+						iccom) < 0) {
+					break;
+				}
+				pkg = __iccom_get_last_tx_package(iccom);
+				pkg->carries_data
+					= __iccom_queue_fill_package(iccom, pkg);
+			}
+			pkg = __iccom_get_package_from_list_anchor(
+					p->tx_last_sent
+					? p->tx_last_sent->list_anchor.next
+					: head->next);
+			if (!pkg->carries_data || pkg == p->tx_next) {
+				break;
+			}
+			p->tx_last_sent = pkg;
+		}
+		pkg->sent_frame = frame + 1;
+		__iccom_package_set_ack(pkg, p->last_rx_package_id
+					, sack_mask, p->link_fallback_requested);
+		p->tx_batch[p->tx_batch_count++] = pkg;
+	}
+}
+
+// Frees whole TX queue (should be called only on ICCom
+// destruction when all external calls which might modify the
+// TX queue are already disabled).
+static void __iccom_queue_free(struct iccom_dev *iccom)
+{
+#ifdef ICCOM_DEBUG
+	if (!__iccom_have_packages(iccom)) {
+	    iccom_err("empty TX packages");
+	}
+#endif
+	mutex_lock(&iccom->p->tx_queue_lock);
+
+	struct iccom_package *first_package
+		    = __iccom_get_first_tx_package(iccom);
+
+	while (first_package) {
+	    __iccom_package_free(first_package);
+	    first_package = __iccom_get_first_tx_package(iccom);
+	}
+
+	__iccom_queue_free_messages(iccom);
+
+	// freeing the TX queue access
+	mutex_unlock(&iccom->p->tx_queue_lock);
+
+	mutex_destroy(&iccom->p->tx_queue_lock);
+}
+
+// Helper. Submits given message to be enqueued into the TX messages
+// queue of its channel, the channel is activated at the TX priority
+// level which corresponds to the message @priority. The message data
+// is copied, and will be written into the TX packages when the next
+// package is built (see __iccom_queue_fill_package).
+//
+// NOTE: the message is only added to the lock-free submission queue
+//      (see @tx_submitted) here, so the consumers never wait for the
+//      TX queue lock, which is taken by the transport layer; the
+//      package builder puts the message into its channel queue.
+//
+// NOTE: every message is queued and sent at its own priority level,
+//      the messages of the same channel keep their order within the
+//      level only. The legacy protocol doesn't allow shuffling of
+//      the message parts within the channel, so the message which is
+//      partially written into the TX packages is finished before any
+//      other message of the channel (see __iccom_tx_channel_hold).
+//
+// NOTE: the message is rejected if the TX queue has no room for it
+//      (see ICCOM_TX_QUEUE_MAX_BYTES).
+//
+// CONCURRENCE: thread safe, lock-free
+//
+// RETURNS:
+//      < 0 : the negated error number
+//          -EAGAIN: the TX queue is full
+//      0   : success
+static int __iccom_queue_append_message(struct iccom_dev *iccom
+			       , char *data, const size_t length
+			       , unsigned int channel
+			       , unsigned int priority)
+{
+#ifdef ICCOM_DEBUG
+	ICCOM_CHECK_DEVICE("", return -ENODEV);
+	ICCOM_CHECK_CHANNEL("", return -EBADSLT);
+	if (IS_ERR_OR_NULL(data)) {
+		iccom_err("bad data pointer");
+		return -EINVAL;
+	}
+	if (!length) {
+		iccom_err("bad data length");
+		return -ENODATA;
+	}
+	if (!__iccom_have_packages(iccom)) {
+		iccom_err("empty TX packages: logical error");
+		return -EFAULT;
+	}
+#endif
+
+	// the room is reserved before the check, so the concurrent
+	// consumers can't overfill the queue together
+	const size_t queued = (size_t)atomic_add_return((int)length
+					, &iccom->p->tx_queued_bytes) - length;
+	if (queued != 0
+	    && queued + length > (size_t)READ_ONCE(tx_queue_max_bytes)) {
+		__iccom_tx_release_bytes(iccom, length);
+		return -EAGAIN;
+	}
+
+	struct iccom_tx_message *msg = kmalloc(sizeof(*msg), GFP_KERNEL);
+	if (!msg) {
+		iccom_err("no memory for new TX message");
+		__iccom_tx_release_bytes(iccom, length);
+		return -ENOMEM;
+	}
+	msg->data = kmalloc(length, GFP_KERNEL);
+	if (!msg->data) {
+		iccom_err("no memory for new TX message data");
+		__iccom_tx_release_bytes(iccom, length);
+		kfree(msg);
+		return -ENOMEM;
+	}
+	memcpy(msg->data, data, length);
+	msg->length = length;
+	msg->offset = 0;
+	msg->channel = channel;
+	msg->priority = priority;
+	msg->level = __iccom_tx_priority_level(priority);
+	msg->posted_ns = ktime_to_ns(ktime_get());
+	INIT_LIST_HEAD(&msg->list_anchor);
+
+	llist_add(&msg->submit_anchor, &iccom->p->tx_submitted);
+	return 0;
+}
+
+// Helper. Adds new message to the storage channel. If channel does
+// not exist, creates it. Returns pointer to newly created message.
+//
+// @iccom {valid iccom pointer}
+// @channel {valid channel number} the channel to add the new message
+//
+// CONCURRENCE: thread safe
+// OWNERSHIP: of the new message belongs to the storage
+//
+// RETURNS:
+//      !NULL: valid pointer to newly created and initialized
+//          iccom_message
+//      NULL: if fails
+static struct iccom_message *__iccom_construct_message_in_storage(
+		struct iccom_dev *iccom
+		, unsigned int channel)
+{
+	struct iccom_message *msg;
+	msg = kmalloc(sizeof(struct iccom_message), GFP_KERNEL);
+	if (IS_ERR_OR_NULL(msg)) {
+		iccom_err("No memory for new message");
+		return NULL;
+	}
+	// TODO: allocate either the message maximum or expected
+	// (if known) size to avoid reallocation
+	__iccom_message_init(msg);
+	msg->channel = channel;
+
+	if (iccom_msg_storage_push_message(&iccom->p->rx_messages
+					   , msg) != 0) {
+		kfree(msg);
+		return NULL;
+	}
+	return msg;
+}
+
+// Helper. Parses the next packet from the package. Starts at given
+// position and if parsing is successful adds the parsed consumer data
+// into the iccom consumer messages storage.
+//
+// @iccom {valid iccom ptr}
+// @start_from {valid ptr} the pointer to the first packet byte
+//      (first byte of packet header)
+// @max_bytes_available the maximum possible total packet size (in
+//      bytes), this is usually equal to the number of bytes left till
+//      the end of the package payload area.
+//      NOTE: any value less than minimal possible packet size
+//          immediately will lead to parsing error.
+// @consumer_bytes_count__out {NULL | valid ptr}: pointer to the
+//      output variable where to ADD number of consumer bytes
+//      parced from the packet. If not valid ptr - not used.
+// @finalized_message__out {NULL | valid ptr}: pointer to the
+//      output variable where to WRITE, if the message was just
+//      finalized. If not valid ptr - not used.
+// @consumer_only if true, then the technical packet is skipped (it
+//      was already applied, see __iccom_rx_package_payload).
+//
+// NOTE: if parsing of a packet failed, then all rest packets from
+//      given package will be dropped, as long as the parsing
+//      will be unreliable.
+//
+// CONCURRENCE: no simultaneous calls allowed, but finalized messages
+//      storage can be read by consumer freely
+//
+// RETURNS:
+//      >0: size of data read from the start (equals to the size of the
+//          package which was read (in bytes)), this also means that
+//          parsing of the packet was successful.
+//       0: caller provided 0 bytes available, so nothing left to parse
+//      <0: negative error number if parsing failed
+static int __iccom_read_next_packet(struct iccom_dev __kernel *iccom
+	, void __kernel *start_from
+	, size_t max_bytes_available
+	, size_t *consumer_bytes_count__out
+	, bool *finalized_message__out
+	, const bool consumer_only)
+{
+#ifdef ICCOM_DEBUG
+	ICCOM_CHECK_DEVICE("", return -ENODEV);
+	ICCOM_CHECK_DEVICE_PRIVATE("", return -EINVAL);
+	ICCOM_CHECK_PTR(start_from, return -EINVAL);
+#endif
+	if (max_bytes_available == 0) {
+		return 0;
+	}
+
+	struct iccom_packet packet;
+	int res = __iccom_packet_parse_into_struct(start_from
+				    , max_bytes_available, &packet);
+	if (res < 0) {
+		iccom_err("Broken packet detected.");
+		return res;
+	}
+
+	if (ICCOM_LINK_NEGOTIATION
+	    && packet.channel == ICCOM_TECHNICAL_CHANNEL_ID) {
+		res = consumer_only ? 0
+				    : __iccom_tech_packet_process(iccom, &packet);
+		if (res < 0) {
+			iccom_err("Broken technical packet detected.");
+			return res;
+		}
+		if (!IS_ERR_OR_NULL(consumer_bytes_count__out)) {
+			*consumer_bytes_count__out = 0;
+		}
+		if (!IS_ERR_OR_NULL(finalized_message__out)) {
+			*finalized_message__out = false;
+		}
+		return iccom_packet_packet_size_bytes(packet.payload_length);
+	}
+
+	// while message id is not used we always append data to the
+	// latest message within the channel
+	// TODO: adapt as protocol includes message ID
+	struct iccom_message *msg
+			= iccom_msg_storage_get_last_unfinalized_message(
+					    &iccom->p->rx_messages
+					    , packet.channel);
+
+	if (!msg) {
+		msg = __iccom_construct_message_in_storage(
+				iccom, packet.channel);
+		if (!msg) {
+			iccom_err("No memory for incoming message.");
+			return -ENOMEM;
+		}
+	}
+
+	res = iccom_msg_storage_append_data_to_message(
+		    &iccom->p->rx_messages, msg->channel, msg->id
+		    , packet.payload, packet.payload_length
+		    , packet.finalizing);
+
+	if (res < 0) {
+		return res;
+	}
+	if (!IS_ERR_OR_NULL(consumer_bytes_count__out)) {
+		*consumer_bytes_count__out = packet.payload_length;
+	}
+	if (!IS_ERR_OR_NULL(finalized_message__out)) {
+		*finalized_message__out = packet.finalizing;
+	}
+
+	return iccom_packet_packet_size_bytes(packet.payload_length);
+}
+
+// Helper. Full parsing of the package and dispatching all its packets
+// to the consumer messages storage.
+//
+// @iccom {valid iccom ptr}
+// @start_from {valid ptr} to the first byte of the package
+//      payload.
+// @payload_size {>=0} the exact size of the package payload in bytes
+// @consumer_only if true, then only the consumer packets are applied
+//      (the technical records of the package were already applied,
+//      see __iccom_rx_package_payload)
+//
+// Rolls back the applied changes from the package if parsing
+// fails at some point. So the message storage is guaranteed to
+// remain in selfconsistent state: either whole package is
+// applied or whole package is not applied.
+//
+// To be called directly or indirectly by transport layer.
+//
+// CONCURRENCE: no simultaneous calls allowed, protected
+//      async reading of finalized messages is OK.
+//
+// RETURNS:
+//      0: on successful parsing of the whole package
+//      -EBADMSG: if parsing failed (also due to out-of-memory conditions)
+static int __iccom_process_package_payload(
+		struct iccom_dev __kernel *iccom
+		, void __kernel *start_from
+		, size_t payload_size
+		, const bool consumer_only)
+{
+	int packets_done = 0;
+	size_t bytes_to_parse = payload_size;
+	void *start = start_from;
+	size_t consumer_bytes_parsed_total = 0;
+
+	if (!consumer_only) {
+		memset(&iccom->p->rx_link_offer_uncommitted, 0
+		       , sizeof(iccom->p->rx_link_offer_uncommitted));
+	}
+
+	while (bytes_to_parse > 0) {
+		int bytes_read = __iccom_read_next_packet(iccom
+					    , start, bytes_to_parse
+					    , &consumer_bytes_parsed_total
+					    , NULL, consumer_only);
+		if (bytes_read <= 0) {
+			iccom_msg_storage_rollback(&iccom->p->rx_messages);
+			iccom_err("Package parsing failed on %d packet"
+				  "(starting from 0). Error code: %d"
+				  , packets_done, bytes_read);
+			print_hex_dump(KERN_WARNING, ICCOM_LOG_PREFIX
+				       ": Failed package payload: ", 0, 16, 1
+				       , start_from, payload_size, true);
+			// NOTE: the no-memory case is aggregated here also
+			// 	to ask other size to resend the message
+			return -EBADMSG;
+		}
+
+		start += bytes_read;
+		bytes_to_parse -= bytes_read;
+		packets_done++;
+	}
+
+	int finalized = iccom_msg_storage_uncommitted_finalized_count(
+				&iccom->p->rx_messages);
+	iccom_msg_storage_commit(&iccom->p->rx_messages);
+	if (!consumer_only) {
+		iccom->p->last_rx_link_offer
+			= iccom->p->rx_link_offer_uncommitted;
+	}
+
+	ICCOM_STATS_ADD(iccom->p, packets_received_ok, packets_done);
+	ICCOM_STATS_ADD(iccom->p, messages_received_ok, finalized);
+	ICCOM_STATS_ADD(iccom->p, total_consumers_bytes_received_ok
+			, consumer_bytes_parsed_total);
+	ICCOM_STATS_ADD(iccom->p, messages_ready_in_storage, finalized);
+
+	if (finalized > 0) {
+		// notify consumer if there is any new ready messages
+		__iccom_schedule_work(iccom
+				, &iccom->p->consumer_delivery_work);
+	}
+	return 0;
+}
+
+#if ICCOM_RX_PIPELINED
+// Helper. Pipelined RX mode. Verifies the packets layout of the
+// received package payload and applies its technical records, the
+// consumer packets are not touched.
+//
+// @iccom {valid iccom ptr}
+// @start_from {valid ptr} to the first byte of the package
+//      payload.
+// @payload_size {>=0} the exact size of the package payload in bytes
+// @consumer_data__out {valid ptr} set to true if the package has
+//      at least one consumer packet
+//
+// CONCURRENCE: called only from transport layer return points
+//
+// RETURNS:
+//      0: if the package payload is fine
+//      -EBADMSG: if the package payload is broken
+static int __iccom_rx_payload_verify(struct iccom_dev *iccom
+				     , void *start_from
+				     , const size_t payload_size
+				     , bool *consumer_data__out)
+{
+	size_t bytes_left = payload_size;
+	void *start = start_from;
+
+	memset(&iccom->p->rx_link_offer_uncommitted, 0
+	       , sizeof(iccom->p->rx_link_offer_uncommitted));
+	*consumer_data__out = false;
+
+	while (bytes_left > 0) {
+		struct iccom_packet packet;
+		if (__iccom_packet_parse_into_struct(start, bytes_left
+						     , &packet) < 0) {
+			iccom_err("Broken packet detected.");
+			return -EBADMSG;
+		}
+		if (ICCOM_LINK_NEGOTIATION
+		    && packet.channel == ICCOM_TECHNICAL_CHANNEL_ID) {
+			if (__iccom_tech_packet_process(iccom, &packet) < 0) {
+				iccom_err("Broken technical packet detected.");
+				return -EBADMSG;
+			}
+		} else {
+			*consumer_data__out = true;
+		}
+		const size_t packet_size = iccom_packet_packet_size_bytes(
+						   packet.payload_length);
+		start += packet_size;
+		bytes_left -= packet_size;
+	}
+	return 0;
+}
+
+// Pipelined RX mode. The work routine which parses the queued
+// received package payloads into the messages storage in order of
+// receiving.
+//
+// NOTE: the package is acked already, so the payload which fails to
+//      be parsed (no memory) is kept at the head of @rx_parse_pending
+//      and the work is rescheduled to parse it again.
+static void __iccom_rx_parse_routine(struct iccom_work_struct *work)
+{
+	if (IS_ERR_OR_NULL(work)) {
+		iccom_err("no RX parsing work provided");
+		return;
+	}
+
+	struct iccom_dev_private *iccom_p = container_of(work
+		, struct iccom_dev_private, rx_parse_work);
+
+	// the queue is LIFO, new payloads go after the pending ones
+	struct llist_node *fresh = llist_reverse_order(
+			llist_del_all(&iccom_p->rx_parse_queue));
+	struct llist_node **tail = &iccom_p->rx_parse_pending;
+	while (*tail) {
+		tail = &(*tail)->next;
+	}
+	*tail = fresh;
+
+	while (iccom_p->rx_parse_pending) {
+		struct iccom_rx_payload *entry = llist_entry(
+				iccom_p->rx_parse_pending
+				, struct iccom_rx_payload, anchor);
+
+		if (__iccom_process_package_payload(iccom_p->iccom
+				, entry->payload, entry->size, true) != 0) {
+			// the messages storage is rolled back, so the
+			// payload can be parsed again from scratch
+			ICCOM_STATS_INC(iccom_p, packages_parsing_failed);
+			iccom_warning("acked package parsing failed, will"
+				      " retry");
+			if (!iccom_p->closing) {
+				__iccom_schedule_work(iccom_p->iccom, work);
+			}
+			return;
+		}
+		iccom_p->rx_parse_pending = entry->anchor.next;
+		kfree(entry);
+	}
+}
+
+// Helper. Pipelined RX mode. Drops all queued received package
+// payloads.
+static void __iccom_rx_parse_queue_free(struct iccom_dev *iccom)
+{
+	struct iccom_rx_payload *entry;
+	struct iccom_rx_payload *tmp;
+
+	llist_for_each_entry_safe(entry, tmp
+			, llist_del_all(&iccom->p->rx_parse_queue), anchor) {
+		kfree(entry);
+	}
+	llist_for_each_entry_safe(entry, tmp, iccom->p->rx_parse_pending
+				  , anchor) {
+		kfree(entry);
+	}
+	iccom->p->rx_parse_pending = NULL;
+}
+#endif
+
+// Helper. Applies the payload of the received package: parses it into
+// the messages storage right away, or (in pipelined RX mode, see
+// ICCOM_RX_PIPELINED) applies its technical records and queues the
+// rest for parsing by the dedicated work.
+//
+// @iccom {valid iccom ptr}
+// @start_from {valid ptr} to the first byte of the package
+//      payload.
+// @payload_size {>=0} the exact size of the package payload in bytes
+//
+// CONCURRENCE: called only from transport layer return points
+//
+// RETURNS:
+//      0: on success, the package can be acked
+//      -EBADMSG: if the package is broken (also due to out-of-memory
+//          conditions), nothing is applied, so the other side
+//          should resend the package
+static int __iccom_rx_package_payload(struct iccom_dev *iccom
+				      , void *start_from
+				      , const size_t payload_size)
+{
+#if ICCOM_RX_PIPELINED
+	bool consumer_data;
+	if (__iccom_rx_payload_verify(iccom, start_from, payload_size
+				      , &consumer_data) < 0) {
+		return -EBADMSG;
+	}
+
+	if (consumer_data) {
+		struct iccom_rx_payload *entry
+			= kmalloc(sizeof(*entry) + payload_size, GFP_KERNEL);
+		if (!entry) {
+			iccom_err("no memory for RX package payload");
+			return -EBADMSG;
+		}
+		entry->size = payload_size;
+		memcpy(entry->payload, start_from, payload_size);
+		llist_add(&entry->anchor, &iccom->p->rx_parse_queue);
+		__iccom_schedule_work(iccom, &iccom->p->rx_parse_work);
+	}
+
+	iccom->p->last_rx_link_offer = iccom->p->rx_link_offer_uncommitted;
+	return 0;
+#else
+	return __iccom_process_package_payload(iccom, start_from
+					       , payload_size, false);
+#endif
+}
+
+// Helper. Initiates the xfer of the first package in TX queue using
+// the underlying transport layer. We must have finalized data package
+// in TX queue before calling this function.
+//
+// NOTE: if the underlying transport is busy, then we will not shedule
+//      xfer here, but in xfer-done callback.
+//
+// RETURNS:
+//      0 on success
+//      < 0 - the negative error code
+static int __iccom_initiate_data_xfer(struct iccom_dev *iccom)
+{
+#ifdef ICCOM_DEBUG
+	ICCOM_CHECK_DEVICE("", return -ENODEV);
+	ICCOM_CHECK_DEVICE_PRIVATE("", return -EINVAL);
+#endif
+	if (!__iccom_have_packages(iccom)) {
+		iccom_err("No data to be sent.");
+		return -ENODATA;
+	}
+
+	// to guarantee selfconsistence, we will just trigger
+	// current xfer, while the xfer data is only to be updated
+	// from the xfer done callback, the xfer done callback is
+	// guaranteed to be called after data_xchange(...) invocation
+	int res = iccom->xfer_iface.data_xchange(
+			iccom->xfer_device, NULL, false);
+
+	switch (res) {
+	case FULL_DUPLEX_ERROR_NOT_READY:
+		return 0;
+	case FULL_DUPLEX_ERROR_NO_DEVICE_PROVIDED:
+		iccom_err("No underlying xfer device provided");
+		return -ENODEV;
+	default: return 0;
+	}
+}
+
+
+// Helper. Piggyback acks mode. Accepts the package which is the next
+// in order from the other side.
+//
+// @rx_pkg {valid ptr to package with verified payload size}
+// @payload_size the verified package payload size
+//
+// CONCURRENCE: called only from transport layer return points
+//
+// RETURNS:
+//      true: if the package was accepted
+//      false: if the package data is broken (it will be resent)
+static bool __iccom_pb_rx_accept(struct iccom_dev *iccom
+				 , struct iccom_package *rx_pkg
+				 , const size_t payload_size)
+{
+	struct iccom_dev_private *p = iccom->p;
+
+	if (__iccom_package_rx_already_received(iccom, rx_pkg)) {
+		ICCOM_STATS_INC(p, packages_duplicated_received);
+	} else if (__iccom_rx_package_payload(iccom
+			, __iccom_package_payload_start_addr(rx_pkg)
+			, payload_size) != 0) {
+		ICCOM_STATS_INC(p, packages_parsing_failed);
+		return false;
+	} else {
+		ICCOM_STATS_INC(p, packages_received_ok);
+	}
+	__iccom_package_rx_accepted(iccom, rx_pkg);
+	return true;
+}
+
+// Helper. Piggyback acks mode. Handles the received package with
+// verified data: accepts it if it is the next in order (together with
+// all packages we hold which follow it), or holds it if it fits into
+// the RX window.
+//
+// @rx_pkg {valid ptr to package with verified payload size}
+// @payload_size the verified package payload size
+//
+// CONCURRENCE: called only from transport layer return points
+//
+// RETURNS:
+//      true: if the link made progress
+//      false: else (duplicated, out of window or broken package)
+static bool __iccom_pb_rx_package(struct iccom_dev *iccom
+				  , struct iccom_package *rx_pkg
+				  , const size_t payload_size)
+{
+	struct iccom_dev_private *p = iccom->p;
+	const int rx_pkg_id = __iccom_package_get_id(rx_pkg);
+	const unsigned int offset = (rx_pkg_id - p->last_rx_package_id - 1)
+				    & 0xFF;
+	struct iccom_package *slot;
+
+	if (offset == 0) {
+		if (!__iccom_pb_rx_accept(iccom, rx_pkg, payload_size)) {
+			return false;
+		}
+		while ((slot = __iccom_pb_rx_window_find(iccom
+				, (p->last_rx_package_id + 1) & 0xFF))) {
+			bool ok;
+			const size_t size = __iccom_package_payload_size(slot
+									 , &ok);
+			const bool accepted = __iccom_pb_rx_accept(iccom, slot
+								   , size);
+			kfree(slot->data);
+			slot->data = NULL;
+			slot->size = 0;
+			if (!accepted) {
+				break;
+			}
+		}
+		return true;
+	}
+
+	if (offset >= p->link_window
+		    || __iccom_pb_rx_window_find(iccom, rx_pkg_id)) {
+		ICCOM_STATS_INC(p, packages_duplicated_received);
+		return false;
+	}
+
+	// NOTE: the window has a free slot as long as the other side
+	//      respects it
+	slot = __iccom_pb_rx_window_find(iccom, -1);
+	if (!slot) {
+		ICCOM_STATS_INC(p, packages_duplicated_received);
+		return false;
+	}
+	slot->data = kmalloc(rx_pkg->size, GFP_KERNEL);
+	if (!slot->data) {
+		iccom_err("no memory, dropping out of order package");
+		return false;
+	}
+	memcpy(slot->data, rx_pkg->data, rx_pkg->size);
+	slot->size = rx_pkg->size;
+	ICCOM_STATS_INC(p, packages_received_out_of_order);
+	return true;
+}
+
+// Helper. Handles the finished frame in piggyback acks mode: every
+// frame consists of single data xfer (of @link_batch packages slots),
+// and our packages carry the ack of the last package we received in
+// order from the other side together with the selective ack of the
+// packages we hold out of order. Prepares the next xfer.
+//
+// @rx_data_pkg {valid ptr || NULL} the received xfer data, NULL if the
+//      xfer failed
+// @start_immediately__out {valid ptr} set to true if the next frame
+//      should be started immediately
+//
+// CONCURRENCE: called only from transport layer return points
+static void __iccom_pb_frame_done(struct iccom_dev *iccom
+				  , struct iccom_package *rx_data_pkg
+				  , bool *start_immediately__out)
+{
+	struct iccom_dev_private *p = iccom->p;
+	int ack_id = -1;
+	unsigned int sack_mask = 0;
+	bool rx_data = false;
+	bool rx_fallback = false;
+	bool progress = false;
+	// our packages of the frame carried the fallback request
+	const bool tx_fallback = p->link_fallback_requested;
+
+	const size_t slot_size = p->data_xfer_size_bytes;
+	const unsigned int slots
+		= (rx_data_pkg && p->link_batch > 1
+		   && rx_data_pkg->size == p->link_batch * slot_size)
+		  ? p->link_batch : 1;
+
+	for (int i = 0; i < slots; i++) {
+		struct iccom_package slot_pkg = {.data = NULL, .size = 0
+						 , .owns_data = false};
+		struct iccom_package *rx_pkg = rx_data_pkg;
+
+		if (slots > 1) {
+			slot_pkg.data = rx_data_pkg->data + i * slot_size;
+			slot_pkg.size = slot_size;
+			rx_pkg = &slot_pkg;
+			// the other side had nothing to send in the slot
+			if (i > 0 && !memchr_inv(slot_pkg.data
+					, ICCOM_PACKAGE_EMPTY_PAYLOAD_VALUE
+					, slot_size)) {
+				continue;
+			}
+		}
+
+		ICCOM_STATS_INC(p, packages_xfered);
+
+		const int payload_size
+			= rx_pkg ? __iccom_verify_package_data(rx_pkg) : -1;
+		if (rx_pkg) {
+			trace_iccom_package_rx(payload_size >= 0
+					? __iccom_package_get_id(rx_pkg) : -1
+					, payload_size);
+		}
+		if (payload_size < 0) {
+			if (rx_pkg) {
+				ICCOM_STATS_INC(p, packages_bad_data_received);
+			}
+			continue;
+		}
+
+		bool fallback;
+		const uint8_t *ack = __iccom_package_ack_addr(rx_pkg
+							      , &fallback);
+		if (ack) {
+			ack_id = (int)ack[0];
+			sack_mask = ack[1];
+			rx_fallback = rx_fallback || fallback;
+			trace_iccom_pb_ack(ack_id, sack_mask);
+		}
+		rx_data = rx_data || __iccom_package_carries_consumer_data(
+						rx_pkg, (size_t)payload_size);
+
+		if (__iccom_pb_rx_package(iccom, rx_pkg
+					  , (size_t)payload_size)) {
+			progress = true;
+		}
+	}
+
+	if (progress) {
+		__iccom_link_on_frame_ok(iccom);
+	} else {
+		__iccom_link_on_frame_failed(iccom);
+	}
+	__iccom_pb_link_fallback_update(iccom, tx_fallback, rx_fallback);
+
+	mutex_lock(&p->tx_queue_lock);
+
+	// fell back to the legacy protocol
+	if (!(p->link_features & ICCOM_LINK_FEATURE_ACK_PIGGYBACK)) {
+		if (__iccom_queue_fit_packages(iccom) < 0) {
+			iccom_err("could not fit TX packages to %zu bytes"
+				  , p->data_xfer_size_bytes);
+		}
+		mutex_unlock(&p->tx_queue_lock);
+		*start_immediately__out = true;
+		__iccom_fillup_next_data_xfer(iccom, &p->xfer);
+		return;
+	}
+
+	__iccom_queue_pb_next(iccom, ack_id, sack_mask);
+	if (p->link_batch > 1) {
+		__iccom_queue_pb_batch(iccom, ack_id);
+	}
+	const bool tx_pending = __iccom_queue_have_pending(iccom);
+	mutex_unlock(&p->tx_queue_lock);
+
+	*start_immediately__out = __iccom_link_idle_update(iccom, tx_pending
+							   , rx_data);
+	__iccom_fillup_next_data_xfer(iccom, &p->xfer);
+}
+
+
+// Transport layer return point.
+//
+// Called from transport layer, when xfer failed. Dedicated
+// to handle supervised error recovery or halting xfer device.
+//
+// See full_duplex_xfer.fail_callback description for details.
+//
+// CONCURRENCE: no simultaneous calls, also with other
+//      transport layer return points
+struct full_duplex_xfer *__iccom_xfer_failed_callback(
+		const struct full_duplex_xfer __kernel *failed_xfer
+		, const int next_xfer_id
+		, int error_code
+		, void __kernel *consumer_data)
+{
+	// The xfer failed
+
+	struct iccom_dev *iccom = (struct iccom_dev *)consumer_data;
+	ICCOM_CHECK_DEVICE("External error. No device provided."
+			   , return ERR_PTR(-ENODATA));
+	// if we are closing, then we will halt bottom transport layer
+	// by returning error pointer value
+	ICCOM_CHECK_CLOSING("will not invoke", return ERR_PTR(-ENODATA));
+
+	iccom_info(ICCOM_LOG_INFO_DBG_LEVEL, "FAILED xfer:");
+	iccom_dbg_printout_xfer(failed_xfer);
+	iccom_info(ICCOM_LOG_INFO_DBG_LEVEL, "TX queue:");
+	iccom_dbg_printout_tx_queue(iccom
+				, ICCOM_DEBUG_PACKAGES_PRINT_MAX_COUNT);
+
+	__iccom_err_report(ICCOM_ERROR_TRANSPORT, error_code);
+
+	if (iccom->p->link_features & ICCOM_LINK_FEATURE_ACK_PIGGYBACK) {
+		bool start_immediately;
+		__iccom_pb_frame_done(iccom, NULL, &start_immediately);
+		goto next_xfer;
+	}
+
+	memset(&iccom->p->frame_rx_link_offer, 0
+	       , sizeof(iccom->p->frame_rx_link_offer));
+
+	// we always goto ack stage with NACK package
+	// and then repeat the data xfer within the next frame.
+	__iccom_fillup_ack_xfer(iccom, &iccom->p->xfer, false);
+	iccom->p->data_xfer_stage = false;
+
+next_xfer:
+	iccom_info(ICCOM_LOG_INFO_DBG_LEVEL, "Next xfer:");
+	iccom_dbg_printout_xfer(&iccom->p->xfer);
+	return &iccom->p->xfer;
+}
+
+// Transport layer return point.
+//
+// CONCURRENCE: no simultaneous calls
+//
+// Called from transport layer, when xfer is done.
+struct full_duplex_xfer *__iccom_xfer_done_callback(
+			const struct full_duplex_xfer __kernel *done_xfer
+			, const int next_xfer_id
+			, bool __kernel *start_immediately__out
+			, void *consumer_data)
+{
+	// The xfer was just finished. The done_xfer.data_rx_buf contains
+	// the received data.
+
+	struct iccom_dev *iccom = (struct iccom_dev *)consumer_data;
+	ICCOM_CHECK_DEVICE("External error. No device provided."
+			   , return ERR_PTR(-ENODATA));
+	// if we are closing, then we will halt bottom transport layer
+	// by returning error pointer value
+	ICCOM_CHECK_CLOSING("will not invoke", return ERR_PTR(-ENODATA));
+
+	// convenience wrappers around done_xfer.data_tx/rx_buf
+	struct iccom_package rx_pkg = {.data = done_xfer->data_rx_buf
+				       , .size = done_xfer->size_bytes
+				       , .owns_data = false};
+	if (IS_ERR_OR_NULL(rx_pkg.data)) {
+		iccom_err("got broken RX data pointer: %px; "
+			  , rx_pkg.data);
+		return ERR_PTR(-ENODATA);
+	}
+
+	iccom_info(ICCOM_LOG_INFO_DBG_LEVEL, "Done xfer:");
+	iccom_dbg_printout_xfer(done_xfer);
+	iccom_info(ICCOM_LOG_INFO_DBG_LEVEL, "TX queue:");
+	iccom_dbg_printout_tx_queue(iccom
+			, ICCOM_DEBUG_PACKAGES_PRINT_MAX_COUNT);
+
+	ICCOM_STATS_ADD(iccom->p, raw_bytes_xfered_via_transport_layer
+			, done_xfer->size_bytes);
+	ICCOM_STATS_INC(iccom->p, transport_layer_xfers_done_count);
+
+	if (iccom->p->link_features & ICCOM_LINK_FEATURE_ACK_PIGGYBACK) {
+		__iccom_pb_frame_done(iccom, &rx_pkg, start_immediately__out);
+		goto next_xfer;
+	}
+
+	// If we are in data xfering stage, thus the data xfer has been
+	// just finished, so we need to verify it and send the ack/nack
+	// answer back. TODO: later we may indicate the CRC failure with
+	// other side drop flag timeout so we'll need no ack/nack xfers
+	// at all.
+	if (iccom->p->data_xfer_stage) {
+		ICCOM_STATS_INC(iccom->p, packages_xfered);
+		memset(&iccom->p->frame_rx_link_offer, 0
+		       , sizeof(iccom->p->frame_rx_link_offer));
+		iccom->p->frame_rx_data = false;
+
+		*start_immediately__out = true;
+
+		int payload_size = __iccom_verify_package_data(&rx_pkg);
+		trace_iccom_package_rx(payload_size >= 0
+				? __iccom_package_get_id(&rx_pkg) : -1
+				, payload_size);
+
+		// if package level data is not selfconsistent
+		if (payload_size < 0) {
+			__iccom_fillup_ack_xfer(iccom, &iccom->p->xfer, false);
+			ICCOM_STATS_INC(iccom->p, packages_bad_data_received);
+			goto finalize;
+		}
+
+		iccom->p->frame_rx_data = __iccom_package_carries_consumer_data(
+						&rx_pkg, (size_t)payload_size);
+
+		// package is selfconsistent, but we already received
+		// and processed it successfully, then we will say that
+		// this package is (already) OK
+		int rx_pkg_id = __iccom_package_get_id(&rx_pkg);
+		if (((iccom->p->last_rx_package_id - rx_pkg_id) & 0xFF)
+				< ICCOM_RX_RESENT_IDS_COUNT) {
+			__iccom_fillup_ack_xfer(iccom, &iccom->p->xfer, true);
+			ICCOM_STATS_INC(iccom->p, packages_duplicated_received);
+			iccom->p->frame_rx_link_offer
+				= iccom->p->last_rx_link_offer;
+			goto finalize;
+		}
+
+		// the other side still uses piggyback acks (we have just
+		// fallen back), and its packages might come out of order
+		if (__iccom_package_ack_addr(&rx_pkg, NULL)
+		    && rx_pkg_id != ((iccom->p->last_rx_package_id + 1)
+				     & 0xFF)) {
+			__iccom_fillup_ack_xfer(iccom, &iccom->p->xfer, false);
+			ICCOM_STATS_INC(iccom->p, packages_duplicated_received);
+			goto finalize;
+		}
+
+		// the package data was received within the original
+		// package before the other side rebuilt it
+		if (__iccom_package_rx_already_received(iccom, &rx_pkg)) {
+			__iccom_fillup_ack_xfer(iccom, &iccom->p->xfer, true);
+			ICCOM_STATS_INC(iccom->p, packages_duplicated_received);
+			__iccom_package_rx_accepted(iccom, &rx_pkg);
+			goto finalize;
+		}
+
+		// package is selfconsistent and we have not processed it
+		// yet, so we'll try to process it
+		void *pkg_payload = __iccom_package_payload_start_addr(&rx_pkg);
+		if (__iccom_rx_package_payload(iccom, pkg_payload
+					       , (size_t)payload_size) != 0) {
+			__iccom_fillup_ack_xfer(iccom, &iccom->p->xfer, false);
+			ICCOM_STATS_INC(iccom->p, packages_parsing_failed);
+			goto finalize;
+		}
+
+		// package parsing was OK
+		ICCOM_STATS_INC(iccom->p, packages_received_ok);
+		__iccom_package_rx_accepted(iccom, &rx_pkg);
+		iccom->p->frame_rx_link_offer = iccom->p->last_rx_link_offer;
+		__iccom_fillup_ack_xfer(iccom, &iccom->p->xfer, true);
+		goto finalize;
+	}
+
+	// If we are in ack stage, then we have just finished the
+	// ack xfer and can goto to the next frame (using old or
+	// new data depending on the ack state of the other side).
+
+	// If other side acked the correct receiving of our data
+	const bool acked = __iccom_verify_ack(&rx_pkg);
+	// our ack xfer of the frame carried the fallback request
+	const bool tx_fallback = iccom->p->link_fallback_requested;
+	trace_iccom_ack(false, acked);
+	if (acked) {
+		ICCOM_STATS_INC(iccom->p, packages_sent_ok);
+		__iccom_link_on_ack(iccom);
+		__iccom_queue_step_forward(iccom);
+	} else {
+		// NOTE: we resend the failed package immediately only
+		//      if the link is not idle (see below), the empty
+		//      package is resent within the next frame anyway
+		__iccom_link_on_frame_failed(iccom);
+	}
+	__iccom_link_fallback_update(iccom, tx_fallback
+				     , __iccom_ack_requests_fallback(&rx_pkg));
+
+	// the link might be changed (negotiated or fallen back)
+	mutex_lock(&iccom->p->tx_queue_lock);
+	if (__iccom_queue_fit_packages(iccom) < 0) {
+		iccom_err("could not fit TX packages to %zu bytes"
+			  , iccom->p->data_xfer_size_bytes);
+	}
+	const bool tx_pending = __iccom_queue_have_pending(iccom);
+	if (iccom->p->link_features & ICCOM_LINK_FEATURE_ACK_PIGGYBACK) {
+		iccom->p->tx_last_sent = __iccom_get_first_tx_package(iccom);
+		iccom->p->tx_next = iccom->p->tx_last_sent;
+		iccom->p->tx_next->sent_frame = iccom->p->pb_frames;
+		__iccom_package_set_ack(iccom->p->tx_next
+					, iccom->p->last_rx_package_id, 0
+					, false);
+	}
+	mutex_unlock(&iccom->p->tx_queue_lock);
+
+	*start_immediately__out = __iccom_link_idle_update(iccom, tx_pending
+					, iccom->p->frame_rx_data);
+
+	// preparing the next xfer with the first pending package in queue
+	__iccom_fillup_next_data_xfer(iccom, &iccom->p->xfer);
+
+finalize:
+	// switching to other stage (the only point where the
+	// data_xfer_stage is being written)
+	iccom->p->data_xfer_stage = !iccom->p->data_xfer_stage;
+
+next_xfer:
+#ifdef ICCOM_DEBUG
+	mutex_lock(&iccom->p->rx_messages.lock);
+	__iccom_msg_storage_printout(&iccom->p->rx_messages
+				     , ICCOM_DEBUG_MESSAGES_PRINTOUT_MAX_COUNT
+				     , ICCOM_DEBUG_CHANNEL);
+	mutex_unlock(&iccom->p->rx_messages.lock);
+#endif
+	iccom_info(ICCOM_LOG_INFO_DBG_LEVEL, "Next xfer:");
+	iccom_dbg_printout_xfer(&iccom->p->xfer);
+
+	return &iccom->p->xfer;
+}
+
+// Stops the underlying byte xfer device and detaches it from
+// the ICCom driver.
+void __iccomm_stop_xfer_device(struct iccom_dev *iccom)
+{
+	iccom->xfer_iface.close(iccom->xfer_device);
+}
+
+
+// The consumer notification procedure, is sheduled every time, when
+// any incoming message is finished and ready to be delivered to the
+// consumer. Due to latency in scheduling not only notifies about
+// initial message, but also checks for other finished messages.
+//
+// @work the scheduled work which launched the notification
+static void __iccom_consumer_notification_routine(
+	struct iccom_work_struct *work)
+{
+	if (IS_ERR_OR_NULL(work)) {
+		iccom_err("no notification work provided");
+		return;
+	}
+
+	struct iccom_dev_private *iccom_p = container_of(work
+		, struct iccom_dev_private, consumer_delivery_work);
+
+	int passed = iccom_msg_storage_pass_ready_data_to_consumer(
+					     &iccom_p->rx_messages);
+	if (passed >= 0) {
+		ICCOM_STATS_ADD(iccom_p, messages_ready_in_storage, -passed);
+	}
+}
+
+// Verifies if the interface of full duplex transport device contains all
+// records relevant for ICCom
+static bool __iccom_verify_transport_layer_interface(
+		const struct full_duplex_sym_iface  *const iface)
+{
+	return !IS_ERR_OR_NULL(iface)
+		    && !IS_ERR_OR_NULL(iface->data_xchange)
+		    && !IS_ERR_OR_NULL(iface->is_running)
+		    && !IS_ERR_OR_NULL(iface->init)
+		    && !IS_ERR_OR_NULL(iface->reset)
+		    && !IS_ERR_OR_NULL(iface->close);
+}
+
+// Helper. Initializes the iccom packages storage (TX storage).
+// RETURNS:
+//      0: all fine
+//      <0: negative error code
+static inline int __iccom_init_packages_storage(struct iccom_dev *iccom)
+{
+#ifdef ICCOM_DEBUG
+	ICCOM_CHECK_DEVICE("", return -ENODEV);
+	ICCOM_CHECK_DEVICE_PRIVATE("", return -EINVAL);
+#endif
+	INIT_LIST_HEAD(&iccom->p->tx_data_packages_head);
+	INIT_LIST_HEAD(&iccom->p->tx_channels);
+	for (int lvl = 0; lvl < ICCOM_TX_PRIORITY_LEVELS_COUNT; lvl++) {
+		INIT_LIST_HEAD(&iccom->p->tx_active_channels[lvl]);
+	}
+	iccom->p->tx_min_rate_channels_count = 0;
+#if ICCOM_TX_SCHEDULING_MATCH(WEIGHTED)
+	iccom->p->tx_sched_cursor = ICCOM_TX_PRIORITY_LEVELS_COUNT - 1;
+	memset(iccom->p->tx_sched_deficit, 0
+	       , sizeof(iccom->p->tx_sched_deficit));
+	iccom->p->tx_sched_deficit[iccom->p->tx_sched_cursor]
+		= iccom_tx_sched_level_weights[iccom->p->tx_sched_cursor]
+		  * ICCOM_TX_SCHED_QUANTUM_BYTES;
+#endif
+	mutex_init(&iccom->p->tx_queue_lock);
+	init_llist_head(&iccom->p->tx_submitted);
+	INIT_LIST_HEAD(&iccom->p->tx_unresolved);
+	atomic_set(&iccom->p->tx_queued_bytes, 0);
+	init_waitqueue_head(&iccom->p->tx_space_wait);
+	INIT_LIST_HEAD(&iccom->p->tx_stats);
+	memset(iccom->p->tx_level_stats, 0
+	       , sizeof(iccom->p->tx_level_stats));
+	iccom->p->next_tx_package_id = ICCOM_INITIAL_PACKAGE_ID;
+
+	iccom->p->data_xfer_size_bytes = ICCOM_DATA_XFER_SIZE_BYTES;
+	iccom->p->link_features = 0;
+	iccom->p->link_state = ICCOM_LINK_NEGOTIATING;
+	iccom->p->link_offers_unanswered = 0;
+	iccom->p->link_failed_frames = 0;
+	iccom->p->link_fallback_requested = false;
+	iccom->p->link_fallback_agreed = false;
+	iccom->p->link_fallback_frames = 0;
+	iccom->p->link_fallbacks = 0;
+	iccom->p->link_stable_frames = 0;
+	iccom->p->link_holdoff_frames = 0;
+	iccom->p->link_max_pkg_size = ICCOM_DATA_XFER_MAX_SIZE_BYTES;
+	iccom->p->link_fell_back = false;
+	memset(&iccom->p->rx_link_offer_uncommitted, 0
+	       , sizeof(iccom->p->rx_link_offer_uncommitted));
+	iccom->p->last_rx_link_offer = iccom->p->rx_link_offer_uncommitted;
+	iccom->p->frame_rx_link_offer = iccom->p->rx_link_offer_uncommitted;
+	iccom->p->link_window = 0;
+	iccom->p->link_batch = 1;
+	iccom->p->pb_frames = 0;
+	iccom->p->frame_rx_data = false;
+	iccom->p->idle = false;
+	iccom->p->tx_last_sent = NULL;
+	iccom->p->tx_next = NULL;
+	iccom->p->tx_batch_count = 0;
+	iccom->p->tx_batch_buf = NULL;
+	if (ICCOM_PB_BATCH_PACKAGES > 1) {
+		iccom->p->tx_batch_buf = kmalloc(ICCOM_PB_BATCH_PACKAGES
+					* ICCOM_DATA_XFER_MAX_SIZE_BYTES
+					, GFP_KERNEL);
+		if (!iccom->p->tx_batch_buf) {
+			return -ENOMEM;
+		}
+	}
+	for (int i = 0; i < ARRAY_SIZE(iccom->p->rx_window); i++) {
+		iccom->p->rx_window[i].data = NULL;
+		iccom->p->rx_window[i].size = 0;
+	}
+	iccom->p->last_rx_package_id = ICCOM_INITIAL_PACKAGE_ID - 1;
+	iccom->p->last_rx_whole_package_id = -1;
+	return 0;
+}
+
+// Helper. Frees all resources owned by packages storage.
+static inline void __iccom_free_packages_storage(struct iccom_dev *iccom)
+{
+#ifdef ICCOM_DEBUG
+	ICCOM_CHECK_DEVICE("", return);
+	ICCOM_CHECK_DEVICE_PRIVATE("", return);
+#endif
+	mutex_lock(&iccom->p->tx_queue_lock);
+	while (__iccom_have_packages(iccom)) {
+		__iccom_package_free(__iccom_get_first_tx_package(iccom));
+	}
+	__iccom_queue_free_messages(iccom);
+	mutex_unlock(&iccom->p->tx_queue_lock);
+	mutex_destroy(&iccom->p->tx_queue_lock);
+	__iccom_pb_rx_window_free(iccom);
+	kfree(iccom->p->tx_batch_buf);
+	iccom->p->tx_batch_buf = NULL;
+}
+
+// The ICCom instance numbers in use (see ICCOM_PROC_ROOT_NAME).
+static DEFINE_IDA(iccom_proc_ids);
+
+// Helper. Inits the ICCom procfs: allocates the instance number and
+// creates the instance proc root directory.
+// RETURNS:
+//      >= 0: on success,
+//      < 0: on failure (negated error code)
+static inline int __iccom_procfs_init(struct iccom_dev *iccom)
+{
+	ICCOM_CHECK_DEVICE("", return -ENODEV);
+	ICCOM_CHECK_DEVICE_PRIVATE("", return -ENODEV);
+
+	iccom->p->proc_root = NULL;
+	iccom->p->proc_id = ida_alloc(&iccom_proc_ids, GFP_KERNEL);
+	if (iccom->p->proc_id < 0) {
+		const int res = iccom->p->proc_id;
+
+		iccom_err("failed to allocate ICCom instance number: %d"
+			  , res);
+		iccom->p->proc_id = -1;
+		return res;
+	}
+
+	char name[ICCOM_PROC_ROOT_NAME_MAX_LEN];
+	if (iccom->p->proc_id == 0) {
+		snprintf(name, sizeof(name), ICCOM_PROC_ROOT_NAME);
+	} else {
+		snprintf(name, sizeof(name), ICCOM_PROC_ROOT_NAME"%d"
+			 , iccom->p->proc_id);
+	}
+
+	iccom->p->proc_root = proc_mkdir(name, NULL);
+
+	if (IS_ERR_OR_NULL(iccom->p->proc_root)) {
+		iccom_err("failed to create ICCom proc root folder"
+			  " with name: %s", name);
+		iccom->p->proc_root = NULL;
+		ida_free(&iccom_proc_ids, iccom->p->proc_id);
+		iccom->p->proc_id = -1;
+		return -EIO;
+	}
+	return 0;
+}
+
+// Removes the ICcom proc root
+static void __iccom_procfs_close(struct iccom_dev *iccom)
+{
+	ICCOM_CHECK_DEVICE("", return);
+	ICCOM_CHECK_DEVICE_PRIVATE("", return);
+
+	if (!IS_ERR_OR_NULL(iccom->p->proc_root)) {
+		proc_remove(iccom->p->proc_root);
+		iccom->p->proc_root = NULL;
+	}
+	if (iccom->p->proc_id >= 0) {
+		ida_free(&iccom_proc_ids, iccom->p->proc_id);
+		iccom->p->proc_id = -1;
+	}
+}
+
+
+// Helper. Initializes the statistics structure of ICCom.
+// NOTE: the ICCom proc rootfs should be created beforehand,
+//      if not: then we will fail to create statistics node.
+//
+// RETURNS:
+//      >= 0: on success,
+//      -ENOMEM: if no memory for the statistics (the device can not
+//          work),
+//      < 0: on other failure (negated error code), the statistics is
+//          still collected
+static inline int __iccom_statistics_init(struct iccom_dev *iccom)
+{
+	ICCOM_CHECK_DEVICE("", return -ENODEV);
+	ICCOM_CHECK_DEVICE_PRIVATE("", return -ENODEV);
+
+	// initial statistics data (zeroed)
+	iccom->p->statistics = alloc_percpu(struct iccom_dev_statistics);
+	if (!iccom->p->statistics) {
+		iccom_err("no memory for statistics");
+		iccom->p->statistics_file = NULL;
+		return -ENOMEM;
+	}
+
+	// statistics access operations
+	memset(&iccom->p->statistics_ops, 0, sizeof(iccom->p->statistics_ops));
+	iccom->p->statistics_ops.read  = &__iccom_statistics_read;
+	iccom->p->statistics_ops.owner = THIS_MODULE;
+
+	if (IS_ERR_OR_NULL(iccom->p->proc_root)) {
+		iccom_err("failed to create statistics proc entry:"
+			  " no ICCom root proc entry");
+		iccom->p->statistics_file = NULL;
+		return -ENOENT;
+	}
+
+	iccom->p->statistics_file = proc_create_data(
+					   ICCOM_STATISTICS_FILE_NAME
+					   , ICCOM_PROC_R_PERMISSIONS
+					   , iccom->p->proc_root
+					   , &iccom->p->statistics_ops
+					   , (void*)iccom);
+
+	if (IS_ERR_OR_NULL(iccom->p->statistics_file)) {
+		iccom_err("failed to create statistics proc entry.");
+		return -EIO;
+	}
+
+	return 0;
+}
+
+// Removes the ICcom proc statistics file and frees the statistics
+static void __iccom_statistics_close(struct iccom_dev *iccom)
+{
+	ICCOM_CHECK_DEVICE("", return);
+	ICCOM_CHECK_DEVICE_PRIVATE("", return);
+
+	if (!IS_ERR_OR_NULL(iccom->p->statistics_file)) {
+		proc_remove(iccom->p->statistics_file);
+		iccom->p->statistics_file = NULL;
+	}
+
+	free_percpu(iccom->p->statistics);
+	iccom->p->statistics = NULL;
+}
+
+// Helper. Sums up the per CPU statistics of ICCom.
+//
+// @stats__out {valid ptr} the statistics sum
+//
+// CONCURRENCE: thread safe
+static void __iccom_statistics_get(struct iccom_dev *iccom
+				   , struct iccom_dev_statistics *stats__out)
+{
+	int cpu;
+
+	memset(stats__out, 0, sizeof(*stats__out));
+	for_each_possible_cpu(cpu) {
+		const struct iccom_dev_statistics *s
+			= per_cpu_ptr(iccom->p->statistics, cpu);
+#define ICCOM_STATS_SUM(field) stats__out->field += s->field
+		ICCOM_STATS_SUM(transport_layer_xfers_done_count);
+		ICCOM_STATS_SUM(raw_bytes_xfered_via_transport_layer);
+		ICCOM_STATS_SUM(packages_xfered);
+		ICCOM_STATS_SUM(packages_sent_ok);
+		ICCOM_STATS_SUM(packages_received_ok);
+		ICCOM_STATS_SUM(packages_bad_data_received);
+		ICCOM_STATS_SUM(packages_duplicated_received);
+		ICCOM_STATS_SUM(packages_parsing_failed);
+		ICCOM_STATS_SUM(packages_received_out_of_order);
+		ICCOM_STATS_SUM(packages_resent);
+		ICCOM_STATS_SUM(idle_periods);
+		ICCOM_STATS_SUM(packets_received_ok);
+		ICCOM_STATS_SUM(messages_received_ok);
+		ICCOM_STATS_SUM(packages_in_tx_queue);
+		ICCOM_STATS_SUM(messages_in_tx_queue);
+		ICCOM_STATS_SUM(total_consumers_bytes_received_ok);
+		ICCOM_STATS_SUM(messages_ready_in_storage);
+		ICCOM_STATS_SUM(packets_sent);
+		ICCOM_STATS_SUM(messages_sent);
+		ICCOM_STATS_SUM(total_consumers_bytes_sent);
+#undef ICCOM_STATS_SUM
+	}
+}
+
+// Helper. Initializes the TX channels control procfs file of ICCom.
+// NOTE: the ICCom proc rootfs and TX packages storage should be
+//      created beforehand, if no proc rootfs: then we will fail to
+//      create the TX channels node.
+//
+// RETURNS:
+//      >= 0: on success,
+//      < 0: on failure (negated error code)
+static int __iccom_tx_channels_ctl_init(struct iccom_dev *iccom)
+{
+	ICCOM_CHECK_DEVICE("", return -ENODEV);
+	ICCOM_CHECK_DEVICE_PRIVATE("", return -ENODEV);
+
+	memset(&iccom->p->tx_channels_ops, 0
+	       , sizeof(iccom->p->tx_channels_ops));
+	iccom->p->tx_channels_ops.read  = &__iccom_tx_channels_read;
+	iccom->p->tx_channels_ops.write = &__iccom_tx_channels_write;
+	iccom->p->tx_channels_ops.owner = THIS_MODULE;
+
+	if (IS_ERR_OR_NULL(iccom->p->proc_root)) {
+		iccom_err("failed to create TX channels proc entry:"
+			  " no ICCom root proc entry");
+		iccom->p->tx_channels_file = NULL;
+		return -ENOENT;
+	}
+
+	iccom->p->tx_channels_file = proc_create_data(
+					   ICCOM_TX_CHANNELS_FILE_NAME
+					   , ICCOM_PROC_RW_PERMISSIONS
+					   , iccom->p->proc_root
+					   , &iccom->p->tx_channels_ops
+					   , (void*)iccom);
+
+	if (IS_ERR_OR_NULL(iccom->p->tx_channels_file)) {
+		iccom_err("failed to create TX channels proc entry.");
+		return -EIO;
+	}
+
+	return 0;
+}
+
+// Removes the ICcom proc TX channels control file
+static void __iccom_tx_channels_ctl_close(struct iccom_dev *iccom)
+{
+	ICCOM_CHECK_DEVICE("", return);
+	ICCOM_CHECK_DEVICE_PRIVATE("", return);
+
+	if (IS_ERR_OR_NULL(iccom->p->tx_channels_file)) {
+		return;
+	}
+
+	proc_remove(iccom->p->tx_channels_file);
+	iccom->p->tx_channels_file = NULL;
+}
+
+// Helper. Initializes the channels statistics procfs file of ICCom.
+// NOTE: the ICCom proc rootfs, messages storage and TX packages
+//      storage should be created beforehand, if no proc rootfs: then
+//      we will fail to create the channels statistics node.
+//
+// RETURNS:
+//      >= 0: on success,
+//      < 0: on failure (negated error code)
+static int __iccom_channels_statistics_init(struct iccom_dev *iccom)
+{
+	ICCOM_CHECK_DEVICE("", return -ENODEV);
+	ICCOM_CHECK_DEVICE_PRIVATE("", return -ENODEV);
+
+	memset(&iccom->p->channels_statistics_ops, 0
+	       , sizeof(iccom->p->channels_statistics_ops));
+	iccom->p->channels_statistics_ops.read
+		= &__iccom_channels_statistics_read;
+	iccom->p->channels_statistics_ops.owner = THIS_MODULE;
+
+	if (IS_ERR_OR_NULL(iccom->p->proc_root)) {
+		iccom_err("failed to create channels statistics proc entry:"
+			  " no ICCom root proc entry");
+		iccom->p->channels_statistics_file = NULL;
+		return -ENOENT;
+	}
+
+	iccom->p->channels_statistics_file = proc_create_data(
+					   ICCOM_CHANNELS_STATISTICS_FILE_NAME
+					   , ICCOM_PROC_R_PERMISSIONS
+					   , iccom->p->proc_root
+					   , &iccom->p->channels_statistics_ops
+					   , (void*)iccom);
+
+	if (IS_ERR_OR_NULL(iccom->p->channels_statistics_file)) {
+		iccom_err("failed to create channels statistics proc entry.");
+		return -EIO;
+	}
+
+	return 0;
+}
+
+// Removes the ICcom proc channels statistics file
+static void __iccom_channels_statistics_close(struct iccom_dev *iccom)
+{
+	ICCOM_CHECK_DEVICE("", return);
+	ICCOM_CHECK_DEVICE_PRIVATE("", return);
+
+	if (IS_ERR_OR_NULL(iccom->p->channels_statistics_file)) {
+		return;
+	}
+
+	proc_remove(iccom->p->channels_statistics_file);
+	iccom->p->channels_statistics_file = NULL;
+}
+
+#if ICCOM_WORKQUEUE_MODE_MATCH(RT_KTHREAD)
+// Helper. Initializes the kthread worker control procfs file of ICCom.
+// NOTE: the ICCom proc rootfs and the kthread worker should be
+//      created beforehand, if no proc rootfs: then we will fail to
+//      create the worker node.
+//
+// RETURNS:
+//      >= 0: on success,
+//      < 0: on failure (negated error code)
+static int __iccom_worker_ctl_init(struct iccom_dev *iccom)
+{
+	ICCOM_CHECK_DEVICE("", return -ENODEV);
+	ICCOM_CHECK_DEVICE_PRIVATE("", return -ENODEV);
+
+	memset(&iccom->p->worker_ops, 0, sizeof(iccom->p->worker_ops));
+	iccom->p->worker_ops.read  = &__iccom_worker_read;
+	iccom->p->worker_ops.write = &__iccom_worker_write;
+	iccom->p->worker_ops.owner = THIS_MODULE;
+
+	if (IS_ERR_OR_NULL(iccom->p->proc_root)) {
+		iccom_err("failed to create worker proc entry:"
+			  " no ICCom root proc entry");
+		iccom->p->worker_file = NULL;
+		return -ENOENT;
+	}
+
+	iccom->p->worker_file = proc_create_data(
+					   ICCOM_WORKER_FILE_NAME
+					   , ICCOM_PROC_RW_PERMISSIONS
+					   , iccom->p->proc_root
+					   , &iccom->p->worker_ops
+					   , (void*)iccom);
+
+	if (IS_ERR_OR_NULL(iccom->p->worker_file)) {
+		iccom_err("failed to create worker proc entry.");
+		return -EIO;
+	}
+
+	return 0;
+}
+
+// Removes the ICcom proc kthread worker control file
+static void __iccom_worker_ctl_close(struct iccom_dev *iccom)
+{
+	ICCOM_CHECK_DEVICE("", return);
+	ICCOM_CHECK_DEVICE_PRIVATE("", return);
+
+	if (IS_ERR_OR_NULL(iccom->p->worker_file)) {
+		return;
+	}
+
+	proc_remove(iccom->p->worker_file);
+	iccom->p->worker_file = NULL;
+}
+#endif
+
+// Provides the read method for ICCom statistics to user world.
+// Is invoked when user reads the /proc/<ICCOM>/<STATISTICS> file.
+//
+// Is restricted to the file size of SIZE_MAX bytes.
+//
+// RETURNS:
+//      >= 0: number of bytes actually provided to user space, on success
+//      < 0: negated error code, on failure
+//
+static ssize_t __iccom_statistics_read(struct file *file
+		, char __user *ubuf
+		, size_t count
+		, loff_t *ppos)
+{
+	ICCOM_CHECK_PTR(file, return -EINVAL);
+	ICCOM_CHECK_PTR(ubuf, return -EINVAL);
+	ICCOM_CHECK_PTR(ppos, return -EINVAL);
+
+	struct iccom_dev *iccom = (struct iccom_dev *)PDE_DATA(file->f_inode);
+
+	ICCOM_CHECK_DEVICE("no device provided", return -ENODEV);
+	ICCOM_CHECK_DEVICE_PRIVATE("broken device data", return -ENODEV);
+
+	const int BUFFER_SIZE = 2048;
+
+	if (*ppos >= BUFFER_SIZE || *ppos > SIZE_MAX) {
+		return 0;
+	}
+
+	char *buf = kmalloc(BUFFER_SIZE, GFP_KERNEL);
+
+	if (IS_ERR_OR_NULL(buf)) {
+		return -ENOMEM;
+	}
+
+	struct iccom_dev_statistics stats;
+	__iccom_statistics_get(iccom, &stats);
+	const struct iccom_dev_statistics * const s = &stats;
+	size_t len = (size_t)snprintf(buf, BUFFER_SIZE
+		     , "transport_layer: xfers done:  %llu\n"
+		       "transport_layer: bytes xfered:  %llu\n"
+		       "packages: xfered total:  %llu\n"
+		       "packages: sent ok:  %llu\n"
+		       "packages: received ok:  %llu\n"
+		       "packages: sent fail (total):  %llu\n"
+		       "packages: received fail (total):  %llu\n"
+		       "packages:     received corrupted:  %llu\n"
+		       "packages:     received duplicated:  %llu\n"
+		       "packages:     detailed parsing failed:  %llu\n"
+		       "packages: received out of order:  %llu\n"
+		       "packages: resent:  %llu\n"
+		       "packages: in tx queue:  %lu\n"
+		       "packages: size:  %zu\n"
+		       "link: features:  0x%x\n"
+		       "link: window:  %u\n"
+		       "link: batch:  %u\n"
+		       "link: idle:  %d\n"
+		       "link: idle periods:  %llu\n"
+		       "messages: in tx queue:  %lu\n"
+		       "messages: tx queue bytes:  %d / %u\n"
+		       "packets: sent ok:  %llu\n"
+		       "messages: sent ok:  %llu\n"
+		       "bandwidth: consumer bytes sent:\t%llu\n"
+		       "packets: received ok:  %llu\n"
+		       "messages: received ok:  %llu\n"
+		       "messages: ready rx:  %lu\n"
+		       "bandwidth: consumer bytes received:\t%llu\n"
+		     , s->transport_layer_xfers_done_count
+		     , s->raw_bytes_xfered_via_transport_layer
+		     , s->packages_xfered
+		     , s->packages_sent_ok
+		     , s->packages_received_ok
+		     , s->packages_xfered - s->packages_sent_ok
+		     , s->packages_xfered - s->packages_received_ok
+		     , s->packages_bad_data_received
+		     , s->packages_duplicated_received
+		     , s->packages_parsing_failed
+		     , s->packages_received_out_of_order
+		     , s->packages_resent
+		     , s->packages_in_tx_queue
+		     , iccom->p->data_xfer_size_bytes
+		     , iccom->p->link_features
+		     , iccom->p->link_window
+		     , iccom->p->link_batch
+		     , iccom->p->idle
+		     , s->idle_periods
+		     , s->messages_in_tx_queue
+		     , atomic_read(&iccom->p->tx_queued_bytes)
+		     , READ_ONCE(tx_queue_max_bytes)
+		     , s->packets_sent
+		     , s->messages_sent
+		     , s->total_consumers_bytes_sent
+		     , s->packets_received_ok
+		     , s->messages_received_ok
+		     , s->messages_ready_in_storage
+		     , s->total_consumers_bytes_received_ok);
+	len++;
+
+	if (len > BUFFER_SIZE) {
+		iccom_warning("statistics output was too big for buffer"
+			      ", required length: %zu", len);
+		len = BUFFER_SIZE;
+		buf[BUFFER_SIZE - 1] = 0;
+	}
+
+	const unsigned long nbytes_to_copy
+			= (len >= (size_t)(*ppos))
+				?  min(len - (size_t)(*ppos), count)
+				: 0;
+	const unsigned long not_copied
+			= copy_to_user(ubuf, buf + (size_t)(*ppos)
+				       , nbytes_to_copy);
+	kfree(buf);
+	buf = NULL;
+	*ppos += nbytes_to_copy - not_copied;
+
+	return nbytes_to_copy - not_copied;
+}
+
+// Provides the read method for ICCom TX channels scheduling parameters
+// to user world. Is invoked when user reads the
+// /proc/<ICCOM>/<TX_CHANNELS> file.
+//
+// Is restricted to the file size of SIZE_MAX bytes.
+//
+// RETURNS:
+//      >= 0: number of bytes actually provided to user space, on success
+//      < 0: negated error code, on failure
+static ssize_t __iccom_tx_channels_read(struct file *file
+		, char __user *ubuf
+		, size_t count
+		, loff_t *ppos)
+{
+	ICCOM_CHECK_PTR(file, return -EINVAL);
+	ICCOM_CHECK_PTR(ubuf, return -EINVAL);
+	ICCOM_CHECK_PTR(ppos, return -EINVAL);
+
+	struct iccom_dev *iccom = (struct iccom_dev *)PDE_DATA(file->f_inode);
+
+	ICCOM_CHECK_DEVICE("no device provided", return -ENODEV);
+	ICCOM_CHECK_DEVICE_PRIVATE("broken device data", return -ENODEV);
+
+	const int BUFFER_SIZE = 4096;
+
+	if (*ppos >= BUFFER_SIZE || *ppos > SIZE_MAX) {
+		return 0;
+	}
+
+	char *buf = kmalloc(BUFFER_SIZE, GFP_KERNEL);
+
+	if (IS_ERR_OR_NULL(buf)) {
+		return -ENOMEM;
+	}
+
+	size_t len = (size_t)snprintf(buf, BUFFER_SIZE
+				      , "channel weight min_rate_bps"
+					" pending_messages level\n");
+
+	mutex_lock(&iccom->p->tx_queue_lock);
+	__iccom_queue_take_submitted(iccom);
+	struct iccom_tx_channel *ch;
+	list_for_each_entry(ch, &iccom->p->tx_channels, all_anchor) {
+		if (len >= BUFFER_SIZE) {
+			break;
+		}
+		int pending = 0;
+		struct list_head *pos;
+		for (int lvl = 0; lvl < ICCOM_TX_PRIORITY_LEVELS_COUNT; lvl++) {
+			list_for_each(pos, &ch->messages[lvl]) {
+				pending++;
+			}
+		}
+		len += (size_t)snprintf(buf + len, BUFFER_SIZE - len
+					, "%u %d %u %d %d\n"
+					, ch->channel, ch->weight
+					, ch->min_rate_bps, pending
+					, ch->sending ? ch->sending->level
+					  : __iccom_tx_channel_top_level(ch));
+	}
+	mutex_unlock(&iccom->p->tx_queue_lock);
+
+	if (len < BUFFER_SIZE) {
+		len += (size_t)snprintf(buf + len, BUFFER_SIZE - len
+				, "\nNOTE: to set the channel TX scheduling"
+				  " parameters write \"<channel> <weight>"
+				  " <min_rate_bps>\" here, weight is in"
+				  " [1; %d], min_rate_bps = 0 means no"
+				  " guaranteed rate.\n"
+				, ICCOM_TX_CHANNEL_MAX_WEIGHT);
+	}
+	len++;
+
+	if (len > BUFFER_SIZE) {
+		iccom_warning("TX channels output was too big for buffer"
+			      ", required length: %zu", len);
+		len = BUFFER_SIZE;
+		buf[BUFFER_SIZE - 1] = 0;
+	}
+
+	const unsigned long nbytes_to_copy
+			= (len >= (size_t)(*ppos))
+				?  min(len - (size_t)(*ppos), count)
+				: 0;
+	const unsigned long not_copied
+			= copy_to_user(ubuf, buf + (size_t)(*ppos)
+				       , nbytes_to_copy);
+	kfree(buf);
+	buf = NULL;
+	*ppos += nbytes_to_copy - not_copied;
+
+	return nbytes_to_copy - not_copied;
+}
+
+// Provides an ability to set the TX scheduling parameters of the
+// channel from User Space. Is invoked when user writes the
+// /proc/<ICCOM>/<TX_CHANNELS> file.
+//
+// The written string format is: "<channel> <weight> <min_rate_bps>",
+// where
+//      * channel [ICCOM_PACKET_MIN_CHANNEL_ID; ICCOM_PACKET_MAX_CHANNEL_ID]
+//        the channel to configure,
+//      * weight [1; ICCOM_TX_CHANNEL_MAX_WEIGHT] the channel weight
+//        among the channels of the same TX priority level,
+//      * min_rate_bps the guaranteed minimal channel rate in bytes
+//        per second, 0 disables the guarantee.
+//
+// RETURNS:
+//      >= 0: number of bytes actually were written, on success
+//      < 0: negated error code, on failure
+static ssize_t __iccom_tx_channels_write(struct file *file
+		, const char __user *ubuf
+		, size_t count
+		, loff_t *ppos)
+{
+	ICCOM_CHECK_PTR(file, return -EINVAL);
+	ICCOM_CHECK_PTR(ubuf, return -EINVAL);
+	ICCOM_CHECK_PTR(ppos, return -EINVAL);
+
+	struct iccom_dev *iccom = (struct iccom_dev *)PDE_DATA(file->f_inode);
+
+	ICCOM_CHECK_DEVICE("no device provided", return -ENODEV);
+	ICCOM_CHECK_DEVICE_PRIVATE("broken device data", return -ENODEV);
+
+	char buf[64];
+
+	// we only get the whole data at once
+	if (*ppos != 0 || count >= sizeof(buf)) {
+		iccom_warning("Ctrl message should be written at once"
+			      " and not exceed %zu bytes.", sizeof(buf) - 1);
+		return -EFAULT;
+	}
+
+	if (copy_from_user(buf, ubuf, count) != 0) {
+		iccom_warning("Not all bytes were copied from user.");
+		return -EIO;
+	}
+	buf[count] = 0;
+
+	unsigned int channel;
+	int weight;
+	unsigned int min_rate_bps;
+
+	if (sscanf(buf, "%u %d %u", &channel, &weight, &min_rate_bps) != 3) {
+		iccom_warning("Parsing failed: %s", buf);
+		return -EINVAL;
+	}
+	if (channel > ICCOM_PACKET_MAX_CHANNEL_ID) {
+		iccom_warning("channel is out of bounds: %u", channel);
+		return -EBADSLT;
+	}
+	if (weight < 1 || weight > ICCOM_TX_CHANNEL_MAX_WEIGHT) {
+		iccom_warning("weight is out of bounds: %d", weight);
+		return -EINVAL;
+	}
+
+	mutex_lock(&iccom->p->tx_queue_lock);
+
+	struct iccom_tx_channel *ch = __iccom_tx_get_channel(iccom, channel);
+	if (!ch) {
+		mutex_unlock(&iccom->p->tx_queue_lock);
+		return -ENOMEM;
+	}
+
+	if (ch->min_rate_bps == 0 && min_rate_bps != 0) {
+		iccom->p->tx_min_rate_channels_count++;
+		ch->rate_tokens = 0;
+		ch->rate_last_refill_ns = ktime_to_ns(ktime_get());
+	} else if (ch->min_rate_bps != 0 && min_rate_bps == 0) {
+		iccom->p->tx_min_rate_channels_count--;
+	}
+	ch->min_rate_bps = min_rate_bps;
+	ch->weight = weight;
+
+	__iccom_tx_channel_collect(ch);
+
+	mutex_unlock(&iccom->p->tx_queue_lock);
+
+	return (ssize_t)count;
+}
+
+#if ICCOM_WORKQUEUE_MODE_MATCH(RT_KTHREAD)
+// Provides the read method for ICCom kthread worker scheduling
+// parameters to user world. Is invoked when user reads the
+// /proc/<ICCOM>/<WORKER> file.
+//
+// RETURNS:
+//      >= 0: number of bytes actually provided to user space, on success
+//      < 0: negated error code, on failure
+static ssize_t __iccom_worker_read(struct file *file
+		, char __user *ubuf
+		, size_t count
+		, loff_t *ppos)
+{
+	ICCOM_CHECK_PTR(file, return -EINVAL);
+	ICCOM_CHECK_PTR(ubuf, return -EINVAL);
+	ICCOM_CHECK_PTR(ppos, return -EINVAL);
+
+	struct iccom_dev *iccom = (struct iccom_dev *)PDE_DATA(file->f_inode);
+
+	ICCOM_CHECK_DEVICE("no device provided", return -ENODEV);
+	ICCOM_CHECK_DEVICE_PRIVATE("broken device data", return -ENODEV);
+
+	const int BUFFER_SIZE = 256;
+
+	if (*ppos >= BUFFER_SIZE || *ppos > SIZE_MAX) {
+		return 0;
+	}
+
+	char *buf = kmalloc(BUFFER_SIZE, GFP_KERNEL);
+
+	if (IS_ERR_OR_NULL(buf)) {
+		return -ENOMEM;
+	}
+
+	mutex_lock(&iccom->p->worker_ctl_lock);
+	size_t len = (size_t)snprintf(buf, BUFFER_SIZE
+			, "policy: %s\n"
+			  "priority: %d\n"
+			  "cpus: %*pbl\n"
+			  "\nNOTE: to set the worker scheduling parameters"
+			  " write \"<priority> [<cpu list>]\" here,"
+			  " priority 0 selects normal policy.\n"
+			, iccom->p->worker_priority ? "SCHED_FIFO"
+						    : "SCHED_NORMAL"
+			, iccom->p->worker_priority
+			, cpumask_pr_args(&iccom->p->worker_cpus));
+	mutex_unlock(&iccom->p->worker_ctl_lock);
+	len++;
+
+	if (len > BUFFER_SIZE) {
+		len = BUFFER_SIZE;
+		buf[BUFFER_SIZE - 1] = 0;
+	}
+
+	const unsigned long nbytes_to_copy
+			= (len >= (size_t)(*ppos))
+				?  min(len - (size_t)(*ppos), count)
+				: 0;
+	const unsigned long not_copied
+			= copy_to_user(ubuf, buf + (size_t)(*ppos)
+				       , nbytes_to_copy);
+	kfree(buf);
+	buf = NULL;
+	*ppos += nbytes_to_copy - not_copied;
+
+	return nbytes_to_copy - not_copied;
+}
+
+// Provides the write method for ICCom kthread worker scheduling
+// parameters. Is invoked when user writes the /proc/<ICCOM>/<WORKER>
+// file in the format:
+//
+//      <priority> [<cpu list>]
+//
+// where the <priority> is the SCHED_FIFO priority [1; MAX_RT_PRIO - 1]
+// or 0 to select normal policy, and the optional <cpu list> is the
+// list of CPUs to pin the worker to, like "1" or "0,2-3" (if omitted
+// the current CPU affinity is kept).
+//
+// RETURNS:
+//      >= 0: number of bytes consumed, on success
+//      < 0: negated error code, on failure
+static ssize_t __iccom_worker_write(struct file *file
+		, const char __user *ubuf
+		, size_t count
+		, loff_t *ppos)
+{
+	ICCOM_CHECK_PTR(file, return -EINVAL);
+	ICCOM_CHECK_PTR(ubuf, return -EINVAL);
+	ICCOM_CHECK_PTR(ppos, return -EINVAL);
+
+	struct iccom_dev *iccom = (struct iccom_dev *)PDE_DATA(file->f_inode);
+
+	ICCOM_CHECK_DEVICE("no device provided", return -ENODEV);
+	ICCOM_CHECK_DEVICE_PRIVATE("broken device data", return -ENODEV);
+
+	char buf[128];
+
+	// we only get the whole data at once
+	if (*ppos != 0 || count >= sizeof(buf)) {
+		iccom_warning("Ctrl message should be written at once"
+			      " and not exceed %zu bytes.", sizeof(buf) - 1);
+		return -EFAULT;
+	}
+
+	if (copy_from_user(buf, ubuf, count) != 0) {
+		iccom_warning("Not all bytes were copied from user.");
+		return -EIO;
+	}
+	buf[count] = 0;
+
+	int priority;
+	int consumed = 0;
+
+	if (sscanf(buf, "%d %n", &priority, &consumed) != 1) {
+		iccom_warning("Parsing failed: %s", buf);
+		return -EINVAL;
+	}
+	if (priority < 0 || priority >= MAX_RT_PRIO) {
+		iccom_warning("priority is out of bounds: %d", priority);
+		return -EINVAL;
+	}
+
+	cpumask_var_t cpus;
+	if (!alloc_cpumask_var(&cpus, GFP_KERNEL)) {
+		return -ENOMEM;
+	}
+
+	mutex_lock(&iccom->p->worker_ctl_lock);
+
+	const char *cpu_list = strim(buf + consumed);
+	int res = 0;
+
+	if (cpu_list[0] == '\0') {
+		cpumask_copy(cpus, &iccom->p->worker_cpus);
+	} else if (cpulist_parse(cpu_list, cpus) < 0) {
+		iccom_warning("CPU list parsing failed: %s", cpu_list);
+		res = -EINVAL;
+		goto finalize;
+	}
+
+	res = __iccom_worker_apply(iccom, priority, cpus);
+	if (res < 0) {
+		iccom_warning("could not apply priority %d and CPUs %*pbl"
+			      " to kthread worker: %d", priority
+			      , cpumask_pr_args(cpus), res);
 	}
 
-	return 0;
+finalize:
+	mutex_unlock(&iccom->p->worker_ctl_lock);
+	free_cpumask_var(cpus);
+
+	return res < 0 ? (ssize_t)res : (ssize_t)count;
 }
+#endif
 
-// Removes the ICcom proc statistics file
-static void __iccom_statistics_close(struct iccom_dev *iccom)
+// Helper. Prints the TX statistics record row (without the channel or
+// level column) into the buffer.
+//
+// RETURNS:
+//      the number of bytes printed (like snprintf)
+static size_t __iccom_tx_stats_print(const struct iccom_tx_stats *stats
+				     , char *buf, const size_t size)
 {
-	ICCOM_CHECK_DEVICE("", return);
-	ICCOM_CHECK_DEVICE_PRIVATE("", return);
-
-	if (IS_ERR_OR_NULL(iccom->p->statistics_file)) {
-		return;
-	}
-
-	proc_remove(iccom->p->statistics_file);
-	iccom->p->statistics_file = NULL;
+	return (size_t)snprintf(buf, size, " %llu %llu %lu\n"
+				, stats->messages_sent, stats->bytes_sent
+				, stats->messages_pending);
 }
 
-// Provides the read method for ICCom statistics to user world.
-// Is invoked when user reads the /proc/<ICCOM>/<STATISTICS> file.
+// Provides the read method for ICCom per-channel and per-priority
+// level statistics to user world. Is invoked when user reads the
+// /proc/<ICCOM>/<CHANNELS_STATISTICS> file.
 //
 // Is restricted to the file size of SIZE_MAX bytes.
 //
 // RETURNS:
 //      >= 0: number of bytes actually provided to user space, on success
 //      < 0: negated error code, on failure
-//
-static ssize_t __iccom_statistics_read(struct file *file
+static ssize_t __iccom_channels_statistics_read(struct file *file
 		, char __user *ubuf
 		, size_t count
 		, loff_t *ppos)
@@ -4048,7 +8327,7 @@ static ssize_t __iccom_statistics_read(struct file *file
 	ICCOM_CHECK_DEVICE("no device provided", return -ENODEV);
 	ICCOM_CHECK_DEVICE_PRIVATE("broken device data", return -ENODEV);
 
-	const int BUFFER_SIZE = 2048;
+	const int BUFFER_SIZE = 16384;
 
 	if (*ppos >= BUFFER_SIZE || *ppos > SIZE_MAX) {
 		return 0;
@@ -4060,48 +8339,135 @@ static ssize_t __iccom_statistics_read(struct file *file
 		return -ENOMEM;
 	}
 
-	const struct iccom_dev_statistics * const s = &iccom->p->statistics;
-	size_t len = (size_t)snprintf(buf, BUFFER_SIZE
-		     , "transport_layer: xfers done:  %llu\n"
-		       "transport_layer: bytes xfered:  %llu\n"
-		       "packages: xfered total:  %llu\n"
-		       "packages: sent ok:  %llu\n"
-		       "packages: received ok:  %llu\n"
-		       "packages: sent fail (total):  %llu\n"
-		       "packages: received fail (total):  %llu\n"
-		       "packages:     received corrupted:  %llu\n"
-		       "packages:     received duplicated:  %llu\n"
-		       "packages:     detailed parsing failed:  %llu\n"
-		       "packages: in tx queue:  %lu\n"
-		       "packets: received ok:  %llu\n"
-		       "messages: received ok:  %llu\n"
-		       "messages: ready rx:  %lu\n"
-		       "bandwidth: consumer bytes received:\t%llu\n"
-		       "\n"
-		       "Note: this is only general statistical/monitoring"
-		       " info and is not expeted to be used in precise"
-		       " measurements due to atomic selfconsistency"
-		       " maintenance would put overhead in the driver.\n"
-		     , s->transport_layer_xfers_done_count
-		     , s->raw_bytes_xfered_via_transport_layer
-		     , s->packages_xfered
-		     , s->packages_sent_ok
-		     , s->packages_received_ok
-		     , s->packages_xfered - s->packages_sent_ok
-		     , s->packages_xfered - s->packages_received_ok
-		     , s->packages_bad_data_received
-		     , s->packages_duplicated_received
-		     , s->packages_parsing_failed
-		     , s->packages_in_tx_queue
-		     , s->packets_received_ok
-		     , s->messages_received_ok
-		     , s->messages_ready_in_storage
-		     , s->total_consumers_bytes_received_ok);
+	struct iccom_tx_stats *stats;
+	size_t len = 0;
+
+	mutex_lock(&iccom->p->tx_queue_lock);
+	__iccom_queue_take_submitted(iccom);
+
+	len += (size_t)snprintf(buf + len, BUFFER_SIZE - len
+				, "tx: channel messages_sent bytes_sent"
+				  " messages_pending\n");
+	list_for_each_entry(stats, &iccom->p->tx_stats, anchor) {
+		if (len >= BUFFER_SIZE) {
+			break;
+		}
+		len += (size_t)snprintf(buf + len, BUFFER_SIZE - len
+					, "%u", stats->channel);
+		if (len < BUFFER_SIZE) {
+			len += __iccom_tx_stats_print(stats, buf + len
+						      , BUFFER_SIZE - len);
+		}
+	}
+
+	if (len < BUFFER_SIZE) {
+		len += (size_t)snprintf(buf + len, BUFFER_SIZE - len
+				, "\ntx: level messages_sent bytes_sent"
+				  " messages_pending\n");
+	}
+	for (int lvl = 0; lvl < ICCOM_TX_PRIORITY_LEVELS_COUNT
+			  && len < BUFFER_SIZE; lvl++) {
+		len += (size_t)snprintf(buf + len, BUFFER_SIZE - len
+					, "%d", lvl);
+		if (len < BUFFER_SIZE) {
+			len += __iccom_tx_stats_print(
+					&iccom->p->tx_level_stats[lvl]
+					, buf + len, BUFFER_SIZE - len);
+		}
+	}
+
+	if (len < BUFFER_SIZE) {
+		len += (size_t)snprintf(buf + len, BUFFER_SIZE - len
+				, "\ntx: post to ack latency histograms\n");
+	}
+	list_for_each_entry(stats, &iccom->p->tx_stats, anchor) {
+		if (len >= BUFFER_SIZE) {
+			break;
+		}
+		len += (size_t)snprintf(buf + len, BUFFER_SIZE - len
+					, "channel %u:", stats->channel);
+		if (len < BUFFER_SIZE) {
+			len += __iccom_latency_hist_print(&stats->post_to_ack
+					, buf + len, BUFFER_SIZE - len);
+		}
+	}
+	for (int lvl = 0; lvl < ICCOM_TX_PRIORITY_LEVELS_COUNT
+			  && len < BUFFER_SIZE; lvl++) {
+		len += (size_t)snprintf(buf + len, BUFFER_SIZE - len
+					, "level %d:", lvl);
+		if (len < BUFFER_SIZE) {
+			len += __iccom_latency_hist_print(
+					&iccom->p->tx_level_stats[lvl].post_to_ack
+					, buf + len, BUFFER_SIZE - len);
+		}
+	}
+	mutex_unlock(&iccom->p->tx_queue_lock);
+
+	struct iccom_message_storage *storage = &iccom->p->rx_messages;
+	struct iccom_message_storage_channel *channel_rec;
+
+	mutex_lock(&storage->lock);
+	if (len < BUFFER_SIZE) {
+		len += (size_t)snprintf(buf + len, BUFFER_SIZE - len
+				, "\nrx: channel messages_delivered"
+				  " bytes_delivered messages_ready\n");
+	}
+	list_for_each_entry(channel_rec, &storage->channels_list
+			    , channel_anchor) {
+		if (len >= BUFFER_SIZE) {
+			break;
+		}
+		unsigned long ready = 0;
+		struct iccom_message *msg;
+		list_for_each_entry(msg, &channel_rec->messages
+				    , list_anchor) {
+			if (__iccom_message_is_ready(msg)) {
+				ready++;
+			}
+		}
+		len += (size_t)snprintf(buf + len, BUFFER_SIZE - len
+					, "%u %llu %llu %lu\n"
+					, channel_rec->channel
+					, channel_rec->messages_delivered
+					, channel_rec->bytes_delivered
+					, ready);
+	}
+
+	if (len < BUFFER_SIZE) {
+		len += (size_t)snprintf(buf + len, BUFFER_SIZE - len
+				, "\nrx: rx to delivery latency"
+				  " histograms\n");
+	}
+	list_for_each_entry(channel_rec, &storage->channels_list
+			    , channel_anchor) {
+		if (len >= BUFFER_SIZE) {
+			break;
+		}
+		len += (size_t)snprintf(buf + len, BUFFER_SIZE - len
+					, "channel %u:", channel_rec->channel);
+		if (len < BUFFER_SIZE) {
+			len += __iccom_latency_hist_print(
+					&channel_rec->rx_to_delivery
+					, buf + len, BUFFER_SIZE - len);
+		}
+	}
+	mutex_unlock(&storage->lock);
+
+	if (len < BUFFER_SIZE) {
+		len += (size_t)snprintf(buf + len, BUFFER_SIZE - len
+				, "\nNOTE: the latency histogram bucket i"
+				  " (starting from 0) counts the latencies"
+				  " within [2^i; 2^(i+1)) usec, the first"
+				  " bucket also counts the lower ones, the"
+				  " last one also counts the higher ones."
+				  " The tx level is the level of the message"
+				  " priority the consumer requested.\n");
+	}
 	len++;
 
 	if (len > BUFFER_SIZE) {
-		iccom_warning("statistics output was too big for buffer"
-			      ", required length: %zu", len);
+		iccom_warning("channels statistics output was too big for"
+			      " buffer, required length: %zu", len);
 		len = BUFFER_SIZE;
 		buf[BUFFER_SIZE - 1] = 0;
 	}
@@ -4120,42 +8486,14 @@ static ssize_t __iccom_statistics_read(struct file *file
 	return nbytes_to_copy - not_copied;
 }
 
-/* -------------------------- KERNEL SPACE API --------------------------*/
-
-// API
-//
-// Sends the consumer data to the other side via specified channel.
-//
-// @data {valid data pointer} the consumer data to be sent to external
-//      @channel.
-//      NOTE: consumer guarantees that the data remain untouched
-//              until call returns.
-//      OWNERSHIP:
-//              consumer
-// @length {>0} the @data size in bytes.
-// @channel [ICCOM_PACKET_MIN_CHANNEL_ID; ICCOM_PACKET_MAX_CHANNEL_ID]
-//      the id of the channel to be used to send the message
-//      should be between ICCOM_PACKET_MIN_CHANNEL_ID and
-//      ICCOM_PACKET_MAX_CHANNEL_ID inclusive
-// @priority Defines the message priority. TODO (not yet implemented).
-// @iccom {valid iccom device ptr} the protocol driver to be used to
-//      send the message
-//
-// CONCURRENCE: thread safe
-//
-// RETURNS:
-//      0 : on success
-//
-//      TODO:
-//          Message id (>= 0) on success (it can be used as timestamp
-//          the bigger the id the later message was ordered for xfer).
+// Helper. Posts the message, see iccom_post_message(...).
 //
-//      <0 : negated error code if fails.
-__maybe_unused
-int iccom_post_message(struct iccom_dev *iccom
+// @initiate_xfer if true, then the xfer is initiated right away.
+static int __iccom_post_message(struct iccom_dev *iccom
 		, char *data, const size_t length
 		, unsigned int channel
-		, unsigned int priority)
+		, unsigned int priority
+		, const bool initiate_xfer)
 {
 	ICCOM_CHECK_DEVICE("no device provided", return -ENODEV);
 	ICCOM_CHECK_DEVICE_PRIVATE("broken device data", return -EINVAL);
@@ -4169,6 +8507,12 @@ int iccom_post_message(struct iccom_dev *iccom
 		return -ENODATA;
 	}
 	ICCOM_CHECK_CLOSING("will not invoke", return -EBADFD);
+	if (ICCOM_LINK_NEGOTIATION
+	    && channel == ICCOM_TECHNICAL_CHANNEL_ID) {
+		iccom_err("channel %d is reserved for ICCom technical data"
+			  , ICCOM_TECHNICAL_CHANNEL_ID);
+		return -EBADSLT;
+	}
 
 #if defined(ICCOM_DEBUG) && defined(ICCOM_DEBUG_PACKAGES_PRINT_MAX_COUNT)
 #if ICCOM_DEBUG_PACKAGES_PRINT_MAX_COUNT != 0
@@ -4181,17 +8525,21 @@ int iccom_post_message(struct iccom_dev *iccom
 #endif
 #endif
 
-	// TODO drop request if there are too many pending
-	// packages to be sent.
-
 	int res = 0;
 	res = __iccom_queue_append_message(iccom, data, length, channel
 					   , priority);
 
+	// the full TX queue is the normal backpressure, not an error
+	if (res == -EAGAIN) {
+		return res;
+	}
 	if (res < 0) {
 		iccom_err("Failed to post the message: err = %d", res);
 		return res;
 	}
+	if (!initiate_xfer) {
+		return 0;
+	}
 
 	// for now we send the package if it is not empty
 	res = __iccom_initiate_data_xfer(iccom);
@@ -4203,6 +8551,83 @@ int iccom_post_message(struct iccom_dev *iccom
 	return 0;
 }
 
+/* -------------------------- KERNEL SPACE API --------------------------*/
+
+// API
+//
+// Sends the consumer data to the other side via specified channel.
+//
+// @data {valid data pointer} the consumer data to be sent to external
+//      @channel.
+//      NOTE: consumer guarantees that the data remain untouched
+//              until call returns.
+//      OWNERSHIP:
+//              consumer
+// @length {>0} the @data size in bytes.
+// @channel [ICCOM_PACKET_MIN_CHANNEL_ID; ICCOM_PACKET_MAX_CHANNEL_ID]
+//      the id of the channel to be used to send the message
+//      should be between ICCOM_PACKET_MIN_CHANNEL_ID and
+//      ICCOM_PACKET_MAX_CHANNEL_ID inclusive
+//      NOTE: if link negotiation is enabled (see
+//          ICCOM_LINK_NEGOTIATION), then the
+//          ICCOM_TECHNICAL_CHANNEL_ID channel is reserved.
+// @priority [0; ICCOM_TX_PRIORITY_MAX] defines the message priority,
+//      the higher the value the earlier the message is sent (see
+//      ICCOM_TX_SCHEDULING). Values above ICCOM_TX_PRIORITY_MAX are
+//      treated as ICCOM_TX_PRIORITY_MAX.
+//      NOTE: the messages of the same channel and the same priority
+//          level (see ICCOM_TX_PRIORITY_LEVELS_COUNT) are always
+//          delivered in the order of posting, the more urgent messages
+//          of the channel might overtake the less urgent ones.
+// @iccom {valid iccom device ptr} the protocol driver to be used to
+//      send the message
+//
+// CONCURRENCE: thread safe
+//
+// RETURNS:
+//      0 : on success
+//
+//      TODO:
+//          Message id (>= 0) on success (it can be used as timestamp
+//          the bigger the id the later message was ordered for xfer).
+//
+//      -EAGAIN : the TX queue is full (see ICCOM_TX_QUEUE_MAX_BYTES),
+//          the consumer may retry later or wait for the room with
+//          iccom_wait_tx_space(...).
+//      <0 : negated error code if fails.
+__maybe_unused
+int iccom_post_message(struct iccom_dev *iccom
+		, char *data, const size_t length
+		, unsigned int channel
+		, unsigned int priority)
+{
+	return __iccom_post_message(iccom, data, length, channel, priority
+				    , true);
+}
+
+// API
+//
+// The same as iccom_post_message(...), but doesn't initiate the xfer:
+// the message is sent with the next xfer. Allows the consumer to
+// submit a batch of messages and then initiate the xfer once with
+// iccom_flush(...), so the whole batch is built into the same
+// package(s), instead of the xfer being started by the first message.
+//
+// CONCURRENCE: thread safe
+//
+// RETURNS:
+//      0 : on success
+//      <0 : negated error code if fails.
+__maybe_unused
+int iccom_submit_message(struct iccom_dev *iccom
+		, char *data, const size_t length
+		, unsigned int channel
+		, unsigned int priority)
+{
+	return __iccom_post_message(iccom, data, length, channel, priority
+				    , false);
+}
+
 // API
 //
 // Forces the ICCom to start xfer of the current heading package
@@ -4230,6 +8655,92 @@ int iccom_flush(struct iccom_dev *iccom)
 	return 0;
 }
 
+// API
+//
+// Waits until the TX queue has the room for the message of @length
+// bytes (see ICCOM_TX_QUEUE_MAX_BYTES), so the consumer which got
+// -EAGAIN from iccom_post_message(...) knows when to retry.
+//
+// @iccom {valid iccom device ptr} the protocol driver to be used
+// @length {>0} the size of the message to be posted
+// @timeout_jiffies {>=0} the max time to wait,
+//      MAX_SCHEDULE_TIMEOUT to wait without timeout, 0 to check
+//      without waiting.
+//
+// NOTE: the room is not reserved, so the concurrent consumer might
+//      take it first, and the post can still fail with -EAGAIN.
+//
+// NOTE: the wait is to be finished before iccom_close(...) is called.
+//
+// CONTEXT: sleepable
+//
+// RETURNS:
+//      >0 : the room is available (the remaining jiffies of timeout,
+//          at least 1)
+//      0 : the timeout elapsed, no room
+//      -ERESTARTSYS : interrupted by a signal
+//      -EBADFD : the device is closing
+//      <0 : negated error code if fails.
+__maybe_unused
+long iccom_wait_tx_space(struct iccom_dev *iccom, const size_t length
+			 , const long timeout_jiffies)
+{
+	ICCOM_CHECK_DEVICE("no device provided", return -ENODEV);
+	ICCOM_CHECK_DEVICE_PRIVATE("broken device data", return -EINVAL);
+	ICCOM_CHECK_CLOSING("will not wait", return -EBADFD);
+
+	if (__iccom_tx_has_space(iccom, length)) {
+		return max(timeout_jiffies, 1L);
+	}
+	if (timeout_jiffies == 0) {
+		return 0;
+	}
+
+	const long res = wait_event_interruptible_timeout(
+				iccom->p->tx_space_wait
+				, __iccom_tx_has_space(iccom, length)
+				  || iccom->p->closing
+				, timeout_jiffies);
+	if (res > 0 && iccom->p->closing) {
+		return -EBADFD;
+	}
+	return res;
+}
+
+// API
+//
+// Provides the current TX queue fill state, so the consumers can
+// adapt their TX rate.
+//
+// @iccom {valid iccom device ptr} the protocol driver to be used
+// @queued_bytes__out {valid ptr || NULL}:OUT the number of consumer
+//      data bytes pending in the TX queue
+// @max_bytes__out {valid ptr || NULL}:OUT the TX queue limit (see
+//      ICCOM_TX_QUEUE_MAX_BYTES)
+//
+// CONCURRENCE: thread safe
+//
+// RETURNS:
+//      0 : on success
+//      <0 : negated error code if fails.
+__maybe_unused
+int iccom_get_tx_queue_state(struct iccom_dev *iccom
+			     , size_t *queued_bytes__out
+			     , size_t *max_bytes__out)
+{
+	ICCOM_CHECK_DEVICE("no device provided", return -ENODEV);
+	ICCOM_CHECK_DEVICE_PRIVATE("broken device data", return -EINVAL);
+
+	if (queued_bytes__out) {
+		*queued_bytes__out
+			= (size_t)atomic_read(&iccom->p->tx_queued_bytes);
+	}
+	if (max_bytes__out) {
+		*max_bytes__out = (size_t)READ_ONCE(tx_queue_max_bytes);
+	}
+	return 0;
+}
+
 // API
 //
 // Adds the message ready callback to the channel. This callback will be
@@ -4374,6 +8885,8 @@ iccom_msg_ready_callback_ptr_t iccom_get_channel_callback(
 //
 // CONCURRENCE: thread safe
 // OWNERSHIP: of the provided message data is transferred to the caller.
+//      NOTE: if RX data room is set, the data is to be freed as
+//          kfree(data - rx_data_headroom), see struct iccom_dev.
 //
 // RETURNS:
 //     0: no errors (absence of messages is not an error)
@@ -4412,8 +8925,7 @@ int iccom_read_message(struct iccom_dev *iccom
 		return 0;
 	}
 
-	__sync_add_and_fetch(
-		    &iccom->p->statistics.messages_ready_in_storage, -1);
+	ICCOM_STATS_DEC(iccom->p, messages_ready_in_storage);
 
 	*msg_data_ptr__out = msg->data;
 	*buf_size__out = msg->length;
@@ -4438,6 +8950,9 @@ int iccom_read_message(struct iccom_dev *iccom
 //      @xfer_iface member should be valid and contain all
 //      pointers.
 //
+//      @rx_data_headroom and @rx_data_tailroom members are to be
+//      set (0 if not needed).
+//
 //      iccom_dev_private structure pointer initialized by iccom
 //      for internal needs.
 //
@@ -4484,15 +8999,23 @@ int iccom_init(struct iccom_dev *iccom)
 	}
 	iccom->p->iccom = iccom;
 
-	__iccom_procfs_init(iccom);
-	__iccom_statistics_init(iccom);
+	res = __iccom_procfs_init(iccom);
+	if (res < 0) {
+		goto free_private;
+	}
+	res = __iccom_statistics_init(iccom);
+	if (res == -ENOMEM) {
+		goto free_procfs;
+	}
 	__iccom_error_report_init(iccom);
 
 	res = iccom_msg_storage_init(&iccom->p->rx_messages);
 	if (res < 0) {
 		iccom_err("Could not initialize messages storage.");
-		goto free_private;
+		goto free_statistics;
 	}
+	iccom->p->rx_messages.data_headroom = iccom->rx_data_headroom;
+	iccom->p->rx_messages.data_tailroom = iccom->rx_data_tailroom;
 
 	res = __iccom_init_packages_storage(iccom);
 	if (res < 0) {
@@ -4500,16 +9023,25 @@ int iccom_init(struct iccom_dev *iccom)
 		goto free_msg_storage;
 	}
 
+	__iccom_tx_channels_ctl_init(iccom);
+	__iccom_channels_statistics_init(iccom);
+
 	// init TX ack/nack data
 	iccom->p->ack_val = ICCOM_PACKAGE_ACK_VALUE;
 	iccom->p->nack_val = ICCOM_PACKAGE_NACK_VALUE;
+	iccom->p->ack_fallback_val = ICCOM_PACKAGE_ACK_FALLBACK_VALUE;
+	iccom->p->nack_fallback_val = ICCOM_PACKAGE_NACK_FALLBACK_VALUE;
 
-	// initial empty package
-	res = __iccom_enqueue_empty_tx_data_package(iccom);
+	// initial package (has no consumer data, but might carry
+	// technical records)
+	res = __iccom_enqueue_new_tx_data_package(iccom);
 	if (res != 0) {
 		iccom_err("Could not add initial TX package");
 		goto free_pkg_storage;
 	}
+	mutex_lock(&iccom->p->tx_queue_lock);
+	__iccom_queue_fill_package(iccom, __iccom_get_last_tx_package(iccom));
+	mutex_unlock(&iccom->p->tx_queue_lock);
 
 	__iccom_fillup_next_data_xfer(iccom, &iccom->p->xfer);
 	iccom->p->data_xfer_stage = true;
@@ -4522,8 +9054,16 @@ int iccom_init(struct iccom_dev *iccom)
 	}
 
 	// initiate consumer notification work
-	INIT_WORK(&iccom->p->consumer_delivery_work
-		  , __iccom_consumer_notification_routine);
+	ICCOM_INIT_WORK(&iccom->p->consumer_delivery_work
+			, __iccom_consumer_notification_routine);
+#if ICCOM_RX_PIPELINED
+	init_llist_head(&iccom->p->rx_parse_queue);
+	iccom->p->rx_parse_pending = NULL;
+	ICCOM_INIT_WORK(&iccom->p->rx_parse_work, __iccom_rx_parse_routine);
+#endif
+#if ICCOM_WORKQUEUE_MODE_MATCH(RT_KTHREAD)
+	__iccom_worker_ctl_init(iccom);
+#endif
 
 	iccom->p->closing = false;
 
@@ -4540,11 +9080,20 @@ int iccom_init(struct iccom_dev *iccom)
 	return 0;
 
 free_workqueue:
+#if ICCOM_WORKQUEUE_MODE_MATCH(RT_KTHREAD)
+	__iccom_worker_ctl_close(iccom);
+#endif
 	__iccom_close_workqueue(iccom);
 free_pkg_storage:
+	__iccom_channels_statistics_close(iccom);
+	__iccom_tx_channels_ctl_close(iccom);
 	__iccom_free_packages_storage(iccom);
 free_msg_storage:
 	iccom_msg_storage_free(&iccom->p->rx_messages);
+free_statistics:
+	__iccom_statistics_close(iccom);
+free_procfs:
+	__iccom_procfs_close(iccom);
 free_private:
 	kfree(iccom->p);
 	iccom->p = NULL;
@@ -4566,46 +9115,58 @@ void iccom_print_statistics(struct iccom_dev *iccom)
 	ICCOM_CHECK_DEVICE_PRIVATE("broken device data", return);
 	ICCOM_CHECK_CLOSING("will not invoke", return);
 
+	struct iccom_dev_statistics s;
+	__iccom_statistics_get(iccom, &s);
+
 	iccom_info_raw(ICCOM_LOG_INFO_KEY_LEVEL
 		       , "====== ICCOM (%px) statistics ======", iccom);
 	iccom_info_raw(ICCOM_LOG_INFO_KEY_LEVEL
 		       , "TRANSPORT LAYER: xfers done count:\t%llu"
-		       , iccom->p->statistics.transport_layer_xfers_done_count);
+		       , s.transport_layer_xfers_done_count);
 	iccom_info_raw(ICCOM_LOG_INFO_KEY_LEVEL
 		       , "TRANSPORT LAYER: bytes xfered:\t%llu"
-		       , iccom->p->statistics.raw_bytes_xfered_via_transport_layer);
+		       , s.raw_bytes_xfered_via_transport_layer);
 	iccom_info_raw(ICCOM_LOG_INFO_KEY_LEVEL
 		       , "PACKAGES: xfered TOTAL:\t%llu"
-		       , iccom->p->statistics.packages_xfered);
+		       , s.packages_xfered);
 	iccom_info_raw(ICCOM_LOG_INFO_KEY_LEVEL
 		       , "PACKAGES: sent OK:\t%llu"
-		       , iccom->p->statistics.packages_sent_ok);
+		       , s.packages_sent_ok);
 	iccom_info_raw(ICCOM_LOG_INFO_KEY_LEVEL
 		       , "PACKAGES: received OK:\t%llu"
-		       , iccom->p->statistics.packages_received_ok);
+		       , s.packages_received_ok);
 	iccom_info_raw(ICCOM_LOG_INFO_KEY_LEVEL
 		       , "PACKAGES: sent FAIL:\t%llu"
-		       , iccom->p->statistics.packages_xfered
-			 - iccom->p->statistics.packages_sent_ok);
+		       , s.packages_xfered
+			 - s.packages_sent_ok);
 	iccom_info_raw(ICCOM_LOG_INFO_KEY_LEVEL
 		       , "PACKAGES: received FAIL:\t%llu"
-		       , iccom->p->statistics.packages_xfered
-			 - iccom->p->statistics.packages_received_ok);
+		       , s.packages_xfered
+			 - s.packages_received_ok);
 	iccom_info_raw(ICCOM_LOG_INFO_KEY_LEVEL
 		       , "PACKAGES: in TX queue:\t%lu"
-		       , iccom->p->statistics.packages_in_tx_queue);
+		       , s.packages_in_tx_queue);
+	iccom_info_raw(ICCOM_LOG_INFO_KEY_LEVEL
+		       , "PACKAGES: size:\t%zu"
+		       , iccom->p->data_xfer_size_bytes);
+	iccom_info_raw(ICCOM_LOG_INFO_KEY_LEVEL
+		       , "LINK: features:\t0x%x"
+		       , iccom->p->link_features);
+	iccom_info_raw(ICCOM_LOG_INFO_KEY_LEVEL
+		       , "MESSAGES: in TX queue:\t%lu"
+		       , s.messages_in_tx_queue);
 	iccom_info_raw(ICCOM_LOG_INFO_KEY_LEVEL
 		       , "PACKETS: received OK:\t%llu"
-		       , iccom->p->statistics.packets_received_ok);
+		       , s.packets_received_ok);
 	iccom_info_raw(ICCOM_LOG_INFO_KEY_LEVEL
 		       , "MESSAGES: received OK:\t%llu"
-		       , iccom->p->statistics.messages_received_ok);
+		       , s.messages_received_ok);
 	iccom_info_raw(ICCOM_LOG_INFO_KEY_LEVEL
 		       , "MESSAGES: ready in RX storage:\t%lu"
-		       , iccom->p->statistics.messages_ready_in_storage);
+		       , s.messages_ready_in_storage);
 	iccom_info_raw(ICCOM_LOG_INFO_KEY_LEVEL
 		       , "BANDWIDTH: total consumer bytes received OK:\t%llu"
-		       , iccom->p->statistics.total_consumers_bytes_received_ok);
+		       , s.total_consumers_bytes_received_ok);
 }
 
 // @@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@
@@ -4643,11 +9204,25 @@ void iccom_close(struct iccom_dev *iccom)
 	iccom_info_raw(ICCOM_LOG_INFO_OPT_LEVEL
 		       , "closing device (%px)", iccom);
 
+	// the consumers waiting for the TX queue room are to go
+	wake_up_interruptible_all(&iccom->p->tx_space_wait);
+
 	__iccom_cancel_work_sync(iccom
 			, &iccom->p->consumer_delivery_work);
 
 	__iccomm_stop_xfer_device(iccom);
 
+#if ICCOM_RX_PIPELINED
+	// the parsing might have scheduled the delivery again
+	__iccom_cancel_work_sync(iccom, &iccom->p->rx_parse_work);
+	__iccom_cancel_work_sync(iccom
+			, &iccom->p->consumer_delivery_work);
+	__iccom_rx_parse_queue_free(iccom);
+#endif
+
+#if ICCOM_WORKQUEUE_MODE_MATCH(RT_KTHREAD)
+	__iccom_worker_ctl_close(iccom);
+#endif
 	__iccom_close_workqueue(iccom);
 
 	// @@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@
@@ -4658,8 +9233,13 @@ void iccom_close(struct iccom_dev *iccom)
 	// working with it. This will lead to crash.
 
 	// Cleanup all our allocated data
+	__iccom_channels_statistics_close(iccom);
+	__iccom_tx_channels_ctl_close(iccom);
 	iccom_msg_storage_free(&iccom->p->rx_messages);
 	__iccom_queue_free(iccom);
+	__iccom_pb_rx_window_free(iccom);
+	kfree(iccom->p->tx_batch_buf);
+	iccom->p->tx_batch_buf = NULL;
 
 	__iccom_statistics_close(iccom);
 	__iccom_procfs_close(iccom);
@@ -4747,7 +9327,10 @@ bool iccom_is_running(struct iccom_dev *iccom)
 /* --------------------- MODULE HOUSEKEEPING SECTION ------------------- */
 
 EXPORT_SYMBOL(iccom_post_message);
+EXPORT_SYMBOL(iccom_submit_message);
 EXPORT_SYMBOL(iccom_flush);
+EXPORT_SYMBOL(iccom_wait_tx_space);
+EXPORT_SYMBOL(iccom_get_tx_queue_state);
 EXPORT_SYMBOL(iccom_set_channel_callback);
 EXPORT_SYMBOL(iccom_remove_channel_callback);
 EXPORT_SYMBOL(iccom_get_channel_callback);
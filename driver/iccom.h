@@ -70,11 +70,26 @@ typedef bool (*iccom_msg_ready_callback_ptr_t)( unsigned int channel
 //      pointer is passed to methods, defined by @xfer_iface.
 // @xfer_iface the structure which provides pointers to
 //      transport methods of the device, provided by @xfer_device.
+// @rx_data_headroom the number of bytes ICCom reserves in front of
+//      the data of every received message within its data buffer.
+//      Set by consumer before init. Allows the consumer which takes
+//      the message data ownership to build its own structure around
+//      the data in place (like the netlink message header), without
+//      allocating and copying the whole message.
+//      NOTE: the message data buffer given to consumer starts at
+//          (msg_data - @rx_data_headroom), and is to be freed as
+//          kfree(msg_data - @rx_data_headroom).
+// @rx_data_tailroom the number of bytes ICCom reserves after the data
+//      of every received message within its data buffer. Set by
+//      consumer before init.
 struct iccom_dev {
         struct iccom_dev_private *p;
 
         void *xfer_device;
         struct full_duplex_sym_iface xfer_iface;
+
+        size_t rx_data_headroom;
+        size_t rx_data_tailroom;
 };
 
 /* ------------------ KERNEL SPACE API DECLARATIONS ---------------------*/
@@ -84,7 +99,16 @@ int iccom_post_message(struct iccom_dev *iccom
                 , char *data, const size_t length
                 , unsigned int channel
                 , unsigned int priority);
+int iccom_submit_message(struct iccom_dev *iccom
+                , char *data, const size_t length
+                , unsigned int channel
+                , unsigned int priority);
 int iccom_flush(struct iccom_dev *iccom);
+long iccom_wait_tx_space(struct iccom_dev *iccom, const size_t length
+                , const long timeout_jiffies);
+int iccom_get_tx_queue_state(struct iccom_dev *iccom
+                , size_t *queued_bytes__out
+                , size_t *max_bytes__out);
 int iccom_set_channel_callback(struct iccom_dev *iccom
                 , unsigned int channel
                 , iccom_msg_ready_callback_ptr_t message_ready_callback
@@ -29,6 +29,16 @@
 #include <uapi/linux/netlink.h>
 #include <linux/proc_fs.h>
 #include <linux/uaccess.h>
+#include <linux/hashtable.h>
+#include <linux/spinlock.h>
+#include <linux/kthread.h>
+#include <linux/llist.h>
+#include <linux/wait.h>
+#include <linux/mutex.h>
+#include <linux/rcupdate.h>
+#include <linux/bitmap.h>
+#include <linux/workqueue.h>
+#include <linux/version.h>
 #include <stddef.h>
 
 #include "./iccom.h"
@@ -40,6 +50,7 @@
 // TODO: remove the dependency
 //#include "./iccom-example.h"
 #include "./symspi.h"
+#include "./full_duplex_loopback.h"
 
 // DEV STACK
 // @@@@@@@@@@@@@
@@ -98,11 +109,58 @@
 //      [ICCOM_SK_MAX_CHANNEL_VAL + 1; 2 * ICCOM_SK_MAX_CHANNEL_VAL  + 1]
 // NOTE: loopback channels can go also in ordinary channel area
 #define ICCOM_SK_MAX_CHANNEL_VAL 0x7FFF
+// The number of all channels (ordinary and loopback ones)
+#define ICCOM_SK_CHANNELS_COUNT (2 * (ICCOM_SK_MAX_CHANNEL_VAL + 1))
+
+// The first netlink port id the subscriber sockets can use, the lower
+// ones are the channel sockets port ids (ordinary and loopback
+// channels).
+#define ICCOM_SK_SUBSCRIBER_PORTID_MIN ICCOM_SK_CHANNELS_COUNT
+
+// The max number of the loopback mapping rules active at once
+#define ICCOM_SK_MAX_LBACK_RULES 32
 
 #define ICCOM_SK_PROC_ROOT_NAME "iccomif"
 #define ICCOM_SK_LBACKCTL_FILE_NAME "loopbackctl"
+#define ICCOM_SK_SUBSCRCTL_FILE_NAME "subscribectl"
+#define ICCOM_SK_TXQUEUE_FILE_NAME "txqueue"
+
+// The netlink message header flag (nlmsg_flags) which marks the User
+// Space message sent with MSG_DONTWAIT: the send flags of the message
+// don't come to the kernel socket input, so libiccom mirrors the
+// MSG_DONTWAIT to the message header.
+#define ICCOM_SK_NLM_F_DONTWAIT 0x8000
+
+// The max number of sockets subscribed to a single channel (not
+// counting the channel own socket bound to port id == channel)
+#define ICCOM_SK_MAX_CHANNEL_SUBSCRIBERS 8
+// The max number of subscriptions in total
+#define ICCOM_SK_MAX_SUBSCRIPTIONS 256
+// The subscriptions hash table size (log2 of buckets number)
+#define ICCOM_SK_SUBSCR_HASH_BITS 6
 
 #define ICCOM_SK_PROC_RW_PERMISSIONS 0600
+#define ICCOM_SK_PROC_RO_PERMISSIONS 0444
+
+// The room ICCom reserves around the received messages data, so the
+// netlink message is built right in the ICCom message data buffer:
+// the netlink header goes in front of the data, while the netlink
+// padding and the skb shared info go after it.
+#define ICCOM_SK_RX_DATA_HEADROOM NLMSG_HDRLEN
+#define ICCOM_SK_RX_DATA_TAILROOM                                       \
+        (NLMSG_ALIGNTO + SKB_DATA_ALIGN(sizeof(struct skb_shared_info)))
+
+// The transport param values
+#define ICCOM_SK_TRANSPORT_SYMSPI "symspi"
+#define ICCOM_SK_TRANSPORT_LOOPBACK "loopback"
+// The loopback transport peer keeps the messages it could not echo
+// right away (its ICCom TX queue was full) up to this total size, and
+// echoes them in order as the TX queue gets room, the messages which
+// do not fit are dropped (and counted).
+#define ICCOM_SK_PEER_ECHO_BACKLOG_MAX_BYTES (64 * 1024)
+// How long the peer echo work waits for the room in the peer TX queue
+// before it rechecks the exiting state.
+#define ICCOM_SK_PEER_ECHO_RETRY_JIFFIES (HZ / 10)
 /* --------------------- UTILITIES SECTION ----------------------------- */
 
 #define iccom_socket_err(fmt, ...)                                       \
@@ -179,10 +237,85 @@ struct iccom_sk_loopback_mapping_rule {
         int shift;
 };
 
+// The set of the loopback mapping rules. Is never modified once
+// published, the update replaces the whole set (RCU), so the rules
+// are looked up on every message without locking.
+//
+// NOTE: the channel ranges (both original and mapped ones) of all
+//      rules never overlap, so every channel belongs to the single
+//      rule at most.
+//
+// @rules_count the number of valid @rules
+// @rules the active (shift != 0) loopback mapping rules
+// @looped the bitmap of all channels covered by the @rules (both
+//      original and mapped ranges), so the channels which are not
+//      looped (the most of the traffic) are told with a single bit
+//      test
+// @rcu to free the set after the update
+struct iccom_sk_loopback_map {
+        int rules_count;
+        struct iccom_sk_loopback_mapping_rule rules[ICCOM_SK_MAX_LBACK_RULES];
+        DECLARE_BITMAP(looped, ICCOM_SK_CHANNELS_COUNT);
+        struct rcu_head rcu;
+};
+
+// The netlink message queued to be sent down to ICCom by the pump
+// thread.
+//
+// @anchor the binding to the TX queue
+// @skb the netlink message skb (we hold a reference to it)
+// @length the message payload size
+struct iccom_sk_tx_entry {
+        struct llist_node anchor;
+        struct sk_buff *skb;
+        size_t length;
+};
+
+// The subscription of the netlink socket to the channel messages.
+// Every message sent up to the channel socket (port id == channel)
+// is also sent to all sockets subscribed to the channel. The
+// subscriber gets the channel number in nlmsg_pid field of the
+// netlink message header.
+//
+// @hash_anchor the binding to the subscriptions hash table (the
+//      channel is the key)
+// @channel the channel subscribed to
+// @portid the netlink port id of the subscribed socket
+struct iccom_sk_subscription {
+        struct hlist_node hash_anchor;
+        unsigned int channel;
+        u32 portid;
+};
+
+// The message the loopback transport peer is still to echo (see
+// ICCOM_SK_PEER_ECHO_BACKLOG_MAX_BYTES).
+//
+// @list_anchor the binding to the peer echo backlog
+// @channel the channel to echo the message to
+// @length the message data size
+// @data the message data
+struct iccom_sk_peer_echo {
+        struct list_head list_anchor;
+        unsigned int channel;
+        size_t length;
+        char data[];
+};
+
 // ICCom socket interface provider.
 //
 // @socket the socket we are working with
 // @pump_task the ptr to thread which pumpts messages to ICCom device
+// @tx_queue the lock-free queue of the netlink messages from User
+//      Space, to be sent down to ICCom by @pump_task
+// @tx_wait the wait queue @pump_task waits for @tx_queue messages on
+// @tx_queue_bytes the total payload size of the @tx_queue messages
+// @tx_space_wait the wait queue the User Space senders wait for the
+//      @tx_queue to be sent down to ICCom on
+// @tx_senders the number of User Space senders being in our netlink
+//      input callback now (they might wait there for the room in
+//      ICCom TX queue)
+// @tx_senders_wait the wait queue the close sequence waits for all
+//      @tx_senders to leave on
 // @iccom the ICCom device to work with
 // @initialized completed as everything is ready to be run after
 //      initialization.
@@ -199,13 +332,53 @@ struct iccom_sk_loopback_mapping_rule {
 //      added.
 // @loopback_ctl_ops loopback control file operations
 // @loopback_ctl_file the loopback control file itself
-// @lback_map_rule the channel loopback mapping rule pointer,
-//      allocated on heap.
+// @lback_map the channel loopback mapping rules set (RCU protected),
+//      NULL if no loopback is configured
+// @lback_map_lock serializes the @lback_map updates
+// @subscriptions the channel subscriptions hash table, the channel
+//      is the key
+// @subscriptions_count the total number of @subscriptions
+// @subscriptions_lock protects @subscriptions and
+//      @subscriptions_count
+// @subscr_ctl_ops subscriptions control file operations
+// @subscr_ctl_file the subscriptions control file itself
+// @tx_queue_ops the TX queue state file operations
+// @tx_queue_file the TX queue state file itself
+// @netlink_notifier the netlink notifier to drop the subscriptions
+//      of the released sockets
+// @peer_iccom the remote side ICCom device, used only with the
+//      loopback transport: it sits on the other side of the loopback
+//      link and echoes every received message back to the same
+//      channel.
+// @loopback_get_device the full_duplex_loopback_get_device() of the
+//      loopback module, taken (with the module reference) only when
+//      the loopback transport is used, NULL otherwise
+// @peer_echo_backlog the list of struct iccom_sk_peer_echo waiting
+//      for the room in the @peer_iccom TX queue, in the RX order
+// @peer_echo_backlog_bytes the total data size of @peer_echo_backlog
+// @peer_echoes_dropped the number of messages the peer dropped as
+//      its echo backlog was full
+// @peer_echo_lock protects the @peer_echo_backlog and serializes the
+//      peer echo posting (so the echo order is kept)
+// @peer_echo_work posts the @peer_echo_backlog messages
 struct iccom_sockets_device {
         struct sock *socket;
         struct task_struct *pump_task;
+        struct llist_head tx_queue;
+        wait_queue_head_t tx_wait;
+        atomic_t tx_queue_bytes;
+        wait_queue_head_t tx_space_wait;
+        atomic_t tx_senders;
+        wait_queue_head_t tx_senders_wait;
 
         struct iccom_dev iccom;
+        struct iccom_dev peer_iccom;
+        typeof(&full_duplex_loopback_get_device) loopback_get_device;
+        struct list_head peer_echo_backlog;
+        size_t peer_echo_backlog_bytes;
+        unsigned long long peer_echoes_dropped;
+        struct mutex peer_echo_lock;
+        struct work_struct peer_echo_work;
 
         struct completion initialized;
         bool exiting;
@@ -217,7 +390,19 @@ struct iccom_sockets_device {
         struct file_operations loopback_ctl_ops;
         struct proc_dir_entry *loopback_ctl_file;
 
-        struct iccom_sk_loopback_mapping_rule *lback_map_rule;
+        struct iccom_sk_loopback_map __rcu *lback_map;
+        struct mutex lback_map_lock;
+
+        DECLARE_HASHTABLE(subscriptions, ICCOM_SK_SUBSCR_HASH_BITS);
+        unsigned int subscriptions_count;
+        spinlock_t subscriptions_lock;
+
+        struct file_operations subscr_ctl_ops;
+        struct proc_dir_entry *subscr_ctl_file;
+        struct notifier_block netlink_notifier;
+
+        struct file_operations tx_queue_ops;
+        struct proc_dir_entry *tx_queue_file;
 };
 
 /* -------------------------- EXTERN VARS -------------------------------*/
@@ -227,6 +412,15 @@ struct iccom_sockets_device {
 // Singleton device for now.
 struct iccom_sockets_device __iccom_sockets_dev;
 
+// The transport to run ICCom over:
+//      "symspi": the SymSPI device (default),
+//      "loopback": the full duplex loopback link with echoing peer
+//              ICCom on the other side, no hardware needed.
+static char *transport = ICCOM_SK_TRANSPORT_SYMSPI;
+module_param(transport, charp, 0444);
+MODULE_PARM_DESC(transport, "The ICCom transport: \"symspi\" (default)"
+                 " or \"loopback\".");
+
 /* --------------------- FORWARD DECLARATIONS ---------------------------*/
 
 static int __iccom_socket_dispatch_msg_up(
@@ -236,11 +430,29 @@ static int __iccom_socket_dispatch_msg_up(
 
 static int __iccom_socket_dispatch_msg_down(
                 struct iccom_sockets_device *iccom_sk
-                , struct sk_buff *sk_buffer);
+                , struct sk_buff *sk_buffer
+                , bool *posted__out);
 
-static int __iccom_socket_match_channel2lbackrule(
-        const struct iccom_sk_loopback_mapping_rule *const rule
-        , const int channel);
+static void __iccom_socket_tx_enqueue(
+                struct iccom_sockets_device *iccom_sk
+                , struct sk_buff *skb);
+
+static int __iccom_socket_tx_admit(
+                struct iccom_sockets_device *iccom_sk
+                , struct sk_buff *skb);
+
+static void __iccom_socket_report_tx_error(
+                struct iccom_sockets_device *iccom_sk
+                , struct sk_buff *skb, const int error);
+
+static bool __iccom_socket_dispatch_msg_up_inplace(
+                struct iccom_sockets_device *iccom_sk
+                , const uint32_t channel, void *const data
+                , const size_t data_size_bytes);
+
+static int __iccom_socket_lback_lookup(
+                struct iccom_sockets_device *iccom_sk
+                , const uint32_t channel, uint32_t *dst_channel__out);
 
 /* --------------------- ENTRY POINTS -----------------------------------*/
 
@@ -251,17 +463,31 @@ static void __iccom_socket_netlink_data_ready(struct sk_buff *skb)
         // TODO: to clarify if possible to pass iccom_sockets_device
         //      as parameter part
 
-        if (__iccom_sockets_dev.exiting) {
-                return;
+        struct iccom_sockets_device *iccom_sk = &__iccom_sockets_dev;
+
+        // the close sequence waits for us to leave
+        atomic_inc(&iccom_sk->tx_senders);
+        smp_mb();
+        if (iccom_sk->exiting) {
+                goto done;
         }
 
-    //    struct sock *socket = __iccom_sockets_dev.socket;
+        // the blocking sender waits here for the room in ICCom TX
+        // queue, the non-blocking one gets the error
+        const int res = __iccom_socket_tx_admit(iccom_sk, skb);
+        if (res < 0) {
+                __iccom_socket_report_tx_error(iccom_sk, skb, res);
+                goto done;
+        }
 
-        __iccom_socket_dispatch_msg_down(&__iccom_sockets_dev, skb);
+        // the message is sent down to ICCom by the pump thread, so
+        // the sender doesn't wait for it
+        __iccom_socket_tx_enqueue(iccom_sk, skb);
 
-        // TODO: try to clarify how to make it run via separate thread
-    //    wake_up_interruptible_all(sk_sleep(socket));
-    //    force_sig(SIGUSR1, __iccom_sockets_dev.pump_task);
+done:
+        if (atomic_dec_and_test(&iccom_sk->tx_senders)) {
+                wake_up_all(&iccom_sk->tx_senders_wait);
+        }
 }
 
 // Is called whenever inderlying protocol layer gets new message
@@ -276,14 +502,19 @@ static bool __iccom_socket_msg_rx_callback(
 
         ICCOM_SK_CHECK_DEVICE("", return false);
 
-        const int lback = __iccom_socket_match_channel2lbackrule(
-                                iccom_sk->lback_map_rule, channel);
         // loopback mode for this channel was enabled, so external
         // party is dropped from the loop channel
-        if (lback != 0) {
+        if (__iccom_socket_lback_lookup(iccom_sk, channel, NULL) != 0) {
             return false;
         }
 
+        // the message data is delivered within the netlink message
+        // built in place, so we take the data ownership
+        if (__iccom_socket_dispatch_msg_up_inplace(iccom_sk, channel
+                                                   , msg_data, msg_len)) {
+                return true;
+        }
+
         __iccom_socket_dispatch_msg_up(iccom_sk, channel, msg_data
                                        , msg_len);
 
@@ -321,6 +552,53 @@ static int __iccom_socket_match_channel2lbackrule(
         return 0;
 }
 
+// Helper. Looks up the loopback mapping of the channel among all
+// loopback rules.
+//
+// @channel the channel to look up
+// @dst_channel__out {valid ptr || NULL}:OUT the channel on the other
+//      end of the loop, set only if the channel is looped
+//
+// CONCURRENCE: thread safe, lock-free
+//
+// RETURNS:
+//      >0: when given channel is the local end of some loop
+//      0: when given channel is not looped
+//      <0: when given channel is the remote end of some loop
+static int __iccom_socket_lback_lookup(
+                struct iccom_sockets_device *iccom_sk
+                , const uint32_t channel, uint32_t *dst_channel__out)
+{
+        if (channel >= ICCOM_SK_CHANNELS_COUNT) {
+                return 0;
+        }
+
+        int lback = 0;
+
+        rcu_read_lock();
+        const struct iccom_sk_loopback_map *map
+                        = rcu_dereference(iccom_sk->lback_map);
+        if (map && test_bit(channel, map->looped)) {
+                for (int i = 0; i < map->rules_count; i++) {
+                        const struct iccom_sk_loopback_mapping_rule *rule
+                                        = &map->rules[i];
+                        lback = __iccom_socket_match_channel2lbackrule(
+                                        rule, (int)channel);
+                        if (lback == 0) {
+                                continue;
+                        }
+                        if (dst_channel__out) {
+                                *dst_channel__out = (lback > 0)
+                                                ? (channel + rule->shift)
+                                                : (channel - rule->shift);
+                        }
+                        break;
+                }
+        }
+        rcu_read_unlock();
+
+        return lback;
+}
 
 // RETURNS:
 //      >=0: on success
@@ -360,17 +638,26 @@ static int __iccom_socket_lback_rule_verify(
         return 0;
 }
 
-// The message header is used in following way:
-// * nlmsg_type -> the destination channel (port number)
-// * nlmsg_flags (lo byte) -> priority
-// * nlmsg_pid -> sending process port ID
+// The message is used in following way:
+// * sender socket port ID (lo 15 bits) -> the destination channel
+// * nlmsg_type (bits 8..15) -> priority
+// * nlmsg_flags & ICCOM_SK_NLM_F_DONTWAIT -> the sender doesn't wait
+//      for the room in ICCom TX queue
+//
+// NOTE: the message is only submitted to ICCom, the xfer is to be
+//      initiated by caller (iccom_flush(...)) if @posted__out is set.
+//
+// @posted__out {valid ptr}:OUT set to true if the message was
+//      submitted to ICCom, untouched otherwise
 //
 // RETURNS:
 //      0: success
+//      -EAGAIN: ICCom TX queue is full
 //      <0: negated error code, if fails
 static int __iccom_socket_dispatch_msg_down(
                 struct iccom_sockets_device *iccom_sk
-                , struct sk_buff *sk_buffer)
+                , struct sk_buff *sk_buffer
+                , bool *posted__out)
 {
         struct nlmsghdr *nl_header = (struct nlmsghdr *)sk_buffer->data;
 
@@ -396,233 +683,886 @@ static int __iccom_socket_dispatch_msg_down(
                        , true);
 #endif
 
-        const int lback = __iccom_socket_match_channel2lbackrule(
-                                iccom_sk->lback_map_rule, channel_nr);
+        uint32_t dst_ch;
+
         // loopback mode for this channel
-        if (lback != 0) {
-                const int shift = iccom_sk->lback_map_rule->shift;
-                const uint32_t dst_ch = (lback > 0) ? (channel_nr + shift)
-                                                    : (channel_nr - shift);
-                return __iccom_socket_dispatch_msg_up(iccom_sk
+        if (__iccom_socket_lback_lookup(iccom_sk, channel_nr
+                                        , &dst_ch) != 0) {
+                const int res = __iccom_socket_dispatch_msg_up(iccom_sk
                                 , dst_ch
                                 , NLMSG_DATA(nl_header)
                                 , NLMSG_PAYLOAD(nl_header, 0));
+                // the loop receiver overrun is not the ICCom TX queue
+                // overflow (-EAGAIN), so it is reported as netlink does
+                return (res == -EAGAIN) ? -ENOBUFS : res;
         }
 
-        return iccom_post_message(&iccom_sk->iccom
+        const int res = iccom_submit_message(&iccom_sk->iccom
                         , NLMSG_DATA(nl_header)
                         , NLMSG_PAYLOAD(nl_header, 0)
                         , channel_nr
                         , priority);
+        if (res == 0) {
+                *posted__out = true;
+        }
+        return res;
 }
 
-// Sends the given message data incoming from ICCom layer
-// up to the netlink socket and correspondingly to User Space
-// application behind it.
+// Helper. Returns the payload size of the netlink message from User
+// Space, 0 for the broken message (it is dropped on dispatch).
+static inline size_t __iccom_socket_tx_payload_size(struct sk_buff *skb)
+{
+        struct nlmsghdr *nl_header = nlmsg_hdr(skb);
+
+        if (!NLMSG_OK(nl_header, skb->len)) {
+                return 0;
+        }
+        return NLMSG_PAYLOAD(nl_header, 0);
+}
+
+// Helper. Checks if the netlink message from User Space of @length
+// bytes fits into ICCom TX queue limit together with all the messages
+// pending on the way: the ones queued to the pump thread and the ones
+// in ICCom TX queue. Just like ICCom does, the message goes to the
+// empty way whatever size it has.
 //
-// @iccom_sk {valid iccom socket dev ptr}
-// @channel {valid channel number}
-// @data {valid data ptr}
-// @data_size_bytes {size of data pointed by @data}
+// @iccom_queued__out {valid ptr}:OUT the ICCom TX queue fill
 //
 // RETURNS:
-//      0: success
-//      <0: negated error code, if fails
-static int __iccom_socket_dispatch_msg_up(
+//      true: the message can be queued
+//      false: no room
+static bool __iccom_socket_tx_has_space(
                 struct iccom_sockets_device *iccom_sk
-                , const uint32_t channel, const void *const data
-                , const size_t data_size_bytes)
+                , const size_t length, size_t *iccom_queued__out)
 {
-        if (data_size_bytes > ICCOM_SOCKET_MAX_MESSAGE_SIZE_BYTES) {
-                iccom_socket_err("received message is bigger than max"
-                                 "  allowed: %zd > %d bytes; dropping;"
-                                 , data_size_bytes
-                                 , ICCOM_SOCKET_MAX_MESSAGE_SIZE_BYTES);
-                return -ENOMEM;
-        }
-        const uint32_t dst_port_id = channel;
-
-        //   TODO: reuse allocated memory if possible
-        struct sk_buff *sk_buffer = alloc_skb(NLMSG_SPACE(data_size_bytes),
-                                              GFP_KERNEL);
+        size_t iccom_queued = 0;
+        size_t max_bytes = 0;
 
-        if (IS_ERR_OR_NULL(sk_buffer)) {
-                iccom_socket_err("could not allocate socket buffer,"
-                                 " req. size: %zd"
-                                 , NLMSG_SPACE(data_size_bytes));
-                return -EPIPE;
-        }
+        iccom_get_tx_queue_state(&iccom_sk->iccom, &iccom_queued
+                                 , &max_bytes);
+        *iccom_queued__out = iccom_queued;
 
-        struct nlmsghdr *nl_header = __nlmsg_put(sk_buffer, dst_port_id
-                                                 , 0, 0, data_size_bytes
-                                                 , 0);
+        const size_t queued = iccom_queued
+                        + (size_t)atomic_read(&iccom_sk->tx_queue_bytes);
 
-        memcpy(NLMSG_DATA(nl_header), data, data_size_bytes);
+        return queued == 0 || queued + length <= max_bytes;
+}
 
-        NETLINK_CB(sk_buffer).portid = 0;
-        NETLINK_CB(sk_buffer).dst_group = 0;
-        NETLINK_CB(sk_buffer).flags = 0;
+// Helper. Returns true if the netlink message from User Space is not
+// to wait for the room in ICCom TX queue: the sender socket is
+// O_NONBLOCK or the message is sent with MSG_DONTWAIT (see
+// ICCOM_SK_NLM_F_DONTWAIT).
+static bool __iccom_socket_tx_nonblock(struct sk_buff *skb)
+{
+        struct sock *sk = NETLINK_CB(skb).sk;
+        struct nlmsghdr *nl_header = nlmsg_hdr(skb);
 
-        iccom_socket_dbg_raw("<- data to User space (ch. %d):"
-                             , dst_port_id);
-#ifdef ICCOM_SOCKET_DEBUG
-        print_hex_dump(KERN_DEBUG
-                       , ICCOM_SOCKETS_LOG_PREFIX"US <- RX data: "
-                       , 0, 16, 1, data, data_size_bytes, true);
-#endif
+        if (skb->len >= NLMSG_HDRLEN
+                    && (nl_header->nlmsg_flags & ICCOM_SK_NLM_F_DONTWAIT)) {
+                return true;
+        }
+        if (IS_ERR_OR_NULL(sk) || IS_ERR_OR_NULL(sk->sk_socket)
+                    || IS_ERR_OR_NULL(sk->sk_socket->file)) {
+                return true;
+        }
+        return (sk->sk_socket->file->f_flags & O_NONBLOCK) != 0;
+}
 
-        int res = netlink_unicast(iccom_sk->socket, sk_buffer, dst_port_id
-                                  , MSG_DONTWAIT);
+// Helper. Waits until ICCom TX queue has the room for the netlink
+// message from User Space together with the messages queued to the
+// pump thread but not yet sent down to ICCom (see
+// __iccom_socket_tx_has_space(...)). The sender defines how long to
+// wait: the message sent via O_NONBLOCK socket or with MSG_DONTWAIT
+// doesn't wait at all, the blocking one waits up to the socket send
+// timeout (SO_SNDTIMEO), forever by default.
+//
+// NOTE: the loopback channels messages don't go to ICCom, so they
+//      are admitted right away.
+//
+// NOTE: while ICCom TX queue is empty, the room is made by the pump
+//      thread sending the messages down to ICCom, otherwise by ICCom
+//      sending its TX queue, so we wait for the one which works now.
+//
+// CONTEXT: netlink input (the sender context)
+//
+// RETURNS:
+//      0: the message can be queued
+//      -EAGAIN: no room in time
+//      -EINTR: the sender was interrupted by a signal
+//      -ESHUTDOWN: we are exiting
+//      <0: other negated error code, if fails
+static int __iccom_socket_tx_admit(
+                struct iccom_sockets_device *iccom_sk
+                , struct sk_buff *skb)
+{
+        const uint32_t channel_nr = NETLINK_CB(skb).portid & 0x00007FFF;
 
-        if (res >= 0) {
+        if (__iccom_socket_lback_lookup(iccom_sk, channel_nr, NULL) != 0) {
                 return 0;
         }
-
-        switch (-res) {
-        // happens when no one listenes the port, which is
-        // not an error generally
-        case ECONNREFUSED: return 0;
-        default:
-                iccom_socket_err("Send to user space failed, err: %d"
-                                 , -res);
+        // ICCom is not there yet, the pump waits for it anyway
+        if (!completion_done(&iccom_sk->initialized)) {
+                return 0;
         }
 
-        return res;
+        struct sock *sk = NETLINK_CB(skb).sk;
+        long timeout = IS_ERR_OR_NULL(sk)
+                        ? 0 : sock_sndtimeo(sk, __iccom_socket_tx_nonblock(skb));
+        const size_t length = __iccom_socket_tx_payload_size(skb);
+        size_t iccom_queued;
+
+        // NOTE: we wait in slices to notice the exiting in time
+        while (!iccom_sk->exiting) {
+                if (__iccom_socket_tx_has_space(iccom_sk, length
+                                                , &iccom_queued)) {
+                        return 0;
+                }
+                if (timeout <= 0) {
+                        return -EAGAIN;
+                }
+
+                const long slice = min(timeout
+                                , (long)ICCOM_SOCKETS_CLOSE_POLL_PERIOD_JIFFIES);
+                long res;
+
+                if (iccom_queued == 0) {
+                        res = wait_event_interruptible_timeout(
+                                        iccom_sk->tx_space_wait
+                                        , __iccom_socket_tx_has_space(
+                                                iccom_sk, length
+                                                , &iccom_queued)
+                                          || iccom_queued != 0
+                                          || iccom_sk->exiting
+                                        , slice);
+                } else {
+                        res = iccom_wait_tx_space(&iccom_sk->iccom
+                                , length + (size_t)atomic_read(
+                                                &iccom_sk->tx_queue_bytes)
+                                , slice);
+                }
+                if (res == -ERESTARTSYS) {
+                        return -EINTR;
+                }
+                if (res < 0) {
+                        return (int)res;
+                }
+                // the wait returns the remaining jiffies when woken up
+                if (timeout != MAX_SCHEDULE_TIMEOUT) {
+                        timeout -= slice - res;
+                }
+        }
+        return -ESHUTDOWN;
 }
 
-// RETURNS:
-//      0: if success
-//      negated error code: if fails
-static int __iccom_socket_reg_socket_family(
-                struct iccom_sockets_device *iccom_sk)
+// Helper. Reports the error of the netlink message from User Space
+// back to the sender socket with the NLMSG_ERROR netlink message, as
+// long as the netlink send to the kernel socket can't return it to
+// the sender directly. The error message is to be read from the
+// sender socket like usual incoming message.
+//
+// @skb {valid ptr} the failed message from User Space
+// @error {<0} the negated error code to report
+//
+// CONTEXT: sleepable
+static void __iccom_socket_report_tx_error(
+                struct iccom_sockets_device *iccom_sk
+                , struct sk_buff *skb, const int error)
 {
-        struct netlink_kernel_cfg netlink_cfg = {
-                        .groups = 0
-                        , .flags = 0
-                        , .input = &__iccom_socket_netlink_data_ready
-                        , .cb_mutex = NULL
-                        , .bind = NULL
-                    } ;
-        // TODO: optionally: add support for earlier versions of kernel
-        iccom_sk->socket = netlink_kernel_create(&init_net
-                                                 , NETLINK_ICCOM
-                                                 , &netlink_cfg);
+        struct nlmsghdr *nl_header = nlmsg_hdr(skb);
+        const uint32_t dst_port_id = NETLINK_CB(skb).portid;
+        struct sk_buff *err_skb = alloc_skb(
+                        NLMSG_SPACE(sizeof(struct nlmsgerr)), GFP_KERNEL);
+
+        if (IS_ERR_OR_NULL(err_skb)) {
+                iccom_socket_err("no memory to report the error %d to"
+                                 " port %u", error, dst_port_id);
+                return;
+        }
 
-        if (IS_ERR(iccom_sk->socket)) {
-                return PTR_ERR(iccom_sk->socket);
-        } else if (!iccom_sk->socket) {
-                iccom_socket_err("could not create kernel netlink socket"
-                                 " for family: %d", NETLINK_ICCOM);
-                return -ENODEV;
+        struct nlmsghdr *err_header = __nlmsg_put(err_skb
+                                        , dst_port_id & 0x00007FFF
+                                        , skb->len >= NLMSG_HDRLEN
+                                          ? nl_header->nlmsg_seq : 0
+                                        , NLMSG_ERROR
+                                        , sizeof(struct nlmsgerr), 0);
+        struct nlmsgerr *err_data = (struct nlmsgerr *)NLMSG_DATA(err_header);
+
+        err_data->error = error;
+        // the broken message might be shorter than its header
+        memset(&err_data->msg, 0, sizeof(err_data->msg));
+        memcpy(&err_data->msg, nl_header
+               , min_t(size_t, skb->len, sizeof(err_data->msg)));
+
+        NETLINK_CB(err_skb).portid = 0;
+        NETLINK_CB(err_skb).dst_group = 0;
+        NETLINK_CB(err_skb).flags = 0;
+
+        const int res = netlink_unicast(iccom_sk->socket, err_skb
+                                        , dst_port_id, MSG_DONTWAIT);
+        if (res < 0 && res != -ECONNREFUSED) {
+                iccom_socket_warning("failed to report the error %d to"
+                                     " port %u, err: %d", error
+                                     , dst_port_id, -res);
         }
-        return 0;
 }
 
-// Unregisters iccom socket family.
-static void __iccom_socket_unreg_socket_family(
-                struct iccom_sockets_device *iccom_sk)
+// Helper. Queues the netlink message from User Space to be sent down
+// to ICCom by the pump thread.
+//
+// CONTEXT: netlink input (the sender context)
+static void __iccom_socket_tx_enqueue(
+                struct iccom_sockets_device *iccom_sk
+                , struct sk_buff *skb)
 {
-        if (IS_ERR_OR_NULL(iccom_sk)
-                    || IS_ERR_OR_NULL(iccom_sk->socket)) {
+        struct iccom_sk_tx_entry *entry = kmalloc(sizeof(*entry)
+                                                  , GFP_KERNEL);
+
+        if (IS_ERR_OR_NULL(entry)) {
+                iccom_socket_err("no memory to queue the message; dropped");
+                __iccom_socket_report_tx_error(iccom_sk, skb, -ENOMEM);
                 return;
         }
-        iccom_sk->exiting = true;
-        netlink_kernel_release(iccom_sk->socket);
-        iccom_sk->socket = NULL;
-        complete(&iccom_sk->socket_closed);
+
+        // the netlink consumes the skb after the input callback, so
+        // we keep our own reference
+        entry->skb = skb_get(skb);
+        entry->length = __iccom_socket_tx_payload_size(skb);
+        atomic_add((int)entry->length, &iccom_sk->tx_queue_bytes);
+
+        // wakeup is only needed when the pump may be sleeping
+        if (llist_add(&entry->anchor, &iccom_sk->tx_queue)) {
+                wake_up_interruptible(&iccom_sk->tx_wait);
+        }
 }
 
-// Provides an ability to read loopback rule from User Space.
-// Is invoked when user reads the /proc/<ICCOM_SK>/<LOOPBACK_CTL> file.
+// Helper. Sends the queued netlink message down to ICCom. If ICCom
+// TX queue is full, then initiates the xfer of the messages submitted
+// so far and waits for the room (the pump thread is the only one to
+// wait here, the senders are throttled before the message is queued,
+// see __iccom_socket_tx_admit(...)). The message which fails to be
+// sent is reported back to the sender socket.
 //
-// Is restricted to the file size of SIZE_MAX bytes.
+// @posted__out {valid ptr}:IN/OUT see
+//      __iccom_socket_dispatch_msg_down(...)
 //
-// RETURNS:
-//      >= 0: number of bytes actually provided to user space, on success
-//      < 0: negated error code, on failure
-static ssize_t __iccom_sk_lback_rule_read(struct file *file
-                , char __user *ubuf
-                , size_t count
-                , loff_t *ppos)
+// CONTEXT: pump thread
+static void __iccom_socket_tx_dispatch_entry(
+                struct iccom_sockets_device *iccom_sk
+                , struct iccom_sk_tx_entry *entry
+                , bool *posted__out)
 {
-        ICCOM_SK_CHECK_PTR(file, return -EINVAL);
-        ICCOM_SK_CHECK_PTR(ubuf, return -EINVAL);
-        ICCOM_SK_CHECK_PTR(ppos, return -EINVAL);
+        int res;
+
+        while ((res = __iccom_socket_dispatch_msg_down(iccom_sk, entry->skb
+                                                       , posted__out))
+                        == -EAGAIN) {
+                if (kthread_should_stop()) {
+                        iccom_socket_warning("ICCom TX queue is full on"
+                                             " exit; message dropped");
+                        __iccom_socket_report_tx_error(iccom_sk
+                                        , entry->skb, -ESHUTDOWN);
+                        return;
+                }
+                if (*posted__out) {
+                        iccom_flush(&iccom_sk->iccom);
+                        *posted__out = false;
+                }
+                iccom_wait_tx_space(&iccom_sk->iccom, entry->length
+                                    , ICCOM_SOCKETS_CLOSE_POLL_PERIOD_JIFFIES);
+        }
+        if (res < 0) {
+                __iccom_socket_report_tx_error(iccom_sk, entry->skb, res);
+        }
+}
 
-        struct iccom_sockets_device *iccom_sk
-                = (struct iccom_sockets_device *)PDE_DATA(file->f_inode);
+// Helper. Takes all queued netlink messages and sends them down to
+// ICCom (if @dispatch is true, otherwise just drops them). The xfer
+// is initiated once for the whole batch, so the messages queued by
+// many senders concurrently go together in the same package(s).
+//
+// CONTEXT: pump thread || closing
+static void __iccom_socket_tx_drain(
+                struct iccom_sockets_device *iccom_sk
+                , const bool dispatch)
+{
+        struct llist_node *first = llist_del_all(&iccom_sk->tx_queue);
 
-        ICCOM_SK_CHECK_DEVICE("no device provided", return -ENODEV);
+        if (!first) {
+                return;
+        }
 
-        const int BUFFER_SIZE = 256;
+        struct iccom_sk_tx_entry *entry;
+        struct iccom_sk_tx_entry *tmp;
+        bool posted = false;
 
-        if (*ppos >= BUFFER_SIZE || *ppos > SIZE_MAX) {
-                return 0;
+        // llist is LIFO, while messages order is to be kept
+        first = llist_reverse_order(first);
+        llist_for_each_entry_safe(entry, tmp, first, anchor) {
+                if (dispatch) {
+                        __iccom_socket_tx_dispatch_entry(iccom_sk, entry
+                                                         , &posted);
+                }
+                atomic_sub((int)entry->length, &iccom_sk->tx_queue_bytes);
+                wake_up_interruptible(&iccom_sk->tx_space_wait);
+                consume_skb(entry->skb);
+                kfree(entry);
         }
 
-        char *buf = kmalloc(BUFFER_SIZE, GFP_KERNEL);
-
-        if (IS_ERR_OR_NULL(buf)) {
-                return -ENOMEM;
+        if (posted) {
+                iccom_flush(&iccom_sk->iccom);
         }
+}
 
-        const struct iccom_sk_loopback_mapping_rule *const rule
-                            = iccom_sk->lback_map_rule;
-
-        size_t len = (size_t)snprintf(buf, BUFFER_SIZE, "%d %d %d\n\n"
-                                      "NOTE: the loopback will map the "
-                                      "[a;b] channels other sides to"
-                                      " [a + shift; b + shift] local "
-                                      "channels where a = first argument"
-                                      ", b = second argument,"
-                                      " shift = third argument\n"
-                                      , rule->from, rule->to, rule->shift)
-                     + 1;
+// The pump thread: sends the User Space messages down to ICCom.
+static int __iccom_socket_pump(void *data)
+{
+        struct iccom_sockets_device *iccom_sk
+                    = (struct iccom_sockets_device *)data;
 
-        if (len > BUFFER_SIZE) {
-                iccom_socket_warning("loopback control output "
-                                     "was too big for buffer"
-                                     ", required length: %zu", len);
-                len = BUFFER_SIZE;
-                buf[BUFFER_SIZE - 1] = 0;
-        }
+        wait_for_completion(&iccom_sk->initialized);
 
-        const unsigned long nbytes_to_copy
-                        = (len >= (size_t)(*ppos))
-                                ?  min(len - (size_t)(*ppos), count)
-                                : 0;
-        const unsigned long not_copied
-                        = copy_to_user(ubuf, buf + (size_t)(*ppos)
-                                       , nbytes_to_copy);
-        kfree(buf);
-        buf = NULL;
-        *ppos += nbytes_to_copy - not_copied;
+        while (!kthread_should_stop()) {
+                wait_event_interruptible(iccom_sk->tx_wait
+                                , !llist_empty(&iccom_sk->tx_queue)
+                                  || kthread_should_stop());
+                __iccom_socket_tx_drain(iccom_sk, true);
+        }
 
-        return nbytes_to_copy - not_copied;
+        complete(&iccom_sk->pump_main_loop_done);
+        return 0;
 }
 
-// @buf pointer to the beginning of the string buffer
-//      NOTE: buffer can be temporary modified within parsing
-// @len size of the buffer (in chars)
-// @out pointer to the struct where the results are to be written
-//      NOTE: useful data is guaranteed to be there only when
-//          return code is successful
+// Helper. Launches the pump thread.
 //
 // RETURNS:
-//      >=0: successful parsing
-//      < 0: on failure (negated error code)
-int  __iccom_sk_parse_lback_string(char *const buf
-                , const size_t len
-                , struct iccom_sk_loopback_mapping_rule *const out)
+//      0: if success
+//      <0: negated error code else
+static int __iccom_socket_pump_init(struct iccom_sockets_device *iccom_sk)
 {
-        ICCOM_SK_CHECK_PTR(buf, return -EINVAL);
-        ICCOM_SK_CHECK_PTR(out, return -EINVAL);
-
-        // identifies the current field to parse string into
-        int number = -1;
-        char *start = buf;
+        struct task_struct *task = kthread_run(&__iccom_socket_pump
+                                               , (void *)iccom_sk
+                                               , "iccom_sk_pump");
 
-        for (int i = 0; i < len; i++) {
+        if (IS_ERR_OR_NULL(task)) {
+                iccom_socket_err("failed to start the pump thread");
+                return IS_ERR(task) ? PTR_ERR(task) : -ENOMEM;
+        }
+        iccom_sk->pump_task = task;
+        return 0;
+}
+
+// Helper. Stops the pump thread and drops the not yet sent messages.
+//
+// NOTE: to be called when no more User Space messages can come.
+static void __iccom_socket_pump_close(
+                struct iccom_sockets_device *iccom_sk)
+{
+        // NOTE: kthread_stop(...) waits for the thread exit
+        if (!IS_ERR_OR_NULL(iccom_sk->pump_task)) {
+                kthread_stop(iccom_sk->pump_task);
+                iccom_sk->pump_task = NULL;
+        }
+        __iccom_socket_tx_drain(iccom_sk, false);
+}
+
+// Helper. Subscribes the @portid socket to the @channel messages.
+//
+// CONTEXT: sleepable
+//
+// RETURNS:
+//      0: success
+//      <0: negated error code, if fails
+static int __iccom_sk_subscribe(struct iccom_sockets_device *iccom_sk
+                , const unsigned int channel, const u32 portid)
+{
+        if (channel > 2 * ICCOM_SK_MAX_CHANNEL_VAL + 1) {
+                iccom_socket_err("channel out of bounds: %u", channel);
+                return -EINVAL;
+        }
+        // the kernel port and the channel sockets ports
+        if (portid < ICCOM_SK_SUBSCRIBER_PORTID_MIN) {
+                iccom_socket_err("invalid subscriber port id: %u, should"
+                                 " be >= %u", portid
+                                 , ICCOM_SK_SUBSCRIBER_PORTID_MIN);
+                return -EINVAL;
+        }
+
+        struct iccom_sk_subscription *new_subscr
+                        = kmalloc(sizeof(*new_subscr), GFP_KERNEL);
+        if (IS_ERR_OR_NULL(new_subscr)) {
+                return -ENOMEM;
+        }
+        new_subscr->channel = channel;
+        new_subscr->portid = portid;
+
+        struct iccom_sk_subscription *subscr;
+        int channel_subscribers = 0;
+        int res = 0;
+
+        spin_lock(&iccom_sk->subscriptions_lock);
+        hash_for_each_possible(iccom_sk->subscriptions, subscr
+                               , hash_anchor, channel) {
+                if (subscr->channel != channel) {
+                        continue;
+                }
+                if (subscr->portid == portid) {
+                        res = -EEXIST;
+                        goto finalize;
+                }
+                channel_subscribers++;
+        }
+        if (channel_subscribers >= ICCOM_SK_MAX_CHANNEL_SUBSCRIBERS
+                    || iccom_sk->subscriptions_count
+                       >= ICCOM_SK_MAX_SUBSCRIPTIONS) {
+                res = -ENOSPC;
+                goto finalize;
+        }
+        hash_add(iccom_sk->subscriptions, &new_subscr->hash_anchor
+                 , channel);
+        iccom_sk->subscriptions_count++;
+        new_subscr = NULL;
+
+finalize:
+        spin_unlock(&iccom_sk->subscriptions_lock);
+        kfree(new_subscr);
+        return res;
+}
+
+// Helper. Removes the subscription of the @portid socket to the
+// @channel messages.
+//
+// CONTEXT: any
+//
+// RETURNS:
+//      0: success
+//      -ENOENT: no such subscription
+static int __iccom_sk_unsubscribe(struct iccom_sockets_device *iccom_sk
+                , const unsigned int channel, const u32 portid)
+{
+        struct iccom_sk_subscription *subscr;
+        struct hlist_node *tmp;
+        int res = -ENOENT;
+
+        spin_lock(&iccom_sk->subscriptions_lock);
+        hash_for_each_possible_safe(iccom_sk->subscriptions, subscr, tmp
+                                    , hash_anchor, channel) {
+                if (subscr->channel != channel
+                            || subscr->portid != portid) {
+                        continue;
+                }
+                hash_del(&subscr->hash_anchor);
+                iccom_sk->subscriptions_count--;
+                kfree(subscr);
+                res = 0;
+                break;
+        }
+        spin_unlock(&iccom_sk->subscriptions_lock);
+        return res;
+}
+
+// Helper. Removes all subscriptions of the @portid socket, or all
+// subscriptions at all if @portid == 0.
+//
+// CONTEXT: any
+static void __iccom_sk_unsubscribe_port(
+                struct iccom_sockets_device *iccom_sk, const u32 portid)
+{
+        struct iccom_sk_subscription *subscr;
+        struct hlist_node *tmp;
+        int bkt;
+
+        spin_lock(&iccom_sk->subscriptions_lock);
+        hash_for_each_safe(iccom_sk->subscriptions, bkt, tmp, subscr
+                           , hash_anchor) {
+                if (portid != 0 && subscr->portid != portid) {
+                        continue;
+                }
+                hash_del(&subscr->hash_anchor);
+                iccom_sk->subscriptions_count--;
+                kfree(subscr);
+        }
+        spin_unlock(&iccom_sk->subscriptions_lock);
+}
+
+// Helper. Gets the port ids of the sockets subscribed to the channel.
+//
+// @portids__out {array of ICCOM_SK_MAX_CHANNEL_SUBSCRIBERS}:OUT
+//      the port ids of the subscribers
+//
+// CONTEXT: any
+//
+// RETURNS:
+//      the number of subscribers written to @portids__out
+static int __iccom_sk_channel_subscribers(
+                struct iccom_sockets_device *iccom_sk
+                , const unsigned int channel, u32 *const portids__out)
+{
+        // no lock needed for the fast path: the subscription made
+        // concurrently with the message delivery may miss it anyway
+        if (READ_ONCE(iccom_sk->subscriptions_count) == 0) {
+                return 0;
+        }
+
+        struct iccom_sk_subscription *subscr;
+        int count = 0;
+
+        spin_lock(&iccom_sk->subscriptions_lock);
+        hash_for_each_possible(iccom_sk->subscriptions, subscr
+                               , hash_anchor, channel) {
+                if (subscr->channel != channel) {
+                        continue;
+                }
+                portids__out[count++] = subscr->portid;
+                if (count >= ICCOM_SK_MAX_CHANNEL_SUBSCRIBERS) {
+                        break;
+                }
+        }
+        spin_unlock(&iccom_sk->subscriptions_lock);
+        return count;
+}
+
+// Helper. Sends the netlink message to all sockets subscribed to the
+// channel. The original @sk_buffer is left untouched (the subscribers
+// get its clones, sharing the data).
+//
+// CONTEXT: sleepable
+static void __iccom_socket_netlink_send_to_subscribers(
+                struct iccom_sockets_device *iccom_sk
+                , const uint32_t channel, struct sk_buff *sk_buffer)
+{
+        u32 subscribers[ICCOM_SK_MAX_CHANNEL_SUBSCRIBERS];
+        const int count = __iccom_sk_channel_subscribers(iccom_sk, channel
+                                                         , subscribers);
+
+        for (int i = 0; i < count; i++) {
+                struct sk_buff *copy = skb_clone(sk_buffer, GFP_KERNEL);
+
+                if (IS_ERR_OR_NULL(copy)) {
+                        iccom_socket_err("could not clone socket buffer"
+                                         " for channel %u subscribers"
+                                         , channel);
+                        return;
+                }
+
+                const int res = netlink_unicast(iccom_sk->socket, copy
+                                                , subscribers[i]
+                                                , MSG_DONTWAIT);
+                // the subscriber socket is gone
+                if (res == -ECONNREFUSED) {
+                        __iccom_sk_unsubscribe(iccom_sk, channel
+                                               , subscribers[i]);
+                }
+        }
+}
+
+// Helper. Sends the ready netlink message up to the netlink socket
+// and correspondingly to User Space application behind it, and to
+// all sockets subscribed to the channel.
+//
+// @iccom_sk {valid iccom socket dev ptr}
+// @channel {valid channel number}
+// @sk_buffer {valid skb ptr} the skb with the netlink message,
+//      is consumed by the call
+//
+// RETURNS:
+//      0: success
+//      <0: negated error code, if fails
+static int __iccom_socket_netlink_send_up(
+                struct iccom_sockets_device *iccom_sk
+                , const uint32_t channel, struct sk_buff *sk_buffer)
+{
+        const uint32_t dst_port_id = channel;
+
+        NETLINK_CB(sk_buffer).portid = 0;
+        NETLINK_CB(sk_buffer).dst_group = 0;
+        NETLINK_CB(sk_buffer).flags = 0;
+
+        __iccom_socket_netlink_send_to_subscribers(iccom_sk, channel
+                                                   , sk_buffer);
+
+        iccom_socket_dbg_raw("<- data to User space (ch. %d):"
+                             , dst_port_id);
+#ifdef ICCOM_SOCKET_DEBUG
+        print_hex_dump(KERN_DEBUG
+                       , ICCOM_SOCKETS_LOG_PREFIX"US <- RX data: "
+                       , 0, 16, 1, NLMSG_DATA(nlmsg_hdr(sk_buffer))
+                       , NLMSG_PAYLOAD(nlmsg_hdr(sk_buffer), 0), true);
+#endif
+
+        int res = netlink_unicast(iccom_sk->socket, sk_buffer, dst_port_id
+                                  , MSG_DONTWAIT);
+
+        if (res >= 0) {
+                return 0;
+        }
+
+        switch (-res) {
+        // happens when no one listenes the port, which is
+        // not an error generally
+        case ECONNREFUSED: return 0;
+        default:
+                iccom_socket_err("Send to user space failed, err: %d"
+                                 , -res);
+        }
+
+        return res;
+}
+
+// Sends the given message data incoming from ICCom layer
+// up to the netlink socket and correspondingly to User Space
+// application behind it. The data is copied into the new skb.
+//
+// @iccom_sk {valid iccom socket dev ptr}
+// @channel {valid channel number}
+// @data {valid data ptr}
+// @data_size_bytes {size of data pointed by @data}
+//
+// RETURNS:
+//      0: success
+//      <0: negated error code, if fails
+static int __iccom_socket_dispatch_msg_up(
+                struct iccom_sockets_device *iccom_sk
+                , const uint32_t channel, const void *const data
+                , const size_t data_size_bytes)
+{
+        if (data_size_bytes > ICCOM_SOCKET_MAX_MESSAGE_SIZE_BYTES) {
+                iccom_socket_err("received message is bigger than max"
+                                 "  allowed: %zd > %d bytes; dropping;"
+                                 , data_size_bytes
+                                 , ICCOM_SOCKET_MAX_MESSAGE_SIZE_BYTES);
+                return -ENOMEM;
+        }
+
+        struct sk_buff *sk_buffer = alloc_skb(NLMSG_SPACE(data_size_bytes),
+                                              GFP_KERNEL);
+
+        if (IS_ERR_OR_NULL(sk_buffer)) {
+                iccom_socket_err("could not allocate socket buffer,"
+                                 " req. size: %zd"
+                                 , NLMSG_SPACE(data_size_bytes));
+                return -EPIPE;
+        }
+
+        struct nlmsghdr *nl_header = __nlmsg_put(sk_buffer, channel
+                                                 , 0, 0, data_size_bytes
+                                                 , 0);
+
+        memcpy(NLMSG_DATA(nl_header), data, data_size_bytes);
+
+        return __iccom_socket_netlink_send_up(iccom_sk, channel
+                                              , sk_buffer);
+}
+
+// Sends the given ICCom message up to the netlink socket without
+// copying its data: the skb is built right around the ICCom message
+// data buffer, which has the room for the netlink header and the skb
+// shared info reserved by ICCom (see ICCOM_SK_RX_DATA_HEADROOM and
+// ICCOM_SK_RX_DATA_TAILROOM).
+//
+// @iccom_sk {valid iccom socket dev ptr}
+// @channel {valid channel number}
+// @data {valid ICCom message data ptr} the data of the message
+//      received by @iccom_sk->iccom
+// @data_size_bytes {size of data pointed by @data}
+//
+// RETURNS:
+//      true: the message data buffer ownership is taken (the data
+//          is sent up or dropped with the skb on send failure)
+//      false: the message was not sent, the data ownership is left
+//          to the caller (to be sent via copy)
+static bool __iccom_socket_dispatch_msg_up_inplace(
+                struct iccom_sockets_device *iccom_sk
+                , const uint32_t channel, void *const data
+                , const size_t data_size_bytes)
+{
+        if (data_size_bytes > ICCOM_SOCKET_MAX_MESSAGE_SIZE_BYTES) {
+                return false;
+        }
+
+        void *const buf = (char *)data - ICCOM_SK_RX_DATA_HEADROOM;
+
+        // NOTE: the buffer is kmalloc-ed by ICCom, so the skb is sized
+        //      by the slab object size and frees the buffer with kfree
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+        struct sk_buff *sk_buffer = slab_build_skb(buf);
+#else
+        // NOTE: before Linux 6.3 the zero frag size is the only way to
+        //      tell build_skb(...) the head is kmalloc-ed, a non-zero
+        //      one marks the head as a page fragment, which is freed
+        //      with the page allocator
+        struct sk_buff *sk_buffer = build_skb(buf, 0);
+#endif
+
+        if (IS_ERR_OR_NULL(sk_buffer)) {
+                return false;
+        }
+
+        // NOTE: only the header and the padding after the data are
+        //      written, the data itself stays in place
+        __nlmsg_put(sk_buffer, channel, 0, 0, data_size_bytes, 0);
+
+        __iccom_socket_netlink_send_up(iccom_sk, channel, sk_buffer);
+        return true;
+}
+
+// RETURNS:
+//      0: if success
+//      negated error code: if fails
+static int __iccom_socket_reg_socket_family(
+                struct iccom_sockets_device *iccom_sk)
+{
+        struct netlink_kernel_cfg netlink_cfg = {
+                        .groups = 0
+                        , .flags = 0
+                        , .input = &__iccom_socket_netlink_data_ready
+                        , .cb_mutex = NULL
+                        , .bind = NULL
+                    } ;
+        // TODO: optionally: add support for earlier versions of kernel
+        iccom_sk->socket = netlink_kernel_create(&init_net
+                                                 , NETLINK_ICCOM
+                                                 , &netlink_cfg);
+
+        if (IS_ERR(iccom_sk->socket)) {
+                return PTR_ERR(iccom_sk->socket);
+        } else if (!iccom_sk->socket) {
+                iccom_socket_err("could not create kernel netlink socket"
+                                 " for family: %d", NETLINK_ICCOM);
+                return -ENODEV;
+        }
+        return 0;
+}
+
+// Unregisters iccom socket family.
+static void __iccom_socket_unreg_socket_family(
+                struct iccom_sockets_device *iccom_sk)
+{
+        if (IS_ERR_OR_NULL(iccom_sk)
+                    || IS_ERR_OR_NULL(iccom_sk->socket)) {
+                return;
+        }
+        iccom_sk->exiting = true;
+        smp_mb();
+        // the senders might still wait for the room in ICCom TX queue
+        wake_up_all(&iccom_sk->tx_space_wait);
+        wait_event(iccom_sk->tx_senders_wait
+                   , atomic_read(&iccom_sk->tx_senders) == 0);
+        netlink_kernel_release(iccom_sk->socket);
+        iccom_sk->socket = NULL;
+        complete(&iccom_sk->socket_closed);
+}
+
+// Provides an ability to read loopback rules from User Space.
+// Is invoked when user reads the /proc/<ICCOM_SK>/<LOOPBACK_CTL> file.
+//
+// Is restricted to the file size of SIZE_MAX bytes.
+//
+// RETURNS:
+//      >= 0: number of bytes actually provided to user space, on success
+//      < 0: negated error code, on failure
+static ssize_t __iccom_sk_lback_rule_read(struct file *file
+                , char __user *ubuf
+                , size_t count
+                , loff_t *ppos)
+{
+        ICCOM_SK_CHECK_PTR(file, return -EINVAL);
+        ICCOM_SK_CHECK_PTR(ubuf, return -EINVAL);
+        ICCOM_SK_CHECK_PTR(ppos, return -EINVAL);
+
+        struct iccom_sockets_device *iccom_sk
+                = (struct iccom_sockets_device *)PDE_DATA(file->f_inode);
+
+        ICCOM_SK_CHECK_DEVICE("no device provided", return -ENODEV);
+
+        // "<from> <to> <shift>\n" per rule + the note
+        const int BUFFER_SIZE = ICCOM_SK_MAX_LBACK_RULES * 40 + 512;
+
+        if (*ppos >= BUFFER_SIZE || *ppos > SIZE_MAX) {
+                return 0;
+        }
+
+        char *buf = kmalloc(BUFFER_SIZE, GFP_KERNEL);
+
+        if (IS_ERR_OR_NULL(buf)) {
+                return -ENOMEM;
+        }
+
+        size_t len = 0;
+
+        rcu_read_lock();
+        const struct iccom_sk_loopback_map *map
+                        = rcu_dereference(iccom_sk->lback_map);
+        if (!map) {
+                len += (size_t)scnprintf(buf + len, BUFFER_SIZE - len
+                                         , "0 0 0\n");
+        }
+        for (int i = 0; map && i < map->rules_count; i++) {
+                len += (size_t)scnprintf(buf + len, BUFFER_SIZE - len
+                                         , "%d %d %d\n"
+                                         , map->rules[i].from
+                                         , map->rules[i].to
+                                         , map->rules[i].shift);
+        }
+        rcu_read_unlock();
+
+        len += (size_t)snprintf(buf + len, BUFFER_SIZE - len
+                                , "\nNOTE: the loopback will map the "
+                                  "[a;b] channels other sides to"
+                                  " [a + shift; b + shift] local "
+                                  "channels where a = first argument"
+                                  ", b = second argument,"
+                                  " shift = third argument; one rule"
+                                  " per line. Write \"a b shift\" to"
+                                  " set the single rule (\"0 0 0\" to"
+                                  " disable all), \"+ a b shift\" to"
+                                  " add the rule, \"- a b\" to remove"
+                                  " the rule.\n")
+               + 1;
+
+        if (len > BUFFER_SIZE) {
+                iccom_socket_warning("loopback control output "
+                                     "was too big for buffer"
+                                     ", required length: %zu", len);
+                len = BUFFER_SIZE;
+                buf[BUFFER_SIZE - 1] = 0;
+        }
+
+        const unsigned long nbytes_to_copy
+                        = (len >= (size_t)(*ppos))
+                                ?  min(len - (size_t)(*ppos), count)
+                                : 0;
+        const unsigned long not_copied
+                        = copy_to_user(ubuf, buf + (size_t)(*ppos)
+                                       , nbytes_to_copy);
+        kfree(buf);
+        buf = NULL;
+        *ppos += nbytes_to_copy - not_copied;
+
+        return nbytes_to_copy - not_copied;
+}
+
+// @buf pointer to the beginning of the string buffer
+//      NOTE: buffer can be temporary modified within parsing
+// @len size of the buffer (in chars)
+// @out pointer to the struct where the results are to be written
+//      NOTE: useful data is guaranteed to be there only when
+//          return code is successful
+//
+// RETURNS:
+//      >=0: successful parsing
+//      < 0: on failure (negated error code)
+int  __iccom_sk_parse_lback_string(char *const buf
+                , const size_t len
+                , struct iccom_sk_loopback_mapping_rule *const out)
+{
+        ICCOM_SK_CHECK_PTR(buf, return -EINVAL);
+        ICCOM_SK_CHECK_PTR(out, return -EINVAL);
+
+        // identifies the current field to parse string into
+        int number = -1;
+        char *start = buf;
+
+        for (int i = 0; i < len; i++) {
                 const char c = buf[i];
                 if (number < 0 && (c == ' ' || c == '\n' || c == '\t')) {
                         continue;
@@ -639,43 +1579,454 @@ int  __iccom_sk_parse_lback_string(char *const buf
                 const char orig_c = buf[i];
                 buf[i] = 0;
 
-                long target;
-                int res = kstrtol(start, 10, &target);
-                buf[i] = orig_c;
+                long target;
+                int res = kstrtol(start, 10, &target);
+                buf[i] = orig_c;
+
+                if (res != 0) {
+                        iccom_socket_err("failed parsing arg %d in: %s"
+                                         , number, buf);
+                        return -EINVAL;
+                };
+
+                switch (number) {
+                case 1: out->from = (int)target; break;
+                case 2: out->to = (int)target; break;
+                case 3: out->shift = (int)target; break;
+                default: return -EINVAL;
+                }
+
+                number = -(number + 1);
+        }
+
+        if (__iccom_socket_lback_rule_verify(out) < 0) {
+                return -EINVAL;
+        }
+
+        return 0;
+}
+
+// Helper. Checks if the channel ranges (original and mapped ones) of
+// two active loopback rules overlap.
+static bool __iccom_socket_lback_rules_overlap(
+        const struct iccom_sk_loopback_mapping_rule *const a
+        , const struct iccom_sk_loopback_mapping_rule *const b)
+{
+        const int a_from[2] = { a->from, a->from + a->shift };
+        const int b_from[2] = { b->from, b->from + b->shift };
+        const int a_len = a->to - a->from;
+        const int b_len = b->to - b->from;
+
+        for (int i = 0; i < 2; i++) {
+                for (int j = 0; j < 2; j++) {
+                        if (a_from[i] <= b_from[j] + b_len
+                                    && b_from[j] <= a_from[i] + a_len) {
+                                return true;
+                        }
+                }
+        }
+        return false;
+}
+
+// Helper. Updates the loopback rules: builds the new rules set from
+// the current one and publishes it in place of the current one.
+//
+// @op the update to do:
+//      '+': add the @rule
+//      '-': remove the rule with the same channel range as @rule has
+//      '=': replace all rules with the @rule (just remove all rules if
+//          the @rule is disabled, i.e. its shift is 0)
+// @rule {valid ptr, verified rule}
+//
+// LOCKING: takes @lback_map_lock
+// CONTEXT: sleepable
+//
+// RETURNS:
+//      0: on success
+//      -ENOSPC: no room for one more rule
+//      -EEXIST: the rule overlaps one of existing rules
+//      -ENOENT: no rule to remove
+//      <0: other negated error code, on failure
+static int __iccom_socket_lback_update(
+                struct iccom_sockets_device *iccom_sk, const char op
+                , const struct iccom_sk_loopback_mapping_rule *const rule)
+{
+        if (op == '+' && rule->shift == 0) {
+                iccom_socket_err("will not add the disabled rule");
+                return -EINVAL;
+        }
+
+        struct iccom_sk_loopback_map *new_map = kzalloc(sizeof(*new_map)
+                                                        , GFP_KERNEL);
+        if (IS_ERR_OR_NULL(new_map)) {
+                iccom_socket_err("failed to create new loopback rules:"
+                                 " no memory");
+                return -ENOMEM;
+        }
+
+        mutex_lock(&iccom_sk->lback_map_lock);
+
+        struct iccom_sk_loopback_map *old_map
+                        = rcu_dereference_protected(iccom_sk->lback_map
+                                , lockdep_is_held(&iccom_sk->lback_map_lock));
+        const int old_count = old_map ? old_map->rules_count : 0;
+        int res = 0;
+
+        switch (op) {
+        case '+':
+                if (old_count >= ICCOM_SK_MAX_LBACK_RULES) {
+                        iccom_socket_err("max number of loopback rules"
+                                         " (%d) reached"
+                                         , ICCOM_SK_MAX_LBACK_RULES);
+                        res = -ENOSPC;
+                        break;
+                }
+                for (int i = 0; i < old_count; i++) {
+                        if (__iccom_socket_lback_rules_overlap(
+                                    &old_map->rules[i], rule)) {
+                                iccom_socket_err("the rule overlaps the"
+                                                 " rule %d %d %d"
+                                                 , old_map->rules[i].from
+                                                 , old_map->rules[i].to
+                                                 , old_map->rules[i].shift);
+                                res = -EEXIST;
+                                break;
+                        }
+                        new_map->rules[new_map->rules_count++]
+                                        = old_map->rules[i];
+                }
+                if (res == 0) {
+                        new_map->rules[new_map->rules_count++] = *rule;
+                }
+                break;
+        case '-':
+                for (int i = 0; i < old_count; i++) {
+                        if (old_map->rules[i].from == rule->from
+                                    && old_map->rules[i].to == rule->to) {
+                                continue;
+                        }
+                        new_map->rules[new_map->rules_count++]
+                                        = old_map->rules[i];
+                }
+                if (new_map->rules_count == old_count) {
+                        res = -ENOENT;
+                }
+                break;
+        case '=':
+                if (rule->shift != 0) {
+                        new_map->rules[new_map->rules_count++] = *rule;
+                }
+                break;
+        default:
+                res = -EINVAL;
+        }
+
+        if (res < 0) {
+                mutex_unlock(&iccom_sk->lback_map_lock);
+                kfree(new_map);
+                return res;
+        }
+
+        for (int i = 0; i < new_map->rules_count; i++) {
+                const struct iccom_sk_loopback_mapping_rule *r
+                                = &new_map->rules[i];
+                bitmap_set(new_map->looped, r->from, r->to - r->from + 1);
+                bitmap_set(new_map->looped, r->from + r->shift
+                           , r->to - r->from + 1);
+        }
+
+        if (new_map->rules_count == 0) {
+                kfree(new_map);
+                new_map = NULL;
+        }
+
+        rcu_assign_pointer(iccom_sk->lback_map, new_map);
+        mutex_unlock(&iccom_sk->lback_map_lock);
+
+        // the readers might still use the old rules
+        if (old_map) {
+                kfree_rcu(old_map, rcu);
+        }
+        return 0;
+}
+
+// Provides an ability to update (and also disable) the loopback rules
+// from User Space.
+// Is invoked when user writes the /proc/<ICCOM_SK>/<LOOPBACK_CTL> file:
+//      "<from> <to> <shift>": replace all rules with the given one
+//          ("0 0 0" removes all rules)
+//      "+ <from> <to> <shift>": add the rule
+//      "- <from> <to>": remove the rule
+//
+// Is restricted to the file size of SIZE_MAX bytes.
+//
+// RETURNS:
+//      >= 0: number of bytes actually were written, on success
+//      < 0: negated error code, on failure
+static ssize_t __iccom_sk_lback_rule_write(struct file *file
+                , const char __user *ubuf
+                , size_t count
+                , loff_t *ppos)
+{
+        ICCOM_SK_CHECK_PTR(file, return -EINVAL);
+        ICCOM_SK_CHECK_PTR(ubuf, return -EINVAL);
+
+        struct iccom_sockets_device *iccom_sk
+                = (struct iccom_sockets_device *)PDE_DATA(file->f_inode);
+
+        ICCOM_SK_CHECK_DEVICE("no device provided", return -ENODEV);
+
+        const unsigned int BUFFER_SIZE = 64;
+
+        // we only get the whole data at once
+        if (*ppos != 0 || count > BUFFER_SIZE) {
+                iccom_socket_warning(
+                        "Ctrl message should be written at once"
+                        " and not exceed %u bytes.", BUFFER_SIZE);
+                return -EFAULT;
+        }
+
+        char *buf = kmalloc(BUFFER_SIZE + 1, GFP_KERNEL);
+
+        if (IS_ERR_OR_NULL(buf)) {
+                return -ENOMEM;
+        }
+
+        const unsigned long not_copied = copy_from_user(buf, ubuf, count);
+        ssize_t ret = 0;
+
+        if (not_copied != 0) {
+                iccom_socket_warning("Not all bytes were copied from user.");
+                ret = -EIO;
+                goto finalize;
+        }
+
+        buf[count] = 0;
+
+        // the legacy command has no op and sets the single rule
+        char op = '=';
+        size_t op_len = 0;
+
+        while (op_len < count && (buf[op_len] == ' ' || buf[op_len] == '\t')) {
+                op_len++;
+        }
+        if (op_len < count && (buf[op_len] == '+' || buf[op_len] == '-')) {
+                op = buf[op_len];
+                op_len++;
+        } else {
+                op_len = 0;
+        }
+
+        struct iccom_sk_loopback_mapping_rule parsing_res = { 0 };
+        ret = __iccom_sk_parse_lback_string(buf + op_len, count - op_len
+                                            , &parsing_res);
+        if (ret < 0) {
+                iccom_socket_warning("Parsing failed: %s", buf);
+                goto finalize;
+        }
+
+        ret = __iccom_socket_lback_update(iccom_sk, op, &parsing_res);
+        if (ret < 0) {
+                goto finalize;
+        }
+
+        ret = (ssize_t)count;
+
+finalize:
+
+        kfree(buf);
+        buf = NULL;
+
+        return ret;
+}
+
+// Helper. Inits the ICCom Sockets procfs.
+// RETURNS:
+//      >= 0: on success,
+//      < 0: on failure (negated error code)
+static int __iccom_sk_procfs_init(
+                struct iccom_sockets_device *iccom_sk)
+{
+        ICCOM_SK_CHECK_DEVICE("", return -ENODEV);
+
+        iccom_sk->proc_root = proc_mkdir(ICCOM_SK_PROC_ROOT_NAME, NULL);
+
+        if (IS_ERR_OR_NULL(iccom_sk->proc_root)) {
+                iccom_socket_err("failed to create ICCom Socket proc"
+                                 "root folder with name: "
+                                 ICCOM_SK_PROC_ROOT_NAME);
+                return -EIO;
+        }
+        return 0;
+}
+
+// Removes the ICcom Sockets proc root
+static void __iccom_sk_procfs_close(
+                struct iccom_sockets_device *iccom_sk)
+{
+        ICCOM_SK_CHECK_DEVICE("", return);
+
+        if (IS_ERR_OR_NULL(iccom_sk->proc_root)) {
+                return;
+        }
+
+        proc_remove(iccom_sk->proc_root);
+        iccom_sk->proc_root = NULL;
+}
+
+// Helper. Initializes the loopback control on ICCom Sockets.
+//
+// NOTE: the ICCom Sockets proc rootfs should be created beforehand,
+//      if not: then we will fail to create loopback node, but
+//          the loopback default state (no rules) will be initialized
+//          anyway.
+//
+// RETURNS:
+//      >= 0: on success,
+//      < 0: on failure (negated error code)
+static int __iccom_sk_loopback_ctl_init(
+                struct iccom_sockets_device *iccom_sk)
+{
+        ICCOM_SK_CHECK_DEVICE("", return -ENODEV);
+
+        // fallback state: no loopback rules
+        memset(&iccom_sk->loopback_ctl_ops, 0
+               , sizeof(iccom_sk->loopback_ctl_ops));
+        RCU_INIT_POINTER(iccom_sk->lback_map, NULL);
+        iccom_sk->loopback_ctl_file = NULL;
+
+        // loopback control ops
+        iccom_sk->loopback_ctl_ops.read = &__iccom_sk_lback_rule_read;
+        iccom_sk->loopback_ctl_ops.write = &__iccom_sk_lback_rule_write;
+
+        if (IS_ERR_OR_NULL(iccom_sk->proc_root)) {
+                iccom_socket_err("failed to create loopback control proc entry:"
+                                 " no ICCom Sockets root proc entry");
+                iccom_sk->loopback_ctl_file = NULL;
+                return -ENOENT;
+        }
+
+        iccom_sk->loopback_ctl_file = proc_create_data(
+                                           ICCOM_SK_LBACKCTL_FILE_NAME
+                                           , ICCOM_SK_PROC_RW_PERMISSIONS
+                                           , iccom_sk->proc_root
+                                           , &iccom_sk->loopback_ctl_ops
+                                           , (void*)iccom_sk);
+
+        if (IS_ERR_OR_NULL(iccom_sk->loopback_ctl_file)) {
+                iccom_socket_err("failed to create loopback control proc entry.");
+                return -EIO;
+        }
+
+        return 0;
+}
+
+// Removes the ICcom proc statistics file
+static void __iccom_sk_loopback_ctl_close(
+                struct iccom_sockets_device *iccom_sk)
+{
+        ICCOM_SK_CHECK_DEVICE("", return);
+
+        mutex_lock(&iccom_sk->lback_map_lock);
+        struct iccom_sk_loopback_map *map
+                        = rcu_dereference_protected(iccom_sk->lback_map
+                                , lockdep_is_held(&iccom_sk->lback_map_lock));
+        RCU_INIT_POINTER(iccom_sk->lback_map, NULL);
+        mutex_unlock(&iccom_sk->lback_map_lock);
+
+        // ICCom might still deliver messages to us
+        if (map) {
+                kfree_rcu(map, rcu);
+        }
+
+        if (IS_ERR_OR_NULL(iccom_sk->loopback_ctl_file)) {
+                return;
+        }
+
+        proc_remove(iccom_sk->loopback_ctl_file);
+        iccom_sk->loopback_ctl_file = NULL;
+}
+
+// Provides an ability to read the channel subscriptions from User
+// Space. Is invoked when user reads the /proc/<ICCOM_SK>/<SUBSCR_CTL>
+// file.
+//
+// RETURNS:
+//      >= 0: number of bytes actually provided to user space, on success
+//      < 0: negated error code, on failure
+static ssize_t __iccom_sk_subscr_ctl_read(struct file *file
+                , char __user *ubuf
+                , size_t count
+                , loff_t *ppos)
+{
+        ICCOM_SK_CHECK_PTR(file, return -EINVAL);
+        ICCOM_SK_CHECK_PTR(ubuf, return -EINVAL);
+        ICCOM_SK_CHECK_PTR(ppos, return -EINVAL);
+
+        struct iccom_sockets_device *iccom_sk
+                = (struct iccom_sockets_device *)PDE_DATA(file->f_inode);
+
+        ICCOM_SK_CHECK_DEVICE("no device provided", return -ENODEV);
 
-                if (res != 0) {
-                        iccom_socket_err("failed parsing arg %d in: %s"
-                                         , number, buf);
-                        return -EINVAL;
-                };
+        // "<channel> <portid>\n" per subscription + the note
+        const int BUFFER_SIZE = ICCOM_SK_MAX_SUBSCRIPTIONS * 24 + 512;
 
-                switch (number) {
-                case 1: out->from = (int)target; break;
-                case 2: out->to = (int)target; break;
-                case 3: out->shift = (int)target; break;
-                default: return -EINVAL;
-                }
+        if (*ppos >= BUFFER_SIZE || *ppos > SIZE_MAX) {
+                return 0;
+        }
 
-                number = -(number + 1);
+        char *buf = kmalloc(BUFFER_SIZE, GFP_KERNEL);
+
+        if (IS_ERR_OR_NULL(buf)) {
+                return -ENOMEM;
         }
 
-        if (__iccom_socket_lback_rule_verify(out) < 0) {
-                return -EINVAL;
+        struct iccom_sk_subscription *subscr;
+        size_t len = 0;
+        int bkt;
+
+        spin_lock(&iccom_sk->subscriptions_lock);
+        hash_for_each(iccom_sk->subscriptions, bkt, subscr, hash_anchor) {
+                len += (size_t)scnprintf(buf + len, BUFFER_SIZE - len
+                                         , "%u %u\n", subscr->channel
+                                         , subscr->portid);
         }
+        spin_unlock(&iccom_sk->subscriptions_lock);
 
-        return 0;
+        len += (size_t)scnprintf(buf + len, BUFFER_SIZE - len
+                                 , "\nNOTE: write \"+ <channel> <port id>\""
+                                 " to subscribe the netlink socket with"
+                                 " the given port id to the channel"
+                                 " messages, \"- <channel> <port id>\""
+                                 " to unsubscribe it, the port id should"
+                                 " be >= %u.\n"
+                                 , ICCOM_SK_SUBSCRIBER_PORTID_MIN);
+
+        const unsigned long nbytes_to_copy
+                        = (len >= (size_t)(*ppos))
+                                ?  min(len - (size_t)(*ppos), count)
+                                : 0;
+        const unsigned long not_copied
+                        = copy_to_user(ubuf, buf + (size_t)(*ppos)
+                                       , nbytes_to_copy);
+        kfree(buf);
+        buf = NULL;
+        *ppos += nbytes_to_copy - not_copied;
+
+        return nbytes_to_copy - not_copied;
 }
 
-// Provides an ability to update (and also disable) current loopback
-// rule from User Space.
-// Is invoked when user writes the /proc/<ICCOM_SK>/<LOOPBACK_CTL> file.
-//
-// Is restricted to the file size of SIZE_MAX bytes.
+// Provides an ability to subscribe/unsubscribe the netlink sockets
+// to/from the channels messages from User Space.
+// Is invoked when user writes the /proc/<ICCOM_SK>/<SUBSCR_CTL> file:
+//      "+ <channel> <port id>": subscribe
+//      "- <channel> <port id>": unsubscribe
+// where the <port id> should be >= ICCOM_SK_SUBSCRIBER_PORTID_MIN.
 //
 // RETURNS:
 //      >= 0: number of bytes actually were written, on success
 //      < 0: negated error code, on failure
-static ssize_t __iccom_sk_lback_rule_write(struct file *file
+static ssize_t __iccom_sk_subscr_ctl_write(struct file *file
                 , const char __user *ubuf
                 , size_t count
                 , loff_t *ppos)
@@ -691,178 +2042,294 @@ static ssize_t __iccom_sk_lback_rule_write(struct file *file
         const unsigned int BUFFER_SIZE = 64;
 
         // we only get the whole data at once
-        if (*ppos != 0 || count > BUFFER_SIZE) {
+        if (*ppos != 0 || count >= BUFFER_SIZE) {
                 iccom_socket_warning(
                         "Ctrl message should be written at once"
-                        " and not exceed %u bytes.", BUFFER_SIZE);
+                        " and not exceed %u bytes.", BUFFER_SIZE - 1);
                 return -EFAULT;
         }
 
-        char *buf = kmalloc(BUFFER_SIZE, GFP_KERNEL);
-
-        if (IS_ERR_OR_NULL(buf)) {
-                return -ENOMEM;
-        }
-
-        const unsigned long not_copied = copy_from_user(buf, ubuf, count);
-        ssize_t ret = 0;
+        char buf[BUFFER_SIZE];
 
-        if (not_copied != 0) {
+        if (copy_from_user(buf, ubuf, count) != 0) {
                 iccom_socket_warning("Not all bytes were copied from user.");
-                ret = -EIO;
-                goto finalize;
+                return -EIO;
         }
+        buf[count] = 0;
 
-        struct iccom_sk_loopback_mapping_rule parsing_res;
-        ret = __iccom_sk_parse_lback_string(buf, count, &parsing_res);
-        if (ret < 0) {
-                iccom_socket_warning("Parsing failed: %s", buf);
-                goto finalize;
-        }
+        char op;
+        unsigned int channel;
+        u32 portid;
 
-        struct iccom_sk_loopback_mapping_rule * new_rule
-                            = (struct iccom_sk_loopback_mapping_rule *)
-                              kmalloc(sizeof(*new_rule), GFP_KERNEL);
-        if (IS_ERR_OR_NULL(new_rule)) {
-                iccom_socket_err("failed to create new loopback rule:"
-                                 " no memory");
-                ret = -ENOMEM;
-                goto finalize;
+        if (sscanf(buf, " %c %u %u", &op, &channel, &portid) != 3
+                    || (op != '+' && op != '-')) {
+                iccom_socket_warning("Parsing failed: %s", buf);
+                return -EINVAL;
         }
-        *new_rule = parsing_res;
-
-        struct iccom_sk_loopback_mapping_rule *tmp_ptr
-                            = iccom_sk->lback_map_rule;
-        *((volatile typeof(new_rule) *)(&(iccom_sk->lback_map_rule))) = new_rule;
 
-        if (!IS_ERR_OR_NULL(tmp_ptr)) {
-                kfree(tmp_ptr);
-                tmp_ptr = NULL;
+        const int res = (op == '+')
+                        ? __iccom_sk_subscribe(iccom_sk, channel, portid)
+                        : __iccom_sk_unsubscribe(iccom_sk, channel
+                                                 , portid);
+        if (res < 0) {
+                return res;
         }
 
-        ret = (ssize_t)count;
+        iccom_socket_info("port %u %s channel %u", portid
+                          , (op == '+') ? "subscribed to"
+                                        : "unsubscribed from"
+                          , channel);
+        return (ssize_t)count;
+}
 
-finalize:
+// Drops the subscriptions of the released ICCom netlink sockets.
+//
+// CONTEXT: atomic
+static int __iccom_sk_netlink_notify(struct notifier_block *nb
+                , unsigned long event, void *ptr)
+{
+        struct iccom_sockets_device *iccom_sk
+                = container_of(nb, struct iccom_sockets_device
+                               , netlink_notifier);
+        struct netlink_notify *n = (struct netlink_notify *)ptr;
 
-        kfree(buf);
-        buf = NULL;
+        if (event != NETLINK_URELEASE || n->protocol != NETLINK_ICCOM
+                    || n->portid == 0) {
+                return NOTIFY_DONE;
+        }
 
-        return ret;
+        __iccom_sk_unsubscribe_port(iccom_sk, n->portid);
+        return NOTIFY_DONE;
 }
 
-// Helper. Inits the ICCom Sockets procfs.
+// Helper. Initializes the channel subscriptions control on ICCom
+// Sockets.
+//
+// NOTE: the ICCom Sockets proc rootfs should be created beforehand,
+//      if not: then we will fail to create subscriptions control
+//      node, and no subscriptions will be possible.
+//
 // RETURNS:
 //      >= 0: on success,
 //      < 0: on failure (negated error code)
-static int __iccom_sk_procfs_init(
+static int __iccom_sk_subscr_ctl_init(
                 struct iccom_sockets_device *iccom_sk)
 {
         ICCOM_SK_CHECK_DEVICE("", return -ENODEV);
 
-        iccom_sk->proc_root = proc_mkdir(ICCOM_SK_PROC_ROOT_NAME, NULL);
+        memset(&iccom_sk->subscr_ctl_ops, 0
+               , sizeof(iccom_sk->subscr_ctl_ops));
+        iccom_sk->subscr_ctl_file = NULL;
+
+        iccom_sk->netlink_notifier.notifier_call = &__iccom_sk_netlink_notify;
+        int res = netlink_register_notifier(&iccom_sk->netlink_notifier);
+        if (res < 0) {
+                iccom_socket_err("failed to register netlink notifier,"
+                                 " err: %d", -res);
+                iccom_sk->netlink_notifier.notifier_call = NULL;
+                return res;
+        }
+
+        iccom_sk->subscr_ctl_ops.read = &__iccom_sk_subscr_ctl_read;
+        iccom_sk->subscr_ctl_ops.write = &__iccom_sk_subscr_ctl_write;
 
         if (IS_ERR_OR_NULL(iccom_sk->proc_root)) {
-                iccom_socket_err("failed to create ICCom Socket proc"
-                                 "root folder with name: "
-                                 ICCOM_SK_PROC_ROOT_NAME);
+                iccom_socket_err("failed to create subscriptions control"
+                                 " proc entry: no ICCom Sockets root proc"
+                                 " entry");
+                return -ENOENT;
+        }
+
+        iccom_sk->subscr_ctl_file = proc_create_data(
+                                           ICCOM_SK_SUBSCRCTL_FILE_NAME
+                                           , ICCOM_SK_PROC_RW_PERMISSIONS
+                                           , iccom_sk->proc_root
+                                           , &iccom_sk->subscr_ctl_ops
+                                           , (void*)iccom_sk);
+
+        if (IS_ERR_OR_NULL(iccom_sk->subscr_ctl_file)) {
+                iccom_socket_err("failed to create subscriptions control"
+                                 " proc entry.");
+                iccom_sk->subscr_ctl_file = NULL;
                 return -EIO;
         }
+
         return 0;
 }
 
-// Removes the ICcom Sockets proc root
-static void __iccom_sk_procfs_close(
+// Removes the subscriptions control file and all subscriptions.
+static void __iccom_sk_subscr_ctl_close(
                 struct iccom_sockets_device *iccom_sk)
 {
         ICCOM_SK_CHECK_DEVICE("", return);
 
-        if (IS_ERR_OR_NULL(iccom_sk->proc_root)) {
-                return;
+        if (!IS_ERR_OR_NULL(iccom_sk->subscr_ctl_file)) {
+                proc_remove(iccom_sk->subscr_ctl_file);
+                iccom_sk->subscr_ctl_file = NULL;
         }
+        if (iccom_sk->netlink_notifier.notifier_call) {
+                netlink_unregister_notifier(&iccom_sk->netlink_notifier);
+                iccom_sk->netlink_notifier.notifier_call = NULL;
+        }
+        __iccom_sk_unsubscribe_port(iccom_sk, 0);
+}
 
-        proc_remove(iccom_sk->proc_root);
-        iccom_sk->proc_root = NULL;
+// Provides the TX queue state to User Space, so the producers can
+// adapt their TX rate. Is invoked when user reads the
+// /proc/<ICCOM_SK>/<TX_QUEUE> file:
+//      "<queued bytes> <max bytes>\n"
+// where the queued bytes are the messages data pending in ICCom TX
+// queue and in our pump queue, the max bytes is ICCom TX queue limit.
+//
+// RETURNS:
+//      >= 0: number of bytes actually provided to user space, on success
+//      < 0: negated error code, on failure
+static ssize_t __iccom_sk_tx_queue_read(struct file *file
+                , char __user *ubuf
+                , size_t count
+                , loff_t *ppos)
+{
+        ICCOM_SK_CHECK_PTR(file, return -EINVAL);
+        ICCOM_SK_CHECK_PTR(ubuf, return -EINVAL);
+        ICCOM_SK_CHECK_PTR(ppos, return -EINVAL);
+
+        struct iccom_sockets_device *iccom_sk
+                = (struct iccom_sockets_device *)PDE_DATA(file->f_inode);
+
+        ICCOM_SK_CHECK_DEVICE("no device provided", return -ENODEV);
+
+        const int BUFFER_SIZE = 64;
+
+        if (*ppos >= BUFFER_SIZE || *ppos > SIZE_MAX) {
+                return 0;
+        }
+
+        size_t queued = 0;
+        size_t max_bytes = 0;
+        const int res = iccom_get_tx_queue_state(&iccom_sk->iccom
+                                                 , &queued, &max_bytes);
+        if (res < 0) {
+                return res;
+        }
+        queued += (size_t)atomic_read(&iccom_sk->tx_queue_bytes);
+
+        char buf[BUFFER_SIZE];
+        const size_t len = (size_t)scnprintf(buf, BUFFER_SIZE, "%zu %zu\n"
+                                             , queued, max_bytes);
+
+        const unsigned long nbytes_to_copy
+                        = (len >= (size_t)(*ppos))
+                                ?  min(len - (size_t)(*ppos), count)
+                                : 0;
+        const unsigned long not_copied
+                        = copy_to_user(ubuf, buf + (size_t)(*ppos)
+                                       , nbytes_to_copy);
+        *ppos += nbytes_to_copy - not_copied;
+
+        return nbytes_to_copy - not_copied;
 }
 
-// Helper. Initializes the loopback control on ICCom Sockets.
+// Helper. Creates the TX queue state file on ICCom Sockets.
 //
-// NOTE: the ICCom Sockets proc rootfs should be created beforehand,
-//      if not: then we will fail to create loopback node, but
-//          the loopback default rule (turned off) will be initialized
-//          anyway.
+// NOTE: the ICCom Sockets proc rootfs should be created beforehand.
 //
 // RETURNS:
 //      >= 0: on success,
 //      < 0: on failure (negated error code)
-static int __iccom_sk_loopback_ctl_init(
+static int __iccom_sk_tx_queue_file_init(
                 struct iccom_sockets_device *iccom_sk)
 {
         ICCOM_SK_CHECK_DEVICE("", return -ENODEV);
 
-        // fallback state
-        memset(&iccom_sk->loopback_ctl_ops, 0
-               , sizeof(iccom_sk->loopback_ctl_ops));
-        iccom_sk->lback_map_rule = NULL;
-        iccom_sk->loopback_ctl_file = NULL;
-
-        // initial rule data
-        iccom_sk->lback_map_rule = (struct iccom_sk_loopback_mapping_rule *)
-                                   kmalloc(sizeof(*iccom_sk->lback_map_rule)
-                                           , GFP_KERNEL);
-        if (IS_ERR_OR_NULL(iccom_sk->lback_map_rule)) {
-                iccom_socket_err("failed to create loopback rule:"
-                                 " no memory");
-                return -ENOMEM;
-        }
-        memset(iccom_sk->lback_map_rule, 0, sizeof(*iccom_sk->lback_map_rule));
+        memset(&iccom_sk->tx_queue_ops, 0, sizeof(iccom_sk->tx_queue_ops));
+        iccom_sk->tx_queue_file = NULL;
 
-        // loopback control ops
-        iccom_sk->loopback_ctl_ops.read = &__iccom_sk_lback_rule_read;
-        iccom_sk->loopback_ctl_ops.write = &__iccom_sk_lback_rule_write;
+        iccom_sk->tx_queue_ops.read = &__iccom_sk_tx_queue_read;
 
         if (IS_ERR_OR_NULL(iccom_sk->proc_root)) {
-                iccom_socket_err("failed to create loopback control proc entry:"
+                iccom_socket_err("failed to create TX queue proc entry:"
                                  " no ICCom Sockets root proc entry");
-                iccom_sk->loopback_ctl_file = NULL;
                 return -ENOENT;
         }
 
-        iccom_sk->loopback_ctl_file = proc_create_data(
-                                           ICCOM_SK_LBACKCTL_FILE_NAME
-                                           , ICCOM_SK_PROC_RW_PERMISSIONS
+        iccom_sk->tx_queue_file = proc_create_data(
+                                           ICCOM_SK_TXQUEUE_FILE_NAME
+                                           , ICCOM_SK_PROC_RO_PERMISSIONS
                                            , iccom_sk->proc_root
-                                           , &iccom_sk->loopback_ctl_ops
+                                           , &iccom_sk->tx_queue_ops
                                            , (void*)iccom_sk);
 
-        if (IS_ERR_OR_NULL(iccom_sk->loopback_ctl_file)) {
-                iccom_socket_err("failed to create loopback control proc entry.");
+        if (IS_ERR_OR_NULL(iccom_sk->tx_queue_file)) {
+                iccom_socket_err("failed to create TX queue proc entry.");
+                iccom_sk->tx_queue_file = NULL;
                 return -EIO;
         }
 
         return 0;
 }
 
-// Removes the ICcom proc statistics file
-static void __iccom_sk_loopback_ctl_close(
+// Removes the TX queue state file.
+static void __iccom_sk_tx_queue_file_close(
                 struct iccom_sockets_device *iccom_sk)
 {
         ICCOM_SK_CHECK_DEVICE("", return);
 
-        if (!IS_ERR_OR_NULL(iccom_sk->lback_map_rule)) {
-            struct iccom_sk_loopback_mapping_rule *ptr
-                        = iccom_sk->lback_map_rule;
-            iccom_sk->lback_map_rule = NULL;
+        if (!IS_ERR_OR_NULL(iccom_sk->tx_queue_file)) {
+                proc_remove(iccom_sk->tx_queue_file);
+                iccom_sk->tx_queue_file = NULL;
+        }
+}
+
+// Helper. Drops all the peer echo backlog messages.
+//
+// LOCKING: @iccom_sk->peer_echo_lock should be held by caller.
+static void __iccom_socket_peer_echo_backlog_free(
+                struct iccom_sockets_device *iccom_sk)
+{
+        struct iccom_sk_peer_echo *echo, *tmp;
 
-            kfree(ptr);
-            ptr = NULL;
+        list_for_each_entry_safe(echo, tmp, &iccom_sk->peer_echo_backlog
+                                 , list_anchor) {
+                list_del(&echo->list_anchor);
+                kfree(echo);
         }
+        iccom_sk->peer_echo_backlog_bytes = 0;
+}
 
-        if (IS_ERR_OR_NULL(iccom_sk->loopback_ctl_file)) {
-                return;
+// Returns true if the loopback transport is selected.
+static inline bool __iccom_socket_loopback_transport(void)
+{
+        return !IS_ERR_OR_NULL(transport)
+                && strcmp(transport, ICCOM_SK_TRANSPORT_LOOPBACK) == 0;
+}
+
+// Helper. Takes the loopback transport module (loading it if needed),
+// so it is an optional dependency used only with the loopback
+// transport.
+//
+// RETURNS:
+//      0: if success
+//      <0: negated error code else
+static int __iccom_socket_loopback_get(struct iccom_sockets_device *iccom_sk)
+{
+        iccom_sk->loopback_get_device
+                = symbol_request(full_duplex_loopback_get_device);
+        if (!iccom_sk->loopback_get_device) {
+                iccom_socket_err("the loopback transport needs the"
+                                 " full_duplex_loopback module");
+                return -ENODEV;
         }
+        return 0;
+}
 
-        proc_remove(iccom_sk->loopback_ctl_file);
-        iccom_sk->loopback_ctl_file = NULL;
+// Helper. Releases the loopback transport module if it was taken.
+static void __iccom_socket_loopback_put(struct iccom_sockets_device *iccom_sk)
+{
+        if (!iccom_sk->loopback_get_device) {
+                return;
+        }
+        symbol_put(full_duplex_loopback_get_device);
+        iccom_sk->loopback_get_device = NULL;
 }
 
 // Closes underlying protocol layer.
@@ -874,7 +2341,154 @@ static void __iccom_socket_protocol_device_close(
                 return;
         }
         iccom_sk->exiting = true;
+        // the peer echo work uses the peer ICCom
+        cancel_work_sync(&iccom_sk->peer_echo_work);
         iccom_close_binded(&iccom_sk->iccom);
+        if (iccom_is_running(&iccom_sk->peer_iccom)) {
+                iccom_close_binded(&iccom_sk->peer_iccom);
+        }
+        // might have been scheduled by the last peer callbacks
+        cancel_work_sync(&iccom_sk->peer_echo_work);
+        mutex_lock(&iccom_sk->peer_echo_lock);
+        __iccom_socket_peer_echo_backlog_free(iccom_sk);
+        mutex_unlock(&iccom_sk->peer_echo_lock);
+        __iccom_socket_loopback_put(iccom_sk);
+}
+
+
+// The peer echo work (loopback transport only): posts the backlog
+// messages to the peer ICCom in order, waiting for the room in its
+// TX queue as needed, till the backlog is empty or we are exiting.
+static void __iccom_socket_peer_echo_routine(struct work_struct *work)
+{
+        struct iccom_sockets_device *iccom_sk
+                = container_of(work, struct iccom_sockets_device
+                               , peer_echo_work);
+
+        mutex_lock(&iccom_sk->peer_echo_lock);
+        while (!list_empty(&iccom_sk->peer_echo_backlog)
+                        && !iccom_sk->exiting) {
+                struct iccom_sk_peer_echo *echo = list_first_entry(
+                                &iccom_sk->peer_echo_backlog
+                                , struct iccom_sk_peer_echo, list_anchor);
+
+                const int res = iccom_post_message(&iccom_sk->peer_iccom
+                                        , echo->data, echo->length
+                                        , echo->channel, 0);
+                if (res == -EAGAIN) {
+                        // new echoes go to the backlog meanwhile, and
+                        // only this work takes the messages from it
+                        mutex_unlock(&iccom_sk->peer_echo_lock);
+                        iccom_wait_tx_space(&iccom_sk->peer_iccom
+                                        , echo->length
+                                        , ICCOM_SK_PEER_ECHO_RETRY_JIFFIES);
+                        mutex_lock(&iccom_sk->peer_echo_lock);
+                        continue;
+                }
+                if (res < 0) {
+                        iccom_socket_err("peer failed to echo message on"
+                                         " channel %u, error: %d"
+                                         , echo->channel, res);
+                }
+                list_del(&echo->list_anchor);
+                iccom_sk->peer_echo_backlog_bytes -= echo->length;
+                kfree(echo);
+        }
+        mutex_unlock(&iccom_sk->peer_echo_lock);
+}
+
+// The peer ICCom message callback (loopback transport only): echoes
+// the message back to the same channel. If the peer TX queue is full,
+// the message is put to the peer echo backlog to be echoed by the
+// peer echo work (see ICCOM_SK_PEER_ECHO_BACKLOG_MAX_BYTES).
+//
+// NOTE: ICCom invokes the rx callbacks without holding its locks,
+//      so posting from here is fine.
+//
+// RETURNS:
+//      false: the message data ownership stays with ICCom
+static bool __iccom_socket_peer_msg_rx_callback(
+                unsigned int channel
+                , void *msg_data, size_t msg_len
+                , void *consumer_data)
+{
+        struct iccom_sockets_device *iccom_sk
+                = (struct iccom_sockets_device *)consumer_data;
+        int res = -EAGAIN;
+
+        mutex_lock(&iccom_sk->peer_echo_lock);
+        // the backlog goes first to keep the echo order
+        if (list_empty(&iccom_sk->peer_echo_backlog)) {
+                res = iccom_post_message(&iccom_sk->peer_iccom
+                                         , (char *)msg_data, msg_len
+                                         , channel, 0);
+        }
+        if (res != -EAGAIN) {
+                mutex_unlock(&iccom_sk->peer_echo_lock);
+                if (res < 0) {
+                        iccom_socket_err("peer failed to echo message on"
+                                         " channel %u, error: %d"
+                                         , channel, res);
+                }
+                return false;
+        }
+
+        struct iccom_sk_peer_echo *echo = NULL;
+        if (iccom_sk->peer_echo_backlog_bytes + msg_len
+                        <= ICCOM_SK_PEER_ECHO_BACKLOG_MAX_BYTES) {
+                echo = kmalloc(sizeof(*echo) + msg_len, GFP_KERNEL);
+        }
+        if (!echo) {
+                iccom_sk->peer_echoes_dropped++;
+                mutex_unlock(&iccom_sk->peer_echo_lock);
+                pr_warn_ratelimited(ICCOM_SOCKETS_LOG_PREFIX"%s: peer echo"
+                                    " backlog is full, dropped message on"
+                                    " channel %u (%llu dropped so far)\n"
+                                    , __func__, channel
+                                    , iccom_sk->peer_echoes_dropped);
+                return false;
+        }
+        echo->channel = channel;
+        echo->length = msg_len;
+        memcpy(echo->data, msg_data, msg_len);
+        list_add_tail(&echo->list_anchor, &iccom_sk->peer_echo_backlog);
+        iccom_sk->peer_echo_backlog_bytes += msg_len;
+        mutex_unlock(&iccom_sk->peer_echo_lock);
+
+        schedule_work(&iccom_sk->peer_echo_work);
+        return false;
+}
+
+// Inits the peer ICCom on the remote side of the loopback link.
+//
+// RETURNS:
+//      0: if success
+//      <0: negated error code else
+static int __iccom_socket_peer_init(struct iccom_sockets_device *iccom_sk)
+{
+        const struct full_duplex_device peer_transport
+                    = iccom_sk->loopback_get_device(1);
+
+        if (IS_ERR(peer_transport.dev)) {
+                return PTR_ERR(peer_transport.dev);
+        }
+
+        int res = iccom_init_binded(&iccom_sk->peer_iccom
+                                    , peer_transport.iface
+                                    , peer_transport.dev);
+        if (res < 0) {
+                iccom_socket_err("peer ICCom init failed, error: %d", res);
+                return res;
+        }
+        res = iccom_set_channel_callback(&iccom_sk->peer_iccom
+                        , ICCOM_ANY_CHANNEL_VALUE
+                        , &__iccom_socket_peer_msg_rx_callback
+                        , (void *)iccom_sk);
+        if (res < 0) {
+                iccom_close_binded(&iccom_sk->peer_iccom);
+                return res;
+        }
+        return 0;
 }
 
 #include <linux/spi/spi.h>
@@ -960,17 +2574,43 @@ static int __iccom_socket_protocol_device_init(
         //      functionality and have no dependencies on the message
         //      transport protocol drivers, nor byte transfer protocol
         //      drivers
-        const struct full_duplex_device transport
-                    = iccom_example_protocol_init_transport_layer();
+        const bool loopback = __iccom_socket_loopback_transport();
+        if (loopback) {
+                const int res = __iccom_socket_loopback_get(iccom_sk);
+                if (res < 0) {
+                        return res;
+                }
+        }
+        const struct full_duplex_device transport_dev
+                    = loopback ? iccom_sk->loopback_get_device(0)
+                               : iccom_example_protocol_init_transport_layer();
+
+        if (IS_ERR(transport_dev.dev)) {
+                __iccom_socket_loopback_put(iccom_sk);
+                return PTR_ERR(transport_dev.dev);
+        }
+
+        iccom_sk->iccom.rx_data_headroom = ICCOM_SK_RX_DATA_HEADROOM;
+        iccom_sk->iccom.rx_data_tailroom = ICCOM_SK_RX_DATA_TAILROOM;
 
         // TODO: ultimate binding shall happen in the ultimate protocol
         //      driver and happen between specific instances of layers
         //      (not between whole layers).
-        int res = iccom_init_binded(&iccom_sk->iccom, transport.iface
-                                    , transport.dev);
+        int res = iccom_init_binded(&iccom_sk->iccom, transport_dev.iface
+                                    , transport_dev.dev);
         if (res < 0) {
+                __iccom_socket_loopback_put(iccom_sk);
                 return res;
         }
+        if (loopback) {
+                iccom_socket_info("running over the loopback transport");
+                res = __iccom_socket_peer_init(iccom_sk);
+                if (res < 0) {
+                        iccom_close_binded(&iccom_sk->iccom);
+                        __iccom_socket_loopback_put(iccom_sk);
+                        return res;
+                }
+        }
         res = iccom_set_channel_callback(&iccom_sk->iccom
                         , ICCOM_ANY_CHANNEL_VALUE
                         , &__iccom_socket_msg_rx_callback
@@ -990,9 +2630,12 @@ static int __iccom_socket_device_close(
         ICCOM_SK_CHECK_DEVICE("", return -ENODEV);
 
         // order matters
+        __iccom_socket_unreg_socket_family(iccom_sk);
+        __iccom_socket_pump_close(iccom_sk);
+        __iccom_sk_tx_queue_file_close(iccom_sk);
+        __iccom_sk_subscr_ctl_close(iccom_sk);
         __iccom_sk_loopback_ctl_close(iccom_sk);
         __iccom_sk_procfs_close(iccom_sk);
-        __iccom_socket_unreg_socket_family(iccom_sk);
         __iccom_socket_protocol_device_close(iccom_sk);
         return 0;
 }
@@ -1010,6 +2653,19 @@ static int __iccom_socket_device_init(
         init_completion(&iccom_sk->initialized);
         init_completion(&iccom_sk->socket_closed);
         init_completion(&iccom_sk->pump_main_loop_done);
+        hash_init(iccom_sk->subscriptions);
+        init_llist_head(&iccom_sk->tx_queue);
+        init_waitqueue_head(&iccom_sk->tx_wait);
+        atomic_set(&iccom_sk->tx_queue_bytes, 0);
+        init_waitqueue_head(&iccom_sk->tx_space_wait);
+        atomic_set(&iccom_sk->tx_senders, 0);
+        init_waitqueue_head(&iccom_sk->tx_senders_wait);
+        spin_lock_init(&iccom_sk->subscriptions_lock);
+        mutex_init(&iccom_sk->lback_map_lock);
+        INIT_LIST_HEAD(&iccom_sk->peer_echo_backlog);
+        mutex_init(&iccom_sk->peer_echo_lock);
+        INIT_WORK(&iccom_sk->peer_echo_work
+                  , &__iccom_socket_peer_echo_routine);
 
         // order matters
         int res = __iccom_socket_reg_socket_family(iccom_sk);
@@ -1024,6 +2680,13 @@ static int __iccom_socket_device_init(
         }
         __iccom_sk_procfs_init(iccom_sk);
         __iccom_sk_loopback_ctl_init(iccom_sk);
+        __iccom_sk_subscr_ctl_init(iccom_sk);
+        __iccom_sk_tx_queue_file_init(iccom_sk);
+
+        res = __iccom_socket_pump_init(iccom_sk);
+        if (res < 0) {
+                goto failed;
+        }
 
         // launches pump thread
         complete(&iccom_sk->initialized);
@@ -1041,6 +2704,16 @@ failed:
 static int __init iccom_socket_module_init(void)
 {
         iccom_socket_info("loading module");
+        if (IS_ERR_OR_NULL(transport)
+                    || (strcmp(transport, ICCOM_SK_TRANSPORT_SYMSPI) != 0
+                        && strcmp(transport, ICCOM_SK_TRANSPORT_LOOPBACK)
+                           != 0)) {
+                iccom_socket_err("unknown transport \"%s\", expected \""
+                                 ICCOM_SK_TRANSPORT_SYMSPI"\" or \""
+                                 ICCOM_SK_TRANSPORT_LOOPBACK"\""
+                                 , transport ? transport : "");
+                return -EINVAL;
+        }
         int res = __iccom_socket_device_init(&__iccom_sockets_dev);
         if (res < 0) {
                 iccom_socket_err("module loading failed, err: %d"
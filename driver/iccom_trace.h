@@ -0,0 +1,147 @@
+/*
+ * This file declares the trace events of the Inter Chip/CPU communication
+ * protocol (ICCom) driver.
+ *
+ * Copyright (c) 2026 The iccom-utils contributors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// SPDX-License-Identifier: GPL-2.0
+
+// The events are available under the "iccom" trace system, say:
+//      echo 1 > /sys/kernel/debug/tracing/events/iccom/enable
+//      cat /sys/kernel/debug/tracing/trace_pipe
+// or
+//      perf record -e 'iccom:*' -a
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM iccom
+
+#if !defined(_ICCOM_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _ICCOM_TRACE_H
+
+#include <linux/tracepoint.h>
+
+// The package @id of @size_bytes was put into the data xfer
+// (at @slot of the batch xfer).
+TRACE_EVENT(iccom_package_tx,
+	TP_PROTO(int id, size_t size_bytes, unsigned int slot),
+	TP_ARGS(id, size_bytes, slot),
+	TP_STRUCT__entry(
+		__field(int, id)
+		__field(size_t, size_bytes)
+		__field(unsigned int, slot)
+	),
+	TP_fast_assign(
+		__entry->id = id;
+		__entry->size_bytes = size_bytes;
+		__entry->slot = slot;
+	),
+	TP_printk("package %d, %zu bytes, slot %u", __entry->id
+		  , __entry->size_bytes, __entry->slot)
+);
+
+// The package was received, @payload_size < 0 means the package
+// is broken (wrong CRC or layout), then @id is -1.
+TRACE_EVENT(iccom_package_rx,
+	TP_PROTO(int id, int payload_size),
+	TP_ARGS(id, payload_size),
+	TP_STRUCT__entry(
+		__field(int, id)
+		__field(int, payload_size)
+	),
+	TP_fast_assign(
+		__entry->id = id;
+		__entry->payload_size = payload_size;
+	),
+	TP_printk("package %d, payload %d bytes%s", __entry->id
+		  , __entry->payload_size
+		  , __entry->payload_size < 0 ? " (broken)" : "")
+);
+
+// The ack/nack of the frame (legacy protocol): @ours - we send it,
+// else the other side sent it to us.
+TRACE_EVENT(iccom_ack,
+	TP_PROTO(bool ours, bool ack),
+	TP_ARGS(ours, ack),
+	TP_STRUCT__entry(
+		__field(bool, ours)
+		__field(bool, ack)
+	),
+	TP_fast_assign(
+		__entry->ours = ours;
+		__entry->ack = ack;
+	),
+	TP_printk("%s %s", __entry->ours ? "sent" : "received"
+		  , __entry->ack ? "ACK" : "NACK")
+);
+
+// The piggyback ack received from the other side: all packages up to
+// @ack_id are received plus the ones selected by the @sack_mask.
+TRACE_EVENT(iccom_pb_ack,
+	TP_PROTO(int ack_id, unsigned int sack_mask),
+	TP_ARGS(ack_id, sack_mask),
+	TP_STRUCT__entry(
+		__field(int, ack_id)
+		__field(unsigned int, sack_mask)
+	),
+	TP_fast_assign(
+		__entry->ack_id = ack_id;
+		__entry->sack_mask = sack_mask;
+	),
+	TP_printk("ack %d, sack 0x%02x", __entry->ack_id
+		  , __entry->sack_mask)
+);
+
+// The message @id of @length bytes was delivered to the consumer of
+// the @channel.
+TRACE_EVENT(iccom_message_delivered,
+	TP_PROTO(unsigned int channel, unsigned int id, size_t length),
+	TP_ARGS(channel, id, length),
+	TP_STRUCT__entry(
+		__field(unsigned int, channel)
+		__field(unsigned int, id)
+		__field(size_t, length)
+	),
+	TP_fast_assign(
+		__entry->channel = channel;
+		__entry->id = id;
+		__entry->length = length;
+	),
+	TP_printk("channel %u, message %u, %zu bytes", __entry->channel
+		  , __entry->id, __entry->length)
+);
+
+// The TX queue depth: @messages consumer messages wait to be sent
+// or acked.
+TRACE_EVENT(iccom_tx_queue,
+	TP_PROTO(unsigned long messages),
+	TP_ARGS(messages),
+	TP_STRUCT__entry(
+		__field(unsigned long, messages)
+	),
+	TP_fast_assign(
+		__entry->messages = messages;
+	),
+	TP_printk("%lu messages pending", __entry->messages)
+);
+
+#endif /* _ICCOM_TRACE_H */
+
+// the header is out of kernel tree, see CFLAGS_iccom.o in Makefile
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE iccom_trace
+#include <trace/define_trace.h>
@@ -25,8 +25,13 @@
 
 #include <linux/module.h>
 #include <linux/workqueue.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/version.h>
 #include <linux/printk.h>
 #include <linux/spi/spi.h>
+#include <linux/dma-mapping.h>
+#include <linux/dmaengine.h>
 #include <linux/gpio.h>
 #include <linux/platform_device.h>
 #include <linux/slab.h>
@@ -39,6 +44,9 @@
 #include <linux/of_device.h>
 #include <linux/of_gpio.h>
 
+#define CREATE_TRACE_POINTS
+#include "symspi_trace.h"
+
 
 
 // DEV STACK
@@ -128,12 +136,41 @@
 
 #define SYMSPI_LOG_PREFIX "SymSPI: "
 
-// The maximum single xfer size in bytes
-// (is limited by the SPI hardware FIFO buffer)
+// The maximum single xfer size in bytes. The xfers larger than
+// the SPI hardware FIFO buffer are split by the SPI controller
+// driver (DMA mode), so the consumer protocol may negotiate the
+// xfer size up to this value.
 //
 // NOTE: usually it is the same for all SPI controllers
 //          on chip and for both Master and Slave modes
-#define SYMSPI_XFER_SIZE_MAX_BYTES 256
+#ifndef SYMSPI_XFER_SIZE_MAX_BYTES
+#define SYMSPI_XFER_SIZE_MAX_BYTES 4096
+#endif
+
+// The maximal number of SPI transfers the single xfer is split into
+// (see full_duplex_xfer.segment_size_bytes). The xfers of more
+// segments are transferred as a single SPI transfer.
+#ifndef SYMSPI_XFER_SEGMENTS_MAX
+#define SYMSPI_XFER_SEGMENTS_MAX 16
+#endif
+
+// The number of preallocated xfer buffer pairs (TX+RX) the
+// current xfer data alternates between. The next xfer data is
+// always written into the idle pair, so the pair which is
+// possibly on the wire is never touched by CPU.
+#define SYMSPI_XFER_BUFFERS_COUNT 2
+
+// Set to 1 to map the preallocated xfer buffers for the SPI
+// controller DMA once at init time (the SPI core then skips
+// per-message mapping). If mapping fails, we fall back to the
+// SPI core mapping silently (with a warning).
+// NOTE: off by default: premapped messages bypass the SPI core
+//      DMA decision (can_dma(), bounce buffers, IOMMU setup of
+//      the controller), so enable it only on the platforms where
+//      the controller is verified to accept premapped buffers.
+#ifndef SYMSPI_XFER_BUFFERS_DMA_PREMAP
+#define SYMSPI_XFER_BUFFERS_DMA_PREMAP 0
+#endif
 
 // Which TTL level will be interpreted as ACTIVE flag state
 #define SYMSPI_MASTER_FLAG_ACTIVE_VALUE 1
@@ -157,13 +194,12 @@
 // (after that timeout SymSPI should go to error state and
 // attempt to recover from error)
 //
-// NOTE: don't set the timeout lower than 3 jiffies (usually 30ms),
-//      cause the relative error will be too high (for example, if
-//      timer is set at the end of current jiffie, it will be timed
-//      out immediately on the next timer tick, which might happen
-//      say in 25 microseconds, instead of 10 milliseconds,
-//      triggering false positive timeout indication, in practice
-//      difference of 0.2ms instead of 10ms set was observed)
+// NOTE: the timeout is driven by the high resolution timer, so
+//      it is not bound to the jiffies granularity any more and can
+//      be safely set as low as 1-2 ms if the other side is known
+//      to react in time (the jiffies based timer could fire up to
+//      a whole tick earlier, say in 0.2ms instead of 10ms set,
+//      triggering false positive timeout indication).
 //
 // NOTE: one more recomendation: set this value to high enough value
 //  	which would reasonably can be considered as "not-normal/
@@ -184,6 +220,48 @@
 // The required precision of silence time waiting
 #define SYMSPI_ERROR_RECOVERY_SILENCE_TIME_VARIANCE_PERCENT 5
 
+// Enables the tiered error recovery. The isolated link glitches
+// (other side indicated error, other side wait timeout, SPI error)
+// are then recovered with the fast resync: the same error indication
+// to the other side followed by the shorter
+// SYMSPI_ERROR_FAST_RECOVERY_SILENCE_TIME_US silence. The
+// SYMSPI_ERROR_RECOVERY_SILENCE_TIME_MS silence is used for all other
+// errors, and for the glitches when:
+// * no xfer succeeded since the previous fast recovery, or
+// * the glitch average rate (see symspi_error_rec) is at or above
+//   SYMSPI_ERROR_FULL_RECOVERY_RATE_PER_SEC.
+//
+// 0: always use the full recovery
+// 1: (DEFAULT) tiered recovery
+#ifndef SYMSPI_ERROR_FAST_RECOVERY
+#define SYMSPI_ERROR_FAST_RECOVERY 1
+#endif
+// The time the other side needs to detect our error indication and
+// to get through its own error indication, so it is ready for the
+// next xfer (the other side might be in fast resync too).
+#define SYMSPI_ERROR_PEER_RECOVERY_WINDOW_US 1000
+// The duration of the silence which follows the fast resync
+#ifndef SYMSPI_ERROR_FAST_RECOVERY_SILENCE_TIME_US
+#define SYMSPI_ERROR_FAST_RECOVERY_SILENCE_TIME_US 1000
+#endif
+#if SYMSPI_ERROR_FAST_RECOVERY_SILENCE_TIME_US \
+	< SYMSPI_ERROR_PEER_RECOVERY_WINDOW_US
+#error SYMSPI_ERROR_FAST_RECOVERY_SILENCE_TIME_US must not be less than \
+	SYMSPI_ERROR_PEER_RECOVERY_WINDOW_US, or we resume the xfers \
+	while the other side is still recovering
+#endif
+// The error rate (errors per second) starting from which the
+// glitches are recovered with the full recovery
+#define SYMSPI_ERROR_FULL_RECOVERY_RATE_PER_SEC 5
+
+// The number of buckets of the frame timing histograms (see struct
+// symspi_timing_hist). The bucket i counts the durations within
+// [2^i; 2^(i+1)) usec, the first bucket also counts the lower ones,
+// the last one also counts the higher ones.
+#ifndef SYMSPI_TIMING_HIST_BUCKETS
+#define SYMSPI_TIMING_HIST_BUCKETS 20
+#endif
+
 // The timeout to wait for hardware xfer to be finished
 // on device closing (in milliseconds)
 #define SYMSPI_CLOSE_HW_WAIT_TIMEOUT_MSEC 500
@@ -191,12 +269,18 @@
 
 // Selects the workqueue to use to run operations ordered
 // from interrupt context.
-// Three options are available now:
+// Four options are available now:
 // * "SYMSPI_WQ_SYSTEM": see system_wq in workqueue.h.
 // * "SYMSPI_WQ_SYSTEM_HIGHPRI": see system_highpri_wq in
 //   workqueue.h.
 // * "SYMSPI_WQ_PRIVATE": use privately constructed high priority
 //   workqueue.
+// * "SYMSPI_WQ_RT_KTHREAD": use the private kthread worker running
+//   with SCHED_FIFO policy (see SYMSPI_RT_KTHREAD_PRIORITY), so the
+//   postprocessing of every xfer (and so the next xfer start) is not
+//   delayed by the regular tasks and kworkers scheduling. Its priority
+//   and CPU affinity can be set via the module parameters and at
+//   runtime via the /proc/symspi/worker file. The default one.
 //
 // NOTE: the selection of the workqueue depends on the
 //      generic considerations on SymSPI functioning
@@ -206,16 +290,21 @@
 //      then "SYMSPI_WQ_SYSTEM" workqeue is a nice option to select.
 //      On the other hand if no delays are allowed in handling SymSPI
 //      communication (say, to communicate to hardware watchdog)
-//      then "SYMSPI_WQ_SYSTEM_HIGHPRI" or "SYMSPI_WQ_PRIVATE" is
-//      surely more preferrable.
+//      then "SYMSPI_WQ_RT_KTHREAD", "SYMSPI_WQ_SYSTEM_HIGHPRI" or
+//      "SYMSPI_WQ_PRIVATE" is surely more preferrable.
+//
+// NOTE: the worker priority and CPU affinity controls (worker_priority
+//      and worker_cpus module parameters, /proc/symspi/worker file)
+//      exist in "SYMSPI_WQ_RT_KTHREAD" mode only.
 //
 #ifndef SYMSPI_WORKQUEUE_MODE
-#define SYMSPI_WORKQUEUE_MODE SYMSPI_WQ_PRIVATE
+#define SYMSPI_WORKQUEUE_MODE SYMSPI_WQ_RT_KTHREAD
 #endif
 
 #define SYMSPI_WQ_SYSTEM 0
 #define SYMSPI_WQ_SYSTEM_HIGHPRI 1
 #define SYMSPI_WQ_PRIVATE 2
+#define SYMSPI_WQ_RT_KTHREAD 3
 
 // Comparator
 #define SYMSPI_WQ_MODE_MATCH(x)		\
@@ -224,7 +313,25 @@
 #ifndef SYMSPI_WORKQUEUE_MODE
 #error SYMSPI_WORKQUEUE_MODE must be defined to \
 		one of [SYMSPI_WQ_SYSTEM, SYMSPI_WQ_SYSTEM_HIGHPRI, \
-		SYMSPI_WQ_PRIVATE].
+		SYMSPI_WQ_PRIVATE, SYMSPI_WQ_RT_KTHREAD].
+#endif
+
+// The default SCHED_FIFO priority of the SymSPI kthread worker
+// (SYMSPI_WQ_RT_KTHREAD mode only), [1; MAX_RT_PRIO - 1].
+// Can be overridden by the worker_priority module parameter and
+// changed at runtime via the /proc/symspi/worker file.
+#ifndef SYMSPI_RT_KTHREAD_PRIORITY
+#define SYMSPI_RT_KTHREAD_PRIORITY (MAX_RT_PRIO / 2)
+#endif
+
+// The SymSPI works are kthread works in SYMSPI_WQ_RT_KTHREAD mode
+// and regular works otherwise.
+#if SYMSPI_WQ_MODE_MATCH(RT_KTHREAD)
+#define symspi_work_struct kthread_work
+#define SYMSPI_INIT_WORK(work, func) kthread_init_work(work, func)
+#else
+#define symspi_work_struct work_struct
+#define SYMSPI_INIT_WORK(work, func) INIT_WORK(work, func)
 #endif
 
 
@@ -264,6 +371,16 @@ static int their_flag_wait_timeout = SYMSPI_THEIR_FLAG_WAIT_TIMEOUT_MSEC;
 module_param(their_flag_wait_timeout, int, S_IRUGO|S_IWUSR);
 MODULE_PARM_DESC(their_flag_wait_timeout,"The timeout of waiting for other side to raise their flag");
 
+#if SYMSPI_WQ_MODE_MATCH(RT_KTHREAD)
+static int worker_priority = SYMSPI_RT_KTHREAD_PRIORITY;
+module_param(worker_priority, int, S_IRUGO);
+MODULE_PARM_DESC(worker_priority,"The initial SCHED_FIFO priority of the kthread worker, 0 for normal policy");
+
+static char *worker_cpus = "";
+module_param(worker_cpus, charp, S_IRUGO);
+MODULE_PARM_DESC(worker_cpus,"The initial CPU list (like \"0,2-3\") the kthread worker runs on, empty for all CPUs");
+#endif
+
 static int slave_driver_reday_delay = SYMSPI_SLAVE_FRIVER_REDAY_DELAY;
 module_param(slave_driver_reday_delay, int, S_IRUGO|S_IWUSR);
 MODULE_PARM_DESC(slave_driver_reday_delay,"The delay between our flag raise and slave driver reday");
@@ -474,6 +591,11 @@ MODULE_PARM_DESC(slave_driver_reday_delay,"The delay between our flag raise and
 // the name of the character device to readout SymSPI info
 #define SYMSPI_INFO_FILE_NAME "info"
 #define SYMSPI_PROC_R_PERMISSIONS 0444
+// the file in SymSPI proc directory, which allows to read and set the
+// scheduling priority and the CPU affinity of the kthread worker
+// (SYMSPI_WQ_RT_KTHREAD mode only)
+#define SYMSPI_WORKER_FILE_NAME "worker"
+#define SYMSPI_PROC_RW_PERMISSIONS 0600
 
 /* ------------------------ GLOBAL VARIABLES ----------------------------*/
 
@@ -485,9 +607,11 @@ static void __symspi_error_report_init(struct symspi_dev *symspi);
 static inline void __symspi_restart_timeout_timer(struct symspi_dev *symspi);
 static inline void __symspi_stop_timeout_timer(struct symspi_dev *symspi);
 static inline void __symspi_stop_timeout_timer_sync(struct symspi_dev *symspi);
-static void __symspi_other_side_wait_timeout(unsigned long data);
+static enum hrtimer_restart __symspi_other_side_wait_timeout(
+		struct hrtimer *timer);
 #if SYMSPI_USE_SLAVEMODE_TX_FIFOFILL_TIMEOUTTIMER
-static void __symspi_slave_tx_fill_timeout(unsigned long data);
+static enum hrtimer_restart __symspi_slave_tx_fill_timeout(
+		struct hrtimer *timer);
 #endif
 static inline int __symspi_init_workqueue(
 		const struct symspi_dev *const symspi);
@@ -495,10 +619,10 @@ static inline void __symspi_close_workqueue(
 		const struct symspi_dev *const symspi);
 static inline void __symspi_schedule_work(
 		const struct symspi_dev *const symspi
-		, struct work_struct *work);
+		, struct symspi_work_struct *work);
 static inline void __symspi_cancel_work_sync(
 		const struct symspi_dev *const symspi
-		, struct work_struct *work);
+		, struct symspi_work_struct *work);
 static inline bool __symspi_is_closing(struct symspi_dev *symspi);
 static int symspi_switch_to_xfer_prepare_sequence(struct full_duplex_xfer *xfer
 		, struct symspi_dev* symspi
@@ -508,6 +632,13 @@ static void symspi_xfer_init_empty(struct full_duplex_xfer *xfer);
 static int symspi_xfer_init_copy(struct full_duplex_xfer *target
 		, struct full_duplex_xfer *source);
 static void symspi_xfer_free(struct full_duplex_xfer *target);
+static int symspi_xfer_buffers_init(struct symspi_dev *symspi);
+static void symspi_xfer_buffers_close(struct symspi_dev *symspi);
+static int symspi_current_xfer_init(struct symspi_dev *symspi
+		, struct full_duplex_xfer *source);
+static void symspi_current_xfer_free(struct symspi_dev *symspi);
+static void symspi_xfer_buffer_rx_to_cpu(struct symspi_dev *symspi);
+static void symspi_xfer_buffer_rx_to_device(struct symspi_dev *symspi);
 static int symspi_verify_consumer_input(struct symspi_dev *symspi
 		, struct full_duplex_xfer *xfer, bool check_xfer);
 static int symspi_init_gpio_irqs(struct symspi_dev *symspi);
@@ -537,9 +668,9 @@ inline static bool symspi_switch_strict(void *symspi_dev_ptr
 		, char dst_state);
 inline static char symspi_switch_state_val_forced(void *symspi_dev_ptr
 		, char dst_state);
-static void symspi_do_xfer_work_wrapper(struct work_struct *work);
+static void symspi_do_xfer_work_wrapper(struct symspi_work_struct *work);
 static int symspi_do_xfer(struct symspi_dev *symspi);
-static void symspi_recovery_sequence_wrapper(struct work_struct *work);
+static void symspi_recovery_sequence_wrapper(struct symspi_work_struct *work);
 static int symspi_recovery_sequence(struct symspi_dev *symspi);
 static void symspi_wait_flag_silence_period(void);
 static void symspi_our_flag_set(struct symspi_dev *symspi);
@@ -549,7 +680,7 @@ static int symspi_try_leave_waiting_prev_sequence(struct symspi_dev *symspi);
 static int symspi_try_leave_waiting_rdy_sequence( struct symspi_dev *symspi);
 static inline int symspi_get_next_xfer_id(struct symspi_dev *symspi);
 static void symspi_inc_current_xfer_counter(struct symspi_dev *symspi);
-static void symspi_postprocessing_sequence(struct work_struct *work);
+static void symspi_postprocessing_sequence(struct symspi_work_struct *work);
 static int symspi_try_to_error_sequence(struct symspi_dev *symspi
 					, int internal_error);
 static int symspi_to_idle_sequence(struct symspi_dev *symspi
@@ -562,6 +693,14 @@ static inline int __symspi_info_init(struct symspi_dev *symspi);
 static void __symspi_info_close(struct symspi_dev *symspi);
 static ssize_t __symspi_info_read(struct file *file
 		, char __user *ubuf, size_t count, loff_t *ppos);
+#if SYMSPI_WQ_MODE_MATCH(RT_KTHREAD)
+static int __symspi_worker_ctl_init(struct symspi_dev *symspi);
+static void __symspi_worker_ctl_close(struct symspi_dev *symspi);
+static ssize_t __symspi_worker_read(struct file *file
+		, char __user *ubuf, size_t count, loff_t *ppos);
+static ssize_t __symspi_worker_write(struct file *file
+		, const char __user *ubuf, size_t count, loff_t *ppos);
+#endif
 static void symspi_spi_xfer_done_callback(void *context);
 static irqreturn_t symspi_their_flag_isr(int irq, void *symspi_device);
 static void symspi_their_flag_drop_isr_sequence(struct symspi_dev *symspi);
@@ -597,7 +736,8 @@ static const char SYMSPI_ERROR_S_IRQ_ACQUISITION[] = "";
 static const char SYMSPI_ERROR_S_ISR_SETUP[] = "";
 static const char SYMSPI_ERROR_S_WAIT_OTHER_SIDE[]
 		= "Timeout waiting for other side reaction.";
-#if SYMSPI_WQ_MODE_MATCH(PRIVATE)
+static const char SYMSPI_ERROR_S_XFER_SIZE_TOO_BIG[] = "";
+#if SYMSPI_WQ_MODE_MATCH(PRIVATE) || SYMSPI_WQ_MODE_MATCH(RT_KTHREAD)
 static const char SYMSPI_ERROR_S_WORKQUEUE_INIT[]
 		= "Failed to create own workqueue.";
 #endif
@@ -639,6 +779,23 @@ struct symspi_error_rec {
 	unsigned int err_per_sec_threshold;
 };
 
+// The log2 histogram of the frame phase durations.
+//
+// @count the number of durations within the bucket, the bucket i
+//      counts the durations within [2^i; 2^(i+1)) usec (see
+//      SYMSPI_TIMING_HIST_BUCKETS).
+// @samples total number of durations recorded
+// @sum_usec sum of all recorded durations in usec
+// @min_usec the minimal recorded duration in usec
+// @max_usec the maximal recorded duration in usec
+struct symspi_timing_hist {
+	unsigned long long count[SYMSPI_TIMING_HIST_BUCKETS];
+	unsigned long long samples;
+	unsigned long long sum_usec;
+	unsigned long long min_usec;
+	unsigned long long max_usec;
+};
+
 // Tracks SymSPI statistics.
 // NOTE: due to performance reasons we can not introduce
 // 		any locking on the statistics, thus values are expected
@@ -649,11 +806,44 @@ struct symspi_error_rec {
 // @xfers_done_ok how many raw SPI xfers were successfully finished
 // @their_flag_edges how many edges of the other side flag was
 //  	detected since startup
+// @fast_recoveries how many errors were recovered with the fast
+//      resync (see SYMSPI_ERROR_FAST_RECOVERY)
+// @full_recoveries how many errors were recovered with the full
+//      error indication and silence period
+// @flag_wait durations from our flag raise till their flag raise
+// @spi_xfer durations from spi_async(...) submission till the
+//      xfer done callback
+// @postprocessing durations from the xfer done callback till the
+//      end of the xfer postprocessing
+// @idle_gap durations from the end of the xfer postprocessing till
+//      the next spi_async(...) submission
 struct symspi_info {
 	unsigned long long other_side_indicated_errors;
 	unsigned long long other_side_no_reaction_errors;
 	unsigned long long xfers_done_ok;
 	unsigned long long their_flag_edges;
+	unsigned long long fast_recoveries;
+	unsigned long long full_recoveries;
+	struct symspi_timing_hist flag_wait;
+	struct symspi_timing_hist spi_xfer;
+	struct symspi_timing_hist postprocessing;
+	struct symspi_timing_hist idle_gap;
+};
+
+// Preallocated xfer data buffers pair. The current xfer data always
+// points to one of these pairs.
+//
+// @data_tx the TX buffer of SYMSPI_XFER_SIZE_MAX_BYTES size
+// @data_rx_buf the RX buffer of SYMSPI_XFER_SIZE_MAX_BYTES size
+// @tx_dma the DMA address of @data_tx, valid only if the buffers
+//      were premapped (see @dma_premapped of symspi_dev_private)
+// @rx_dma the DMA address of @data_rx_buf, valid only if the
+//      buffers were premapped
+struct symspi_xfer_buffer {
+	void *data_tx;
+	void *data_rx_buf;
+	dma_addr_t tx_dma;
+	dma_addr_t rx_dma;
 };
 
 // Opaque struct which is allocated and managed by SymSPI internally.
@@ -664,10 +854,25 @@ struct symspi_info {
 // @symspi keeps pointer to the wrapping symspi device structure
 //      (inited by SymSPI at creation time)
 // @current_xfer The data to work with upon next entering
-//      SYMSPI_STATE_XFER_PREPARE state.
+//      SYMSPI_STATE_XFER_PREPARE state. Its data buffers always
+//      point to the @xfer_buffers[@xfer_buffer_idx] pair.
+//      OWNERSHIP: our module
+// @xfer_buffers the preallocated xfer data buffers, the current
+//      xfer alternates between them, so the xfer update is a copy
+//      into the idle pair and index switch, without reallocation
+//      and remapping.
 //      OWNERSHIP: our module
-// @spi_xfer the underlying SPI device xfer data.
+// @xfer_buffer_idx the index of the buffers pair currently used
+//      by @current_xfer.
+// @dma_premapped true, when @xfer_buffers are mapped for SPI
+//      controller DMA by us (then @spi_msg is marked as DMA mapped).
+// @dma_tx_dev the device the TX buffers are mapped for.
+// @dma_rx_dev the device the RX buffers are mapped for.
+// @spi_xfers the underlying SPI device transfers, one per current
+//      xfer segment, all chained into @spi_msg, so the whole xfer
+//      goes within a single SPI message (single handshake).
 //      OWNERSHIP: our module
+// @spi_xfers_count the number of @spi_xfers used by current xfer.
 // @spi_msg the underlying SPI device message data.
 //      OWNERSHIP: our module
 // @next_xfer_id keeps the next xfer id.
@@ -679,6 +884,15 @@ struct symspi_info {
 //      by other running/pending tasks. So to stay on a safe side we
 //      will allocate our own single-threaded workqueue for our purposes.
 //      NOTE: used only when SYMSPI_WORKQUEUE_MODE equals SYMSPI_WQ_PRIVATE
+// @worker the SymSPI dedicated SCHED_FIFO kthread worker to handle
+//      communication jobs.
+//      NOTE: used only when SYMSPI_WORKQUEUE_MODE equals
+//          SYMSPI_WQ_RT_KTHREAD
+// @worker_ctl_lock serializes the changes of the @worker scheduling
+//      parameters.
+// @worker_priority the current SCHED_FIFO priority of the @worker,
+//      0 means the normal scheduling policy.
+// @worker_cpus the CPUs the @worker is currently allowed to run on.
 // @xfer_work launches the xfer out of interrupt context.
 //      Not used for now, but this might be changed due to performance
 //      investigations.
@@ -726,10 +940,14 @@ struct symspi_info {
 //      the close_request is already issued, this completion
 //      indicates that the device is ready to be closed (triggered
 //      only once)
+// @fast_recovery_unconfirmed is set to true by the fast error
+//      recovery and is dropped by the first successful xfer after it,
+//      if the next error comes while it is still set, the fast
+//      recovery didn't help, so the full recovery is to be used.
 // @last_error keeps the last error code (positive), keeps its
 //      value while recovery is not completed.
-// @wait_timeout_timer the other side wait timeout timer,
-//      it is enabled every time when we start waiting for the
+// @wait_timeout_timer the other side wait timeout (high resolution)
+//      timer, it is enabled every time when we start waiting for the
 //      other side action, and is disabled every time we finish
 //      the waiting.
 // @magic {always SYMSPI_PRIVATE_MAGIC after struct was initialized}
@@ -749,6 +967,11 @@ struct symspi_info {
 //      info to user space.
 // @info_ops defines info file operations to call upon request
 //      from user space
+// @worker_file the file in proc fs which allows user space to read
+//      and set the kthread worker priority and CPU affinity.
+//      NOTE: used only in SYMSPI_WQ_RT_KTHREAD mode
+// @worker_ops defines worker file operations to call upon request
+//      from user space
 // @info tracks representation of current status of SymSPI
 //      from performance POV (error statistics, data statistics)
 //      and also its configuration.
@@ -760,16 +983,28 @@ struct symspi_dev_private {
 	int next_xfer_id;
 	struct full_duplex_xfer current_xfer;
 
-	struct spi_transfer spi_xfer;
+	struct symspi_xfer_buffer xfer_buffers[SYMSPI_XFER_BUFFERS_COUNT];
+	int xfer_buffer_idx;
+	bool dma_premapped;
+	struct device *dma_tx_dev;
+	struct device *dma_rx_dev;
+
+	struct spi_transfer spi_xfers[SYMSPI_XFER_SEGMENTS_MAX];
+	int spi_xfers_count;
 	struct spi_message spi_msg;
 
 #if SYMSPI_WQ_MODE_MATCH(PRIVATE)
 	struct workqueue_struct *work_queue;
+#elif SYMSPI_WQ_MODE_MATCH(RT_KTHREAD)
+	struct kthread_worker *worker;
+	struct mutex worker_ctl_lock;
+	int worker_priority;
+	struct cpumask worker_cpus;
 #endif
 
-	struct work_struct xfer_work;
-	struct work_struct postprocessing_work;
-	struct work_struct recover_work;
+	struct symspi_work_struct xfer_work;
+	struct symspi_work_struct postprocessing_work;
+	struct symspi_work_struct recover_work;
 
 	atomic_t state;
 
@@ -784,13 +1019,21 @@ struct symspi_dev_private {
 	atomic_t delayed_xfer_request;
 	atomic_t close_request;
 #if SYMSPI_USE_SLAVEMODE_TX_FIFOFILL_TIMEOUTTIMER
-	struct timer_list slave_tx_fill_timeout_timer;
+	struct hrtimer slave_tx_fill_timeout_timer;
 #endif
 	struct completion final_leave_xfer_completion;
 
+	bool fast_recovery_unconfirmed;
 	int last_error;
 
-	struct timer_list wait_timeout_timer;
+	// frame phases start timestamps (ns), 0 means the phase is not
+	// being measured, see struct symspi_info
+	s64 our_flag_set_ns;
+	s64 spi_submit_ns;
+	s64 spi_done_ns;
+	s64 idle_start_ns;
+
+	struct hrtimer wait_timeout_timer;
 
 	unsigned int magic;
 
@@ -801,6 +1044,10 @@ struct symspi_dev_private {
 	struct proc_dir_entry *proc_root;
 	struct proc_dir_entry *info_file;
 	struct file_operations info_ops;
+#if SYMSPI_WQ_MODE_MATCH(RT_KTHREAD)
+	struct proc_dir_entry *worker_file;
+	struct file_operations worker_ops;
+#endif
 
 	struct symspi_info info;
 };
@@ -1026,21 +1273,26 @@ int symspi_init(void __kernel *device
 	atomic_set(&symspi->p->close_request,true);
 	symspi->p->symspi = symspi;
 	symspi->p->last_error = SYMSPI_SUCCESS;
+	symspi->p->fast_recovery_unconfirmed = false;
 
 	symspi->p->next_xfer_id = SYMSPI_INITIAL_XFER_ID;
 
 	__symspi_error_report_init(symspi);
 
 	// timeout timer
-	setup_timer(&symspi->p->wait_timeout_timer,
-		    __symspi_other_side_wait_timeout, (unsigned long)symspi);
+	hrtimer_init(&symspi->p->wait_timeout_timer, CLOCK_MONOTONIC
+		     , HRTIMER_MODE_REL);
+	symspi->p->wait_timeout_timer.function
+		= &__symspi_other_side_wait_timeout;
 
 #if SYMSPI_USE_SLAVEMODE_TX_FIFOFILL_TIMEOUTTIMER
-	setup_timer(&symspi->p->slave_tx_fill_timeout_timer,
-		    __symspi_slave_tx_fill_timeout, (unsigned long)symspi);
+	hrtimer_init(&symspi->p->slave_tx_fill_timeout_timer
+		     , CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	symspi->p->slave_tx_fill_timeout_timer.function
+		= &__symspi_slave_tx_fill_timeout;
 #endif
 
-	res = symspi_xfer_init_copy(&symspi->p->current_xfer, default_xfer);
+	res = symspi_current_xfer_init(symspi, default_xfer);
 	if (res < 0) {
 		symspi_err("Failed to init new xfer, error: %d. Abort!", -res);
 		symspi_close((void*)symspi);
@@ -1059,14 +1311,12 @@ int symspi_init(void __kernel *device
 	// next xfer are in general case defined by data from previous
 	// xfer).
 
-	// init spi xfer
-	memset(&symspi->p->spi_xfer, 0, sizeof(struct spi_transfer));
-	symspi_do_update_native_spi_xfer_data(symspi);
-
-	// init spi message
+	// init spi message and its xfers
 	spi_message_init(&symspi->p->spi_msg);
-	spi_message_add_tail(&symspi->p->spi_xfer, &symspi->p->spi_msg);
+	symspi_do_update_native_spi_xfer_data(symspi);
 	symspi->p->spi_msg.spi = symspi->spi;
+	// premapped buffers are synced by us explicitly
+	symspi->p->spi_msg.is_dma_mapped = symspi->p->dma_premapped;
 	// We will call consumer callback indirectly (through the
 	// work queue) from our.
 	symspi->p->spi_msg.complete = &symspi_spi_xfer_done_callback;
@@ -1087,9 +1337,9 @@ int symspi_init(void __kernel *device
 		return -SYMSPI_ERROR_WORKQUEUE_INIT;
 	}
 	// works init
-	INIT_WORK(&symspi->p->xfer_work, symspi_do_xfer_work_wrapper);
-	INIT_WORK(&symspi->p->postprocessing_work, symspi_postprocessing_sequence);
-	INIT_WORK(&symspi->p->recover_work, symspi_recovery_sequence_wrapper);
+	SYMSPI_INIT_WORK(&symspi->p->xfer_work, symspi_do_xfer_work_wrapper);
+	SYMSPI_INIT_WORK(&symspi->p->postprocessing_work, symspi_postprocessing_sequence);
+	SYMSPI_INIT_WORK(&symspi->p->recover_work, symspi_recovery_sequence_wrapper);
 	__SYMSPI_INIT_LEVEL(WORKQUEUE_INIT);
 
 	// still cold for now
@@ -1123,6 +1373,9 @@ int symspi_init(void __kernel *device
 
 	__symspi_procfs_init(symspi);
 	__symspi_info_init(symspi);
+#if SYMSPI_WQ_MODE_MATCH(RT_KTHREAD)
+	__symspi_worker_ctl_init(symspi);
+#endif
 
 	// Make it run. Starting from that point
 	// we go to normal workflow.
@@ -1197,6 +1450,9 @@ int symspi_close(void __kernel *device)
 	}
 
 full:
+#if SYMSPI_WQ_MODE_MATCH(RT_KTHREAD)
+	__symspi_worker_ctl_close(symspi);
+#endif
 	__symspi_info_close(symspi);
 	__symspi_procfs_close(symspi);
 
@@ -1248,6 +1504,9 @@ gpio_irqs:
 
 	// close waiting timer
 	__symspi_stop_timeout_timer_sync(symspi);
+#if SYMSPI_USE_SLAVEMODE_TX_FIFOFILL_TIMEOUTTIMER
+	hrtimer_cancel(&symspi->p->slave_tx_fill_timeout_timer);
+#endif
 
 	// No one can leave this state except init(), which should
 	// not be called by contract
@@ -1285,8 +1544,9 @@ xfer_created:
 
 	// spi xfer and symspi xfer point on the same data,
 	// so we free only once
-	symspi_xfer_free(&symspi->p->current_xfer);
-	symspi_do_update_native_spi_xfer_data(symspi);
+	symspi_current_xfer_free(symspi);
+	memset(symspi->p->spi_xfers, 0, sizeof(symspi->p->spi_xfers));
+	symspi->p->spi_xfers_count = 0;
 
 	__SYMSPI_INIT_LEVEL(PRIVATE_ALLOCATED);
 
@@ -1335,6 +1595,7 @@ int symspi_reset(void __kernel *device
 {
 	struct symspi_dev *symspi = (struct symspi_dev *)device;
 	struct full_duplex_xfer tmp_xfer;
+	bool tmp_xfer_used = false;
 	if (symspi_is_current_xfer_ok(symspi) && !default_xfer) {
 		int res = symspi_xfer_init_copy(&tmp_xfer
 										, &symspi->p->current_xfer);
@@ -1344,18 +1605,26 @@ int symspi_reset(void __kernel *device
 			return res;
 		}
 		default_xfer = &tmp_xfer;
+		tmp_xfer_used = true;
 	}
 
 	int res;
 	res = symspi_verify_consumer_input(symspi, default_xfer, true);
 	if (res != SYMSPI_SUCCESS) {
 		symspi_err("Incorrect input. Abort.");
-		return res;
+		goto out;
 	}
 
 	symspi_close((void*)symspi);
 
-	return symspi_init((void*)symspi, default_xfer);
+	res = symspi_init((void*)symspi, default_xfer);
+
+out:
+	if (tmp_xfer_used) {
+		symspi_xfer_free(&tmp_xfer);
+	}
+
+	return res;
 }
 
 const struct full_duplex_sym_iface symspi_full_duplex_iface = {
@@ -1380,6 +1649,91 @@ const struct full_duplex_sym_iface *symspi_iface(void)
 	return &symspi_full_duplex_iface;
 }
 
+/* --------------------- FRAME TIMINGS SECTION --------------------------*/
+
+// Helper. Adds the duration to the timing histogram.
+//
+// @hist {valid ptr}
+// @duration_ns the duration in nsec
+//
+// CONTEXT:
+//      any
+static void __symspi_timing_hist_add(struct symspi_timing_hist *hist
+				     , const s64 duration_ns)
+{
+	const u64 usec = duration_ns > 0
+			 ? div_u64((u64)duration_ns, NSEC_PER_USEC) : 0;
+	int bucket = usec ? fls64(usec) - 1 : 0;
+
+	if (bucket >= SYMSPI_TIMING_HIST_BUCKETS) {
+		bucket = SYMSPI_TIMING_HIST_BUCKETS - 1;
+	}
+	hist->count[bucket]++;
+
+	if (hist->samples == 0 || usec < hist->min_usec) {
+		hist->min_usec = usec;
+	}
+	if (usec > hist->max_usec) {
+		hist->max_usec = usec;
+	}
+	hist->sum_usec += usec;
+	hist->samples++;
+}
+
+// Helper. Finishes the frame phase measurement: if the phase was
+// started (@start_ns points to non-zero timestamp), adds the phase
+// duration to the histogram and resets the phase start timestamp.
+//
+// @hist {valid ptr}
+// @start_ns {valid ptr} the phase start timestamp
+// @now_ns the current timestamp
+//
+// CONTEXT:
+//      any
+static inline void __symspi_timing_phase_end(
+		struct symspi_timing_hist *hist
+		, s64 *start_ns, const s64 now_ns)
+{
+	if (*start_ns == 0) {
+		return;
+	}
+	__symspi_timing_hist_add(hist, now_ns - *start_ns);
+	*start_ns = 0;
+}
+
+// Helper. Prints the timing histogram summary line and its buckets
+// counters line into the buffer.
+//
+// @name {valid ptr} the histogram name
+// @hist {valid ptr}
+// @buf {valid ptr} the buffer to print to
+// @size the buffer size in bytes
+//
+// RETURNS:
+//      the number of bytes printed (like snprintf, so might be
+//      greater than @size if the output was truncated)
+static size_t __symspi_timing_hist_print(const char *name
+		, const struct symspi_timing_hist *hist
+		, char *buf, const size_t size)
+{
+	const unsigned long long avg_usec = hist->samples
+			     ? div64_u64(hist->sum_usec, hist->samples) : 0;
+	size_t len = (size_t)snprintf(buf, size
+			, "%s: min %llu, avg %llu, max %llu, samples %llu\n"
+			  "  buckets:"
+			, name, hist->min_usec, avg_usec, hist->max_usec
+			, hist->samples);
+
+	for (int i = 0; i < SYMSPI_TIMING_HIST_BUCKETS && len < size; i++) {
+		len += (size_t)snprintf(buf + len, size - len, " %llu"
+					, hist->count[i]);
+	}
+	if (len < size) {
+		len += (size_t)snprintf(buf + len, size - len, "\n");
+	}
+	return len;
+}
+
 /* ------------------------- MAIN SECTION -------------------------------*/
 
 // Helper.
@@ -1409,7 +1763,8 @@ static void __symspi_error_report_init(struct symspi_dev *symspi)
 	SYMSPI_ERR_REC(11, IRQ_ACQUISITION, 0);
 	SYMSPI_ERR_REC(12, ISR_SETUP, 0);
 	SYMSPI_ERR_REC(13, WAIT_OTHER_SIDE, 5);
-#if SYMSPI_WQ_MODE_MATCH(PRIVATE)
+	SYMSPI_ERR_REC(15, XFER_SIZE_TOO_BIG, 0);
+#if SYMSPI_WQ_MODE_MATCH(PRIVATE) || SYMSPI_WQ_MODE_MATCH(RT_KTHREAD)
 	SYMSPI_ERR_REC(14, WORKQUEUE_INIT, 0);
 #endif
 
@@ -1694,25 +2049,13 @@ static void __symspi_error_handle_(struct symspi_dev *symspi
 //      any
 static inline void __symspi_restart_timeout_timer(struct symspi_dev *symspi)
 {
-	const unsigned long expiration_time_jf
-		= jiffies + msecs_to_jiffies(their_flag_wait_timeout);
-	mod_timer(&symspi->p->wait_timeout_timer, expiration_time_jf);
-	symspi_trace(
-		    "timer set: in %d ms, in %lu jiffies"
-		    " (at %lu jiffies), timer: %px, now: %lu jiffies"
-		    , their_flag_wait_timeout
-		    , expiration_time_jf >= jiffies ? (expiration_time_jf - jiffies) : 0
-		    , expiration_time_jf
-		    , &symspi->p->wait_timeout_timer
-		    , jiffies);
-	if (timer_pending(&symspi->p->wait_timeout_timer)) {
-		symspi_trace(
-			    "timer status: pending at %lu jiffies, now: %lu jiffies"
-			    , symspi->p->wait_timeout_timer.expires
-			    , jiffies);
-	} else {
-		symspi_trace("timer status: idle");
-	};
+	hrtimer_start(&symspi->p->wait_timeout_timer
+		      , ms_to_ktime(their_flag_wait_timeout)
+		      , HRTIMER_MODE_REL);
+	symspi_trace("timer set: in %d ms, timer: %px, now: %lld us"
+		     , their_flag_wait_timeout
+		     , &symspi->p->wait_timeout_timer
+		     , ktime_to_us(ktime_get()));
 }
 
 // Helper.
@@ -1722,7 +2065,7 @@ static inline void __symspi_restart_timeout_timer(struct symspi_dev *symspi)
 //      any
 static inline void __symspi_stop_timeout_timer(struct symspi_dev *symspi)
 {
-	del_timer(&symspi->p->wait_timeout_timer);
+	hrtimer_try_to_cancel(&symspi->p->wait_timeout_timer);
 	symspi_trace("Timer stop");
 }
 
@@ -1734,32 +2077,136 @@ static inline void __symspi_stop_timeout_timer(struct symspi_dev *symspi)
 //      sleepable
 static inline void __symspi_stop_timeout_timer_sync(struct symspi_dev *symspi)
 {
-	del_timer_sync(&symspi->p->wait_timeout_timer);
+	hrtimer_cancel(&symspi->p->wait_timeout_timer);
 	symspi_trace("Timer stop (sync)");
 }
 
 
 // Launches error recovery on timeout
-static void __symspi_other_side_wait_timeout(unsigned long data)
+//
+// CONTEXT:
+//      hrtimer callback (hard IRQ)
+static enum hrtimer_restart __symspi_other_side_wait_timeout(
+		struct hrtimer *timer)
 {
-	struct symspi_dev *symspi = (struct symspi_dev *)data;
+	struct symspi_dev_private *symspi_p = container_of(timer
+			, struct symspi_dev_private, wait_timeout_timer);
+	struct symspi_dev *symspi = symspi_p->symspi;
 
 	SYMSPI_CHECK_DEVICE_AND_PRIVATE("No device provided for recovery."
-					, return);
+					, return HRTIMER_NORESTART);
 	__symspi_error_handle(SYMSPI_ERROR_WAIT_OTHER_SIDE, 0);
+	return HRTIMER_NORESTART;
 }
 
 #if SYMSPI_USE_SLAVEMODE_TX_FIFOFILL_TIMEOUTTIMER
-static void __symspi_slave_tx_fill_timeout(unsigned long data)
+// Retriggers our flag if SPI TX FIFO was not filled in time
+// and rearms itself.
+//
+// CONTEXT:
+//      hrtimer callback (hard IRQ)
+static enum hrtimer_restart __symspi_slave_tx_fill_timeout(
+		struct hrtimer *timer)
 {
-	struct symspi_dev *symspi = (struct symspi_dev *)data;
+	struct symspi_dev_private *symspi_p = container_of(timer
+			, struct symspi_dev_private
+			, slave_tx_fill_timeout_timer);
+	struct symspi_dev *symspi = symspi_p->symspi;
 
 	SYMSPI_CHECK_DEVICE_AND_PRIVATE("No device provided for recovery."
-					, return);
+					, return HRTIMER_NORESTART);
 	symspi_our_flag_drop(symspi);
 	udelay(10);
 	symspi_our_flag_set(symspi);
-	mod_timer(&symspi->p->slave_tx_fill_timeout_timer, jiffies + msecs_to_jiffies(SYMSPI_USE_SLAVEMODE_TX_FIFOFILL_TIMEOUT_MS));
+	hrtimer_forward_now(timer
+		, ms_to_ktime(SYMSPI_USE_SLAVEMODE_TX_FIFOFILL_TIMEOUT_MS));
+	return HRTIMER_RESTART;
+}
+#endif
+
+#if SYMSPI_WQ_MODE_MATCH(RT_KTHREAD)
+// Helper.
+// Switches the @task to the SCHED_FIFO policy with the @priority, or
+// to the normal policy if the @priority is 0.
+//
+// NOTE: since Linux 5.9 the modules can not pick the RT priority
+//      directly, so there the @priority is mapped to the closest
+//      level the kernel provides: [MAX_RT_PRIO / 2; MAX_RT_PRIO - 1]
+//      to sched_set_fifo() and [1; MAX_RT_PRIO / 2 - 1] to
+//      sched_set_fifo_low(), so the relative order of the workers
+//      is kept.
+//
+// RETURNS:
+//      >= 0: the priority actually applied, on success
+//      < 0: negated error code, on failure
+static int __symspi_worker_set_policy(struct task_struct *task
+		, const int priority)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 9, 0)
+	if (priority == 0) {
+		sched_set_normal(task, 0);
+		return 0;
+	}
+	if (priority >= MAX_RT_PRIO / 2) {
+		sched_set_fifo(task);
+		return MAX_RT_PRIO / 2;
+	}
+	sched_set_fifo_low(task);
+	return 1;
+#else
+	const struct sched_param param = {
+		.sched_priority = priority
+	};
+
+	int res = sched_setscheduler(task
+			, priority ? SCHED_FIFO : SCHED_NORMAL, &param);
+	return res < 0 ? res : priority;
+#endif
+}
+
+// Helper.
+// Applies the scheduling policy and the CPU affinity to the SymSPI
+// kthread worker and keeps the applied values on success, the
+// worker is left as it was on failure.
+//
+// @symspi the SymSPI device with the running kthread worker
+// @priority the SCHED_FIFO priority, [1; MAX_RT_PRIO - 1],
+//      or 0 to run the worker with normal policy.
+// @cpus the CPUs the worker is allowed to run on, should contain
+//      at least one online CPU.
+//
+// RETURNS:
+//      0: on success
+//      < 0: negated error code, on failure
+//
+// LOCKING: @symspi->p->worker_ctl_lock should be held by caller.
+static int __symspi_worker_apply(const struct symspi_dev *const symspi
+		, const int priority, const struct cpumask *const cpus)
+{
+	if (priority < 0 || priority >= MAX_RT_PRIO) {
+		return -EINVAL;
+	}
+
+	struct task_struct *task = symspi->p->worker->task;
+
+	// the affinity goes first: it is the one which can be rolled
+	// back, so the failed call leaves the worker as it was
+	int res = set_cpus_allowed_ptr(task, cpus);
+	if (res < 0) {
+		return res;
+	}
+
+	res = __symspi_worker_set_policy(task, priority);
+	if (res < 0) {
+		set_cpus_allowed_ptr(task, &symspi->p->worker_cpus);
+		return res;
+	}
+	symspi->p->worker_priority = res;
+	if (&symspi->p->worker_cpus != cpus) {
+		cpumask_copy(&symspi->p->worker_cpus, cpus);
+	}
+
+	return 0;
 }
 #endif
 
@@ -1796,6 +2243,49 @@ static inline int __symspi_init_workqueue(
 				   , __func__);
 		return -SYMSPI_ERROR_WORKQUEUE_INIT;
 	}
+#elif SYMSPI_WQ_MODE_MATCH(RT_KTHREAD)
+	symspi_info(SYMSPI_LOG_INFO_KEY_LEVEL, "using RT kthread worker");
+	symspi->p->worker = kthread_create_worker(0, "symspi");
+
+	if (IS_ERR(symspi->p->worker)) {
+		symspi_err("%s: the kthread worker init failed: %ld."
+			   , __func__, PTR_ERR(symspi->p->worker));
+		symspi->p->worker = NULL;
+		return -SYMSPI_ERROR_WORKQUEUE_INIT;
+	}
+
+	mutex_init(&symspi->p->worker_ctl_lock);
+	symspi->p->worker_priority = 0;
+	cpumask_copy(&symspi->p->worker_cpus, cpu_possible_mask);
+
+	cpumask_var_t cpus;
+	if (!alloc_cpumask_var(&cpus, GFP_KERNEL)) {
+		symspi_warning("%s: no memory for the worker CPU list, using"
+			       " normal policy on all CPUs", __func__);
+		return SYMSPI_SUCCESS;
+	}
+	cpumask_copy(cpus, cpu_possible_mask);
+	if (worker_cpus && worker_cpus[0] != '\0'
+			&& cpulist_parse(worker_cpus, cpus) < 0) {
+		symspi_warning("%s: could not parse the worker CPU list"
+			       " \"%s\", using all CPUs"
+			       , __func__, worker_cpus);
+		cpumask_copy(cpus, cpu_possible_mask);
+	}
+
+	// the failed apply leaves the worker as it was created: normal
+	// policy on all CPUs
+	mutex_lock(&symspi->p->worker_ctl_lock);
+	int res = __symspi_worker_apply(symspi, worker_priority, cpus);
+	if (res < 0) {
+		symspi_warning("%s: could not apply priority %d and CPUs"
+			       " \"%s\" to kthread worker: %d, using"
+			       " normal policy on all CPUs", __func__
+			       , worker_priority, worker_cpus, res);
+	}
+	mutex_unlock(&symspi->p->worker_ctl_lock);
+	free_cpumask_var(cpus);
+	return SYMSPI_SUCCESS;
 #endif
 }
 
@@ -1809,6 +2299,9 @@ static inline void __symspi_close_workqueue(
 #if SYMSPI_WQ_MODE_MATCH(PRIVATE)
 	destroy_workqueue(symspi->p->work_queue);
 	symspi->p->work_queue = NULL;
+#elif SYMSPI_WQ_MODE_MATCH(RT_KTHREAD)
+	kthread_destroy_worker(symspi->p->worker);
+	symspi->p->worker = NULL;
 #else
 	(void)symspi;
 #endif
@@ -1820,7 +2313,7 @@ static inline void __symspi_close_workqueue(
 // Schedules SymSPI work to the target queue.
 static inline void __symspi_schedule_work(
 		const struct symspi_dev *const symspi
-		, struct work_struct *work)
+		, struct symspi_work_struct *work)
 {
 #if SYMSPI_WQ_MODE_MATCH(SYSTEM)
 	(void)symspi;
@@ -1830,6 +2323,8 @@ static inline void __symspi_schedule_work(
 	queue_work(system_highpri_wq, work);
 #elif SYMSPI_WQ_MODE_MATCH(PRIVATE)
 	queue_work(symspi->p->work_queue, work);
+#elif SYMSPI_WQ_MODE_MATCH(RT_KTHREAD)
+	kthread_queue_work(symspi->p->worker, work);
 #else
 #error no known SymSPI work queue mode defined
 #endif
@@ -1840,9 +2335,13 @@ static inline void __symspi_schedule_work(
 // need some custom queue operations on cancelling.
 static inline void __symspi_cancel_work_sync(
 		const struct symspi_dev *const symspi
-		, struct work_struct *work)
+		, struct symspi_work_struct *work)
 {
+#if SYMSPI_WQ_MODE_MATCH(RT_KTHREAD)
+	kthread_cancel_work_sync(work);
+#else
 	cancel_work_sync(work);
+#endif
 }
 
 // Helper.
@@ -1933,6 +2432,7 @@ static int symspi_xfer_init_copy(struct full_duplex_xfer *target
 		return -SYMSPI_ERROR_NO_MEMORY;
 	}
 	memcpy(target->data_tx, source->data_tx, source->size_bytes);
+	target->segment_size_bytes = source->segment_size_bytes;
 	target->done_callback = source->done_callback;
 	target->consumer_data = source->consumer_data;
 	return SYMSPI_SUCCESS;
@@ -1946,6 +2446,233 @@ static void symspi_xfer_free(struct full_duplex_xfer *target)
 	target->consumer_data = NULL;
 }
 
+// Helper function. Unmaps (if mapped) and frees all xfer buffers.
+// Safe to call on partially initialized buffers.
+static void symspi_xfer_buffers_close(struct symspi_dev *symspi)
+{
+	for (int i = 0; i < SYMSPI_XFER_BUFFERS_COUNT; i++) {
+		struct symspi_xfer_buffer *b = &symspi->p->xfer_buffers[i];
+
+		if (symspi->p->dma_premapped) {
+			dma_unmap_single(symspi->p->dma_tx_dev, b->tx_dma
+					 , SYMSPI_XFER_SIZE_MAX_BYTES
+					 , DMA_TO_DEVICE);
+			dma_unmap_single(symspi->p->dma_rx_dev, b->rx_dma
+					 , SYMSPI_XFER_SIZE_MAX_BYTES
+					 , DMA_FROM_DEVICE);
+		}
+		kfree(b->data_tx);
+		kfree(b->data_rx_buf);
+		memset(b, 0, sizeof(*b));
+	}
+	symspi->p->dma_premapped = false;
+	symspi->p->dma_tx_dev = NULL;
+	symspi->p->dma_rx_dev = NULL;
+}
+
+// Helper function. Maps all xfer buffers for the SPI controller
+// DMA, using the same devices as SPI core itself would use.
+//
+// RETURNS:
+//      true: if all buffers were mapped
+//      false: else (no buffers are left mapped then)
+static bool symspi_xfer_buffers_dma_map(struct symspi_dev *symspi)
+{
+	struct spi_master *master = symspi->spi->master;
+
+	if (IS_ERR_OR_NULL(master)) {
+		return false;
+	}
+
+	struct device *tx_dev = master->dma_tx
+				? master->dma_tx->device->dev
+				: master->dev.parent;
+	struct device *rx_dev = master->dma_rx
+				? master->dma_rx->device->dev
+				: master->dev.parent;
+
+	if (!tx_dev || !rx_dev) {
+		return false;
+	}
+
+	int mapped = 0;
+
+	for (; mapped < SYMSPI_XFER_BUFFERS_COUNT; mapped++) {
+		struct symspi_xfer_buffer *b = &symspi->p->xfer_buffers[mapped];
+
+		b->tx_dma = dma_map_single(tx_dev, b->data_tx
+					   , SYMSPI_XFER_SIZE_MAX_BYTES
+					   , DMA_TO_DEVICE);
+		if (dma_mapping_error(tx_dev, b->tx_dma)) {
+			goto unmap;
+		}
+		b->rx_dma = dma_map_single(rx_dev, b->data_rx_buf
+					   , SYMSPI_XFER_SIZE_MAX_BYTES
+					   , DMA_FROM_DEVICE);
+		if (dma_mapping_error(rx_dev, b->rx_dma)) {
+			dma_unmap_single(tx_dev, b->tx_dma
+					 , SYMSPI_XFER_SIZE_MAX_BYTES
+					 , DMA_TO_DEVICE);
+			goto unmap;
+		}
+	}
+
+	symspi->p->dma_tx_dev = tx_dev;
+	symspi->p->dma_rx_dev = rx_dev;
+	return true;
+
+unmap:
+	while (--mapped >= 0) {
+		struct symspi_xfer_buffer *b = &symspi->p->xfer_buffers[mapped];
+
+		dma_unmap_single(tx_dev, b->tx_dma, SYMSPI_XFER_SIZE_MAX_BYTES
+				 , DMA_TO_DEVICE);
+		dma_unmap_single(rx_dev, b->rx_dma, SYMSPI_XFER_SIZE_MAX_BYTES
+				 , DMA_FROM_DEVICE);
+	}
+	return false;
+}
+
+// Helper function. Allocates the xfer buffers of max xfer size
+// and (if configured) maps them for SPI controller DMA. This is
+// done once at init time, so no allocations/mappings are done
+// on the per-xfer path.
+//
+// RETURNS:
+//      SYMSPI_SUCCESS on success
+//      -SYMSPI_ERROR_NO_MEMORY if allocation fails
+static int symspi_xfer_buffers_init(struct symspi_dev *symspi)
+{
+	for (int i = 0; i < SYMSPI_XFER_BUFFERS_COUNT; i++) {
+		struct symspi_xfer_buffer *b = &symspi->p->xfer_buffers[i];
+
+		b->data_tx = kzalloc(SYMSPI_XFER_SIZE_MAX_BYTES, GFP_KERNEL);
+		b->data_rx_buf = kzalloc(SYMSPI_XFER_SIZE_MAX_BYTES
+					 , GFP_KERNEL);
+		if (!b->data_tx || !b->data_rx_buf) {
+			symspi_xfer_buffers_close(symspi);
+			return -SYMSPI_ERROR_NO_MEMORY;
+		}
+	}
+	symspi->p->xfer_buffer_idx = 0;
+	symspi->p->dma_premapped = false;
+
+#if SYMSPI_XFER_BUFFERS_DMA_PREMAP
+	symspi->p->dma_premapped = symspi_xfer_buffers_dma_map(symspi);
+	if (!symspi->p->dma_premapped) {
+		symspi_warning("could not premap xfer buffers for DMA,"
+			       " will rely on SPI core mapping.");
+	}
+#endif
+
+	return SYMSPI_SUCCESS;
+}
+
+// Helper function. Copies the TX data of @source into the idle
+// xfer buffers pair and switches the current xfer to that pair.
+// The buffers pair of the previous xfer is left intact.
+//
+// @size_bytes {0 < size_bytes <= SYMSPI_XFER_SIZE_MAX_BYTES}
+//      new current xfer size
+static void symspi_current_xfer_switch_buffers(struct symspi_dev *symspi
+		, const void *data_tx, const size_t size_bytes)
+{
+	const int idx = (symspi->p->xfer_buffer_idx + 1)
+			% SYMSPI_XFER_BUFFERS_COUNT;
+	struct symspi_xfer_buffer *b = &symspi->p->xfer_buffers[idx];
+	struct full_duplex_xfer *curr_xfer = &symspi->p->current_xfer;
+
+	if (symspi->p->dma_premapped) {
+		dma_sync_single_for_cpu(symspi->p->dma_tx_dev, b->tx_dma
+					, size_bytes, DMA_TO_DEVICE);
+	}
+	memcpy(b->data_tx, data_tx, size_bytes);
+	if (symspi->p->dma_premapped) {
+		dma_sync_single_for_device(symspi->p->dma_tx_dev, b->tx_dma
+					   , size_bytes, DMA_TO_DEVICE);
+	}
+
+	symspi->p->xfer_buffer_idx = idx;
+	curr_xfer->data_tx = b->data_tx;
+	curr_xfer->data_rx_buf = b->data_rx_buf;
+	curr_xfer->size_bytes = size_bytes;
+}
+
+// Helper function. Gives the RX buffer of current xfer to CPU,
+// to be called when SPI xfer is done and before RX data is read.
+static void symspi_xfer_buffer_rx_to_cpu(struct symspi_dev *symspi)
+{
+	if (!symspi->p->dma_premapped) {
+		return;
+	}
+	const struct symspi_xfer_buffer *b
+		= &symspi->p->xfer_buffers[symspi->p->xfer_buffer_idx];
+	dma_sync_single_for_cpu(symspi->p->dma_rx_dev, b->rx_dma
+				, symspi->p->current_xfer.size_bytes
+				, DMA_FROM_DEVICE);
+}
+
+// Helper function. Gives the RX buffer of current xfer to
+// device, to be called right before the SPI xfer is started.
+static void symspi_xfer_buffer_rx_to_device(struct symspi_dev *symspi)
+{
+	if (!symspi->p->dma_premapped) {
+		return;
+	}
+	const struct symspi_xfer_buffer *b
+		= &symspi->p->xfer_buffers[symspi->p->xfer_buffer_idx];
+	dma_sync_single_for_device(symspi->p->dma_rx_dev, b->rx_dma
+				   , symspi->p->current_xfer.size_bytes
+				   , DMA_FROM_DEVICE);
+}
+
+// Helper function. Allocates the xfer buffers and initializes
+// the current xfer with a copy of @source xfer.
+//
+// @source {valid, not empty xfer}
+//
+// RETURNS:
+//      SYMSPI_SUCCESS on success
+//      <0 negated error code
+static int symspi_current_xfer_init(struct symspi_dev *symspi
+		, struct full_duplex_xfer *source)
+{
+#ifdef SYMSPI_DEBUG
+	if (!source || source->size_bytes == 0 || source->data_tx == NULL) {
+		symspi_err("source empty");
+		return -SYMSPI_ERROR_LOGICAL;
+	}
+#endif
+	if (source->size_bytes > SYMSPI_XFER_SIZE_MAX_BYTES) {
+		return -SYMSPI_ERROR_XFER_SIZE_TOO_BIG;
+	}
+
+	int res = symspi_xfer_buffers_init(symspi);
+	if (res != SYMSPI_SUCCESS) {
+		return res;
+	}
+
+	struct full_duplex_xfer *curr_xfer = &symspi->p->current_xfer;
+
+	symspi_xfer_init_empty(curr_xfer);
+	// xfer_buffer_idx is 0, so the switch lands on the next pair
+	symspi_current_xfer_switch_buffers(symspi, source->data_tx
+					   , source->size_bytes);
+	curr_xfer->segment_size_bytes = source->segment_size_bytes;
+	curr_xfer->done_callback = source->done_callback;
+	curr_xfer->fail_callback = source->fail_callback;
+	curr_xfer->consumer_data = source->consumer_data;
+	return SYMSPI_SUCCESS;
+}
+
+// Helper function. Releases the current xfer together with
+// all xfer buffers.
+static void symspi_current_xfer_free(struct symspi_dev *symspi)
+{
+	symspi_xfer_buffers_close(symspi);
+	symspi_xfer_init_empty(&symspi->p->current_xfer);
+}
+
 #ifdef SYMSPI_DEBUG
 static void symspi_xfer_printout(struct full_duplex_xfer *xfer)
 {
@@ -2037,6 +2764,12 @@ static int symspi_verify_consumer_input(struct symspi_dev *symspi
 		symspi_err("%s: Zero size default xfer.", __func__);
 		return -SYMSPI_ERROR_NO_XFER;
 	}
+	if (xfer->size_bytes > SYMSPI_XFER_SIZE_MAX_BYTES) {
+		symspi_err("%s: Default xfer size %zu exceeds max xfer"
+			   " size %d.", __func__, xfer->size_bytes
+			   , SYMSPI_XFER_SIZE_MAX_BYTES);
+		return -SYMSPI_ERROR_XFER_SIZE_TOO_BIG;
+	}
 	if (IS_ERR_OR_NULL(xfer->data_tx)) {
 		symspi_err("%s: Default xfer no TX data.", __func__);
 		return -SYMSPI_ERROR_NO_XFER;
@@ -2169,16 +2902,46 @@ static int symspi_xfer_prepare_to_waiting_prev_sequence(
 
 
 // Helper function. Updates underlying SPI layer transfer data
-// from our current xfer
+// from our current xfer: rebuilds the SPI message transfers list
+// with a transfer per current xfer segment.
+//
+// NOTE: the SPI message should not be in use by SPI layer.
 inline static void symspi_do_update_native_spi_xfer_data(
 		struct symspi_dev *symspi)
 {
-	struct spi_transfer *dst = &symspi->p->spi_xfer;
 	struct full_duplex_xfer *src = &symspi->p->current_xfer;
-
-	dst->tx_buf = src->data_tx;
-	dst->rx_buf = src->data_rx_buf;
-	dst->len = src->size_bytes;
+	size_t seg_size = src->size_bytes;
+	int count = 1;
+
+	if (src->segment_size_bytes > 0
+	    && src->size_bytes % src->segment_size_bytes == 0
+	    && src->size_bytes / src->segment_size_bytes
+	       <= SYMSPI_XFER_SEGMENTS_MAX) {
+		seg_size = src->segment_size_bytes;
+		count = (int)(src->size_bytes / seg_size);
+	}
+
+	const struct symspi_xfer_buffer *b
+		= &symspi->p->xfer_buffers[symspi->p->xfer_buffer_idx];
+
+	INIT_LIST_HEAD(&symspi->p->spi_msg.transfers);
+	for (int i = 0; i < count; i++) {
+		struct spi_transfer *dst = &symspi->p->spi_xfers[i];
+		const size_t offset = i * seg_size;
+
+		memset(dst, 0, sizeof(*dst));
+		dst->tx_buf = src->data_tx ? (u8 *)src->data_tx + offset : NULL;
+		dst->rx_buf = src->data_rx_buf
+			      ? (u8 *)src->data_rx_buf + offset : NULL;
+		dst->len = seg_size;
+		// NOTE: CS is kept active between the transfers
+		if (symspi->p->dma_premapped) {
+			dst->tx_dma = b->tx_dma + offset;
+			dst->rx_dma = b->rx_dma + offset;
+		}
+		spi_message_add_tail(dst, &symspi->p->spi_msg);
+	}
+	symspi->p->spi_xfers_count = count;
 }
 
 
@@ -2194,10 +2957,9 @@ inline static void symspi_do_update_native_spi_xfer_data(
 //      @new_size_bytes { >= 0 } new xfer data size in bytes
 //          (size of one buffer)
 //
-// TODO: to implement growing-only allocation mode for the xfer
-//          to reduce real allocations amount and increase speed.
-//          Other option might be just pointers switching to
-//          switch the current xfer.
+// NOTE: not used for the current xfer, which lives in the
+//          preallocated xfer buffers (see symspi_xfer_buffers_init),
+//          only for temporary consumer xfer copies.
 // TODO: move all xfer accociated methods to the full_duplex_interface
 //      and make them globally accessible
 static void symspi_do_resize_xfer(struct full_duplex_xfer *xfer
@@ -2295,6 +3057,7 @@ static inline bool regions_overlap(void *r_1, size_t size_1
 // ERRORS:
 //      SYMSPI_ERROR_XFER_SIZE_ZERO
 //      SYMSPI_ERROR_XFER_SIZE_MISMATCH
+//      SYMSPI_ERROR_XFER_SIZE_TOO_BIG
 //      SYMSPI_ERROR_NO_MEMORY
 //      SYMSPI_ERROR_OVERLAP
 //
@@ -2331,6 +3094,13 @@ inline static int symspi_replace_xfer(
 			   " Will not apply.", __func__);
 		return -SYMSPI_ERROR_XFER_SIZE_ZERO;
 	}
+	if (new_xfer->size_bytes > SYMSPI_XFER_SIZE_MAX_BYTES) {
+		symspi_err("%s: new xfer orders %zu bytes new size, while"
+			   " max is %d. Will not apply.", __func__
+			   , new_xfer->size_bytes
+			   , SYMSPI_XFER_SIZE_MAX_BYTES);
+		return -SYMSPI_ERROR_XFER_SIZE_TOO_BIG;
+	}
 	if (regions_overlap(curr_xfer->data_tx, curr_xfer->size_bytes
 			    , new_xfer->data_tx, new_xfer->size_bytes)) {
 		symspi_err("%s: new and current xfers TX datas overlap."
@@ -2355,19 +3125,17 @@ inline static int symspi_replace_xfer(
 			return -SYMSPI_ERROR_XFER_SIZE_MISMATCH;
 		}
 
-		symspi_do_resize_xfer(curr_xfer, new_xfer->size_bytes);
-
-		if (curr_xfer->size_bytes == 0) {
-			return -SYMSPI_ERROR_NO_MEMORY;
-		}
 	}
 
-	memcpy(curr_xfer->data_tx , new_xfer->data_tx
-	       , curr_xfer->size_bytes);
+	// NOTE: no reallocation here, the data goes into the idle
+	//      preallocated buffers pair, and the pairs are switched.
+	symspi_current_xfer_switch_buffers(symspi, new_xfer->data_tx
+					   , new_xfer->size_bytes);
 
 	// TODO: to make a bulk copy, to avoid naming members
 	//      (will avoid complications in debugging)
 	curr_xfer->id = new_xfer->id;
+	curr_xfer->segment_size_bytes = new_xfer->segment_size_bytes;
 	curr_xfer->done_callback = new_xfer->done_callback;
 	curr_xfer->fail_callback = new_xfer->fail_callback;
 	curr_xfer->consumer_data = new_xfer->consumer_data;
@@ -2484,6 +3252,7 @@ inline static bool symspi_switch_strict(void *symspi_dev_ptr,
 
 	bool res = (atomic_cmpxchg(state_ptr, expected_state, dst_state) == expected_state);
 	if (res) {
+		trace_symspi_state(expected_state, dst_state);
 		symspi_trace_raw(
 				"Switched from %d to %d", (int)expected_state
 				, (int)dst_state);
@@ -2510,13 +3279,15 @@ inline static char symspi_switch_state_val_forced(void *symspi_dev_ptr
 	symspi_info(SYMSPI_LOG_INFO_DBG_LEVEL
 		    , "Forced switching to %d.", (int)dst_state);
 	atomic_t *state_ptr = symspi_get_state_ptr(symspi_dev_ptr);
-	return atomic_xchg(state_ptr, dst_state);
+	const char old_state = atomic_xchg(state_ptr, dst_state);
+	trace_symspi_state(old_state, dst_state);
+	return old_state;
 }
 
 // TODO: not used for now, need performance tests to decide
 // Wrapper to launxh xfer. This wrapper is launched by
 // worker from work queue.
-static void symspi_do_xfer_work_wrapper(struct work_struct *work)
+static void symspi_do_xfer_work_wrapper(struct symspi_work_struct *work)
 {
 	SYMSPI_CHECK_WORK(work, return);
 
@@ -2584,6 +3355,16 @@ static int symspi_do_xfer(struct symspi_dev *symspi)
 	// dropping their flag falling edge counter right before xfer
 	atomic_set(&symspi->p->their_flag_drop_counter, 0);
 
+	symspi_xfer_buffer_rx_to_device(symspi);
+
+	trace_symspi_spi_submit(symspi->p->current_xfer.id
+				, symspi->p->current_xfer.size_bytes);
+
+	const s64 now_ns = ktime_get_ns();
+	__symspi_timing_phase_end(&symspi->p->info.idle_gap
+				  , &symspi->p->idle_start_ns, now_ns);
+	symspi->p->spi_submit_ns = now_ns;
+
 	// note, SPI_READY flow is enabled/disabled at SPI init time
 	int res = spi_async(symspi->spi, &symspi->p->spi_msg);
 	if (res == 0) {
@@ -2598,7 +3379,7 @@ static int symspi_do_xfer(struct symspi_dev *symspi)
 
 
 // Work wrapper for recovery sequence
-static void symspi_recovery_sequence_wrapper(struct work_struct *work)
+static void symspi_recovery_sequence_wrapper(struct symspi_work_struct *work)
 {
 	SYMSPI_CHECK_WORK(work, return);
 
@@ -2608,6 +3389,43 @@ static void symspi_recovery_sequence_wrapper(struct work_struct *work)
 	symspi_recovery_sequence(symspi);
 }
 
+// Helper.
+// Decides whether the error can be recovered with the fast resync
+// instead of the full error indication and silence period (see
+// SYMSPI_ERROR_FAST_RECOVERY).
+//
+// @symspi {valid ptr to symspi device}
+// @error_code the error to recover from
+// @e_ptr {NULL || the error record of @error_code}
+//
+// RETURNS:
+//      true: the error is an isolated glitch, fast resync is enough
+//      false: full recovery is required
+static bool __symspi_fast_recovery_allowed(struct symspi_dev *symspi
+		, const int error_code
+		, const struct symspi_error_rec *const e_ptr)
+{
+#if SYMSPI_ERROR_FAST_RECOVERY
+	if (error_code != SYMSPI_ERROR_OTHER_SIDE
+			&& error_code != SYMSPI_ERROR_WAIT_OTHER_SIDE
+			&& error_code != SYMSPI_ERROR_SPI) {
+		return false;
+	}
+	// previous fast recovery didn't bring the link back
+	if (symspi->p->fast_recovery_unconfirmed || !e_ptr) {
+		return false;
+	}
+	const unsigned int rate = 1000
+		/ max((unsigned int)(e_ptr->exp_avg_interval_msec), 1U);
+	return rate < SYMSPI_ERROR_FULL_RECOVERY_RATE_PER_SEC;
+#else
+	(void)symspi;
+	(void)error_code;
+	(void)e_ptr;
+	return false;
+#endif
+}
+
 // Attempts to restore the correct device state and bring
 // communication back.
 //
@@ -2642,10 +3460,24 @@ static int symspi_recovery_sequence(struct symspi_dev *symspi)
 								, error_code);
 	bool report = e_ptr ? e_ptr->last_reported : true;
 
+	const bool fast = __symspi_fast_recovery_allowed(symspi, error_code
+							 , e_ptr);
+
 	if (report) {
-		symspi_warning_raw("starting recovery of SymSPI, "
-				   "after warning/error: %d", error_code);
+		symspi_warning_raw("starting %s recovery of SymSPI, "
+				   "after warning/error: %d"
+				   , fast ? "fast" : "full", error_code);
+	}
+
+	trace_symspi_recovery(error_code, fast);
+	symspi->p->fast_recovery_unconfirmed = fast;
+	if (fast) {
+		symspi->p->info.fast_recoveries += 1;
+	} else {
+		symspi->p->info.full_recoveries += 1;
 	}
+	// the recovery time is not an idle gap
+	symspi->p->idle_start_ns = 0;
 
 	__symspi_stop_timeout_timer_sync(symspi);
 
@@ -2660,6 +3492,10 @@ static int symspi_recovery_sequence(struct symspi_dev *symspi)
 	symspi_wait_flag_silence_period();
 	symspi_our_flag_drop(symspi);
 	symspi_wait_flag_silence_period();
+	// NOTE: the whole sequence is needed also in fast resync: the
+	//      other side might have counted none of the drops yet (its
+	//      counter is reset on xfer start) and detects the error only
+	//      at its third one, see symspi_their_flag_drop_isr_sequence()
 	symspi_our_flag_set(symspi);
 	symspi_wait_flag_silence_period();
 	symspi_our_flag_drop(symspi);
@@ -2667,7 +3503,8 @@ static int symspi_recovery_sequence(struct symspi_dev *symspi)
 
 	// idle time of scilence to give other side time to react
 	const unsigned long idle_time_us
-		= SYMSPI_ERROR_RECOVERY_SILENCE_TIME_MS * 1000;
+		= fast ? SYMSPI_ERROR_FAST_RECOVERY_SILENCE_TIME_US
+		       : SYMSPI_ERROR_RECOVERY_SILENCE_TIME_MS * 1000;
 	const int variance
 		= SYMSPI_ERROR_RECOVERY_SILENCE_TIME_VARIANCE_PERCENT;
 	// we allow 10% of variance in sleeping time
@@ -2750,6 +3587,8 @@ static void symspi_our_flag_set(struct symspi_dev *symspi)
 	SYMSPI_CHECK_DEVICE("No device provided.", return);
 #endif
 	symspi_trace("Our flag SET.");
+	trace_symspi_flag(true, true);
+	symspi->p->our_flag_set_ns = ktime_get_ns();
 	gpio_set_value(symspi->gpiod_our_flag
 			    , symspi->p->spi_master_mode
 			      ? SYMSPI_MASTER_FLAG_ACTIVE_VALUE
@@ -2766,6 +3605,8 @@ static void symspi_our_flag_drop(struct symspi_dev *symspi)
 	SYMSPI_CHECK_DEVICE("No device provided.", return);
 #endif
 	symspi_trace("Our flag DROP.");
+	trace_symspi_flag(true, false);
+	symspi->p->our_flag_set_ns = 0;
 	gpio_set_value(symspi->gpiod_our_flag
 			    , symspi->p->spi_master_mode
 			      ? !SYMSPI_MASTER_FLAG_ACTIVE_VALUE
@@ -2929,7 +3770,7 @@ static void symspi_inc_current_xfer_counter(struct symspi_dev *symspi)
 // CONTEXT:
 //      sleepable
 //
-static void symspi_postprocessing_sequence(struct work_struct *work)
+static void symspi_postprocessing_sequence(struct symspi_work_struct *work)
 {
 	struct symspi_dev *symspi = NULL;
 
@@ -3016,6 +3857,11 @@ static void symspi_postprocessing_sequence(struct work_struct *work)
 			symspi_wait_flag_silence_period();
 	}
 
+	const s64 now_ns = ktime_get_ns();
+	__symspi_timing_phase_end(&symspi->p->info.postprocessing
+				  , &symspi->p->spi_done_ns, now_ns);
+	symspi->p->idle_start_ns = now_ns;
+
 	// And only after postprocessing of the data is done, then
 	// the xfer cycle is really done, so we move either to IDLE state
 	// or to next xfer.
@@ -3260,7 +4106,7 @@ static ssize_t __symspi_info_read(struct file *file
 
 	SYMSPI_CHECK_DEVICE_AND_PRIVATE("", return -ENODEV);
 
-	const int BUFFER_SIZE = 2048;
+	const int BUFFER_SIZE = 4096;
 
 	if (*ppos >= BUFFER_SIZE || *ppos > SIZE_MAX) {
 		return 0;
@@ -3279,6 +4125,8 @@ static ssize_t __symspi_info_read(struct file *file
 		       "other side no reaction errors:  %llu\n"
 		       "xfers done OK:  %llu\n"
 		       "their flag edges detected:  %llu\n"
+		       "fast error recoveries:  %llu\n"
+		       "full error recoveries:  %llu\n"
 		       "current xfer request:  %d\n"
 		       "\n"
 		       "Configuration:\n"
@@ -3292,21 +4140,43 @@ static ssize_t __symspi_info_read(struct file *file
 			   "error recovery silence time: "
                macro_val_str(SYMSPI_ERROR_RECOVERY_SILENCE_TIME_MS)
 			   " ms\n"
+			   "fast error recovery: "
+			   macro_val_str(SYMSPI_ERROR_FAST_RECOVERY)"\n"
 			   "workqueue mode: "macro_val_str(SYMSPI_WORKQUEUE_MODE)"\n"
+			   "xfer buffers DMA premapped: %s\n"
 			   "verbosity level: "macro_val_str(SYMSPI_VERBOSITY)"\n"
 		       "\n"
-		       "Note: statistical/monitoring"
-		       " info is not expeted to be used in precise"
-		       " measurements due to atomic selfconsistency"
-		       " maintenance would put overhead in the driver.\n"
+		       "Frame timings (us), log2 histograms:\n"
 			, s->other_side_indicated_errors
 			, s->other_side_no_reaction_errors
 			, s->xfers_done_ok
 			, s->their_flag_edges
+			, s->fast_recoveries
+			, s->full_recoveries
 			, atomic_read(&symspi->p->delayed_xfer_request)
 			, our_flag_inactive_timeout
 			, their_flag_wait_timeout
+			, symspi->p->dma_premapped ? "yes" : "no"
 		);
+	const struct symspi_timing_hist *hists[] = {
+		&s->flag_wait, &s->spi_xfer, &s->postprocessing, &s->idle_gap
+	};
+	const char *hist_names[] = {
+		"flag wait", "spi xfer", "postprocessing", "idle gap"
+	};
+	for (int i = 0; i < ARRAY_SIZE(hists) && len < BUFFER_SIZE; i++) {
+		len += __symspi_timing_hist_print(hist_names[i], hists[i]
+						  , buf + len, BUFFER_SIZE - len);
+	}
+	if (len < BUFFER_SIZE) {
+		len += (size_t)snprintf(buf + len, BUFFER_SIZE - len
+				, "\n"
+				  "Note: statistical/monitoring"
+				  " info is not expeted to be used in precise"
+				  " measurements due to atomic selfconsistency"
+				  " maintenance would put overhead in the"
+				  " driver.\n");
+	}
 	len++;
 
 	if (len > BUFFER_SIZE) {
@@ -3330,6 +4200,207 @@ static ssize_t __symspi_info_read(struct file *file
 	return nbytes_to_copy - not_copied;
 }
 
+#if SYMSPI_WQ_MODE_MATCH(RT_KTHREAD)
+// Helper. Initializes the kthread worker control procfs file of SymSPI.
+// NOTE: the SymSPI proc rootfs and the kthread worker should be
+//      created beforehand, if no proc rootfs: then we will fail to
+//      create the worker node.
+//
+// RETURNS:
+//      >= 0: on success,
+//      < 0: on failure (negated error code)
+static int __symspi_worker_ctl_init(struct symspi_dev *symspi)
+{
+	SYMSPI_CHECK_DEVICE_AND_PRIVATE("", return -ENODEV);
+
+	memset(&symspi->p->worker_ops, 0, sizeof(symspi->p->worker_ops));
+	symspi->p->worker_ops.read  = &__symspi_worker_read;
+	symspi->p->worker_ops.write = &__symspi_worker_write;
+	symspi->p->worker_ops.owner = THIS_MODULE;
+
+	if (IS_ERR_OR_NULL(symspi->p->proc_root)) {
+		symspi_err("failed to create worker proc entry:"
+			  " no SymSPI root proc entry");
+		symspi->p->worker_file = NULL;
+		return -ENOENT;
+	}
+
+	symspi->p->worker_file = proc_create_data(
+					   SYMSPI_WORKER_FILE_NAME
+					   , SYMSPI_PROC_RW_PERMISSIONS
+					   , symspi->p->proc_root
+					   , &symspi->p->worker_ops
+					   , (void*)symspi);
+
+	if (IS_ERR_OR_NULL(symspi->p->worker_file)) {
+		symspi_err("failed to create worker proc entry.");
+		return -EIO;
+	}
+
+	return 0;
+}
+
+// Removes the SymSPI proc worker control file
+static void __symspi_worker_ctl_close(struct symspi_dev *symspi)
+{
+	SYMSPI_CHECK_DEVICE_AND_PRIVATE("", return);
+
+	if (IS_ERR_OR_NULL(symspi->p->worker_file)) {
+		return;
+	}
+
+	proc_remove(symspi->p->worker_file);
+	symspi->p->worker_file = NULL;
+}
+
+// Provides the read method for SymSPI kthread worker scheduling
+// parameters to user world. Is invoked when user reads the
+// /proc/<SYMSPI>/<WORKER> file.
+//
+// RETURNS:
+//      >= 0: number of bytes actually provided to user space, on success
+//      < 0: negated error code, on failure
+static ssize_t __symspi_worker_read(struct file *file
+		, char __user *ubuf, size_t count, loff_t *ppos)
+{
+	SYMSPI_CHECK_PTR(file, return -EINVAL);
+	SYMSPI_CHECK_PTR(ubuf, return -EINVAL);
+	SYMSPI_CHECK_PTR(ppos, return -EINVAL);
+
+	struct symspi_dev *symspi = (struct symspi_dev *)PDE_DATA(file->f_inode);
+
+	SYMSPI_CHECK_DEVICE_AND_PRIVATE("", return -ENODEV);
+
+	const int BUFFER_SIZE = 256;
+
+	if (*ppos >= BUFFER_SIZE || *ppos > SIZE_MAX) {
+		return 0;
+	}
+
+	char *buf = kmalloc(BUFFER_SIZE, GFP_KERNEL);
+
+	if (IS_ERR_OR_NULL(buf)) {
+		return -ENOMEM;
+	}
+
+	mutex_lock(&symspi->p->worker_ctl_lock);
+	size_t len = (size_t)snprintf(buf, BUFFER_SIZE
+		     , "policy: %s\n"
+		       "priority: %d\n"
+		       "cpus: %*pbl\n"
+		       "\n"
+		       "Write \"<priority> [<cpu list>]\" to change,"
+		       " priority 0 selects normal policy.\n"
+		     , symspi->p->worker_priority ? "SCHED_FIFO" : "SCHED_NORMAL"
+		     , symspi->p->worker_priority
+		     , cpumask_pr_args(&symspi->p->worker_cpus));
+	mutex_unlock(&symspi->p->worker_ctl_lock);
+	len++;
+
+	if (len > BUFFER_SIZE) {
+		len = BUFFER_SIZE;
+		buf[BUFFER_SIZE - 1] = 0;
+	}
+
+	const unsigned long nbytes_to_copy
+			= (len >= (size_t)(*ppos))
+				?  min(len - (size_t)(*ppos), count)
+				: 0;
+	const unsigned long not_copied
+			= copy_to_user(ubuf, buf + (size_t)(*ppos)
+				       , nbytes_to_copy);
+	kfree(buf);
+	buf = NULL;
+	*ppos += nbytes_to_copy - not_copied;
+
+	return nbytes_to_copy - not_copied;
+}
+
+// Provides the write method for SymSPI kthread worker scheduling
+// parameters. Is invoked when user writes the /proc/<SYMSPI>/<WORKER>
+// file in the format:
+//
+//      <priority> [<cpu list>]
+//
+// where the <priority> is the SCHED_FIFO priority [1; MAX_RT_PRIO - 1]
+// or 0 to select normal policy, and the optional <cpu list> is the
+// list of CPUs to pin the worker to, like "1" or "0,2-3" (if omitted
+// the current CPU affinity is kept).
+//
+// RETURNS:
+//      >= 0: number of bytes consumed, on success
+//      < 0: negated error code, on failure
+static ssize_t __symspi_worker_write(struct file *file
+		, const char __user *ubuf, size_t count, loff_t *ppos)
+{
+	SYMSPI_CHECK_PTR(file, return -EINVAL);
+	SYMSPI_CHECK_PTR(ubuf, return -EINVAL);
+	SYMSPI_CHECK_PTR(ppos, return -EINVAL);
+
+	struct symspi_dev *symspi = (struct symspi_dev *)PDE_DATA(file->f_inode);
+
+	SYMSPI_CHECK_DEVICE_AND_PRIVATE("", return -ENODEV);
+
+	char buf[128];
+
+	// we only get the whole data at once
+	if (*ppos != 0 || count >= sizeof(buf)) {
+		symspi_warning("Worker ctrl message should be written at"
+			       " once and not exceed %zu bytes."
+			       , sizeof(buf) - 1);
+		return -EFAULT;
+	}
+
+	if (copy_from_user(buf, ubuf, count) != 0) {
+		symspi_warning("Not all bytes were copied from user.");
+		return -EIO;
+	}
+	buf[count] = 0;
+
+	int priority;
+	int consumed = 0;
+
+	if (sscanf(buf, "%d %n", &priority, &consumed) != 1) {
+		symspi_warning("Parsing failed: %s", buf);
+		return -EINVAL;
+	}
+	if (priority < 0 || priority >= MAX_RT_PRIO) {
+		symspi_warning("priority is out of bounds: %d", priority);
+		return -EINVAL;
+	}
+
+	cpumask_var_t cpus;
+	if (!alloc_cpumask_var(&cpus, GFP_KERNEL)) {
+		return -ENOMEM;
+	}
+
+	mutex_lock(&symspi->p->worker_ctl_lock);
+
+	const char *cpu_list = strim(buf + consumed);
+	int res = 0;
+
+	if (cpu_list[0] == '\0') {
+		cpumask_copy(cpus, &symspi->p->worker_cpus);
+	} else if (cpulist_parse(cpu_list, cpus) < 0) {
+		symspi_warning("CPU list parsing failed: %s", cpu_list);
+		res = -EINVAL;
+		goto finalize;
+	}
+
+	res = __symspi_worker_apply(symspi, priority, cpus);
+	if (res < 0) {
+		symspi_warning("could not apply priority %d and CPUs %*pbl"
+			       " to kthread worker: %d", priority
+			       , cpumask_pr_args(cpus), res);
+	}
+
+finalize:
+	mutex_unlock(&symspi->p->worker_ctl_lock);
+	free_cpumask_var(cpus);
+
+	return res < 0 ? (ssize_t)res : (ssize_t)count;
+}
+#endif
 
 /* ----------------------- SPI CALLBACKS SECTION ----------------------- */
 #if SYMSPI_USE_SLAVEMODE_TX_FIFOFILL_DONE
@@ -3342,7 +4413,9 @@ static void symspi_spi_xfer_tx_done_callback(void *context)
 #endif
 	if (!symspi->p->spi_master_mode) {
 		#if SYMSPI_USE_SLAVEMODE_TX_FIFOFILL_TIMEOUTTIMER
-		mod_timer(&symspi->p->slave_tx_fill_timeout_timer, jiffies + msecs_to_jiffies(SYMSPI_USE_SLAVEMODE_TX_FIFOFILL_TIMEOUT_MS));
+		hrtimer_start(&symspi->p->slave_tx_fill_timeout_timer
+			, ms_to_ktime(SYMSPI_USE_SLAVEMODE_TX_FIFOFILL_TIMEOUT_MS)
+			, HRTIMER_MODE_REL);
 		#endif
 		symspi_our_flag_set(symspi);
 	}
@@ -3366,10 +4439,21 @@ static void symspi_spi_xfer_done_callback(void *context)
 
 #if SYMSPI_USE_SLAVEMODE_TX_FIFOFILL_DONE && SYMSPI_USE_SLAVEMODE_TX_FIFOFILL_TIMEOUTTIMER
 	if (!symspi->p->spi_master_mode) {
-		del_timer(&symspi->p->slave_tx_fill_timeout_timer);
+		hrtimer_try_to_cancel(&symspi->p->slave_tx_fill_timeout_timer);
 	}
 #endif
 
+	trace_symspi_spi_complete(symspi->p->current_xfer.id
+				  , symspi->p->spi_msg.status);
+
+	const s64 now_ns = ktime_get_ns();
+	__symspi_timing_phase_end(&symspi->p->info.spi_xfer
+				  , &symspi->p->spi_submit_ns, now_ns);
+	symspi->p->spi_done_ns = now_ns;
+
+	// RX data is to be read by CPU from now on
+	symspi_xfer_buffer_rx_to_cpu(symspi);
+
 	// No one except us can exit the xfer state, even error
 	// handling shall be postponed
 	if (!SYMSPI_SWITCH_STRICT(XFER, POSTPROCESSING)) {
@@ -3394,6 +4478,7 @@ static void symspi_spi_xfer_done_callback(void *context)
 
 	// update overview info
 	symspi->p->info.xfers_done_ok += 1;
+	symspi->p->fast_recovery_unconfirmed = false;
 
 	// all went fine
 	// we'll shedule the data processing
@@ -3452,7 +4537,10 @@ static irqreturn_t symspi_their_flag_isr(int irq, void *symspi_device)
 		return IRQ_HANDLED;
 	}
 
-	if (symspi_their_flag_is_set(symspi)) {
+	const bool their_flag_set = symspi_their_flag_is_set(symspi);
+	trace_symspi_flag(false, their_flag_set);
+
+	if (their_flag_set) {
 		symspi_their_flag_set_isr_sequence(symspi);
 	} else {
 		symspi_their_flag_drop_isr_sequence(symspi);
@@ -3528,6 +4616,10 @@ static void symspi_their_flag_set_isr_sequence(
 #ifdef SYMSPI_DEBUG
 	SYMSPI_CHECK_DEVICE("No device provided.", return);
 #endif
+	__symspi_timing_phase_end(&symspi->p->info.flag_wait
+				  , &symspi->p->our_flag_set_ns
+				  , ktime_get_ns());
+
 	// TODO: Use the softIRQs
 	// see: https://notes.shichao.io/lkd/ch8/#implementing-softirqs
 	// for detailed description
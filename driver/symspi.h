@@ -35,7 +35,7 @@
 
 
 // NOTE: Keep updated if adding/removing error type
-#define SYMSPI_ERROR_TYPES_COUNT 15
+#define SYMSPI_ERROR_TYPES_COUNT 16
 
 
 // no error code, keep it 0
@@ -74,6 +74,8 @@
 #define SYMSPI_ERROR_WAIT_OTHER_SIDE 16
 // error trying to create private work queue
 #define SYMSPI_ERROR_WORKQUEUE_INIT 17
+// New xfer size exceeds the SYMSPI_XFER_SIZE_MAX_BYTES
+#define SYMSPI_ERROR_XFER_SIZE_TOO_BIG 18
 
 
 /* --------------------- DATA STRUCTS SECTION ---------------------------*/
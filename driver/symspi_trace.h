@@ -0,0 +1,140 @@
+/*
+ * This file declares the trace events of the SymSPI driver.
+ *
+ * Driver for the Symmetrical SPI (SymSPI) communication between independent
+ * CPUs, which uses the SPI bus + 2 GPIO handshaking lines to implement
+ * full duplex and fully symmetrical communication between parties.
+ *
+ * Copyright (c) 2026 The iccom-utils contributors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// SPDX-License-Identifier: GPL-2.0
+
+// The events are available under the "symspi" trace system, say:
+//      echo 1 > /sys/kernel/debug/tracing/events/symspi/enable
+//      cat /sys/kernel/debug/tracing/trace_pipe
+// or
+//      perf record -e 'symspi:*' -a
+// When the events are disabled they cost only a static branch.
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM symspi
+
+#if !defined(_SYMSPI_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _SYMSPI_TRACE_H
+
+#include <linux/tracepoint.h>
+
+// NOTE: to be kept in sync with SYMSPI_STATE_* values
+#define symspi_trace_show_state(state)				\
+	__print_symbolic(state					\
+			 , { 0, "COLD" }			\
+			 , { 1, "IDLE" }			\
+			 , { 2, "XFER_PREPARE" }		\
+			 , { 3, "WAITING_PREV" }		\
+			 , { 4, "WAITING_RDY" }			\
+			 , { 5, "XFER" }			\
+			 , { 6, "POSTPROCESSING" }		\
+			 , { 7, "ERROR" })
+
+// The SymSPI state machine switched from @from to @to state.
+TRACE_EVENT(symspi_state,
+	TP_PROTO(int from, int to),
+	TP_ARGS(from, to),
+	TP_STRUCT__entry(
+		__field(int, from)
+		__field(int, to)
+	),
+	TP_fast_assign(
+		__entry->from = from;
+		__entry->to = to;
+	),
+	TP_printk("%s -> %s", symspi_trace_show_state(__entry->from)
+		  , symspi_trace_show_state(__entry->to))
+);
+
+// The edge of the flag line: @ours - our flag, else their flag,
+// @active - the flag got active, else inactive.
+TRACE_EVENT(symspi_flag,
+	TP_PROTO(bool ours, bool active),
+	TP_ARGS(ours, active),
+	TP_STRUCT__entry(
+		__field(bool, ours)
+		__field(bool, active)
+	),
+	TP_fast_assign(
+		__entry->ours = ours;
+		__entry->active = active;
+	),
+	TP_printk("%s flag %s", __entry->ours ? "our" : "their"
+		  , __entry->active ? "set" : "drop")
+);
+
+// The xfer @xfer_id of @size_bytes was submitted to the SPI layer.
+TRACE_EVENT(symspi_spi_submit,
+	TP_PROTO(int xfer_id, size_t size_bytes),
+	TP_ARGS(xfer_id, size_bytes),
+	TP_STRUCT__entry(
+		__field(int, xfer_id)
+		__field(size_t, size_bytes)
+	),
+	TP_fast_assign(
+		__entry->xfer_id = xfer_id;
+		__entry->size_bytes = size_bytes;
+	),
+	TP_printk("xfer %d, %zu bytes", __entry->xfer_id
+		  , __entry->size_bytes)
+);
+
+// The SPI layer completed the xfer @xfer_id with @status.
+TRACE_EVENT(symspi_spi_complete,
+	TP_PROTO(int xfer_id, int status),
+	TP_ARGS(xfer_id, status),
+	TP_STRUCT__entry(
+		__field(int, xfer_id)
+		__field(int, status)
+	),
+	TP_fast_assign(
+		__entry->xfer_id = xfer_id;
+		__entry->status = status;
+	),
+	TP_printk("xfer %d, status %d", __entry->xfer_id, __entry->status)
+);
+
+// The error recovery from @error is started, @fast - the fast resync
+// is used, else the full recovery.
+TRACE_EVENT(symspi_recovery,
+	TP_PROTO(int error, bool fast),
+	TP_ARGS(error, fast),
+	TP_STRUCT__entry(
+		__field(int, error)
+		__field(bool, fast)
+	),
+	TP_fast_assign(
+		__entry->error = error;
+		__entry->fast = fast;
+	),
+	TP_printk("error %d, %s", __entry->error
+		  , __entry->fast ? "fast" : "full")
+);
+
+#endif /* _SYMSPI_TRACE_H */
+
+// the header is out of kernel tree, see CFLAGS_symspi.o in Makefile
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE symspi_trace
+#include <trace/define_trace.h>
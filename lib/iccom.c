@@ -83,6 +83,65 @@ static struct sockaddr_nl remote_addr = {
     , .nl_groups = 0 /* unicast */
 };
 
+/* ------------------- HELPERS ---------------------------------------- */
+
+// Helper. Provides the netlink sequence number for the next message
+// sent by this process, so the error reported by the driver can be
+// matched to the send which caused it. Never 0.
+static __u32 __iccom_next_seq(void)
+{
+    static __u32 seq = 0;
+    __u32 res;
+
+    do {
+        res = __atomic_add_fetch(&seq, 1, __ATOMIC_RELAXED);
+    } while (res == 0);
+    return res;
+}
+
+// Helper. Takes the errors the driver reported for the messages sent
+// via the socket (NLMSG_ERROR messages) from the head of the socket
+// input without waiting. Stops at the first non-error message, so the
+// incoming data is left for the receive.
+//
+// @seq the sequence number of the message just sent
+//
+// RETURNS:
+//      0: no errors were pending
+//      <0: the error of the message with @seq if it was among the
+//          pending ones, else the first pending error (of an earlier
+//          message)
+static int __iccom_take_send_errors(const int sock_fd, const __u32 seq)
+{
+    union {
+        struct nlmsghdr header;
+        char data[NLMSG_SPACE(sizeof(struct nlmsgerr))];
+    } buf;
+    int res = 0;
+
+    while (true) {
+        const ssize_t len = recv(sock_fd, &buf, sizeof(buf)
+                                 , MSG_PEEK | MSG_DONTWAIT);
+        if (len < (ssize_t)sizeof(buf)
+                || buf.header.nlmsg_type != NLMSG_ERROR) {
+            break;
+        }
+        if (recv(sock_fd, &buf, sizeof(buf), MSG_DONTWAIT) < 0) {
+            break;
+        }
+
+        const struct nlmsgerr *const nl_err
+                = (const struct nlmsgerr *)NLMSG_DATA(&buf.header);
+        if (buf.header.nlmsg_seq == seq) {
+            return nl_err->error;
+        }
+        if (res == 0) {
+            res = nl_err->error;
+        }
+    }
+    return res;
+}
+
 /* ------------------- ICCOM SOCKETS CONVENIENCE API ------------------- */
 
 // See iccom.h
@@ -223,6 +282,112 @@ int iccom_get_socket_write_timeout(const int sock_fd)
     return timeout.tv_sec * 1000 + timeout.tv_usec / 1000;
 }
 
+// See iccom.h
+int iccom_open_subscriber_socket(void)
+{
+    int sock_fd = socket(PF_NETLINK, SOCK_RAW, NETLINK_ICCOM);
+    if (sock_fd < 0) {
+        int err = errno;
+        log("Failed to open the netlink socket: "
+            "netlink_family: %d; error code: %d(%s)"
+            , NETLINK_ICCOM, err, strerror(err));
+        return -err;
+    }
+
+    // NOTE: the kernel assigned port id is the process id at first,
+    //      which might be a channel, so we pick the port id ourselves
+    static unsigned int port_seq = 0;
+    const unsigned int span = ICCOM_SUBSCRIBER_PORTID_MAX
+                              - ICCOM_SUBSCRIBER_PORTID_MIN + 1;
+    const unsigned int start = ((unsigned int)getpid() * 64
+                                + __atomic_fetch_add(&port_seq, 1
+                                                     , __ATOMIC_RELAXED))
+                               % span;
+
+    struct sockaddr_nl src_addr;
+    memset(&src_addr, 0, sizeof(src_addr));
+    src_addr.nl_family = AF_NETLINK;
+
+    int err = EADDRINUSE;
+    for (unsigned int i = 0; i < ICCOM_SUBSCRIBER_BIND_ATTEMPTS; i++) {
+        src_addr.nl_pid = ICCOM_SUBSCRIBER_PORTID_MIN + (start + i) % span;
+        if (bind(sock_fd, (struct sockaddr*)&src_addr
+                 , sizeof(src_addr)) == 0) {
+            return sock_fd;
+        }
+        err = errno;
+        if (err != EADDRINUSE) {
+            break;
+        }
+    }
+
+    log("Failed to bind the subscriber socket; "
+        "error code: %d(%s)", err, strerror(err));
+    log("Closing the socket.");
+    iccom_close_socket(sock_fd);
+    return -err;
+}
+
+// Helper. Writes the subscription control command for the socket.
+//
+// @op '+' to subscribe, '-' to unsubscribe
+//
+// RETURNS:
+//      0: on success
+//      <0: negated error code, if fails
+static int __iccom_subscription_ctl(const int sock_fd
+            , const unsigned int channel, const char op)
+{
+    if (__iccom_channel_verify(channel, ICCOM_CHANNEL_AREA_ANY, "") < 0) {
+        return -EINVAL;
+    }
+
+    struct sockaddr_nl addr;
+    socklen_t addr_len = sizeof(addr);
+    if (getsockname(sock_fd, (struct sockaddr*)&addr, &addr_len) < 0) {
+        int err = errno;
+        log("Failed to get the socket %d port id; "
+            "error code: %d(%s)", sock_fd, err, strerror(err));
+        return -err;
+    }
+
+    FILE *ctl_file = fopen(ICCOM_SUBSCRIBE_IF_CTRL_FILE_PATH, "w");
+
+    if (!ctl_file) {
+        const int err = errno;
+        log("ICCom IF subscribe ctl file open failed, error: %d", err);
+        log("this might be caused either by permissions, either by "
+            " non-existing file (which means that ICCom Sockets driver"
+            " is not loaded)");
+        return -err;
+    }
+
+    int ret_val = 0;
+    // NOTE: unbuffered, to get the kernel error on the write itself
+    setbuf(ctl_file, NULL);
+    if (fprintf(ctl_file, "%c %u %u\n", op, channel, addr.nl_pid) < 0) {
+        const int err = errno;
+        log("ICCom IF subscribe ctl file write failed, error: %d(%s)"
+            , err, strerror(err));
+        ret_val = -err;
+    }
+
+    fclose(ctl_file);
+    return ret_val;
+}
+
+// See iccom.h
+int iccom_subscribe(const int sock_fd, const unsigned int channel)
+{
+    return __iccom_subscription_ctl(sock_fd, channel, '+');
+}
+
+// See iccom.h
+int iccom_unsubscribe(const int sock_fd, const unsigned int channel)
+{
+    return __iccom_subscription_ctl(sock_fd, channel, '-');
+}
+
 // See iccom.h
 void iccom_close_socket(const int sock_fd)
 {
@@ -239,6 +404,31 @@ int iccom_send_data_nocopy(const int sock_fd, const void *const buf
                , const size_t buf_size_bytes
                , const size_t data_offset
                , const size_t data_size_bytes)
+{
+    return iccom_send_data_nocopy_prio(sock_fd, buf, buf_size_bytes
+                                       , data_offset, data_size_bytes
+                                       , ICCOM_PRIORITY_DEFAULT, 0);
+}
+
+// See iccom.h
+int iccom_send_data_nocopy_flags(const int sock_fd, const void *const buf
+               , const size_t buf_size_bytes
+               , const size_t data_offset
+               , const size_t data_size_bytes
+               , const int flags)
+{
+    return iccom_send_data_nocopy_prio(sock_fd, buf, buf_size_bytes
+                                       , data_offset, data_size_bytes
+                                       , ICCOM_PRIORITY_DEFAULT, flags);
+}
+
+// See iccom.h
+int iccom_send_data_nocopy_prio(const int sock_fd, const void *const buf
+               , const size_t buf_size_bytes
+               , const size_t data_offset
+               , const size_t data_size_bytes
+               , const unsigned int priority
+               , const int flags)
 {
     if (buf_size_bytes != NLMSG_SPACE(data_size_bytes)) {
         log("Buffer size %zu doesn't match data size %zu."
@@ -264,11 +454,22 @@ int iccom_send_data_nocopy(const int sock_fd, const void *const buf
         log("Null buffer pointer. Nothing to send.");
         return -EINVAL;
     }
+    if (priority > ICCOM_PRIORITY_MAX) {
+        log("Message priority %u is out of range [%d; %d]."
+            , priority, ICCOM_PRIORITY_MIN, ICCOM_PRIORITY_MAX);
+        return -EINVAL;
+    }
 
     struct nlmsghdr *const nl_msg = (struct nlmsghdr *const)buf;
 
     memset(nl_msg, 0, sizeof(*nl_msg));
     nl_msg->nlmsg_len = NLMSG_LENGTH(data_size_bytes);
+    nl_msg->nlmsg_type = (__u16)(priority << ICCOM_NLM_TYPE_PRIORITY_SHIFT);
+    nl_msg->nlmsg_seq = __iccom_next_seq();
+    // the driver doesn't get the send flags, only the message itself
+    if (flags & MSG_DONTWAIT) {
+        nl_msg->nlmsg_flags |= ICCOM_NLM_F_DONTWAIT;
+    }
 
     struct iovec iov = { (void *)nl_msg, nl_msg->nlmsg_len };
     const struct msghdr msg = { &dest_addr, sizeof(dest_addr),
@@ -297,7 +498,7 @@ int iccom_send_data_nocopy(const int sock_fd, const void *const buf
     log("    [SND] ------- payload data end ---------");
 #endif
 
-    ssize_t res = sendmsg(sock_fd, &msg, 0);
+    ssize_t res = sendmsg(sock_fd, &msg, flags);
     if (res < 0) {
         int err = errno;
         log("sending of the message failed, error:"
@@ -305,12 +506,23 @@ int iccom_send_data_nocopy(const int sock_fd, const void *const buf
         return -err;
     }
 
-    return 0;
+    // the message rejected by the driver (say, ICCom TX queue is
+    // full) is reported back before sendmsg(...) returns
+    return __iccom_take_send_errors(sock_fd, nl_msg->nlmsg_seq);
 }
 
 // See iccom.h
 int iccom_send_data(const int sock_fd, const void *const data
             , const size_t data_size_bytes)
+{
+    return iccom_send_data_prio(sock_fd, data, data_size_bytes
+                                , ICCOM_PRIORITY_DEFAULT);
+}
+
+// See iccom.h
+int iccom_send_data_prio(const int sock_fd, const void *const data
+            , const size_t data_size_bytes
+            , const unsigned int priority)
 {
     if (data_size_bytes > ICCOM_SOCKET_MAX_MESSAGE_SIZE_BYTES) {
         log("Can't send messages larger than: %d bytes."
@@ -336,10 +548,11 @@ int iccom_send_data(const int sock_fd, const void *const data
 
     memcpy(NLMSG_DATA(nl_msg), data, data_size_bytes);
 
-    int res = iccom_send_data_nocopy(sock_fd, (void*)nl_msg
+    int res = iccom_send_data_nocopy_prio(sock_fd, (void*)nl_msg
                , nl_total_msg_size
                , NLMSG_LENGTH(0)
-               , data_size_bytes);
+               , data_size_bytes
+               , priority, 0);
 
     free(nl_msg);
 
@@ -372,7 +585,7 @@ int iccom_receive_data_nocopy(
     if (len < 0) {
         int err = errno;
         // timeout not an error
-        if (err == EAGAIN) {
+        if (err == EAGAIN || err == EWOULDBLOCK) {
             return 0;
         }
         log("Error reading data from socket (fd: %d): %d(%s)"
@@ -416,6 +629,17 @@ int iccom_receive_data_nocopy(
         return -EPIPE;
     }
 
+    // the error of our earlier sent message
+    if (nl_header->nlmsg_type == NLMSG_ERROR) {
+        if (NLMSG_PAYLOAD(nl_header, 0) < sizeof(struct nlmsgerr)) {
+            log("Broken error message from socket (fd: %d).", sock_fd);
+            return -EPIPE;
+        }
+        const struct nlmsgerr *const nl_err
+                = (const struct nlmsgerr *)NLMSG_DATA(nl_header);
+        return nl_err->error;
+    }
+
     int data_len = NLMSG_PAYLOAD(nl_header, 0);
     *data_offset__out = NLMSG_LENGTH(0);
 
@@ -478,8 +702,13 @@ int __iccom_receive_data_pure(const int sock_fd, void *const receive_buffer
     return res;
 }
 
-int iccom_loopback_enable(const unsigned int from_ch, const unsigned int to_ch
-              , const int range_shift)
+// Helper. Verifies the loopback rule (see @iccom_loopback_enable).
+//
+// RETURNS:
+//      0: the rule is valid
+//      <0: negated error code, if the rule is invalid
+static int __iccom_loopback_verify(const unsigned int from_ch
+              , const unsigned int to_ch, const int range_shift)
 {
     if (to_ch < from_ch) {
         log("to_ch (%d) must be > from_ch (%d)", to_ch, from_ch);
@@ -513,6 +742,118 @@ int iccom_loopback_enable(const unsigned int from_ch, const unsigned int to_ch
             " regions");
         return -EINVAL;
     }
+    return 0;
+}
+
+// Helper. Writes the loopback control command.
+//
+// RETURNS:
+//      0: on success
+//      <0: negated error code, if fails
+static int __iccom_loopback_ctl(const char *const cmd)
+{
+    FILE *ctl_file = fopen(ICCOM_LOOPBACK_IF_CTRL_FILE_PATH, "w");
+
+    if (!ctl_file) {
+        const int err = errno;
+        log("ICCom IF loopback ctl file open failed, error: %d", err);
+        log("this might be caused either by permissions, either by "
+            " non-existing file (which means that ICCom Sockets driver"
+            " is not loaded)");
+        return -err;
+    }
+
+    int ret_val = 0;
+    // NOTE: unbuffered, to get the kernel error on the write itself
+    setbuf(ctl_file, NULL);
+    if (fputs(cmd, ctl_file) < 0) {
+        const int err = errno;
+        log("ICCom IF loopback ctl file write failed, error: %d(%s)"
+            , err, strerror(err));
+        ret_val = -err;
+    }
+
+    fclose(ctl_file);
+    return ret_val;
+}
+
+// See iccom.h
+int iccom_loopback_add(const unsigned int from_ch, const unsigned int to_ch
+              , const int range_shift)
+{
+    if (range_shift == 0) {
+        log("range_shift 0 doesn't define the loopback");
+        return -EINVAL;
+    }
+    const int res = __iccom_loopback_verify(from_ch, to_ch, range_shift);
+    if (res < 0) {
+        return res;
+    }
+
+    char cmd[64];
+    snprintf(cmd, sizeof(cmd), "+ %u %u %d\n", from_ch, to_ch, range_shift);
+    return __iccom_loopback_ctl(cmd);
+}
+
+// See iccom.h
+int iccom_loopback_remove(const unsigned int from_ch
+              , const unsigned int to_ch)
+{
+    char cmd[64];
+    snprintf(cmd, sizeof(cmd), "- %u %u\n", from_ch, to_ch);
+    return __iccom_loopback_ctl(cmd);
+}
+
+// See iccom.h
+int iccom_loopback_get_all(loopback_cfg *const out
+              , const unsigned int max_count)
+{
+    if (out == NULL && max_count != 0) {
+        log("no output ptr is provided");
+        return -EINVAL;
+    }
+
+    FILE *ctl_file = fopen(ICCOM_LOOPBACK_IF_CTRL_FILE_PATH, "r");
+
+    if (!ctl_file) {
+        const int err = errno;
+        log("ICCom IF loopback ctl file open failed, error: %d", err);
+        log("this might be caused either by permissions, either by "
+            " non-existing file (which means that ICCom Sockets driver"
+            " is not loaded)");
+        return -err;
+    }
+
+    // one rule per line, the rules list ends with the empty line
+    const int paramenters_count = 3;
+    unsigned int count = 0;
+    loopback_cfg rule;
+    char line[128];
+    while (fgets(line, sizeof(line), ctl_file)) {
+        if (sscanf(line, "%u %u %d", &rule.from_ch, &rule.to_ch
+                   , &rule.range_shift) != paramenters_count) {
+            break;
+        }
+        // no rules
+        if (rule.range_shift == 0) {
+            continue;
+        }
+        if (count < max_count) {
+            out[count] = rule;
+        }
+        count++;
+    }
+
+    fclose(ctl_file);
+    return (int)count;
+}
+
+int iccom_loopback_enable(const unsigned int from_ch, const unsigned int to_ch
+              , const int range_shift)
+{
+    if (__iccom_loopback_verify(from_ch, to_ch, range_shift) < 0) {
+        return -EINVAL;
+    }
 
     FILE *ctl_file = fopen(ICCOM_LOOPBACK_IF_CTRL_FILE_PATH, "w");
 
@@ -601,6 +942,47 @@ int iccom_loopback_get(loopback_cfg *const out)
     return ret_val;
 }
 
+// See iccom.h
+int iccom_get_tx_queue_state(size_t *const queued_bytes__out
+                             , size_t *const max_bytes__out)
+{
+    FILE *state_file = fopen(ICCOM_TX_QUEUE_IF_FILE_PATH, "r");
+
+    if (!state_file) {
+        const int err = errno;
+        log("ICCom IF TX queue file open failed, error: %d", err);
+        log("this might be caused either by permissions, either by "
+            " non-existing file (which means that ICCom Sockets driver"
+            " is not loaded)");
+        return -err;
+    }
+
+    const int paramenters_count = 2;
+    size_t queued = 0;
+    size_t max_bytes = 0;
+    int ret_val = 0;
+    if (fscanf(state_file, "%zu %zu", &queued, &max_bytes)
+            != paramenters_count) {
+        const int err = errno;
+        log("ICCom IF TX queue read&parsing op, file error: %d,"
+            " gen error: %d", ferror(state_file), err);
+        ret_val = -EIO;
+    }
+
+    fclose(state_file);
+
+    if (ret_val < 0) {
+        return ret_val;
+    }
+    if (queued_bytes__out) {
+        *queued_bytes__out = queued;
+    }
+    if (max_bytes__out) {
+        *max_bytes__out = max_bytes;
+    }
+    return 0;
+}
+
 
 #ifdef __cplusplus
 } /* extern C */
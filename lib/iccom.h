@@ -37,6 +37,10 @@
 #define LIBICCOM_LOG_PREFIX "libiccom: "
 // TODO: grab it from kernel header
 #define ICCOM_LOOPBACK_IF_CTRL_FILE_PATH "/proc/iccomif/loopbackctl"
+// TODO: grab it from kernel header
+#define ICCOM_SUBSCRIBE_IF_CTRL_FILE_PATH "/proc/iccomif/subscribectl"
+// TODO: grab it from kernel header
+#define ICCOM_TX_QUEUE_IF_FILE_PATH "/proc/iccomif/txqueue"
 #define ICCOM_CHANNEL_AREA_PRIME 1
 #define ICCOM_CHANNEL_AREA_LOOPBACK 2
 #define ICCOM_CHANNEL_AREA_ANY 3
@@ -59,6 +63,31 @@
 #define ICCOM_MIN_CHANNEL 0
 // TODO: grab this information from kernel include
 #define ICCOM_MAX_CHANNEL 0x7FFF
+// The netlink port ids reserved for the subscriber sockets, above the
+// channel sockets ones (ordinary and loopback channels, see
+// ICCOM_SK_SUBSCRIBER_PORTID_MIN in the driver) and below the kernel
+// autobind port ids.
+// TODO: grab this information from kernel include
+#define ICCOM_SUBSCRIBER_PORTID_MIN (2 * (ICCOM_MAX_CHANNEL + 1))
+#define ICCOM_SUBSCRIBER_PORTID_MAX 0x7FFFFFFF
+// How many subscriber port ids are tried before giving up, when they
+// are already taken
+#define ICCOM_SUBSCRIBER_BIND_ATTEMPTS 64
+// The netlink message header flag which tells the driver that the
+// message is sent with MSG_DONTWAIT (the kernel socket doesn't get the
+// send flags, see ICCOM_SK_NLM_F_DONTWAIT in the driver).
+// TODO: grab this information from kernel include
+#define ICCOM_NLM_F_DONTWAIT 0x8000
+// The message priority range, the higher value the more urgent
+// message (see ICCOM_TX_PRIORITY_MAX in the driver).
+// TODO: grab this information from kernel include
+#define ICCOM_PRIORITY_MIN 0
+#define ICCOM_PRIORITY_MAX 100
+#define ICCOM_PRIORITY_DEFAULT ICCOM_PRIORITY_MIN
+// The message priority is sent in the bits 8..15 of the netlink
+// message header type (nlmsg_type).
+// TODO: grab this information from kernel include
+#define ICCOM_NLM_TYPE_PRIORITY_SHIFT 8
 
 #define LUN_CID_2_CH(lun, cid)                  \
     ((((unsigned int)(lun)) << 7) | ((unsigned int)(cid)))
@@ -273,6 +302,44 @@ int iccom_set_socket_write_timeout(const int sock_fd, const int ms);
 //      <0: if error occured
 int iccom_get_socket_write_timeout(const int sock_fd);
 
+// Opens the iccom socket not bound to any channel, to be subscribed
+// to the channels messages (see @iccom_subscribe). The socket is
+// bound to a free port id within [ICCOM_SUBSCRIBER_PORTID_MIN;
+// ICCOM_SUBSCRIBER_PORTID_MAX], so it never takes a channel port id
+// (like a kernel assigned one could). The socket gets
+// the copies of the messages received in the subscribed channels
+// (in addition to the channel own socket, see @iccom_open_socket),
+// for example to monitor the channels. The channel of the received
+// message is given in nlmsg_pid field of the netlink message header
+// (see @iccom_receive_data_nocopy).
+//
+// RETURNS:
+//      >=0: socket file descriptor , if socket
+//          successfully opened
+//      <0: negated error code, if fails
+int iccom_open_subscriber_socket(void);
+
+// Subscribes the socket to the messages received in the channel.
+//
+// NOTE: the subscriptions of the socket are dropped as it is closed.
+//
+// @sock_fd {socket opened by @iccom_open_subscriber_socket}
+// @channel {valid channel, see @iccom_channel_verify}
+//      the channel to subscribe to
+//
+// RETURNS:
+//      0: on success
+//      <0: negated error code, if fails
+int iccom_subscribe(const int sock_fd, const unsigned int channel);
+
+// Unsubscribes the socket from the channel messages
+// (see @iccom_subscribe).
+//
+// RETURNS:
+//      0: on success
+//      <0: negated error code, if fails
+int iccom_unsubscribe(const int sock_fd, const unsigned int channel);
+
 // Closes the iccom socket.
 // @sock_fd {opened socket file descriptor} the descriptor validity
 //      is checked by kernel
@@ -313,14 +380,66 @@ void iccom_close_socket(const int sock_fd);
 // @data_size_bytes [1; @iccom_get_max_payload_size()]
 //      the size of the user data (message) within the @buf buffer
 //
+// NOTE: when ICCom TX queue is full, the blocking socket send waits
+//      for the room in the queue (up to the socket write timeout, see
+//      @iccom_set_socket_write_timeout), while the message sent via
+//      non-blocking (O_NONBLOCK) socket or with MSG_DONTWAIT (see
+//      @iccom_send_data_nocopy_flags) is dropped at once. In both
+//      cases the send of the dropped message returns -EAGAIN, so the
+//      producer can slow down (see also @iccom_get_tx_queue_state).
+//
+// NOTE: the driver reports the errors back via the socket input, the
+//      send takes the errors which wait there ahead of any incoming
+//      data. If the incoming data is ahead, then the error is
+//      returned by the receive (see @iccom_receive_data_nocopy).
+//
 // RETURNS:
 //      0: on success
+//      -EAGAIN: the message was dropped, ICCom TX queue is full
 //      <0: negated error code, if fails
+//          NOTE: the message which failed later in the driver (after
+//              its send returned) is reported by the next send via
+//              the socket, then the error (never -EAGAIN) is of the
+//              earlier message, while the message itself is sent.
 int iccom_send_data_nocopy(const int sock_fd, const void *const buf
                , const size_t buf_size_bytes
                , const size_t data_offset
                , const size_t data_size_bytes);
 
+// The same as @iccom_send_data_nocopy(...), but with the send flags.
+//
+// @flags the sendmsg(...) flags, MSG_DONTWAIT makes this message not
+//      to wait for the room in ICCom TX queue, even if the socket
+//      is blocking.
+//
+// RETURNS:
+//      0: on success
+//      <0: negated error code, if fails
+int iccom_send_data_nocopy_flags(const int sock_fd, const void *const buf
+               , const size_t buf_size_bytes
+               , const size_t data_offset
+               , const size_t data_size_bytes
+               , const int flags);
+
+// The same as @iccom_send_data_nocopy_flags(...), but with the message
+// priority.
+//
+// @priority [ICCOM_PRIORITY_MIN; ICCOM_PRIORITY_MAX] the message
+//      priority, the more urgent messages are sent before the less
+//      urgent ones of all channels. The messages sent via other calls
+//      get ICCOM_PRIORITY_DEFAULT.
+// @flags see @iccom_send_data_nocopy_flags
+//
+// RETURNS:
+//      0: on success
+//      <0: negated error code, if fails
+int iccom_send_data_nocopy_prio(const int sock_fd, const void *const buf
+               , const size_t buf_size_bytes
+               , const size_t data_offset
+               , const size_t data_size_bytes
+               , const unsigned int priority
+               , const int flags);
+
 
 // Sends the data to the given iccom socket. Not efficient
 // as long as it allocates buffer memory and performs memcpy
@@ -338,6 +457,17 @@ int iccom_send_data_nocopy(const int sock_fd, const void *const buf
 int iccom_send_data(const int sock_fd, const void *const data
             , const  size_t data_size_bytes);
 
+// The same as @iccom_send_data(...), but with the message priority.
+//
+// @priority see @iccom_send_data_nocopy_prio
+//
+// RETURNS:
+//      0: on success
+//      <0: negated error code, if fails
+int iccom_send_data_prio(const int sock_fd, const void *const data
+            , const size_t data_size_bytes
+            , const unsigned int priority);
+
 // RETURNS:
 //      the offset of the consumer payload data in the buffer
 //      which contains the full transportation ready message
@@ -401,7 +531,7 @@ static inline size_t iccom_get_max_payload_size(void)
 //           when succeeded,
 //           NOTE: the timeout is not interpreted as an error
 //              the 0 data size will be simply returned in case
-//              of timeout.
+//              of timeout (or no data on the non-blocking socket).
 //           NOTE:
 //              ICCOM OVER TCP:
 //                  + OR the socket has been closed, 0 also will be
@@ -409,6 +539,10 @@ static inline size_t iccom_get_max_payload_size(void)
 //                    will not be respected.
 //      <0: negated error code, when failed
 //           NOTE: the timeout is not interpreted as an error
+//           NOTE: the error of the message earlier sent via the
+//              socket is also returned here, if it was not taken by
+//              the send (see @iccom_send_data_nocopy), say -EAGAIN if
+//              the message was dropped due to ICCom TX queue is full.
 int iccom_receive_data_nocopy(
         const int sock_fd, void *const receive_buffer
         , const size_t buffer_size, int *const data_offset__out);
@@ -441,6 +575,8 @@ int __iccom_receive_data_pure(const int sock_fd, void *const receive_buffer
 // XXXXXXXXXXXXXXXX            XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX
 // ----------------------- HW --------------------------------------------
 // NOTE: THE HW PATHS ARE CUT OUT FROM SRC AND DST REGION
+// NOTE: replaces all loopback rules with the given one, to loop
+//      several channel regions at once see @iccom_loopback_add
 //
 // @from_ch {valid, [ICCOM_MIN_CHANNEL; ICCOM_MAX_CHANNEL]} the source
 //  channel region first channel
@@ -468,7 +604,8 @@ int iccom_loopback_disable(void);
 //      0: loopback is disabled / any error happened
 char iccom_loopback_is_active(void);
 
-// Get the loopback current configuration.
+// Get the loopback current configuration (the first rule if there
+// are many, see @iccom_loopback_get_all).
 // @out {valid ptr to struct loopback_cfg) points to the struct where to
 //  write the execution results.
 //
@@ -477,6 +614,60 @@ char iccom_loopback_is_active(void);
 //      <0: negated error code (out data is undefined)
 int iccom_loopback_get(loopback_cfg *const out);
 
+// Adds one more loopback rule (see @iccom_loopback_enable for the
+// rule description), so several channel regions can be looped at
+// once while other channels still go to the other side.
+//
+// NOTE: the regions (both source and destination ones) of all rules
+//      must not overlap.
+// NOTE: @iccom_loopback_enable replaces all rules with the single one,
+//      @iccom_loopback_disable removes all rules.
+//
+// RETURNS:
+//      >=0: on success
+//      <0: on failure (negated error code)
+//          -EEXIST: the rule overlaps one of existing rules
+//          -ENOSPC: max number of rules reached
+int iccom_loopback_add(const unsigned int from_ch, const unsigned int to_ch
+              , const int range_shift);
+
+// Removes the loopback rule of the given source channel region (see
+// @iccom_loopback_add).
+//
+// RETURNS:
+//      >=0: on success
+//      <0: on failure (negated error code)
+//          -ENOENT: no such rule
+int iccom_loopback_remove(const unsigned int from_ch
+              , const unsigned int to_ch);
+
+// Gets all loopback rules.
+//
+// @out {valid ptr to array of @max_count struct loopback_cfg || NULL if
+//      @max_count is 0} points to the array where to write the rules.
+// @max_count the @out array size.
+//
+// RETURNS:
+//      >=0: the number of rules (might be bigger than @max_count, then
+//          only first @max_count rules are written to @out)
+//      <0: negated error code
+int iccom_loopback_get_all(loopback_cfg *const out
+              , const unsigned int max_count);
+
+// Gets the ICCom TX queue fill state, so the producers can adapt
+// their TX rate to the link before the messages start being dropped
+// or the sends start blocking (see @iccom_send_data_nocopy).
+//
+// @queued_bytes__out {valid ptr || NULL}:OUT the number of the messages
+//      data bytes pending to be sent to the other side (all channels)
+// @max_bytes__out {valid ptr || NULL}:OUT the TX queue limit in bytes
+//
+// RETURNS:
+//      >=0: all is OK (out data can be used only in this case)
+//      <0: negated error code (out data is undefined)
+int iccom_get_tx_queue_state(size_t *const queued_bytes__out
+                             , size_t *const max_bytes__out);
+
 
 #ifdef __cplusplus
 }
@@ -530,6 +721,8 @@ namespace
 //      padding for netlink allignment, we can not use its size to determine
 //      actual size of the output data provided by user, so this variable
 //      tracks the size of the data actually provided by user.
+// @m_priority the priority of the messages sent via the socket, see
+//      @iccom_send_data_nocopy_prio
 // @m_debug if true, then debug printing is enabled, otherwise - disabled
 class IccomSocket
 {
@@ -556,6 +749,9 @@ public:
     int set_write_timeout(const int ms);
     int write_timeout();
 
+    int set_priority(const unsigned int priority);
+    inline unsigned int priority();
+
     void set_dbg_mode(const bool dbg_mode);
 
     void print_channel_data(const bool incoming
@@ -585,6 +781,7 @@ private:
     std::vector<char> m_incoming_data;
     std::vector<char> m_outgoing_data;
     size_t m_outgoing_payload_size;
+    unsigned int m_priority;
     bool m_dbg;
 };
 
@@ -598,6 +795,7 @@ private:
 //      output data: empty
 //      input data: empty
 //      debug mode: disabled
+//      priority: ICCOM_PRIORITY_DEFAULT
 //      socket: not opened
 //
 // THROWS:
@@ -611,6 +809,7 @@ IccomSocket::IccomSocket(const unsigned int channel):
         , m_incoming_data{}
         , m_outgoing_data{}
         , m_outgoing_payload_size{0}
+        , m_priority{ICCOM_PRIORITY_DEFAULT}
         , m_dbg{false}
 {
     this->m_sock_fd = -1;
@@ -701,12 +900,13 @@ int IccomSocket::send(const bool reset_message_on_success)
     if (m_outgoing_payload_size == 0) {
         return 0;
     }
-    int res = iccom_send_data_nocopy(
+    int res = iccom_send_data_nocopy_prio(
             this->m_sock_fd
             , this->m_outgoing_data.data()
             , this->m_outgoing_data.size()
             , NLMSG_LENGTH(0)
-            , m_outgoing_payload_size);
+            , m_outgoing_payload_size
+            , this->m_priority, 0);
     if (res < 0) {
         return res;
     }
@@ -777,7 +977,8 @@ int IccomSocket::send_direct(
     if (!this->is_open()) {
            return -EBADFD;
     }
-    return iccom_send_data(this->m_sock_fd, data.data(), data.size());
+    return iccom_send_data_prio(this->m_sock_fd, data.data(), data.size()
+                                , this->m_priority);
 }
 
 // Wrapper of @iccom_send_data for current channel
@@ -793,7 +994,8 @@ int IccomSocket::send_direct(const char *data, size_t len)
     if (!this->is_open()) {
            return -EBADFD;
     }
-    return iccom_send_data(this->m_sock_fd, data, len);
+    return iccom_send_data_prio(this->m_sock_fd, data, len
+                                , this->m_priority);
 }
 
 // Wrapper of @__iccom_receive_data_pure for current channel
@@ -906,6 +1108,30 @@ int IccomSocket::write_timeout()
     return iccom_get_socket_write_timeout(this->m_sock_fd);
 }
 
+// Sets the priority of the messages sent via the socket from now on.
+//
+// @priority [ICCOM_PRIORITY_MIN; ICCOM_PRIORITY_MAX] see
+//      @iccom_send_data_nocopy_prio
+//
+// RETURNS:
+//      0: on success
+//      <0: a negated error code
+int IccomSocket::set_priority(const unsigned int priority)
+{
+    if (priority > ICCOM_PRIORITY_MAX) {
+        return -EINVAL;
+    }
+    this->m_priority = priority;
+    return 0;
+}
+
+// RETURNS:
+//      the priority of the messages sent via the socket
+inline unsigned int IccomSocket::priority()
+{
+    return this->m_priority;
+}
+
 // Sets the debug printing mode.
 //
 // In dbg mode on every receive/send the corresponding
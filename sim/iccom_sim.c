@@ -0,0 +1,739 @@
+/*
+ * This file implements the ICCom protocol simulation: two ICCom
+ * instances connected through the simulated full duplex link
+ * exchange the generated messages. Used to benchmark (throughput,
+ * latency) and fuzz the protocol logic without SymSPI hardware.
+ *
+ * Copyright (c) 2026 The iccom-utils contributors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// SPDX-License-Identifier: GPL-2.0
+
+// Every generated message carries the header (struct sim_msg_header)
+// followed by the payload pattern derived from the message sequence
+// number, so the receiver verifies the message integrity, the in
+// channel order and measures the delivery latency (in virtual time).
+//
+// All time is virtual: the link moves the time forward by the xfers
+// durations, so the results do not depend on the host performance.
+
+#include <getopt.h>
+
+#include <linux/kernel.h>
+
+#include "iccom.h"
+#include "sim_full_duplex.h"
+
+/* ------------------------- CONFIGURATION ------------------------------*/
+
+// the max number of channels the messages are spread over
+#define SIM_CHANNELS_MAX 64
+// the first channel to be used by the simulation
+#define SIM_CHANNEL_FIRST 1
+// The number of message priority classes, the message with sequence
+// number seq is of class c = seq % SIM_PRIORITY_CLASSES and is posted
+// with priority c * 100 / (SIM_PRIORITY_CLASSES - 1), so
+// every class maps to its own ICCom TX priority level (with default
+// ICCOM_TX_PRIORITY_LEVELS_COUNT). The in channel order is verified
+// within the class, since the more urgent messages overtake.
+#define SIM_PRIORITY_CLASSES 4
+// The fuzzed offered load is kept within 1 / SIM_FUZZ_LINK_SHARE of
+// the link raw bitrate (see __sim_fuzz_config).
+#define SIM_FUZZ_LINK_SHARE 4
+
+// The traffic configuration (same for both directions).
+//
+// @messages the number of messages to be sent by every side
+// @size_min {>= sizeof(struct sim_msg_header)} the min message size
+// @size_max {>= @size_min} the max message size
+// @channels {[1; SIM_CHANNELS_MAX]} the number of channels to use
+// @rate the messages per second posted by every side, 0 means all
+//      messages are posted at once (throughput mode)
+// @time_limit_ms the virtual time (msec) given to deliver the
+//      messages after the last message was posted
+struct sim_traffic_config {
+	unsigned int messages;
+	size_t size_min;
+	size_t size_max;
+	unsigned int channels;
+	unsigned int rate;
+	unsigned int time_limit_ms;
+};
+
+/* ------------------------- STRUCTURES ---------------------------------*/
+
+// The generated message header.
+//
+// @seq the message sequence number within the direction
+// @channel_seq the message sequence number within the channel and
+//      the priority class (the class is @seq % SIM_PRIORITY_CLASSES)
+// @post_ns the virtual time the message was posted at
+struct sim_msg_header {
+	u32 seq;
+	u32 channel_seq;
+	s64 post_ns;
+} __attribute__((packed));
+
+// The single side of the simulation (sender of one direction and
+// receiver of the other one).
+//
+// @iccom the ICCom instance of the side
+// @name the side name
+// @posted the number of messages posted
+// @posted_bytes the number of bytes posted
+// @rejected the number of messages rejected by iccom_post_message
+// @next_post_ns the virtual time to post the next message at
+// @channel_tx_seq per channel and priority class sequence numbers of
+//      sent messages
+// @delivered the number of messages received
+// @delivered_bytes the number of bytes received
+// @corrupted the number of received messages with broken data
+// @reordered the number of received messages out of channel order
+// @channel_rx_seq per channel and priority class next expected
+//      sequence numbers
+// @latencies_ns the delivery latencies of received messages
+// @latencies_cap the @latencies_ns capacity
+// @class_latencies_ns the delivery latencies of received messages
+//      of every priority class
+// @class_delivered the number of messages received of every priority
+//      class
+// @first_rx_ns the virtual time of the first message received
+// @last_rx_ns the virtual time of the last message received
+// @tx_queued_bytes the bytes left in the ICCom TX queue when the run
+//      ended
+struct sim_side {
+	struct iccom_dev iccom;
+	const char *name;
+
+	unsigned int posted;
+	unsigned long long posted_bytes;
+	unsigned int rejected;
+	s64 next_post_ns;
+	u32 channel_tx_seq[SIM_CHANNELS_MAX][SIM_PRIORITY_CLASSES];
+
+	unsigned int delivered;
+	unsigned long long delivered_bytes;
+	unsigned int corrupted;
+	unsigned int reordered;
+	u32 channel_rx_seq[SIM_CHANNELS_MAX][SIM_PRIORITY_CLASSES];
+	s64 *latencies_ns;
+	unsigned int latencies_cap;
+	s64 *class_latencies_ns[SIM_PRIORITY_CLASSES];
+	unsigned int class_delivered[SIM_PRIORITY_CLASSES];
+	s64 first_rx_ns;
+	s64 last_rx_ns;
+	size_t tx_queued_bytes;
+};
+
+// The simulation run.
+//
+// @traffic the traffic configuration
+// @link the link between sides
+// @side the sides
+// @rng_state the traffic random generator state
+// @start_ns the virtual time the run started at
+// @deadline_expired the run was stopped by the delivery time limit,
+//      so the messages not delivered by then were still on the way
+//      (expired), and not lost by the link going idle
+// @verbose print the per side ICCom statistics at the end
+struct sim_run {
+	struct sim_traffic_config traffic;
+	struct sim_link link;
+	struct sim_side side[2];
+	unsigned long long rng_state;
+	s64 start_ns;
+	bool deadline_expired;
+	bool verbose;
+};
+
+/* ------------------------- TRAFFIC ------------------------------------*/
+
+// RETURNS:
+//      the next pseudo random number of the traffic (xorshift64*)
+static unsigned long long __sim_rand(struct sim_run *run)
+{
+	unsigned long long x = run->rng_state;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	run->rng_state = x;
+	return x * 0x2545F4914F6CDD1DULL;
+}
+
+// RETURNS:
+//      the payload byte @idx of the message @seq
+static inline unsigned char __sim_pattern(const u32 seq, const size_t idx)
+{
+	return (unsigned char)(seq * 131 + idx);
+}
+
+// Helper. Posts the next message of the @side.
+static void __sim_post(struct sim_run *run, struct sim_side *side)
+{
+	const struct sim_traffic_config *cfg = &run->traffic;
+	const size_t size = cfg->size_min
+			    + __sim_rand(run) % (cfg->size_max - cfg->size_min + 1);
+	const unsigned int ch_idx = __sim_rand(run) % cfg->channels;
+	const unsigned int prio_class = side->posted % SIM_PRIORITY_CLASSES;
+	const unsigned int priority = prio_class * 100
+				      / (SIM_PRIORITY_CLASSES - 1);
+
+	char *data = malloc(size);
+	if (!data) {
+		side->rejected++;
+		side->posted++;
+		return;
+	}
+
+	struct sim_msg_header hdr = {
+		.seq = side->posted
+		, .channel_seq = side->channel_tx_seq[ch_idx][prio_class]
+		, .post_ns = ktime_to_ns(ktime_get())
+	};
+	memcpy(data, &hdr, sizeof(hdr));
+	for (size_t i = sizeof(hdr); i < size; i++) {
+		data[i] = __sim_pattern(hdr.seq, i);
+	}
+
+	const int res = iccom_post_message(&side->iccom, data, size
+					   , SIM_CHANNEL_FIRST + ch_idx
+					   , priority);
+	free(data);
+
+	side->posted++;
+	if (res < 0) {
+		side->rejected++;
+		return;
+	}
+	side->channel_tx_seq[ch_idx][prio_class]++;
+	side->posted_bytes += size;
+}
+
+// ICCom message ready callback: verifies the received message.
+static bool __sim_msg_ready(unsigned int channel, void *msg_data
+			    , size_t msg_len, void *consumer_data)
+{
+	struct sim_side *side = (struct sim_side *)consumer_data;
+	const unsigned char *data = (const unsigned char *)msg_data;
+	const unsigned int ch_idx = channel - SIM_CHANNEL_FIRST;
+	const s64 now_ns = ktime_to_ns(ktime_get());
+	struct sim_msg_header hdr;
+
+	if (msg_len < sizeof(hdr) || ch_idx >= SIM_CHANNELS_MAX) {
+		side->corrupted++;
+		return false;
+	}
+	memcpy(&hdr, data, sizeof(hdr));
+	for (size_t i = sizeof(hdr); i < msg_len; i++) {
+		if (data[i] != __sim_pattern(hdr.seq, i)) {
+			side->corrupted++;
+			return false;
+		}
+	}
+
+	// NOTE: duplicates are also out of order
+	const unsigned int prio_class = hdr.seq % SIM_PRIORITY_CLASSES;
+	u32 *rx_seq = &side->channel_rx_seq[ch_idx][prio_class];
+	if (hdr.channel_seq != *rx_seq
+	    || side->delivered >= side->latencies_cap) {
+		side->reordered++;
+	}
+	*rx_seq = hdr.channel_seq + 1;
+
+	if (side->delivered == 0) {
+		side->first_rx_ns = now_ns;
+	}
+	side->last_rx_ns = now_ns;
+	if (side->delivered < side->latencies_cap) {
+		const unsigned int c = prio_class;
+
+		side->latencies_ns[side->delivered] = now_ns - hdr.post_ns;
+		side->class_latencies_ns[c][side->class_delivered[c]++]
+			= now_ns - hdr.post_ns;
+	}
+	side->delivered++;
+	side->delivered_bytes += msg_len;
+
+	// the data ownership remains in ICCom
+	return false;
+}
+
+/* ------------------------- RUN ----------------------------------------*/
+
+// RETURNS:
+//      true: if all messages were delivered
+static bool __sim_done(const struct sim_run *run)
+{
+	for (int i = 0; i < 2; i++) {
+		const struct sim_side *tx = &run->side[i];
+		const struct sim_side *rx = &run->side[1 - i];
+
+		if (tx->posted < run->traffic.messages
+		    || rx->delivered + rx->corrupted
+		       < tx->posted - tx->rejected) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Helper. Posts the messages due by the current virtual time.
+//
+// RETURNS:
+//      the virtual time of the next post, or -1 if all messages
+//      are posted
+static s64 __sim_post_due(struct sim_run *run)
+{
+	const s64 now_ns = ktime_to_ns(ktime_get());
+	const s64 interval_ns = run->traffic.rate
+				? NSEC_PER_SEC / run->traffic.rate : 0;
+	s64 next_ns = -1;
+
+	for (int i = 0; i < 2; i++) {
+		struct sim_side *side = &run->side[i];
+
+		while (side->posted < run->traffic.messages
+		       && side->next_post_ns <= now_ns) {
+			__sim_post(run, side);
+			side->next_post_ns += interval_ns;
+		}
+		if (side->posted < run->traffic.messages
+		    && (next_ns < 0 || side->next_post_ns < next_ns)) {
+			next_ns = side->next_post_ns;
+		}
+	}
+	return next_ns;
+}
+
+// Sets up the sides and the link of the run.
+//
+// RETURNS:
+//      0: on success
+//      <0: negated error code
+static int sim_run_init(struct sim_run *run)
+{
+	static const char *names[] = { "A", "B" };
+	const s64 now_ns = ktime_to_ns(ktime_get());
+
+	run->start_ns = now_ns;
+	run->deadline_expired = false;
+
+	for (int i = 0; i < 2; i++) {
+		struct sim_side *side = &run->side[i];
+
+		memset(side, 0, sizeof(*side));
+		side->name = names[i];
+		side->next_post_ns = now_ns;
+		side->latencies_ns = calloc(run->traffic.messages + 1
+					    , sizeof(*side->latencies_ns));
+		if (!side->latencies_ns) {
+			return -ENOMEM;
+		}
+		side->latencies_cap = run->traffic.messages;
+		for (int c = 0; c < SIM_PRIORITY_CLASSES; c++) {
+			side->class_latencies_ns[c]
+				= calloc(run->traffic.messages + 1
+					 , sizeof(*side->class_latencies_ns[c]));
+			if (!side->class_latencies_ns[c]) {
+				return -ENOMEM;
+			}
+		}
+	}
+
+	for (int i = 0; i < 2; i++) {
+		struct sim_side *side = &run->side[i];
+
+		int res = iccom_init_binded(&side->iccom
+					    , &sim_full_duplex_iface
+					    , &run->link.side[i]);
+		if (res < 0) {
+			fprintf(stderr, "%s: iccom init failed: %d\n"
+				, side->name, res);
+			return res;
+		}
+		res = iccom_set_channel_callback(&side->iccom
+						 , ICCOM_ANY_CHANNEL_VALUE
+						 , &__sim_msg_ready, side);
+		if (res < 0) {
+			fprintf(stderr, "%s: callback setup failed: %d\n"
+				, side->name, res);
+			return res;
+		}
+	}
+	return 0;
+}
+
+// Runs the traffic till all messages are delivered, the link goes
+// idle with nothing more to post, or the time limit is reached.
+static void sim_run_traffic(struct sim_run *run)
+{
+	const s64 limit_ns = (s64)run->traffic.time_limit_ms * NSEC_PER_MSEC;
+	s64 last_post_ns = ktime_to_ns(ktime_get());
+
+	while (!__sim_done(run)) {
+		const s64 next_post_ns = __sim_post_due(run);
+		const s64 now_ns = ktime_to_ns(ktime_get());
+
+		if (next_post_ns >= 0) {
+			last_post_ns = now_ns;
+		} else if (now_ns - last_post_ns > limit_ns) {
+			run->deadline_expired = true;
+			break;
+		}
+
+		if (sim_link_step(&run->link)) {
+			continue;
+		}
+		// the link is idle
+		if (next_post_ns < 0) {
+			break;
+		}
+		kshim_time_advance_ns(next_post_ns - now_ns);
+	}
+
+	for (int i = 0; i < 2; i++) {
+		iccom_get_tx_queue_state(&run->side[i].iccom
+					 , &run->side[i].tx_queued_bytes, NULL);
+	}
+}
+
+static void sim_run_close(struct sim_run *run)
+{
+	for (int i = 0; i < 2; i++) {
+		if (run->verbose) {
+			const bool log_enabled = kshim_log_enabled;
+
+			kshim_log_enabled = true;
+			fprintf(stderr, "--- side %s ICCom statistics ---\n"
+				, run->side[i].name);
+			iccom_print_statistics(&run->side[i].iccom);
+			kshim_log_enabled = log_enabled;
+		}
+		iccom_close_binded(&run->side[i].iccom);
+	}
+	kshim_run_works();
+	sim_link_close(&run->link);
+	for (int i = 0; i < 2; i++) {
+		free(run->side[i].latencies_ns);
+		run->side[i].latencies_ns = NULL;
+		for (int c = 0; c < SIM_PRIORITY_CLASSES; c++) {
+			free(run->side[i].class_latencies_ns[c]);
+			run->side[i].class_latencies_ns[c] = NULL;
+		}
+	}
+}
+
+/* ------------------------- REPORT -------------------------------------*/
+
+static int __sim_cmp_s64(const void *a, const void *b)
+{
+	const s64 x = *(const s64 *)a;
+	const s64 y = *(const s64 *)b;
+
+	return (x > y) - (x < y);
+}
+
+// Prints the direction @tx -> @rx report.
+//
+// RETURNS:
+//      true: if the direction had no failures (no message was lost,
+//          corrupted or reordered, the ones still on the way at the
+//          delivery deadline don't count)
+static bool __sim_report_direction(const struct sim_run *run
+				   , const struct sim_side *tx
+				   , struct sim_side *rx)
+{
+	const unsigned int sent = tx->posted - tx->rejected;
+	const unsigned int missing = sent > rx->delivered + rx->corrupted
+				     ? sent - rx->delivered - rx->corrupted : 0;
+	// the messages still on the way at the deadline are not lost
+	const unsigned int expired = run->deadline_expired ? missing : 0;
+	const unsigned int lost = missing - expired;
+	const s64 span_ns = max(rx->last_rx_ns - run->start_ns, 1LL);
+
+	printf("%s->%s: posted %u (rejected %u), delivered %u, lost %u"
+	       ", expired %u, corrupted %u, reordered %u\n"
+	       , tx->name, rx->name, tx->posted, tx->rejected
+	       , rx->delivered, lost, expired, rx->corrupted, rx->reordered);
+	if (expired) {
+		printf("      delivery deadline expired, %zu bytes still in"
+		       " the %s TX queue\n", tx->tx_queued_bytes, tx->name);
+	}
+
+	if (rx->delivered) {
+		s64 *lat = rx->latencies_ns;
+		const unsigned int n = min(rx->delivered, rx->latencies_cap);
+		s64 sum = 0;
+
+		qsort(lat, n, sizeof(*lat), &__sim_cmp_s64);
+		for (unsigned int i = 0; i < n; i++) {
+			sum += lat[i];
+		}
+		printf("      throughput %.1f KiB/s, latency us: min %lld"
+		       ", avg %lld, p50 %lld, p99 %lld, max %lld\n"
+		       , (double)rx->delivered_bytes / 1024.0
+			 * NSEC_PER_SEC / (double)span_ns
+		       , lat[0] / NSEC_PER_USEC
+		       , sum / n / NSEC_PER_USEC
+		       , lat[n / 2] / NSEC_PER_USEC
+		       , lat[(n - 1) * 99 / 100] / NSEC_PER_USEC
+		       , lat[n - 1] / NSEC_PER_USEC);
+
+		printf("      latency us p50/p99 by priority class:");
+		for (int c = 0; c < SIM_PRIORITY_CLASSES; c++) {
+			const unsigned int cn = rx->class_delivered[c];
+
+			lat = rx->class_latencies_ns[c];
+			if (cn == 0) {
+				printf(" %d: -", c);
+				continue;
+			}
+			qsort(lat, cn, sizeof(*lat), &__sim_cmp_s64);
+			printf(" %d: %lld/%lld", c
+			       , lat[cn / 2] / NSEC_PER_USEC
+			       , lat[(cn - 1) * 99 / 100] / NSEC_PER_USEC);
+		}
+		printf("\n");
+	}
+
+	// the messages which are still on the way are not a failure
+	return lost == 0 && rx->corrupted == 0 && rx->reordered == 0;
+}
+
+// Prints the run report.
+//
+// RETURNS:
+//      true: if the run had no failures
+static bool sim_run_report(struct sim_run *run)
+{
+	const struct sim_link_stats *ls = &run->link.stats;
+	const s64 now_ns = ktime_to_ns(ktime_get()) - run->start_ns;
+
+	printf("link: xfers %llu (failed %llu), bytes %llu, bits flipped %llu"
+	       ", busy %.1f%%, virtual time %.3f ms\n"
+	       , ls->xfers, ls->xfers_failed, ls->bytes, ls->bits_flipped
+	       , now_ns ? 100.0 * (double)ls->busy_ns / (double)now_ns : 0.0
+	       , (double)now_ns / NSEC_PER_MSEC);
+	if (ls->glitches) {
+		printf("link recovery: glitches %llu, missed indications %llu"
+		       ", resync collisions %llu, recovery %.3f ms\n"
+		       , ls->glitches, ls->indications_missed
+		       , ls->resync_collisions
+		       , (double)ls->recovery_ns / NSEC_PER_MSEC);
+	}
+
+	const bool ok_ab = __sim_report_direction(run, &run->side[0]
+						  , &run->side[1]);
+	const bool ok_ba = __sim_report_direction(run, &run->side[1]
+						  , &run->side[0]);
+	return ok_ab && ok_ba;
+}
+
+/* ------------------------- MAIN ---------------------------------------*/
+
+static void sim_usage(const char *prog)
+{
+	printf("%s - ICCom protocol simulation over the simulated link.\n"
+	       "Usage: %s [options]\n"
+	       "  -n <count>      messages sent by every side (1000)\n"
+	       "  -s <min>[:<max>] message size range, bytes (16:512)\n"
+	       "  -c <channels>   number of channels to use (4)\n"
+	       "  -r <rate>       messages per second per side,\n"
+	       "                  0: post all at once (0)\n"
+	       "  -t <ms>         delivery time limit after the last"
+	       " post (10000)\n"
+	       "  -e <ber>        link bit error rate (0)\n"
+	       "  -l <us>         link per xfer latency (20)\n"
+	       "  -j <us>         link per xfer jitter (0)\n"
+	       "  -b <bps>        link bitrate (10000000)\n"
+	       "  -g <rate>       probability of the xfer to fail on one"
+	       " side only (0)\n"
+	       "  -R <edges>[:<us>] error indication flag falling edges"
+	       " and the\n"
+	       "                  silence after it, as SymSPI fast resync"
+	       " does (3:1000)\n"
+	       "  -S <seed>       random seed (1)\n"
+	       "  -f <runs>       fuzz: make <runs> runs with random"
+	       " link and traffic\n"
+	       "                  configuration (seeds from <seed>)\n"
+	       "  -v              print the ICCom statistics at the end\n"
+	       "  -k              print the ICCom kernel log\n"
+	       "Exit code is 0 when no message was lost, corrupted or"
+	       " reordered\n"
+	       "(the messages still on the way at the time limit don't"
+	       " count).\n"
+	       , prog, prog);
+}
+
+// Randomizes the run configuration for fuzzing. The offered load is
+// kept below the link capacity and the time limit covers the expected
+// transfer time, so the runs are not expected to expire.
+//
+// @time_limit_ms the time limit given by user, the run gets at least
+//      this one
+static void __sim_fuzz_config(struct sim_run *run
+			      , const unsigned int time_limit_ms)
+{
+	static const double bers[] = { 0.0, 1e-7, 1e-6, 1e-5, 1e-4 };
+	struct sim_link_config *lc = &run->link.config;
+	struct sim_traffic_config *tc = &run->traffic;
+
+	lc->bit_error_rate = bers[__sim_rand(run) % ARRAY_SIZE(bers)];
+	lc->latency_us = __sim_rand(run) % 200;
+	lc->jitter_us = __sim_rand(run) % 200;
+	lc->bitrate_bps = 1000000 + __sim_rand(run) % 20000000;
+	lc->seed = __sim_rand(run);
+
+	tc->size_min = sizeof(struct sim_msg_header)
+		       + __sim_rand(run) % 64;
+	tc->size_max = tc->size_min + __sim_rand(run) % 4096;
+	tc->channels = 1 + __sim_rand(run) % 8;
+	tc->rate = (__sim_rand(run) % 2) ? 0 : 100 + __sim_rand(run) % 5000;
+
+	// the consumer data rate the link is sure to carry (bytes/s): a
+	// quarter of the raw bitrate leaves room for the packages
+	// overhead, acks and resends on errors
+	const u64 capacity = max(lc->bitrate_bps / 8 / SIM_FUZZ_LINK_SHARE
+				 , 1UL);
+	const u64 size_avg = (tc->size_min + tc->size_max) / 2;
+
+	if (tc->rate) {
+		tc->rate = (unsigned int)min((u64)tc->rate
+					     , max(capacity / size_avg
+						   , (u64)1));
+	}
+	tc->time_limit_ms = time_limit_ms
+			    + (unsigned int)(2 * (u64)tc->messages * size_avg
+					     * MSEC_PER_SEC / capacity);
+}
+
+int main(int argc, char *argv[])
+{
+	struct sim_run run;
+	unsigned long long seed = 1;
+	unsigned int fuzz_runs = 0;
+	int opt;
+
+	memset(&run, 0, sizeof(run));
+	run.traffic = (struct sim_traffic_config){
+		.messages = 1000
+		, .size_min = 16
+		, .size_max = 512
+		, .channels = 4
+		, .rate = 0
+		, .time_limit_ms = 10000
+	};
+	run.link.config = (struct sim_link_config){
+		.bit_error_rate = 0.0
+		, .latency_us = 20
+		, .jitter_us = 0
+		, .bitrate_bps = 10000000
+		, .glitch_rate = 0.0
+		, .recovery_edges = 3
+		, .recovery_pulse_us = 10
+		, .recovery_silence_us = 1000
+		, .peer_window_us = 1000
+		, .peer_wait_timeout_us = 30000
+	};
+
+	while ((opt = getopt(argc, argv, "n:s:c:r:t:e:l:j:b:g:R:S:f:vkh")) != -1) {
+		switch (opt) {
+		case 'n': run.traffic.messages = strtoul(optarg, NULL, 0); break;
+		case 's': {
+			char *end;
+			run.traffic.size_min = strtoul(optarg, &end, 0);
+			run.traffic.size_max = *end == ':'
+					       ? strtoul(end + 1, NULL, 0)
+					       : run.traffic.size_min;
+			break;
+		}
+		case 'c': run.traffic.channels = strtoul(optarg, NULL, 0); break;
+		case 'r': run.traffic.rate = strtoul(optarg, NULL, 0); break;
+		case 't': run.traffic.time_limit_ms = strtoul(optarg, NULL, 0); break;
+		case 'e': run.link.config.bit_error_rate = strtod(optarg, NULL); break;
+		case 'l': run.link.config.latency_us = strtoul(optarg, NULL, 0); break;
+		case 'j': run.link.config.jitter_us = strtoul(optarg, NULL, 0); break;
+		case 'b': run.link.config.bitrate_bps = strtoul(optarg, NULL, 0); break;
+		case 'g': run.link.config.glitch_rate = strtod(optarg, NULL); break;
+		case 'R': {
+			char *end;
+			run.link.config.recovery_edges = strtoul(optarg, &end, 0);
+			if (*end == ':') {
+				run.link.config.recovery_silence_us
+					= strtoul(end + 1, NULL, 0);
+			}
+			break;
+		}
+		case 'S': seed = strtoull(optarg, NULL, 0); break;
+		case 'f': fuzz_runs = strtoul(optarg, NULL, 0); break;
+		case 'v': run.verbose = true; break;
+		case 'k': kshim_log_enabled = true; break;
+		default:
+			sim_usage(argv[0]);
+			return opt == 'h' ? 0 : 2;
+		}
+	}
+
+	if (run.traffic.size_min < sizeof(struct sim_msg_header)
+	    || run.traffic.size_max < run.traffic.size_min
+	    || run.traffic.channels == 0
+	    || run.traffic.channels > SIM_CHANNELS_MAX
+	    || run.link.config.bitrate_bps == 0) {
+		fprintf(stderr, "invalid configuration: message size must be"
+			" >= %zu, channels within [1; %d], bitrate > 0\n"
+			, sizeof(struct sim_msg_header), SIM_CHANNELS_MAX);
+		return 2;
+	}
+
+	const unsigned int runs = fuzz_runs ? fuzz_runs : 1;
+	const unsigned int time_limit_ms = run.traffic.time_limit_ms;
+	unsigned int failed = 0;
+
+	for (unsigned int i = 0; i < runs; i++) {
+		run.rng_state = (seed + i) * 0x9E3779B97F4A7C15ULL + 1;
+		run.link.config.seed = seed + i;
+		if (fuzz_runs) {
+			__sim_fuzz_config(&run, time_limit_ms);
+			printf("=== run %u: seed %llu, ber %g, latency %u us"
+			       ", jitter %u us, bitrate %lu, sizes %zu:%zu"
+			       ", channels %u, rate %u, time limit %u ms\n"
+			       , i, seed + i, run.link.config.bit_error_rate
+			       , run.link.config.latency_us
+			       , run.link.config.jitter_us
+			       , run.link.config.bitrate_bps
+			       , run.traffic.size_min, run.traffic.size_max
+			       , run.traffic.channels, run.traffic.rate
+			       , run.traffic.time_limit_ms);
+		}
+
+		const struct sim_link_config link_config = run.link.config;
+		sim_link_init(&run.link, &link_config);
+
+		if (sim_run_init(&run) < 0) {
+			return 1;
+		}
+		sim_run_traffic(&run);
+		if (!sim_run_report(&run)) {
+			failed++;
+		}
+		sim_run_close(&run);
+	}
+
+	if (fuzz_runs) {
+		printf("fuzz: %u of %u runs failed\n", failed, runs);
+	}
+	return failed ? 1 : 0;
+}
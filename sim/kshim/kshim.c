@@ -0,0 +1,252 @@
+/*
+ * This file implements the minimal userspace replacement of the kernel
+ * API used by the ICCom protocol driver, see kshim.h.
+ *
+ * Copyright (c) 2026 The iccom-utils contributors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// SPDX-License-Identifier: GPL-2.0
+
+#include <stdarg.h>
+
+#include "kshim.h"
+
+/* ------------------------- GLOBAL VARIABLES ---------------------------*/
+
+bool kshim_log_enabled = false;
+
+// the virtual time in nsec
+static s64 kshim_now_ns = 0;
+
+// the list of pending works in order of their scheduling
+static LIST_HEAD(kshim_pending_works);
+
+// all workqueues are the same single queue in the shim, so the
+// pointer is just a valid non-NULL cookie
+static int kshim_wq_cookie;
+struct workqueue_struct *system_wq
+		= (struct workqueue_struct *)&kshim_wq_cookie;
+struct workqueue_struct *system_highpri_wq
+		= (struct workqueue_struct *)&kshim_wq_cookie;
+
+// the procfs entries are not created, the pointer is just a valid
+// non-NULL cookie
+static int kshim_proc_cookie;
+
+/* ------------------------- LOGGING ------------------------------------*/
+
+int printk(const char *fmt, ...)
+{
+	if (!kshim_log_enabled) {
+		return 0;
+	}
+
+	va_list args;
+
+	va_start(args, fmt);
+	const int res = vfprintf(stderr, fmt, args);
+	va_end(args);
+	return res;
+}
+
+void print_hex_dump(const char *level, const char *prefix_str
+		    , int prefix_type, int rowsize, int groupsize
+		    , const void *buf, size_t len, bool ascii)
+{
+	if (!kshim_log_enabled) {
+		return;
+	}
+
+	const unsigned char *data = (const unsigned char *)buf;
+
+	if (rowsize <= 0) {
+		rowsize = 16;
+	}
+	for (size_t i = 0; i < len; i++) {
+		if (i % rowsize == 0) {
+			fprintf(stderr, "%s%s%08zx:", i ? "\n" : ""
+				, prefix_str, i);
+		}
+		fprintf(stderr, " %02x", data[i]);
+	}
+	fputc('\n', stderr);
+}
+
+/* ------------------------- MEMORY -------------------------------------*/
+
+void *kmalloc(size_t size, gfp_t flags)
+{
+	return (flags & __GFP_ZERO) ? calloc(1, size) : malloc(size);
+}
+
+void *kzalloc(size_t size, gfp_t flags)
+{
+	return calloc(1, size);
+}
+
+void *krealloc(const void *p, size_t size, gfp_t flags)
+{
+	return realloc((void *)p, size);
+}
+
+void kfree(const void *p)
+{
+	free((void *)p);
+}
+
+unsigned long copy_to_user(void __user *to, const void *from
+			   , unsigned long n)
+{
+	memcpy(to, from, n);
+	return 0;
+}
+
+unsigned long copy_from_user(void *to, const void __user *from
+			     , unsigned long n)
+{
+	memcpy(to, from, n);
+	return 0;
+}
+
+/* ------------------------- TIME ---------------------------------------*/
+
+ktime_t ktime_get(void)
+{
+	return kshim_now_ns;
+}
+
+u64 ktime_get_ns(void)
+{
+	return (u64)kshim_now_ns;
+}
+
+void kshim_time_advance_ns(const s64 delta_ns)
+{
+	if (delta_ns > 0) {
+		kshim_now_ns += delta_ns;
+	}
+}
+
+/* ------------------------- WORKQUEUES ---------------------------------*/
+
+struct workqueue_struct *alloc_workqueue(const char *fmt
+					 , unsigned int flags
+					 , int max_active, ...)
+{
+	return (struct workqueue_struct *)&kshim_wq_cookie;
+}
+
+void destroy_workqueue(struct workqueue_struct *wq)
+{
+}
+
+bool queue_work(struct workqueue_struct *wq, struct work_struct *work)
+{
+	if (!list_empty(&work->entry)) {
+		return false;
+	}
+	list_add_tail(&work->entry, &kshim_pending_works);
+	return true;
+}
+
+bool schedule_work(struct work_struct *work)
+{
+	return queue_work(system_wq, work);
+}
+
+bool cancel_work_sync(struct work_struct *work)
+{
+	if (list_empty(&work->entry)) {
+		return false;
+	}
+	list_del_init(&work->entry);
+	return true;
+}
+
+bool flush_work(struct work_struct *work)
+{
+	if (list_empty(&work->entry)) {
+		return false;
+	}
+	list_del_init(&work->entry);
+	work->func(work);
+	return true;
+}
+
+unsigned int kshim_run_works(void)
+{
+	unsigned int count = 0;
+
+	while (!list_empty(&kshim_pending_works)) {
+		struct work_struct *work = list_first_entry(
+				&kshim_pending_works, struct work_struct
+				, entry);
+
+		// the work may reschedule itself while running
+		list_del_init(&work->entry);
+		work->func(work);
+		count++;
+	}
+	return count;
+}
+
+bool kshim_works_pending(void)
+{
+	return !list_empty(&kshim_pending_works);
+}
+
+/* ------------------------- IDA ----------------------------------------*/
+
+int ida_alloc(struct ida *ida, gfp_t gfp)
+{
+	for (unsigned int id = 0; id < 64; id++) {
+		if (!(ida->used & (1ULL << id))) {
+			ida->used |= 1ULL << id;
+			return (int)id;
+		}
+	}
+	return -ENOSPC;
+}
+
+void ida_free(struct ida *ida, unsigned int id)
+{
+	if (id < 64) {
+		ida->used &= ~(1ULL << id);
+	}
+}
+
+/* ------------------------- PROCFS -------------------------------------*/
+
+struct proc_dir_entry *proc_mkdir(const char *name
+				  , struct proc_dir_entry *parent)
+{
+	return (struct proc_dir_entry *)&kshim_proc_cookie;
+}
+
+struct proc_dir_entry *proc_create_data(const char *name, umode_t mode
+		, struct proc_dir_entry *parent
+		, const struct file_operations *proc_fops, void *data)
+{
+	return (struct proc_dir_entry *)&kshim_proc_cookie;
+}
+
+void proc_remove(struct proc_dir_entry *de)
+{
+}
+
+void *PDE_DATA(const struct inode *inode)
+{
+	return inode->i_private;
+}
@@ -0,0 +1,653 @@
+/*
+ * This file provides the minimal userspace replacement of the kernel
+ * API used by the ICCom protocol driver (driver/iccom.c), so the
+ * protocol logic can be built and run as a regular userspace program
+ * (see sim/iccom_sim.c).
+ *
+ * Copyright (c) 2026 The iccom-utils contributors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// SPDX-License-Identifier: GPL-2.0
+
+// The shim is single threaded by design:
+// * all locks are no-ops,
+// * the scheduled works are not run by the scheduling call, but
+//   are queued and run by kshim_run_works(...) called from the
+//   simulation loop (like the workqueue thread would run them
+//   later),
+// * the time is virtual, and is moved only by the simulation loop
+//   via kshim_time_advance_ns(...).
+//
+// Only the default (workqueue based) ICCom work mode is supported.
+
+#ifndef KSHIM_HEADER
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+
+/* ------------------------- BASIC TYPES --------------------------------*/
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef unsigned long long u64;
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef long long s64;
+typedef u16 __be16;
+typedef u32 __be32;
+typedef unsigned int gfp_t;
+typedef unsigned short umode_t;
+typedef s64 ktime_t;
+
+#define __kernel
+#define __user
+#define __init
+#define __exit
+#define __percpu
+#define __maybe_unused __attribute__((unused))
+
+#define likely(x) __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+#define READ_ONCE(x) (*(volatile typeof(x) *)&(x))
+#define WRITE_ONCE(x, v) (*(volatile typeof(x) *)&(x) = (v))
+
+#define __stringify_1(x) #x
+#define __stringify(x) __stringify_1(x)
+
+/* ------------------------- UTILITIES ----------------------------------*/
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define min_t(t, a, b) ((t)(a) < (t)(b) ? (t)(a) : (t)(b))
+#define max_t(t, a, b) ((t)(a) > (t)(b) ? (t)(a) : (t)(b))
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#define DIV_ROUND_UP(n, d) (((n) + (d) - 1) / (d))
+#define BIT(n) (1UL << (n))
+#define container_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+#define BUILD_BUG_ON(c) ((void)sizeof(char[1 - 2 * !!(c)]))
+
+#define fls64(x) ((x) ? 64 - __builtin_clzll(x) : 0)
+
+static inline u64 div_u64(u64 dividend, u32 divisor)
+{
+	return dividend / divisor;
+}
+
+static inline u64 div64_u64(u64 dividend, u64 divisor)
+{
+	return dividend / divisor;
+}
+
+static inline void *memchr_inv(const void *s, int c, size_t n)
+{
+	const unsigned char *p = s;
+
+	for (size_t i = 0; i < n; i++) {
+		if (p[i] != (unsigned char)c) {
+			return (void *)(p + i);
+		}
+	}
+	return NULL;
+}
+
+#define clamp_t(t, v, lo, hi) min_t(t, max_t(t, v, lo), hi)
+
+// NOTE: the dividend is updated in place, the remainder is returned
+#define do_div(n, base) \
+	({ u32 __rem = (n) % (base); (n) /= (base); __rem; })
+
+#define __cpu_to_be16(x) __builtin_bswap16(x)
+#define __be16_to_cpu(x) __builtin_bswap16(x)
+#define __cpu_to_be32(x) __builtin_bswap32(x)
+#define __be32_to_cpu(x) __builtin_bswap32(x)
+#define cpu_to_be16 __cpu_to_be16
+#define be16_to_cpu __be16_to_cpu
+#define cpu_to_be32 __cpu_to_be32
+#define be32_to_cpu __be32_to_cpu
+
+/* ------------------------- ERRORS -------------------------------------*/
+
+#define MAX_ERRNO 4095
+#define ENOTSUPP 524
+
+#define IS_ERR_VALUE(x) ((unsigned long)(void *)(x) >= (unsigned long)-MAX_ERRNO)
+
+static inline void *ERR_PTR(long error)
+{
+	return (void *)error;
+}
+
+static inline long PTR_ERR(const void *ptr)
+{
+	return (long)ptr;
+}
+
+static inline bool IS_ERR(const void *ptr)
+{
+	return IS_ERR_VALUE((unsigned long)ptr);
+}
+
+static inline bool IS_ERR_OR_NULL(const void *ptr)
+{
+	return !ptr || IS_ERR_VALUE((unsigned long)ptr);
+}
+
+/* ------------------------- LOGGING ------------------------------------*/
+
+#define KERN_DEBUG ""
+#define KERN_INFO ""
+#define KERN_WARNING ""
+#define KERN_ERR ""
+#define KERN_CONT ""
+
+#define DUMP_PREFIX_NONE 0
+#define DUMP_PREFIX_OFFSET 1
+#define DUMP_PREFIX_ADDRESS 2
+
+// The kernel log output is written to stderr only when enabled.
+extern bool kshim_log_enabled;
+
+int printk(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+#define pr_err(fmt, ...) printk(fmt, ##__VA_ARGS__)
+#define pr_warn(fmt, ...) printk(fmt, ##__VA_ARGS__)
+#define pr_info(fmt, ...) printk(fmt, ##__VA_ARGS__)
+#define pr_cont(fmt, ...) printk(fmt, ##__VA_ARGS__)
+
+void print_hex_dump(const char *level, const char *prefix_str
+		    , int prefix_type, int rowsize, int groupsize
+		    , const void *buf, size_t len, bool ascii);
+
+/* ------------------------- MEMORY -------------------------------------*/
+
+#define GFP_KERNEL 0x0u
+#define GFP_ATOMIC 0x1u
+#define __GFP_ZERO 0x100u
+
+void *kmalloc(size_t size, gfp_t flags);
+void *kzalloc(size_t size, gfp_t flags);
+void *krealloc(const void *p, size_t size, gfp_t flags);
+void kfree(const void *p);
+
+unsigned long copy_to_user(void __user *to, const void *from
+			   , unsigned long n);
+unsigned long copy_from_user(void *to, const void __user *from
+			     , unsigned long n);
+
+/* ------------------------- LISTS --------------------------------------*/
+
+struct list_head {
+	struct list_head *next, *prev;
+};
+
+#define LIST_HEAD_INIT(name) { &(name), &(name) }
+#define LIST_HEAD(name) struct list_head name = LIST_HEAD_INIT(name)
+
+static inline void INIT_LIST_HEAD(struct list_head *list)
+{
+	list->next = list;
+	list->prev = list;
+}
+
+static inline void __list_add(struct list_head *new
+			      , struct list_head *prev
+			      , struct list_head *next)
+{
+	next->prev = new;
+	new->next = next;
+	new->prev = prev;
+	prev->next = new;
+}
+
+static inline void list_add(struct list_head *new, struct list_head *head)
+{
+	__list_add(new, head, head->next);
+}
+
+static inline void list_add_tail(struct list_head *new
+				 , struct list_head *head)
+{
+	__list_add(new, head->prev, head);
+}
+
+static inline void list_del(struct list_head *entry)
+{
+	entry->next->prev = entry->prev;
+	entry->prev->next = entry->next;
+}
+
+static inline void list_del_init(struct list_head *entry)
+{
+	list_del(entry);
+	INIT_LIST_HEAD(entry);
+}
+
+static inline void list_move(struct list_head *list, struct list_head *head)
+{
+	list_del(list);
+	list_add(list, head);
+}
+
+static inline void list_move_tail(struct list_head *list
+				  , struct list_head *head)
+{
+	list_del(list);
+	list_add_tail(list, head);
+}
+
+static inline int list_empty(const struct list_head *head)
+{
+	return head->next == head;
+}
+
+static inline int list_is_singular(const struct list_head *head)
+{
+	return !list_empty(head) && (head->next == head->prev);
+}
+
+static inline void __list_splice(const struct list_head *list
+				 , struct list_head *prev
+				 , struct list_head *next)
+{
+	struct list_head *first = list->next;
+	struct list_head *last = list->prev;
+
+	first->prev = prev;
+	prev->next = first;
+	last->next = next;
+	next->prev = last;
+}
+
+static inline void list_splice(const struct list_head *list
+			       , struct list_head *head)
+{
+	if (!list_empty(list)) {
+		__list_splice(list, head, head->next);
+	}
+}
+
+static inline void list_splice_tail(const struct list_head *list
+				    , struct list_head *head)
+{
+	if (!list_empty(list)) {
+		__list_splice(list, head->prev, head);
+	}
+}
+
+static inline void list_splice_init(struct list_head *list
+				    , struct list_head *head)
+{
+	if (!list_empty(list)) {
+		__list_splice(list, head, head->next);
+		INIT_LIST_HEAD(list);
+	}
+}
+
+static inline void list_splice_tail_init(struct list_head *list
+					 , struct list_head *head)
+{
+	if (!list_empty(list)) {
+		__list_splice(list, head->prev, head);
+		INIT_LIST_HEAD(list);
+	}
+}
+
+#define list_entry(ptr, type, member) container_of(ptr, type, member)
+#define list_first_entry(ptr, type, member) \
+	list_entry((ptr)->next, type, member)
+#define list_last_entry(ptr, type, member) \
+	list_entry((ptr)->prev, type, member)
+#define list_first_entry_or_null(ptr, type, member) \
+	(list_empty(ptr) ? NULL : list_first_entry(ptr, type, member))
+#define list_next_entry(pos, member) \
+	list_entry((pos)->member.next, typeof(*(pos)), member)
+#define list_prev_entry(pos, member) \
+	list_entry((pos)->member.prev, typeof(*(pos)), member)
+#define list_for_each(pos, head) \
+	for (pos = (head)->next; pos != (head); pos = pos->next)
+#define list_for_each_safe(pos, n, head) \
+	for (pos = (head)->next, n = pos->next; pos != (head) \
+	     ; pos = n, n = pos->next)
+#define list_for_each_entry(pos, head, member) \
+	for (pos = list_first_entry(head, typeof(*pos), member) \
+	     ; &pos->member != (head) \
+	     ; pos = list_next_entry(pos, member))
+#define list_for_each_entry_reverse(pos, head, member) \
+	for (pos = list_last_entry(head, typeof(*pos), member) \
+	     ; &pos->member != (head) \
+	     ; pos = list_prev_entry(pos, member))
+#define list_for_each_entry_safe(pos, n, head, member) \
+	for (pos = list_first_entry(head, typeof(*pos), member) \
+	     , n = list_next_entry(pos, member) \
+	     ; &pos->member != (head) \
+	     ; pos = n, n = list_next_entry(n, member))
+
+/* ------------------------- SYNCHRONIZATION ----------------------------*/
+
+// NOTE: single threaded environment, all locks are no-ops.
+
+typedef struct {
+	int counter;
+} atomic_t;
+
+#define ATOMIC_INIT(i) { (i) }
+
+static inline int atomic_read(const atomic_t *v)
+{
+	return v->counter;
+}
+
+static inline void atomic_set(atomic_t *v, int i)
+{
+	v->counter = i;
+}
+
+static inline void atomic_add(int i, atomic_t *v)
+{
+	v->counter += i;
+}
+
+static inline void atomic_sub(int i, atomic_t *v)
+{
+	v->counter -= i;
+}
+
+static inline int atomic_add_return(int i, atomic_t *v)
+{
+	v->counter += i;
+	return v->counter;
+}
+
+static inline void atomic_inc(atomic_t *v)
+{
+	v->counter++;
+}
+
+static inline void atomic_dec(atomic_t *v)
+{
+	v->counter--;
+}
+
+static inline int atomic_xchg(atomic_t *v, int i)
+{
+	const int old = v->counter;
+
+	v->counter = i;
+	return old;
+}
+
+static inline int atomic_cmpxchg(atomic_t *v, int old, int new)
+{
+	const int cur = v->counter;
+
+	if (cur == old) {
+		v->counter = new;
+	}
+	return cur;
+}
+
+#define smp_mb() __sync_synchronize()
+#define smp_wmb() __sync_synchronize()
+#define smp_rmb() __sync_synchronize()
+
+struct mutex {
+	int locked;
+};
+
+#define DEFINE_MUTEX(name) struct mutex name = { 0 }
+
+static inline void mutex_init(struct mutex *lock)
+{
+	lock->locked = 0;
+}
+
+static inline void mutex_lock(struct mutex *lock)
+{
+	lock->locked++;
+}
+
+static inline void mutex_unlock(struct mutex *lock)
+{
+	lock->locked--;
+}
+
+static inline void mutex_destroy(struct mutex *lock)
+{
+}
+
+typedef struct {
+	int locked;
+} spinlock_t;
+
+#define DEFINE_SPINLOCK(name) spinlock_t name = { 0 }
+
+static inline void spin_lock_init(spinlock_t *lock)
+{
+	lock->locked = 0;
+}
+
+static inline void spin_lock(spinlock_t *lock)
+{
+	lock->locked++;
+}
+
+static inline void spin_unlock(spinlock_t *lock)
+{
+	lock->locked--;
+}
+
+#define spin_lock_irqsave(lock, flags) \
+	do { (flags) = 0; spin_lock(lock); } while (0)
+#define spin_unlock_irqrestore(lock, flags) \
+	do { (void)(flags); spin_unlock(lock); } while (0)
+#define spin_lock_bh(lock) spin_lock(lock)
+#define spin_unlock_bh(lock) spin_unlock(lock)
+
+// NOTE: nobody else can run while we wait, so the wait just checks
+//      the condition once.
+
+#define MAX_SCHEDULE_TIMEOUT LONG_MAX
+
+typedef struct {
+	int waiters;
+} wait_queue_head_t;
+
+static inline void init_waitqueue_head(wait_queue_head_t *wq)
+{
+	wq->waiters = 0;
+}
+
+#define wake_up_interruptible(wq) do { (void)(wq); } while (0)
+#define wake_up_interruptible_all(wq) do { (void)(wq); } while (0)
+#define wait_event_interruptible_timeout(wq, condition, timeout) \
+	({ (void)(wq); (condition) ? max((long)(timeout), 1L) : 0L; })
+
+/* ------------------------- PER CPU ------------------------------------*/
+
+// NOTE: single CPU environment.
+
+#define alloc_percpu(type) ((type *)kzalloc(sizeof(type), GFP_KERNEL))
+#define free_percpu(ptr) kfree(ptr)
+#define per_cpu_ptr(ptr, cpu) ({ (void)(cpu); (ptr); })
+#define this_cpu_ptr(ptr) (ptr)
+#define this_cpu_add(var, val) ((var) += (val))
+#define this_cpu_inc(var) ((var)++)
+#define this_cpu_dec(var) ((var)--)
+#define for_each_possible_cpu(cpu) for ((cpu) = 0; (cpu) < 1; (cpu)++)
+
+/* ------------------------- TIME ---------------------------------------*/
+
+#define NSEC_PER_USEC 1000L
+#define NSEC_PER_MSEC 1000000L
+#define NSEC_PER_SEC 1000000000L
+#define USEC_PER_SEC 1000000L
+#define MSEC_PER_SEC 1000L
+
+ktime_t ktime_get(void);
+u64 ktime_get_ns(void);
+
+static inline s64 ktime_to_ns(const ktime_t kt)
+{
+	return kt;
+}
+
+static inline s64 ktime_to_us(const ktime_t kt)
+{
+	return kt / NSEC_PER_USEC;
+}
+
+static inline s64 ktime_to_ms(const ktime_t kt)
+{
+	return kt / NSEC_PER_MSEC;
+}
+
+#define ktime_sub(a, b) ((a) - (b))
+#define ktime_add(a, b) ((a) + (b))
+
+// Moves the virtual time forward by @delta_ns.
+void kshim_time_advance_ns(const s64 delta_ns);
+
+/* ------------------------- WORKQUEUES ---------------------------------*/
+
+struct work_struct;
+typedef void (*work_func_t)(struct work_struct *work);
+
+// @entry the pending works list anchor, the work is pending
+//      while it is in the list
+struct work_struct {
+	work_func_t func;
+	struct list_head entry;
+};
+
+struct workqueue_struct;
+
+extern struct workqueue_struct *system_wq;
+extern struct workqueue_struct *system_highpri_wq;
+
+#define WQ_UNBOUND (1 << 1)
+#define WQ_MEM_RECLAIM (1 << 3)
+#define WQ_HIGHPRI (1 << 4)
+#define WQ_CPU_INTENSIVE (1 << 5)
+
+#define INIT_WORK(work, f) \
+	do { (work)->func = (f); INIT_LIST_HEAD(&(work)->entry); } while (0)
+
+struct workqueue_struct *alloc_workqueue(const char *fmt
+					 , unsigned int flags
+					 , int max_active, ...);
+void destroy_workqueue(struct workqueue_struct *wq);
+bool queue_work(struct workqueue_struct *wq, struct work_struct *work);
+bool schedule_work(struct work_struct *work);
+bool cancel_work_sync(struct work_struct *work);
+bool flush_work(struct work_struct *work);
+
+// Runs all pending works (including the ones scheduled by the works
+// being run).
+//
+// RETURNS:
+//      the number of works run
+unsigned int kshim_run_works(void);
+
+// RETURNS:
+//      true: if there are works pending
+bool kshim_works_pending(void);
+
+/* ------------------------- MODULES ------------------------------------*/
+
+struct module;
+
+#define THIS_MODULE ((struct module *)0)
+
+#define MODULE_LICENSE(x)
+#define MODULE_AUTHOR(x)
+#define MODULE_DESCRIPTION(x)
+#define MODULE_PARM_DESC(name, desc)
+#define EXPORT_SYMBOL(sym)
+#define EXPORT_SYMBOL_GPL(sym)
+#define module_param(name, type, perm)
+
+// the module init/exit functions are run on program start/exit
+#define module_init(fn) \
+	static void __attribute__((constructor)) __kshim_init_##fn(void) \
+	{ fn(); }
+#define module_exit(fn) \
+	static void __attribute__((destructor)) __kshim_exit_##fn(void) \
+	{ fn(); }
+
+#define S_IRUGO 0444
+#define S_IWUGO 0222
+#define S_IRUSR 0400
+#define S_IWUSR 0200
+
+/* ------------------------- IDA ----------------------------------------*/
+
+// NOTE: the ids are kept in a single bitmap word, which is enough
+//      for the simulation.
+
+struct ida {
+	unsigned long long used;
+};
+
+#define DEFINE_IDA(name) struct ida name = { 0 }
+
+int ida_alloc(struct ida *ida, gfp_t gfp);
+void ida_free(struct ida *ida, unsigned int id);
+
+/* ------------------------- PROCFS -------------------------------------*/
+
+// NOTE: the procfs entries are not created in userspace, the
+//      calls just succeed.
+
+struct inode {
+	void *i_private;
+};
+
+struct file {
+	struct inode *f_inode;
+	void *private_data;
+};
+
+struct file_operations {
+	struct module *owner;
+	ssize_t (*read)(struct file *file, char __user *buf, size_t count
+			, loff_t *ppos);
+	ssize_t (*write)(struct file *file, const char __user *buf
+			 , size_t count, loff_t *ppos);
+	int (*open)(struct inode *inode, struct file *file);
+	int (*release)(struct inode *inode, struct file *file);
+};
+
+struct proc_dir_entry;
+
+struct proc_dir_entry *proc_mkdir(const char *name
+				  , struct proc_dir_entry *parent);
+struct proc_dir_entry *proc_create_data(const char *name, umode_t mode
+		, struct proc_dir_entry *parent
+		, const struct file_operations *proc_fops, void *data);
+void proc_remove(struct proc_dir_entry *de);
+void *PDE_DATA(const struct inode *inode);
+
+#define KSHIM_HEADER
+
+#endif //KSHIM_HEADER
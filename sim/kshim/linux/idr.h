@@ -0,0 +1,2 @@
+// userspace shim, see kshim.h
+#include "../kshim.h"
@@ -0,0 +1,68 @@
+// userspace shim, see kshim.h
+#include "../kshim.h"
+
+#ifndef KSHIM_LLIST_HEADER
+#define KSHIM_LLIST_HEADER
+
+struct llist_node {
+	struct llist_node *next;
+};
+
+struct llist_head {
+	struct llist_node *first;
+};
+
+#define llist_entry(ptr, type, member) container_of(ptr, type, member)
+
+static inline void init_llist_head(struct llist_head *list)
+{
+	list->first = NULL;
+}
+
+static inline bool llist_empty(const struct llist_head *head)
+{
+	return head->first == NULL;
+}
+
+// RETURNS: true if the list was empty before adding
+static inline bool llist_add(struct llist_node *new
+			     , struct llist_head *head)
+{
+	new->next = head->first;
+	head->first = new;
+	return new->next == NULL;
+}
+
+static inline struct llist_node *llist_del_all(struct llist_head *head)
+{
+	struct llist_node *first = head->first;
+
+	head->first = NULL;
+	return first;
+}
+
+static inline struct llist_node *llist_reverse_order(
+		struct llist_node *head)
+{
+	struct llist_node *new_head = NULL;
+
+	while (head) {
+		struct llist_node *tmp = head;
+
+		head = head->next;
+		tmp->next = new_head;
+		new_head = tmp;
+	}
+	return new_head;
+}
+
+#define llist_for_each_entry_safe(pos, n, node, member)                  \
+	for (pos = (node) ? llist_entry((node), typeof(*pos), member)    \
+			  : NULL                                         \
+	     ; pos && (n = pos->member.next                              \
+		       ? llist_entry(pos->member.next, typeof(*pos)      \
+				     , member)                           \
+		       : NULL, 1)                                        \
+	     ; pos = n)
+
+#endif //KSHIM_LLIST_HEADER
@@ -0,0 +1,22 @@
+// userspace shim, see kshim.h
+//
+// The trace events are compiled out: every event turns into the
+// empty inline trace_<event>(...) function.
+#include "../kshim.h"
+
+#ifndef KSHIM_TRACEPOINT_HEADER
+#define KSHIM_TRACEPOINT_HEADER
+
+#define TP_PROTO(args...) args
+#define TP_ARGS(args...) args
+#define PARAMS(args...) args
+
+#define TRACE_EVENT(name, proto, args, tstruct, assign, print)          \
+	static inline void trace_##name(proto) {}                       \
+	static inline bool trace_##name##_enabled(void) { return false; }
+#define DECLARE_EVENT_CLASS(name, proto, args, tstruct, assign, print)
+#define DEFINE_EVENT(template, name, proto, args)                       \
+	static inline void trace_##name(proto) {}                       \
+	static inline bool trace_##name##_enabled(void) { return false; }
+
+#endif //KSHIM_TRACEPOINT_HEADER
@@ -0,0 +1 @@
+// userspace shim, see kshim.h: trace events are compiled out
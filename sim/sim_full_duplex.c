@@ -0,0 +1,495 @@
+/*
+ * This file implements the simulated full duplex transport, see
+ * sim_full_duplex.h.
+ *
+ * Copyright (c) 2026 The iccom-utils contributors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// SPDX-License-Identifier: GPL-2.0
+
+// The simulated link mimics the SymSPI behaviour as it is seen by the
+// full duplex interface consumer:
+// * the xfer starts when any side requests it, both sides exchange
+//   their current xfers data within it,
+// * the consumer callbacks of both sides are called upon the xfer
+//   end, the done callback may request the next xfer to start
+//   immediately,
+// * the failed xfer is followed by the next xfer started by both
+//   sides (like the SymSPI error recovery ends with),
+// * the xfer which failed on one side only (glitch) is followed by
+//   the error indication of that side, the other side detects it (or
+//   not) and recovers the same way as SymSPI does, so the recovery
+//   sequence parameters can be checked against each other.
+//
+// The link is run by sim_link_step(...) which runs the pending works
+// of the consumers and then the next requested xfer, if any. The xfer
+// moves the virtual time forward by its duration.
+
+#include <math.h>
+
+#include <linux/kernel.h>
+
+#include "sim_full_duplex.h"
+
+/* ------------------------- LINK RANDOM --------------------------------*/
+
+// RETURNS:
+//      the next pseudo random number of the link (xorshift64*)
+unsigned long long sim_link_rand(struct sim_link *link)
+{
+	unsigned long long x = link->rng_state;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	link->rng_state = x;
+	return x * 0x2545F4914F6CDD1DULL;
+}
+
+// RETURNS:
+//      the pseudo random number within (0; 1)
+static double __sim_link_rand_unit(struct sim_link *link)
+{
+	return ((double)(sim_link_rand(link) >> 11) + 0.5)
+		/ (double)(1ULL << 53);
+}
+
+/* ------------------------- DEVICE HELPERS -----------------------------*/
+
+// Helper. Makes the device buffers fit at least @size bytes.
+//
+// RETURNS:
+//      0: on success
+//      <0: negated error code
+static int __sim_dev_buffers_fit(struct sim_full_duplex_dev *dev
+				 , const size_t size)
+{
+	if (size <= dev->buf_size) {
+		return 0;
+	}
+
+	void *tx_buf = krealloc(dev->tx_buf, size, GFP_KERNEL);
+	if (!tx_buf) {
+		return -ENOMEM;
+	}
+	dev->tx_buf = tx_buf;
+
+	void *rx_buf = krealloc(dev->rx_buf, size, GFP_KERNEL);
+	if (!rx_buf) {
+		return -ENOMEM;
+	}
+	dev->rx_buf = rx_buf;
+
+	dev->buf_size = size;
+	return 0;
+}
+
+// Helper. Makes the consumer @xfer the current one of the device
+// (TX data is copied).
+//
+// RETURNS:
+//      the new xfer id: on success
+//      <0: negated error code
+static int __sim_dev_xfer_accept(struct sim_full_duplex_dev *dev
+				 , struct full_duplex_xfer *xfer)
+{
+	const int res = __sim_dev_buffers_fit(dev, xfer->size_bytes);
+	if (res < 0) {
+		return res;
+	}
+
+	if (xfer->data_tx) {
+		memcpy(dev->tx_buf, xfer->data_tx, xfer->size_bytes);
+	} else {
+		memset(dev->tx_buf, 0, xfer->size_bytes);
+	}
+
+	dev->xfer = *xfer;
+	dev->xfer.data_tx = dev->tx_buf;
+	dev->xfer.data_rx_buf = dev->rx_buf;
+	dev->xfer.xfers_counter = 0;
+	dev->xfer.id = dev->next_xfer_id;
+
+	dev->next_xfer_id = dev->next_xfer_id < INT_MAX
+			    ? dev->next_xfer_id + 1 : 1;
+
+	xfer->id = dev->xfer.id;
+	return dev->xfer.id;
+}
+
+// Helper. Applies the next xfer provided by the consumer callback.
+//
+// @next_xfer the callback result
+//      {valid ptr}: the next xfer
+//      {NULL}: the current xfer persists
+//      {error ptr}: the device halts
+static void __sim_dev_xfer_next(struct sim_full_duplex_dev *dev
+				, struct full_duplex_xfer *next_xfer)
+{
+	if (IS_ERR(next_xfer)) {
+		dev->halted = true;
+		return;
+	}
+	if (!next_xfer) {
+		return;
+	}
+	if (__sim_dev_xfer_accept(dev, next_xfer) < 0) {
+		dev->halted = true;
+	}
+}
+
+// Helper. Copies the other side TX data into our RX buffer
+// corrupting it with the link bit error rate.
+static void __sim_link_wire(struct sim_link *link
+			    , const struct sim_full_duplex_dev *from
+			    , struct sim_full_duplex_dev *to)
+{
+	const size_t size = to->xfer.size_bytes;
+
+	memcpy(to->rx_buf, from->tx_buf, size);
+	link->stats.bytes += size;
+
+	const double ber = link->config.bit_error_rate;
+	if (ber <= 0.0) {
+		return;
+	}
+
+	// the distance between the flipped bits is geometrically
+	// distributed, so we jump directly from one flipped bit to
+	// the next one
+	const unsigned long long bits = (unsigned long long)size * 8;
+	const double log_ok = ber < 1.0 ? log1p(-ber) : -INFINITY;
+	unsigned long long bit = 0;
+
+	while (true) {
+		const double gap = log_ok == -INFINITY ? 0.0
+				   : floor(log(__sim_link_rand_unit(link))
+					   / log_ok);
+		if (gap >= (double)(bits - bit)) {
+			break;
+		}
+		bit += (unsigned long long)gap;
+		((unsigned char *)to->rx_buf)[bit / 8] ^= 1 << (bit % 8);
+		link->stats.bits_flipped++;
+		bit++;
+	}
+}
+
+// Helper. Moves the virtual time forward by the duration of the xfer
+// of @size_bytes.
+static void __sim_link_xfer_time(struct sim_link *link
+				 , const size_t size_bytes)
+{
+	const struct sim_link_config *cfg = &link->config;
+	s64 duration_ns = (s64)cfg->latency_us * NSEC_PER_USEC;
+
+	if (cfg->jitter_us) {
+		duration_ns += (s64)(sim_link_rand(link)
+				     % ((u64)cfg->jitter_us * NSEC_PER_USEC + 1));
+	}
+	duration_ns += (s64)div64_u64((u64)size_bytes * 8 * NSEC_PER_SEC
+				      , cfg->bitrate_bps);
+
+	link->stats.busy_ns += (u64)duration_ns;
+	kshim_time_advance_ns(duration_ns);
+}
+
+// Helper. Reports the failed xfer to both sides, which then restart
+// with the new xfer.
+static void __sim_link_xfer_fail(struct sim_link *link, const int error)
+{
+	for (int i = 0; i < 2; i++) {
+		struct sim_full_duplex_dev *dev = &link->side[i];
+		struct full_duplex_xfer *next_xfer = NULL;
+
+		if (dev->xfer.fail_callback) {
+			dev->in_callback = true;
+			next_xfer = dev->xfer.fail_callback(
+					&dev->xfer, dev->next_xfer_id
+					, error, dev->xfer.consumer_data);
+			dev->in_callback = false;
+		}
+		__sim_dev_xfer_next(dev, next_xfer);
+		// the recovery ends with the new xfer
+		dev->xfer_requested = true;
+	}
+}
+
+// Helper. Recovers the link from the xfer which failed on one side
+// only: that side indicates the error by its flag and stays silent
+// for the recovery silence time, while the other side either detects
+// the indication (by the count of the flag falling edges) and
+// recovers within the peer window, or misses it and fails only on its
+// xfer wait timeout. If the first side resumes before the other one
+// is ready, the next xfer fails as well (on both sides).
+//
+// The virtual time is moved forward by the recovery duration.
+static void __sim_link_glitch(struct sim_link *link)
+{
+	const struct sim_link_config *cfg = &link->config;
+	const u64 indication_us = (u64)cfg->recovery_edges * 2
+				  * cfg->recovery_pulse_us;
+	const u64 resume_us = indication_us + cfg->recovery_silence_us;
+	u64 peer_ready_us = indication_us + cfg->peer_window_us;
+
+	link->stats.glitches++;
+	link->stats.xfers_failed++;
+
+	if (cfg->recovery_edges < SIM_FULL_DUPLEX_ERROR_INDICATION_EDGES) {
+		link->stats.indications_missed++;
+		peer_ready_us = (u64)cfg->peer_wait_timeout_us
+				+ cfg->peer_window_us;
+	}
+
+	u64 recovery_us = max(resume_us, peer_ready_us);
+	__sim_link_xfer_fail(link, SIM_FULL_DUPLEX_ERROR_GLITCH);
+
+	if (resume_us < peer_ready_us) {
+		// the next xfer is not answered in time, both sides
+		// indicate the error and recover again
+		link->stats.resync_collisions++;
+		link->stats.xfers_failed++;
+		recovery_us += indication_us + max(cfg->recovery_silence_us
+						   , cfg->peer_window_us);
+		__sim_link_xfer_fail(link, SIM_FULL_DUPLEX_ERROR_GLITCH);
+	}
+
+	link->stats.recovery_ns += recovery_us * NSEC_PER_USEC;
+	kshim_time_advance_ns((s64)recovery_us * NSEC_PER_USEC);
+}
+
+// Helper. Runs the xfer between the link sides.
+static void __sim_link_xfer(struct sim_link *link)
+{
+	struct sim_full_duplex_dev *a = &link->side[0];
+	struct sim_full_duplex_dev *b = &link->side[1];
+
+	a->xfer_requested = false;
+	b->xfer_requested = false;
+
+	link->stats.xfers++;
+	__sim_link_xfer_time(link, max(a->xfer.size_bytes
+				       , b->xfer.size_bytes));
+
+	if (a->xfer.size_bytes != b->xfer.size_bytes) {
+		link->stats.xfers_failed++;
+		__sim_link_xfer_fail(link, SIM_FULL_DUPLEX_ERROR_SIZE_MISMATCH);
+		return;
+	}
+
+	if (link->config.glitch_rate > 0.0
+	    && __sim_link_rand_unit(link) < link->config.glitch_rate) {
+		__sim_link_glitch(link);
+		return;
+	}
+
+	__sim_link_wire(link, a, b);
+	__sim_link_wire(link, b, a);
+
+	for (int i = 0; i < 2; i++) {
+		struct sim_full_duplex_dev *dev = &link->side[i];
+		struct full_duplex_xfer *next_xfer = NULL;
+		bool start_immediately = false;
+
+		dev->xfer.xfers_counter++;
+		if (dev->xfer.done_callback) {
+			dev->in_callback = true;
+			next_xfer = dev->xfer.done_callback(
+					&dev->xfer, dev->next_xfer_id
+					, &start_immediately
+					, dev->xfer.consumer_data);
+			dev->in_callback = false;
+		}
+		__sim_dev_xfer_next(dev, next_xfer);
+		if (start_immediately) {
+			dev->xfer_requested = true;
+		}
+	}
+}
+
+/* ------------------------- FULL DUPLEX IFACE --------------------------*/
+
+// Full duplex interface: see symspi_data_xchange(...).
+static int sim_data_xchange(void __kernel *device
+			    , struct __kernel full_duplex_xfer *xfer
+			    , bool force_size_change)
+{
+	struct sim_full_duplex_dev *dev = (struct sim_full_duplex_dev *)device;
+
+	if (!dev->running || dev->halted) {
+		return -FULL_DUPLEX_ERROR_NOT_READY;
+	}
+
+	int res = 0;
+	if (xfer) {
+		if (xfer->size_bytes != dev->xfer.size_bytes
+				&& !force_size_change && !dev->in_callback) {
+			return -EINVAL;
+		}
+		res = __sim_dev_xfer_accept(dev, xfer);
+		if (res < 0) {
+			return res;
+		}
+	}
+
+	dev->xfer_requested = true;
+	return res;
+}
+
+// Full duplex interface: see symspi_default_data_update(...).
+static int sim_default_data_update(void __kernel *device
+				   , struct full_duplex_xfer *xfer
+				   , bool force_size_change)
+{
+	struct sim_full_duplex_dev *dev = (struct sim_full_duplex_dev *)device;
+
+	if (!dev->running || dev->halted) {
+		return -FULL_DUPLEX_ERROR_NOT_READY;
+	}
+	if (!xfer) {
+		return 0;
+	}
+	if (xfer->size_bytes != dev->xfer.size_bytes
+			&& !force_size_change && !dev->in_callback) {
+		return -EINVAL;
+	}
+	return __sim_dev_xfer_accept(dev, xfer);
+}
+
+// Full duplex interface: see symspi_is_running(...).
+static bool sim_is_running(void __kernel *device)
+{
+	struct sim_full_duplex_dev *dev = (struct sim_full_duplex_dev *)device;
+
+	return dev->running;
+}
+
+// Full duplex interface: see symspi_init(...).
+static int sim_init(void __kernel *device
+		    , struct full_duplex_xfer *default_xfer)
+{
+	struct sim_full_duplex_dev *dev = (struct sim_full_duplex_dev *)device;
+
+	if (!default_xfer) {
+		return -EINVAL;
+	}
+
+	dev->halted = false;
+	dev->xfer_requested = false;
+	dev->next_xfer_id = 1;
+
+	const int res = __sim_dev_xfer_accept(dev, default_xfer);
+	if (res < 0) {
+		return res;
+	}
+
+	dev->running = true;
+	return 0;
+}
+
+// Full duplex interface: see symspi_reset(...).
+static int sim_reset(void __kernel *device
+		     , struct full_duplex_xfer *default_xfer)
+{
+	struct sim_full_duplex_dev *dev = (struct sim_full_duplex_dev *)device;
+
+	dev->running = false;
+	return sim_init(device, default_xfer);
+}
+
+// Full duplex interface: see symspi_close(...).
+static int sim_close(void __kernel *device)
+{
+	struct sim_full_duplex_dev *dev = (struct sim_full_duplex_dev *)device;
+
+	dev->running = false;
+	dev->xfer_requested = false;
+	return 0;
+}
+
+const struct full_duplex_sym_iface sim_full_duplex_iface = {
+	.data_xchange = &sim_data_xchange
+	, .default_data_update = &sim_default_data_update
+	, .is_running = &sim_is_running
+	, .init = &sim_init
+	, .reset = &sim_reset
+	, .close = &sim_close
+};
+
+/* ------------------------- LINK API -----------------------------------*/
+
+// Initializes the link with the given configuration. The link
+// sides devices are then ready to be initialized by their consumers
+// via sim_full_duplex_iface.
+//
+// @link {valid ptr} the link to initialize
+// @config {valid ptr} the link configuration
+void sim_link_init(struct sim_link *link
+		   , const struct sim_link_config *config)
+{
+	memset(link, 0, sizeof(*link));
+	link->config = *config;
+	if (!link->config.bitrate_bps) {
+		link->config.bitrate_bps = 1;
+	}
+	// xorshift state must be non-zero
+	link->rng_state = config->seed ? config->seed : 0x9E3779B97F4A7C15ULL;
+
+	for (int i = 0; i < 2; i++) {
+		link->side[i].link = link;
+	}
+}
+
+// Frees the link resources. The consumers are expected to close the
+// link sides devices before.
+//
+// @link {valid ptr} the link to close
+void sim_link_close(struct sim_link *link)
+{
+	for (int i = 0; i < 2; i++) {
+		kfree(link->side[i].tx_buf);
+		kfree(link->side[i].rx_buf);
+		link->side[i].tx_buf = NULL;
+		link->side[i].rx_buf = NULL;
+		link->side[i].buf_size = 0;
+	}
+}
+
+// Runs all pending works, and then the next xfer if it was requested
+// by any side.
+//
+// @link {valid ptr} the link to run
+//
+// RETURNS:
+//      true: if any work or xfer was run (the link is active)
+//      false: if the link is idle (nothing to do until new data
+//          posted by consumers)
+bool sim_link_step(struct sim_link *link)
+{
+	const bool works_run = kshim_run_works() > 0;
+
+	struct sim_full_duplex_dev *a = &link->side[0];
+	struct sim_full_duplex_dev *b = &link->side[1];
+
+	if (!a->running || !b->running || a->halted || b->halted) {
+		return works_run;
+	}
+	if (!a->xfer_requested && !b->xfer_requested) {
+		return works_run;
+	}
+
+	__sim_link_xfer(link);
+	return true;
+}
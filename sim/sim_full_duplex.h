@@ -0,0 +1,162 @@
+/*
+ * This file declares the simulated full duplex transport: the pair of
+ * full_duplex_sym_iface devices connected to each other through memory
+ * with configurable bit errors, latency and jitter.
+ *
+ * Copyright (c) 2026 The iccom-utils contributors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// SPDX-License-Identifier: GPL-2.0
+
+#ifndef SIM_FULL_DUPLEX_HEADER
+
+#include "full_duplex_interface.h"
+
+// The error code reported to both sides via the fail callback when
+// the sides xfers sizes differ.
+#define SIM_FULL_DUPLEX_ERROR_SIZE_MISMATCH 1
+// The error code reported to the side which hit the link glitch, and
+// to the other side when it detects the error indication or its wait
+// for the xfer times out.
+#define SIM_FULL_DUPLEX_ERROR_GLITCH 2
+
+// The number of their flag falling edges since the xfer start at
+// which SymSPI detects the other side error indication.
+#define SIM_FULL_DUPLEX_ERROR_INDICATION_EDGES 3
+
+// The simulated link configuration.
+//
+// @bit_error_rate {[0; 1]} the probability of every transferred bit
+//      to be flipped
+// @latency_us the fixed duration of every xfer in usec (the flags
+//      handshake and the transport layer processing), added to the
+//      wire time
+// @jitter_us the upper bound of the random duration in usec added to
+//      every xfer (uniformly distributed)
+// @bitrate_bps {>0} the wire bitrate (bits per second)
+// @seed the seed of the link random generator
+// @glitch_rate {[0; 1]} the probability of every xfer to fail on one
+//      (random) side only (like SPI error), the side then indicates
+//      the error to the other side via the flag line, like SymSPI
+//      error recovery does
+// @recovery_edges the number of the flag falling edges of the error
+//      indication
+// @recovery_pulse_us the duration of every flag state within the
+//      error indication
+// @recovery_silence_us the silence after the error indication, after
+//      which the side resumes the xfers
+// @peer_window_us the time the other side needs, after it detected
+//      the error indication, to be ready for the next xfer
+// @peer_wait_timeout_us the time after which the other side which
+//      missed the error indication gives up waiting for the xfer
+struct sim_link_config {
+	double bit_error_rate;
+	unsigned int latency_us;
+	unsigned int jitter_us;
+	unsigned long bitrate_bps;
+	unsigned long long seed;
+
+	double glitch_rate;
+	unsigned int recovery_edges;
+	unsigned int recovery_pulse_us;
+	unsigned int recovery_silence_us;
+	unsigned int peer_window_us;
+	unsigned int peer_wait_timeout_us;
+};
+
+// The simulated link statistics.
+//
+// @xfers the number of xfers done (including the failed ones)
+// @xfers_failed the number of xfers failed due to the sides xfer
+//      size mismatch
+// @bytes the number of bytes transferred (both directions)
+// @bits_flipped the number of bits corrupted by the link
+// @busy_ns the total duration of all xfers in nsec
+// @glitches the number of xfers failed on one side only
+// @indications_missed the number of error indications the other
+//      side did not detect (and waited for its timeout)
+// @resync_collisions the number of times a side resumed the xfers
+//      while the other side was still recovering
+// @recovery_ns the total duration of the glitches recovery in nsec
+struct sim_link_stats {
+	unsigned long long xfers;
+	unsigned long long xfers_failed;
+	unsigned long long bytes;
+	unsigned long long bits_flipped;
+	unsigned long long busy_ns;
+
+	unsigned long long glitches;
+	unsigned long long indications_missed;
+	unsigned long long resync_collisions;
+	unsigned long long recovery_ns;
+};
+
+struct sim_link;
+
+// Describes the single side of the simulated link, this is the
+// device to be used with sim_full_duplex_iface.
+//
+// @link the link the device belongs to
+// @running true between init and close
+// @halted true if the consumer halted the device by returning the
+//      error pointer from a callback
+// @xfer_requested true when the xfer was requested by this side
+// @in_callback true while the consumer callback is running
+// @xfer the current xfer, its data points to the device buffers
+// @tx_buf the current xfer TX data copy
+// @rx_buf the RX data buffer
+// @buf_size the size of @tx_buf and @rx_buf
+// @next_xfer_id the id to be assigned to the next new xfer
+struct sim_full_duplex_dev {
+	struct sim_link *link;
+
+	bool running;
+	bool halted;
+	bool xfer_requested;
+	bool in_callback;
+
+	struct full_duplex_xfer xfer;
+	void *tx_buf;
+	void *rx_buf;
+	size_t buf_size;
+
+	int next_xfer_id;
+};
+
+// The simulated link between two full duplex devices.
+//
+// @config the link configuration
+// @side the devices of the link sides
+// @stats the link statistics
+// @rng_state the link random generator state
+struct sim_link {
+	struct sim_link_config config;
+	struct sim_full_duplex_dev side[2];
+	struct sim_link_stats stats;
+	unsigned long long rng_state;
+};
+
+// The full duplex interface implemented by struct sim_full_duplex_dev.
+extern const struct full_duplex_sym_iface sim_full_duplex_iface;
+
+void sim_link_init(struct sim_link *link
+		   , const struct sim_link_config *config);
+void sim_link_close(struct sim_link *link);
+bool sim_link_step(struct sim_link *link);
+unsigned long long sim_link_rand(struct sim_link *link);
+
+#define SIM_FULL_DUPLEX_HEADER
+
+#endif //SIM_FULL_DUPLEX_HEADER